@@ -0,0 +1,63 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_ALIGNMENT sizeof(void*)
+
+static ArenaBlock* createArenaBlock(size_t size) {
+  ArenaBlock* block = (ArenaBlock*) countedMalloc(sizeof(ArenaBlock) + size);
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+void initArena(Arena* arena) {
+  arena->blocks = NULL;
+}
+
+// The memory is zeroed, as calloc would
+void* arenaAlloc(Arena* arena, size_t size) {
+  ArenaBlock* block = arena->blocks;
+  void* p;
+
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if ((block == NULL) || (block->used + size > block->size)) {
+    block = createArenaBlock((size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE);
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+  p = block->data + block->used;
+  block->used += size;
+  memset(p, 0, size);
+  return p;
+}
+
+void resetArena(Arena* arena) {
+  ArenaBlock* block;
+
+  if (arena->blocks == NULL) return;
+  while (arena->blocks->next != NULL) {
+    block = arena->blocks;
+    arena->blocks = block->next;
+    countedFree(block, sizeof(ArenaBlock) + block->size);
+  }
+  arena->blocks->used = 0;
+}
+
+void cleanArena(Arena* arena) {
+  ArenaBlock* block;
+
+  while (arena->blocks != NULL) {
+    block = arena->blocks;
+    arena->blocks = block->next;
+    countedFree(block, sizeof(ArenaBlock) + block->size);
+  }
+}
@@ -0,0 +1,39 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 65536
+
+/*
+ * Memory for many small objects freed all at once: allocation moves a
+ * pointer through big blocks, and nothing is freed until the arena is
+ * reset. A reset keeps the first block for the next compilation.
+ */
+struct ArenaBlock_ {
+  struct ArenaBlock_* next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+typedef struct ArenaBlock_ ArenaBlock;
+
+struct Arena_ {
+  ArenaBlock* blocks;        // the block being filled first
+};
+
+typedef struct Arena_ Arena;
+
+void initArena(Arena* arena);
+void* arenaAlloc(Arena* arena, size_t size);
+void resetArena(Arena* arena);
+void cleanArena(Arena* arena);
+
+#endif
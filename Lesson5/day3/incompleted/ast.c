@@ -0,0 +1,145 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "stats.h"
+
+#define INITIAL_STACK_SIZE 64
+
+void initAst(Compiler* compiler) {
+  Ast* ast = (Ast*) countedMalloc(sizeof(Ast));
+
+  initArena(&ast->arena);
+  ast->stackSize = INITIAL_STACK_SIZE;
+  ast->stack = (Node**) countedMalloc(ast->stackSize * sizeof(Node*));
+  ast->stackTop = 0;
+  ast->program = NULL;
+  ast->printIr = 0;
+  ast->optLevel = 0;
+  ast->inlineLimit = DEFAULT_INLINE_LIMIT;
+  ast->unrollFactor = 0;
+  ast->unrollGrowth = 0;
+  compiler->ast = ast;
+}
+
+void cleanAst(Compiler* compiler) {
+  cleanArena(&compiler->ast->arena);
+  countedFree(compiler->ast->stack, compiler->ast->stackSize * sizeof(Node*));
+  countedFree(compiler->ast, sizeof(Ast));
+  compiler->ast = NULL;
+}
+
+void initCodeOptions(CodeOptions* options) {
+  options->ast = 0;
+  options->printIr = 0;
+  options->optLevel = 0;
+  options->inlineLimit = DEFAULT_INLINE_LIMIT;
+  options->unrollFactor = 0;
+}
+
+int analyseCodeOption(CodeOptions* options, char* param) {
+  if (strcmp(param, "-ast") == 0) {
+    options->ast = 1;
+    return 1;
+  }
+  if (strcmp(param, "-O2") == 0) {
+    options->ast = 1;
+    options->optLevel = 2;
+    return 1;
+  }
+  if (strcmp(param, "-ir") == 0) {
+    options->ast = 1;
+    options->printIr = 1;
+    return 1;
+  }
+  if (strncmp(param, "-inline=", 8) == 0) {
+    options->inlineLimit = atoi(param + 8);
+    return 1;
+  }
+  if (strncmp(param, "-unroll=", 8) == 0) {
+    options->ast = 1;
+    options->unrollFactor = atoi(param + 8);
+    return 1;
+  }
+  return 0;
+}
+
+void applyCodeOptions(Compiler* compiler, CodeOptions* options) {
+  if (!options->ast) return;
+  initAst(compiler);
+  compiler->ast->printIr = options->printIr;
+  compiler->ast->optLevel = options->optLevel;
+  compiler->ast->inlineLimit = options->inlineLimit;
+  compiler->ast->unrollFactor = options->unrollFactor;
+}
+
+// Drops the tree of the previous compilation, keeping the memory
+void resetAst(Compiler* compiler) {
+  resetArena(&compiler->ast->arena);
+  compiler->ast->stackTop = 0;
+  compiler->ast->program = NULL;
+}
+
+// A node at the position of the current token
+Node* makeNode(Compiler* compiler, int kind) {
+  Node* node = (Node*) arenaAlloc(&compiler->ast->arena, sizeof(Node));
+
+  node->kind = kind;
+  if (compiler->currentToken != NULL) {
+    node->lineNo = compiler->currentToken->lineNo;
+    node->colNo = compiler->currentToken->colNo;
+  }
+  return node;
+}
+
+void pushNode(Compiler* compiler, Node* node) {
+  Ast* ast = compiler->ast;
+
+  if (ast->stackTop == ast->stackSize) {
+    ast->stack = (Node**) countedRealloc(ast->stack, ast->stackSize * sizeof(Node*), 2 * ast->stackSize * sizeof(Node*));
+    ast->stackSize *= 2;
+  }
+  ast->stack[ast->stackTop ++] = node;
+}
+
+Node* popNode(Compiler* compiler) {
+  return compiler->ast->stack[-- compiler->ast->stackTop];
+}
+
+int nodeDepth(Compiler* compiler) {
+  return compiler->ast->stackTop;
+}
+
+// What a construct that failed left on the stack
+void dropNodes(Compiler* compiler, int depth) {
+  compiler->ast->stackTop = depth;
+}
+
+Node* buildNode(Compiler* compiler, int kind, int kidCount) {
+  Node* node = makeNode(compiler, kind);
+
+  while (kidCount > 0)
+    node->kids[-- kidCount] = popNode(compiler);
+  pushNode(compiler, node);
+  return node;
+}
+
+Node* buildList(Compiler* compiler, int kind, int depth) {
+  Node* node = makeNode(compiler, kind);
+  Node* list = NULL;
+  Node* item;
+
+  while (nodeDepth(compiler) > depth) {
+    item = popNode(compiler);
+    item->next = list;
+    list = item;
+  }
+  node->kids[0] = list;
+  pushNode(compiler, node);
+  return node;
+}
@@ -0,0 +1,129 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __AST_H__
+#define __AST_H__
+
+#include "arena.h"
+#include "symtab.h"
+#include "compiler.h"
+
+enum NodeKind {
+  AST_PROGRAM,      // object; kids[0] the block
+  AST_FUNCTION,     // object; kids[0] the block
+  AST_PROCEDURE,    // object; kids[0] the block
+  AST_BLOCK,        // kids[0] a group of the subroutines, kids[1] the body
+
+  // Statements
+  AST_GROUP,        // kids[0] the first statement, the others follow by next
+  AST_ASSIGN,       // kids[0] := kids[1]
+  AST_CALL,         // object a procedure or a function; kids[0] the first argument
+  AST_IF,           // IF kids[0] THEN kids[1] ELSE kids[2], which may be NULL
+  AST_WHILE,        // WHILE kids[0] DO kids[1]
+  AST_FOR,          // FOR kids[0], an AST_ASSIGN, TO kids[1] DO kids[2]
+
+  // Expressions
+  AST_NUMBER,       // value
+  AST_CHAR,         // value
+  AST_NAME,         // object a variable, a parameter, or a function as the
+                    // place of its return value
+  AST_INDEX,        // kids[0] (. kids[1] .)
+  AST_PLUS,         // + kids[0]
+  AST_NEG,          // - kids[0]
+  AST_ADD,          // kids[0] + kids[1], and so on
+  AST_SUB,
+  AST_MUL,
+  AST_DIV,
+  AST_EQ,
+  AST_NE,
+  AST_LT,
+  AST_LE,
+  AST_GT,
+  AST_GE,
+  AST_ERROR         // an expression that failed to compile
+};
+
+/*
+ * One node of the abstract syntax tree. Every kind of node has the same
+ * layout: the kids and value are interpreted by kind as listed above.
+ * Nodes live in the arena of the compiler, and die with the compilation.
+ */
+struct Node_ {
+  unsigned char kind;
+  unsigned short colNo;
+  int lineNo;
+  Type* type;               // of an expression, set by the checking pass
+  struct Node_* next;       // the next statement, argument or subroutine
+  struct Node_* kids[3];
+  union {
+    Object* object;
+    int value;
+  };
+};
+
+typedef struct Node_ Node;
+
+/*
+ * When a compiler has an Ast, the parser builds the tree instead of
+ * emitting code. It builds it where it would emit code: the operands of
+ * a construct are pushed on the node stack as they are compiled, in the
+ * order the VM would push their values, and the construct pops them as
+ * its kids. Types are then checked and code generated in separate passes.
+ */
+#define DEFAULT_INLINE_LIMIT 20
+
+struct Ast_ {
+  Arena arena;
+  Node** stack;
+  int stackTop;
+  int stackSize;
+  Node* program;
+  int printIr;              // print the IR built from the tree
+  int optLevel;             // 2 for the optimisations of -O2
+  int inlineLimit;          // the size of the functions -O2 inlines, 0 for none
+  int unrollFactor;         // the copies of the body of a FOR unrolled, 0 for none
+  int unrollGrowth;         // the nodes unrolling may still add to the program
+};
+
+typedef struct Ast_ Ast;
+
+void initAst(Compiler* compiler);
+void cleanAst(Compiler* compiler);
+void resetAst(Compiler* compiler);
+
+/*
+ * The options that change the code generated: -ast, -ir, -O2, -inline=N
+ * and -unroll=N. kplc, the workers of kplc --batch and the warm compilers
+ * of kplcd all set up their compilers from one of these.
+ */
+struct CodeOptions_ {
+  int ast;                  // build a tree, which the others need
+  int printIr;
+  int optLevel;
+  int inlineLimit;
+  int unrollFactor;
+};
+
+typedef struct CodeOptions_ CodeOptions;
+
+void initCodeOptions(CodeOptions* options);
+// Returns 0 if param is none of the code options
+int analyseCodeOption(CodeOptions* options, char* param);
+// Gives a compiler fresh from initCompiler() its Ast, if the options need one
+void applyCodeOptions(Compiler* compiler, CodeOptions* options);
+
+Node* makeNode(Compiler* compiler, int kind);
+void pushNode(Compiler* compiler, Node* node);
+Node* popNode(Compiler* compiler);
+int nodeDepth(Compiler* compiler);
+void dropNodes(Compiler* compiler, int depth);
+
+// Pops kidCount nodes as the kids of a new node, which is pushed
+Node* buildNode(Compiler* compiler, int kind, int kidCount);
+// Pops the nodes above depth as a list, the kids[0] of a new node
+Node* buildList(Compiler* compiler, int kind, int depth);
+
+#endif
@@ -0,0 +1,178 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "reader.h"
+#include "parser.h"
+#include "codegen.h"
+
+#define WRITE_ERROR 3
+
+struct Batch_ {
+  BatchJob* jobs;
+  int jobCount;
+  int nextJob;
+  CodeOptions* options;
+  pthread_mutex_t lock;
+};
+
+typedef struct Batch_ Batch;
+
+static void compileJob(Compiler* compiler, BatchJob* job) {
+  job->result = compile(compiler, job->input);
+  if ((job->result == IO_SUCCESS) && (serialize(compiler, job->output) == IO_ERROR))
+    job->result = WRITE_ERROR;
+  if (job->result == COMPILE_ERROR)
+    job->diagnostics = strdup(compiler->diagnostics);
+}
+
+// Each worker compiles all its files with the same compiler
+static void* runWorker(void* arg) {
+  Batch* batch = (Batch*) arg;
+  Compiler compiler;
+  int job;
+
+  initCompiler(&compiler);
+  applyCodeOptions(&compiler, batch->options);
+  while (1) {
+    pthread_mutex_lock(&batch->lock);
+    job = batch->nextJob ++;
+    pthread_mutex_unlock(&batch->lock);
+    if (job >= batch->jobCount) break;
+    compileJob(&compiler, batch->jobs + job);
+  }
+  cleanCompiler(&compiler);
+  return NULL;
+}
+
+static int readBatchList(Batch* batch, char* listFileName) {
+  FILE* f;
+  char line[2 * FILENAME_MAX + 2];
+  char input[FILENAME_MAX], output[FILENAME_MAX];
+  int size = 0;
+  int lineNo = 0;
+  int fields;
+  char format[32];
+  int inputEnd, outputEnd;
+
+  f = fopen(listFileName, "r");
+  if (f == NULL) {
+    printf("kplc: Can\'t read batch list %s!\n", listFileName);
+    return 0;
+  }
+
+  // The widths keep every name in its buffer; %n tells where it stopped
+  sprintf(format, "%%%ds%%n %%%ds%%n", FILENAME_MAX - 1, FILENAME_MAX - 1);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    lineNo ++;
+    inputEnd = outputEnd = 0;
+    fields = sscanf(line, format, input, &inputEnd, output, &outputEnd);
+    // A name cut by its width, or a line cut by fgets, doesn't fit
+    if (((fields >= 1) && (line[inputEnd] != '\0') && !isspace((unsigned char) line[inputEnd])) ||
+	((fields == 2) && (line[outputEnd] != '\0') && !isspace((unsigned char) line[outputEnd])) ||
+	((strchr(line, '\n') == NULL) && !feof(f))) {
+      printf("%s:%d: file name too long.\n", listFileName, lineNo);
+      fclose(f);
+      return 0;
+    }
+    if (fields <= 0) continue;
+    if (fields == 1) {
+      printf("%s:%d: no output file for %s.\n", listFileName, lineNo, input);
+      fclose(f);
+      return 0;
+    }
+
+    if (batch->jobCount == size) {
+      size = (size == 0) ? 64 : 2 * size;
+      batch->jobs = (BatchJob*) realloc(batch->jobs, size * sizeof(BatchJob));
+    }
+    batch->jobs[batch->jobCount].input = strdup(input);
+    batch->jobs[batch->jobCount].output = strdup(output);
+    batch->jobs[batch->jobCount].result = IO_SUCCESS;
+    batch->jobs[batch->jobCount].diagnostics = NULL;
+    batch->jobCount ++;
+  }
+  fclose(f);
+  return 1;
+}
+
+static void freeBatch(Batch* batch) {
+  int i;
+
+  for (i = 0; i < batch->jobCount; i++) {
+    free(batch->jobs[i].input);
+    free(batch->jobs[i].output);
+    free(batch->jobs[i].diagnostics);
+  }
+  free(batch->jobs);
+}
+
+// Compiler messages read "line-col:message"; in a batch they get the file name in front
+static void reportJob(BatchJob* job) {
+  char* line;
+  char* end;
+
+  switch (job->result) {
+  case IO_ERROR:
+    printf("%s: Can\'t read input file!\n", job->input);
+    break;
+  case WRITE_ERROR:
+    printf("%s: Can\'t write output file %s!\n", job->input, job->output);
+    break;
+  case COMPILE_ERROR:
+    for (line = job->diagnostics; (line != NULL) && (*line != '\0'); line = end) {
+      end = strchr(line, '\n');
+      end = (end == NULL) ? line + strlen(line) : end + 1;
+      printf("%s:%.*s", job->input, (int) (end - line), line);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+int compileBatch(char* listFileName, int workerCount, CodeOptions* options) {
+  Batch batch;
+  pthread_t* workers;
+  int failures = 0;
+  int i;
+
+  batch.jobs = NULL;
+  batch.jobCount = 0;
+  batch.nextJob = 0;
+  batch.options = options;
+  if (!readBatchList(&batch, listFileName)) {
+    freeBatch(&batch);
+    return -1;
+  }
+
+  if (workerCount > batch.jobCount) workerCount = batch.jobCount;
+  if (workerCount < 1) workerCount = 1;
+
+  pthread_mutex_init(&batch.lock, NULL);
+  workers = (pthread_t*) malloc(workerCount * sizeof(pthread_t));
+  for (i = 0; i < workerCount; i++)
+    pthread_create(&workers[i], NULL, runWorker, &batch);
+  for (i = 0; i < workerCount; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  pthread_mutex_destroy(&batch.lock);
+
+  for (i = 0; i < batch.jobCount; i++) {
+    reportJob(batch.jobs + i);
+    if (batch.jobs[i].result != IO_SUCCESS)
+      failures ++;
+  }
+
+  freeBatch(&batch);
+  return failures;
+}
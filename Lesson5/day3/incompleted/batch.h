@@ -0,0 +1,31 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "ast.h"
+
+// One source of a batch and what became of it
+struct BatchJob_ {
+  char* input;
+  char* output;
+  int result;           // IO_SUCCESS, or what failed: see compileJob()
+  char* diagnostics;
+};
+
+typedef struct BatchJob_ BatchJob;
+
+/*
+ * Compiles every "input output" pair listed in listFileName, one pair per
+ * line, on workerCount threads, each compiler set up from options. The
+ * diagnostics of each file are printed after all of them are done, in the
+ * order of the list. Returns the number of files that failed, or -1 if the
+ * list can't be read.
+ */
+int compileBatch(char* listFileName, int workerCount, CodeOptions* options);
+
+#endif
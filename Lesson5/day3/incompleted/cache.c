@@ -0,0 +1,296 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "cache.h"
+#include "codegen.h"
+
+#define STATS_FILE "stats"
+
+// Two 64 bit FNV-1a hashes with different offsets. This isn't a
+// cryptographic hash: the cache trusts whoever can write its directory.
+struct Hash_ {
+  unsigned long long h1;
+  unsigned long long h2;
+};
+
+typedef struct Hash_ Hash;
+
+#define FNV_PRIME 0x100000001b3ULL
+
+static void hashBytes(Hash* hash, const unsigned char* bytes, size_t length) {
+  size_t i;
+
+  for (i = 0; i < length; i ++) {
+    hash->h1 = (hash->h1 ^ bytes[i]) * FNV_PRIME;
+    hash->h2 = (hash->h2 ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+static int hashFile(Hash* hash, char* fileName) {
+  unsigned char buffer[8192];
+  size_t length;
+  FILE* f = fopen(fileName, "rb");
+
+  if (f == NULL) return 0;
+  while ((length = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    hashBytes(hash, buffer, length);
+  fclose(f);
+  return 1;
+}
+
+static char* makePath(Cache* cache, char* name, char* ext) {
+  char* path = (char*) malloc(strlen(cache->directory) + strlen(name) + strlen(ext) + 2);
+  sprintf(path, "%s/%s%s", cache->directory, name, ext);
+  return path;
+}
+
+int openCache(Cache* cache, char* directory, long long maxSize) {
+  struct stat info;
+
+  cache->directory = directory;
+  cache->maxSize = maxSize;
+  mkdir(directory, 0777);
+  return (stat(directory, &info) == 0) && S_ISDIR(info.st_mode);
+}
+
+/*
+ * The key covers the compiler itself, so that rebuilding kplc invalidates
+ * what an older one compiled, and the flags that change the output. The
+ * compiler is known by its version and the size and time of its binary.
+ */
+int makeCacheKey(char* sourceFile, char* flags, char* key) {
+  Hash hash = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+  struct stat compiler;
+  long long compilerId[3] = { 0, 0, 0 };
+
+  if (stat("/proc/self/exe", &compiler) == 0) {
+    compilerId[0] = compiler.st_size;
+    compilerId[1] = compiler.st_mtime;
+    compilerId[2] = compiler.st_ino;
+  }
+  hashBytes(&hash, (unsigned char*) COMPILER_VERSION, strlen(COMPILER_VERSION) + 1);
+  hashBytes(&hash, (unsigned char*) compilerId, sizeof(compilerId));
+  hashBytes(&hash, (unsigned char*) flags, strlen(flags) + 1);
+  if (!hashFile(&hash, sourceFile))
+    return 0;
+
+  sprintf(key, "%016llx%016llx", hash.h1, hash.h2);
+  return 1;
+}
+
+static int copyFile(char* from, char* to) {
+  char buffer[8192];
+  size_t length;
+  FILE* in = fopen(from, "rb");
+  FILE* out;
+
+  if (in == NULL) return 0;
+  out = fopen(to, "wb");
+  if (out == NULL) {
+    fclose(in);
+    return 0;
+  }
+  while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    fwrite(buffer, 1, length, out);
+  fclose(in);
+  return fclose(out) == 0;
+}
+
+// A copy, never a link: the compiler writes its outputs in place, and
+// would write through a link into the entry
+static int installFile(char* from, char* to) {
+  unlink(to);
+  return copyFile(from, to);
+}
+
+static void countRequest(Cache* cache, int hit) {
+  char* path = makePath(cache, STATS_FILE, "");
+  long long hits = 0, misses = 0;
+  FILE* f;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT, 0666);
+  free(path);
+  if (fd < 0) return;
+  flock(fd, LOCK_EX);
+  f = fdopen(fd, "r+");
+  if (fscanf(f, "%lld %lld", &hits, &misses) != 2)
+    hits = misses = 0;
+  if (hit) hits ++;
+  else misses ++;
+  rewind(f);
+  fprintf(f, "%lld %lld\n", hits, misses);
+  fflush(f);
+  flock(fd, LOCK_UN);
+  fclose(f);
+}
+
+int fetchFromCache(Cache* cache, char* key, char* output) {
+  char* entry = makePath(cache, key, "");
+  char* symbols = makePath(cache, key, SYMBOL_FILE_EXT);
+  char* outputSymbols = (char*) malloc(strlen(output) + strlen(SYMBOL_FILE_EXT) + 1);
+  int hit;
+
+  strcpy(outputSymbols, output);
+  strcat(outputSymbols, SYMBOL_FILE_EXT);
+
+  hit = (access(entry, R_OK) == 0) && (access(symbols, R_OK) == 0) &&
+    installFile(entry, output) && installFile(symbols, outputSymbols);
+  // Hits keep an entry from being evicted
+  if (hit) utime(entry, NULL);
+  countRequest(cache, hit);
+
+  free(entry);
+  free(symbols);
+  free(outputSymbols);
+  return hit;
+}
+
+// Entries appear whole: they are written under a temporary name first
+static void storeFile(Cache* cache, char* from, char* name) {
+  char* path = makePath(cache, name, "");
+  char* temporary = (char*) malloc(strlen(path) + 32);
+
+  sprintf(temporary, "%s.%d.tmp", path, (int) getpid());
+  if (copyFile(from, temporary))
+    rename(temporary, path);
+  else unlink(temporary);
+  free(temporary);
+  free(path);
+}
+
+struct CacheEntry_ {
+  char name[CACHE_KEY_LENGTH + 1];
+  long long size;       // with the symbol file
+  time_t lastUse;
+};
+
+typedef struct CacheEntry_ CacheEntry;
+
+static int isCacheKey(char* name) {
+  return (strlen(name) == CACHE_KEY_LENGTH) && (strspn(name, "0123456789abcdef") == CACHE_KEY_LENGTH);
+}
+
+static long long fileSize(Cache* cache, char* name, char* ext, time_t* lastUse) {
+  char* path = makePath(cache, name, ext);
+  struct stat info;
+  long long size = 0;
+
+  if (stat(path, &info) == 0) {
+    size = info.st_size;
+    if (lastUse != NULL) *lastUse = info.st_mtime;
+  }
+  free(path);
+  return size;
+}
+
+// All the entries, in *entries; returns how many there are
+static int listEntries(Cache* cache, CacheEntry** entries) {
+  DIR* dir = opendir(cache->directory);
+  struct dirent* file;
+  int count = 0, size = 0;
+
+  *entries = NULL;
+  if (dir == NULL) return 0;
+  while ((file = readdir(dir)) != NULL) {
+    if (!isCacheKey(file->d_name)) continue;
+    if (count == size) {
+      size = (size == 0) ? 64 : 2 * size;
+      *entries = (CacheEntry*) realloc(*entries, size * sizeof(CacheEntry));
+    }
+    strcpy((*entries)[count].name, file->d_name);
+    (*entries)[count].lastUse = 0;
+    (*entries)[count].size = fileSize(cache, file->d_name, "", &((*entries)[count].lastUse)) +
+      fileSize(cache, file->d_name, SYMBOL_FILE_EXT, NULL);
+    count ++;
+  }
+  closedir(dir);
+  return count;
+}
+
+static int compareLastUse(const void* a, const void* b) {
+  time_t x = ((CacheEntry*) a)->lastUse, y = ((CacheEntry*) b)->lastUse;
+  return (x > y) - (x < y);
+}
+
+static void evict(Cache* cache) {
+  CacheEntry* entries;
+  long long total = 0;
+  char* path;
+  int count, i;
+
+  count = listEntries(cache, &entries);
+  for (i = 0; i < count; i ++)
+    total += entries[i].size;
+
+  qsort(entries, count, sizeof(CacheEntry), compareLastUse);
+  for (i = 0; (i < count) && (total > cache->maxSize); i ++) {
+    path = makePath(cache, entries[i].name, "");
+    unlink(path);
+    free(path);
+    path = makePath(cache, entries[i].name, SYMBOL_FILE_EXT);
+    unlink(path);
+    free(path);
+    total -= entries[i].size;
+  }
+  free(entries);
+}
+
+void storeInCache(Cache* cache, char* key, char* output) {
+  char* outputSymbols = (char*) malloc(strlen(output) + strlen(SYMBOL_FILE_EXT) + 1);
+  char* symbolsName = (char*) malloc(strlen(key) + strlen(SYMBOL_FILE_EXT) + 1);
+
+  strcpy(outputSymbols, output);
+  strcat(outputSymbols, SYMBOL_FILE_EXT);
+  strcpy(symbolsName, key);
+  strcat(symbolsName, SYMBOL_FILE_EXT);
+
+  // The symbol file first: an entry counts once its executable is there
+  storeFile(cache, outputSymbols, symbolsName);
+  storeFile(cache, output, key);
+  evict(cache);
+
+  free(outputSymbols);
+  free(symbolsName);
+}
+
+void printCacheStats(Cache* cache) {
+  CacheEntry* entries;
+  long long hits = 0, misses = 0, total = 0;
+  char* path = makePath(cache, STATS_FILE, "");
+  FILE* f = fopen(path, "r");
+  int count, i;
+
+  free(path);
+  if (f != NULL) {
+    if (fscanf(f, "%lld %lld", &hits, &misses) != 2)
+      hits = misses = 0;
+    fclose(f);
+  }
+
+  count = listEntries(cache, &entries);
+  for (i = 0; i < count; i ++)
+    total += entries[i].size;
+  free(entries);
+
+  printf("Cache %s\n", cache->directory);
+  printf("  entries: %d\n", count);
+  printf("  size: %lld bytes (limit %lld)\n", total, cache->maxSize);
+  printf("  hits: %lld, misses: %lld", hits, misses);
+  if (hits + misses > 0)
+    printf(" (%.1f%% hits)", 100.0 * hits / (hits + misses));
+  printf("\n");
+}
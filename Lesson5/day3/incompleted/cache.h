@@ -0,0 +1,39 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define COMPILER_VERSION "kplc 1.0"
+#define DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+
+#define CACHE_KEY_LENGTH 32   // hex digits
+
+/*
+ * An on-disk cache of executables, kept in one directory. An entry is
+ * named after the hash of the source, the compiler and its flags, and
+ * holds the executable and its symbol file. The least recently used
+ * entries are removed when the cache grows over its size.
+ */
+struct Cache_ {
+  char* directory;
+  long long maxSize;    // bytes
+};
+
+typedef struct Cache_ Cache;
+
+int openCache(Cache* cache, char* directory, long long maxSize);
+
+// key: CACHE_KEY_LENGTH + 1 chars. Returns 0 if the source can't be read.
+int makeCacheKey(char* sourceFile, char* flags, char* key);
+
+// Copies the entry to output, returns 0 on a miss
+int fetchFromCache(Cache* cache, char* key, char* output);
+void storeInCache(Cache* cache, char* key, char* output);
+
+void printCacheStats(Cache* cache);
+
+#endif
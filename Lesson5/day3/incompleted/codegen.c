@@ -5,234 +5,367 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "reader.h"
 #include "codegen.h"  
+#include "stats.h"
 
 #define CODE_SIZE 10000
-extern SymTab* symtab;
 
-extern Object* readiFunction;
-extern Object* readcFunction;
-extern Object* writeiProcedure;
-extern Object* writecProcedure;
-extern Object* writelnProcedure;
+// The number of static links from the current scope out to scope
+int computeNestedLevel(Compiler* compiler, Scope* scope) {
+  int level = 0;
+  Scope* tmp = compiler->symtab->currentScope;
 
-CodeBlock* codeBlock;
-
-int computeNestedLevel(Scope* scope) {
-  // TODO
+  while (tmp != scope) {
+    tmp = tmp->outer;
+    level ++;
+  }
+  return level;
 }
 
-void genVariableAddress(Object* var) {
-  // TODO
+void genVariableAddress(Compiler* compiler, Object* var) {
+  int level = computeNestedLevel(compiler, VARIABLE_SCOPE(var));
+  genLA(compiler, level, VARIABLE_OFFSET(var));
 }
 
-void genVariableValue(Object* var) {
-  // TODO
+void genVariableValue(Compiler* compiler, Object* var) {
+  int level = computeNestedLevel(compiler, VARIABLE_SCOPE(var));
+  genLV(compiler, level, VARIABLE_OFFSET(var));
 }
 
-void genParameterAddress(Object* param) {
-  // TODO
+// A reference parameter holds the address of its argument
+void genParameterAddress(Compiler* compiler, Object* param) {
+  int level = computeNestedLevel(compiler, PARAMETER_SCOPE(param));
+
+  if (param->paramAttrs->kind == PARAM_REFERENCE)
+    genLV(compiler, level, PARAMETER_OFFSET(param));
+  else genLA(compiler, level, PARAMETER_OFFSET(param));
 }
 
-void genParameterValue(Object* param) {
-  // TODO
+void genParameterValue(Compiler* compiler, Object* param) {
+  int level = computeNestedLevel(compiler, PARAMETER_SCOPE(param));
+
+  genLV(compiler, level, PARAMETER_OFFSET(param));
+  if (param->paramAttrs->kind == PARAM_REFERENCE)
+    genLI(compiler);
 }
 
-void genReturnValueAddress(Object* func) {
-  // TODO
+void genReturnValueAddress(Compiler* compiler, Object* func) {
+  int level = computeNestedLevel(compiler, FUNCTION_SCOPE(func));
+  genLA(compiler, level, RETURN_VALUE_OFFSET);
 }
 
-void genReturnValueValue(Object* func) {
-  // TODO
+void genReturnValueValue(Compiler* compiler, Object* func) {
+  int level = computeNestedLevel(compiler, FUNCTION_SCOPE(func));
+  genLV(compiler, level, RETURN_VALUE_OFFSET);
 }
 
-void genPredefinedProcedureCall(Object* proc) {
-  if (proc == writeiProcedure)
-    genWRI();
-  else if (proc == writecProcedure)
-    genWRC();
-  else if (proc == writelnProcedure)
-    genWLN();
+void genPredefinedProcedureCall(Compiler* compiler, Object* proc) {
+  if (proc == compiler->writeiProcedure)
+    genWRI(compiler);
+  else if (proc == compiler->writecProcedure)
+    genWRC(compiler);
+  else if (proc == compiler->writelnProcedure)
+    genWLN(compiler);
 }
 
-void genProcedureCall(Object* proc) {
-  // TODO
+// The static link of the callee is the frame of the block declaring it
+void genProcedureCall(Compiler* compiler, Object* proc) {
+  int level = computeNestedLevel(compiler, PROCEDURE_SCOPE(proc)->outer);
+  genCALL(compiler, level, proc->procAttrs->codeAddress);
 }
 
-void genPredefinedFunctionCall(Object* func) {
-  if (func == readiFunction)
-    genRI();
-  else if (func == readcFunction)
-    genRC();
+void genPredefinedFunctionCall(Compiler* compiler, Object* func) {
+  if (func == compiler->readiFunction)
+    genRI(compiler);
+  else if (func == compiler->readcFunction)
+    genRC(compiler);
 }
 
-void genFunctionCall(Object* func) {
-  // TODO
+void genFunctionCall(Compiler* compiler, Object* func) {
+  int level = computeNestedLevel(compiler, FUNCTION_SCOPE(func)->outer);
+  genCALL(compiler, level, func->funcAttrs->codeAddress);
 }
 
-void genLA(int level, int offset) {
-  emitLA(codeBlock, level, offset);
+void genLA(Compiler* compiler, int level, int offset) {
+  emitLA(compiler->codeBlock, level, offset);
 }
 
-void genLV(int level, int offset) {
-  emitLV(codeBlock, level, offset);
+void genLV(Compiler* compiler, int level, int offset) {
+  emitLV(compiler->codeBlock, level, offset);
 }
 
-void genLC(WORD constant) {
-  emitLC(codeBlock, constant);
+void genLC(Compiler* compiler, WORD constant) {
+  emitLC(compiler->codeBlock, constant);
 }
 
-void genLI(void) {
-  emitLI(codeBlock);
+void genLI(Compiler* compiler) {
+  emitLI(compiler->codeBlock);
 }
 
-void genINT(int delta) {
-  emitINT(codeBlock,delta);
+void genINT(Compiler* compiler, int delta) {
+  emitINT(compiler->codeBlock,delta);
 }
 
-void genDCT(int delta) {
-  emitDCT(codeBlock,delta);
+void genDCT(Compiler* compiler, int delta) {
+  emitDCT(compiler->codeBlock,delta);
 }
 
-Instruction* genJ(CodeAddress label) {
-  Instruction* inst = codeBlock->code + codeBlock->codeSize;
-  emitJ(codeBlock,label);
+// NULL when the code buffer is full; compile() reports that
+Instruction* genJ(Compiler* compiler, CodeAddress label) {
+  Instruction* inst = compiler->codeBlock->code + compiler->codeBlock->codeSize;
+  if (!emitJ(compiler->codeBlock,label)) return NULL;
   return inst;
 }
 
-Instruction* genFJ(CodeAddress label) {
-  Instruction* inst = codeBlock->code + codeBlock->codeSize;
-  emitFJ(codeBlock, label);
+Instruction* genFJ(Compiler* compiler, CodeAddress label) {
+  Instruction* inst = compiler->codeBlock->code + compiler->codeBlock->codeSize;
+  if (!emitFJ(compiler->codeBlock, label)) return NULL;
   return inst;
 }
 
-void genHL(void) {
-  emitHL(codeBlock);
+void genHL(Compiler* compiler) {
+  emitHL(compiler->codeBlock);
+}
+
+void genST(Compiler* compiler) {
+  emitST(compiler->codeBlock);
+}
+
+void genCALL(Compiler* compiler, int level, CodeAddress label) {
+  emitCALL(compiler->codeBlock, level, label);
+}
+
+void genEP(Compiler* compiler) {
+  emitEP(compiler->codeBlock);
 }
 
-void genST(void) {
-  emitST(codeBlock);
+void genEF(Compiler* compiler) {
+  emitEF(compiler->codeBlock);
 }
 
-void genCALL(int level, CodeAddress label) {
-  emitCALL(codeBlock, level, label);
+void genRC(Compiler* compiler) {
+  emitRC(compiler->codeBlock);
 }
 
-void genEP(void) {
-  emitEP(codeBlock);
+void genRI(Compiler* compiler) {
+  emitRI(compiler->codeBlock);
 }
 
-void genEF(void) {
-  emitEF(codeBlock);
+void genWRC(Compiler* compiler) {
+  emitWRC(compiler->codeBlock);
 }
 
-void genRC(void) {
-  emitRC(codeBlock);
+void genWRI(Compiler* compiler) {
+  emitWRI(compiler->codeBlock);
 }
 
-void genRI(void) {
-  emitRI(codeBlock);
+void genWLN(Compiler* compiler) {
+  emitWLN(compiler->codeBlock);
 }
 
-void genWRC(void) {
-  emitWRC(codeBlock);
+void genAD(Compiler* compiler) {
+  emitAD(compiler->codeBlock);
 }
 
-void genWRI(void) {
-  emitWRI(codeBlock);
+void genSB(Compiler* compiler) {
+  emitSB(compiler->codeBlock);
 }
 
-void genWLN(void) {
-  emitWLN(codeBlock);
+/*
+ * ML or DV by the constant just loaded, a power of 2, becomes the shift
+ * op of the other operand; by 1, nothing at all. Returns whether it did.
+ * Only -O2 code shifts: SL and SR are not in the shipped executables and
+ * older VMs don't know them.
+ */
+static int shiftByConstant(Compiler* compiler, enum OpCode op) {
+  CodeBlock* codeBlock = compiler->codeBlock;
+  Instruction* last;
+  int shift;
+
+  if (codeBlock->codeSize == 0)
+    return 0;
+  last = codeBlock->code + codeBlock->codeSize - 1;
+  if ((last->op != OP_LC) || (last->q <= 0) || ((last->q & (last->q - 1)) != 0))
+    return 0;
+
+  for (shift = 0; (1 << shift) != last->q; shift ++);
+  if (shift == 0)
+    dropLastCode(codeBlock);
+  else {
+    last->op = op;
+    last->q = shift;
+  }
+  return 1;
 }
 
-void genAD(void) {
-  emitAD(codeBlock);
+void genML(Compiler* compiler) {
+  emitML(compiler->codeBlock);
 }
 
-void genSB(void) {
-  emitSB(codeBlock);
+void genDV(Compiler* compiler) {
+  emitDV(compiler->codeBlock);
 }
 
-void genML(void) {
-  emitML(codeBlock);
+void genShiftedML(Compiler* compiler) {
+  if (!shiftByConstant(compiler, OP_SL))
+    emitML(compiler->codeBlock);
 }
 
-void genDV(void) {
-  emitDV(codeBlock);
+void genShiftedDV(Compiler* compiler) {
+  if (!shiftByConstant(compiler, OP_SR))
+    emitDV(compiler->codeBlock);
 }
 
-void genNEG(void) {
-  emitNEG(codeBlock);
+void genNEG(Compiler* compiler) {
+  emitNEG(compiler->codeBlock);
 }
 
-void genCV(void) {
-  emitCV(codeBlock);
+void genCV(Compiler* compiler) {
+  emitCV(compiler->codeBlock);
 }
 
-void genEQ(void) {
-  emitEQ(codeBlock);
+void genEQ(Compiler* compiler) {
+  emitEQ(compiler->codeBlock);
 }
 
-void genNE(void) {
-  emitNE(codeBlock);
+void genNE(Compiler* compiler) {
+  emitNE(compiler->codeBlock);
 }
 
-void genGT(void) {
-  emitGT(codeBlock);
+void genGT(Compiler* compiler) {
+  emitGT(compiler->codeBlock);
 }
 
-void genGE(void) {
-  emitGE(codeBlock);
+void genGE(Compiler* compiler) {
+  emitGE(compiler->codeBlock);
 }
 
-void genLT(void) {
-  emitLT(codeBlock);
+void genLT(Compiler* compiler) {
+  emitLT(compiler->codeBlock);
 }
 
-void genLE(void) {
-  emitLE(codeBlock);
+void genLE(Compiler* compiler) {
+  emitLE(compiler->codeBlock);
 }
 
 void updateJ(Instruction* jmp, CodeAddress label) {
-  jmp->q = label;
+  if (jmp != NULL)
+    jmp->q = label;
 }
 
 void updateFJ(Instruction* jmp, CodeAddress label) {
-  jmp->q = label;
+  if (jmp != NULL)
+    jmp->q = label;
 }
 
-CodeAddress getCurrentCodeAddress(void) {
-  return codeBlock->codeSize;
+CodeAddress getCurrentCodeAddress(Compiler* compiler) {
+  return compiler->codeBlock->codeSize;
 }
 
-int isPredefinedFunction(Object* func) {
-  return ((func == readiFunction) || (func == readcFunction));
+// Code emitted from now on is attributed to the given source line
+void setSourceLine(Compiler* compiler, int lineNo) {
+  setCurrentLine(compiler->codeBlock, lineNo);
 }
 
-int isPredefinedProcedure(Object* proc) {
-  return ((proc == writeiProcedure) || (proc == writecProcedure) || (proc == writelnProcedure));
+void addCodeSymbol(Compiler* compiler, Object* obj) {
+  CodeSymbol* symbol = (CodeSymbol*) countedMalloc(sizeof(CodeSymbol));
+  CodeSymbol** last = &compiler->codeSymbols;
+
+  strcpy(symbol->name, obj->name);
+  switch (obj->kind) {
+  case OBJ_FUNCTION:
+    symbol->address = obj->funcAttrs->codeAddress;
+    break;
+  case OBJ_PROCEDURE:
+    symbol->address = obj->procAttrs->codeAddress;
+    break;
+  case OBJ_PROGRAM:
+    symbol->address = obj->progAttrs->codeAddress;
+    break;
+  default:
+    countedFree(symbol, sizeof(CodeSymbol));
+    return;
+  }
+  symbol->next = NULL;
+
+  while (*last != NULL)
+    last = &((*last)->next);
+  *last = symbol;
 }
 
-void initCodeBuffer(void) {
-  codeBlock = createCodeBlock(CODE_SIZE);
+int isPredefinedFunction(Compiler* compiler, Object* func) {
+  return ((func == compiler->readiFunction) || (func == compiler->readcFunction));
 }
 
-void printCodeBuffer(void) {
-  printCodeBlock(codeBlock);
+int isPredefinedProcedure(Compiler* compiler, Object* proc) {
+  return ((proc == compiler->writeiProcedure) || (proc == compiler->writecProcedure) || (proc == compiler->writelnProcedure));
 }
 
-void cleanCodeBuffer(void) {
-  freeCodeBlock(codeBlock);
+void initCodeBuffer(Compiler* compiler) {
+  compiler->codeBlock = createCodeBlock(CODE_SIZE);
+  compiler->codeSymbols = NULL;
 }
 
-int serialize(char* fileName) {
-  FILE* f;
+void printCodeBuffer(Compiler* compiler) {
+  printCodeBlock(compiler->codeBlock);
+}
 
-  f = fopen(fileName, "wb");
+static void freeCodeSymbols(Compiler* compiler) {
+  CodeSymbol* symbol;
+
+  while (compiler->codeSymbols != NULL) {
+    symbol = compiler->codeSymbols;
+    compiler->codeSymbols = compiler->codeSymbols->next;
+    countedFree(symbol, sizeof(CodeSymbol));
+  }
+}
+
+void cleanCodeBuffer(Compiler* compiler) {
+  freeCodeBlock(compiler->codeBlock);
+  freeCodeSymbols(compiler);
+}
+
+void resetCodeBuffer(Compiler* compiler) {
+  resetCodeBlock(compiler->codeBlock);
+  freeCodeSymbols(compiler);
+}
+
+// Writes "address name" lines to fileName.sym so that kplrun can show
+// KPL names in its call-graph profile
+int serializeSymbols(Compiler* compiler, char* fileName) {
+  FILE* f;
+  char* symFileName;
+  CodeSymbol* symbol;
+
+  symFileName = (char*) malloc(strlen(fileName) + strlen(SYMBOL_FILE_EXT) + 1);
+  strcpy(symFileName, fileName);
+  strcat(symFileName, SYMBOL_FILE_EXT);
+  f = fopen(symFileName, "w");
+  free(symFileName);
   if (f == NULL) return IO_ERROR;
-  saveCode(codeBlock, f);
+
+  for (symbol = compiler->codeSymbols; symbol != NULL; symbol = symbol->next)
+    fprintf(f, "%d %s\n", symbol->address, symbol->name);
   fclose(f);
   return IO_SUCCESS;
 }
+
+int serialize(Compiler* compiler, char* fileName) {
+  int stage = enterStage(STAGE_CODEGEN);
+  FILE* f;
+  int result;
+
+  f = fopen(fileName, "wb");
+  if (f == NULL) {
+    leaveStage(stage);
+    return IO_ERROR;
+  }
+  saveCode(compiler->codeBlock, f);
+  fclose(f);
+  result = serializeSymbols(compiler, fileName);
+  leaveStage(stage);
+  return result;
+}
@@ -9,14 +9,15 @@
 
 #include "symtab.h"
 #include "instructions.h"
+#include "compiler.h"
 
 #define RESERVED_WORDS 4
 
-#define PROCEDURE_PARAM_COUNT(proc) (proc->procAttrs->numOfParams)
+#define PROCEDURE_PARAM_COUNT(proc) (proc->procAttrs->paramCount)
 #define PROCEDURE_SCOPE(proc) (proc->procAttrs->scope)
 #define PROCEDURE_FRAME_SIZE(proc) (proc->procAttrs->scope->frameSize)
 
-#define FUNCTION_PARAM_COUNT(func) (func->funcAttrs->numOfParams)
+#define FUNCTION_PARAM_COUNT(func) (func->funcAttrs->paramCount)
 #define FUNCTION_SCOPE(func) (func->funcAttrs->scope)
 #define FUNCTION_FRAME_SIZE(func) (func->funcAttrs->scope->frameSize)
 
@@ -29,73 +30,90 @@
 #define PARAMETER_OFFSET(param) (param->paramAttrs->localOffset)
 #define PARAMETER_SCOPE(param) (param->paramAttrs->scope)
 
+#define SYMBOL_FILE_EXT ".sym"
+
+// A named entry point in the code buffer (the program, a function or a procedure)
+struct CodeSymbol_ {
+  char name[MAX_IDENT_LEN + 1];
+  CodeAddress address;
+  struct CodeSymbol_ *next;
+};
+
+typedef struct CodeSymbol_ CodeSymbol;
+
 #define RETURN_VALUE_OFFSET 0
 #define DYNAMIC_LINK_OFFSET 1
 #define RETURN_ADDRESS_OFFSET 2
 #define STATIC_LINK_OFFSET 3
 
-int computeNestedLevel(Scope* scope);
-
-void genVariableAddress(Object* var);
-void genVariableValue(Object* var);
-
-void genParameterAddress(Object* param); 
-void genParameterValue(Object* param);
-
-void genReturnValueAddress(Object* func);
-void genReturnValueAddress(Object* func);
-
-void genArrayElementAddress(Type* arrayType);
-void genArrayElementValue(Type* arrayType);
-
-void genPredefinedProcedureCall(Object* proc);
-void genProcedureCall(Object* proc);
-
-void genPredefinedFunctionCall(Object* func);
-void genFunctionCall(Object* func);
-
-void genLA(int level, int offset);
-void genLV(int level, int offset);
-void genLC(WORD constant);
-void genLI(void);
-void genINT(int delta);
-void genDCT(int delta);
-Instruction* genJ(CodeAddress label);
-Instruction* genFJ(CodeAddress label);
-void genHL(void);
-void genST(void);
-void genCALL(int level, CodeAddress label);
-void genEP(void);
-void genEF(void);
-void genRC(void);
-void genRI(void);
-void genWRC(void);
-void genWRI(void);
-void genWLN(void);
-void genAD(void);
-void genSB(void);
-void genML(void);
-void genDV(void);
-void genNEG(void);
-void genCV(void);
-void genEQ(void);
-void genNE(void);
-void genGT(void);
-void genGE(void);
-void genLT(void);
-void genLE(void);
+int computeNestedLevel(Compiler* compiler, Scope* scope);
+
+void genVariableAddress(Compiler* compiler, Object* var);
+void genVariableValue(Compiler* compiler, Object* var);
+
+void genParameterAddress(Compiler* compiler, Object* param); 
+void genParameterValue(Compiler* compiler, Object* param);
+
+void genReturnValueAddress(Compiler* compiler, Object* func);
+void genReturnValueAddress(Compiler* compiler, Object* func);
+
+void genArrayElementAddress(Compiler* compiler, Type* arrayType);
+void genArrayElementValue(Compiler* compiler, Type* arrayType);
+
+void genPredefinedProcedureCall(Compiler* compiler, Object* proc);
+void genProcedureCall(Compiler* compiler, Object* proc);
+
+void genPredefinedFunctionCall(Compiler* compiler, Object* func);
+void genFunctionCall(Compiler* compiler, Object* func);
+
+void genLA(Compiler* compiler, int level, int offset);
+void genLV(Compiler* compiler, int level, int offset);
+void genLC(Compiler* compiler, WORD constant);
+void genLI(Compiler* compiler);
+void genINT(Compiler* compiler, int delta);
+void genDCT(Compiler* compiler, int delta);
+Instruction* genJ(Compiler* compiler, CodeAddress label);
+Instruction* genFJ(Compiler* compiler, CodeAddress label);
+void genHL(Compiler* compiler);
+void genST(Compiler* compiler);
+void genCALL(Compiler* compiler, int level, CodeAddress label);
+void genEP(Compiler* compiler);
+void genEF(Compiler* compiler);
+void genRC(Compiler* compiler);
+void genRI(Compiler* compiler);
+void genWRC(Compiler* compiler);
+void genWRI(Compiler* compiler);
+void genWLN(Compiler* compiler);
+void genAD(Compiler* compiler);
+void genSB(Compiler* compiler);
+void genML(Compiler* compiler);
+void genDV(Compiler* compiler);
+void genShiftedML(Compiler* compiler);
+void genShiftedDV(Compiler* compiler);
+void genNEG(Compiler* compiler);
+void genCV(Compiler* compiler);
+void genEQ(Compiler* compiler);
+void genNE(Compiler* compiler);
+void genGT(Compiler* compiler);
+void genGE(Compiler* compiler);
+void genLT(Compiler* compiler);
+void genLE(Compiler* compiler);
 
 void updateJ(Instruction* jmp, CodeAddress label);
 void updateFJ(Instruction* jmp, CodeAddress label);
 
-CodeAddress getCurrentCodeAddress(void);
-int isPredefinedProcedure(Object* proc);
-int isPredefinedFunction(Object* func);
+CodeAddress getCurrentCodeAddress(Compiler* compiler);
+void setSourceLine(Compiler* compiler, int lineNo);
+void addCodeSymbol(Compiler* compiler, Object* obj);
+int isPredefinedProcedure(Compiler* compiler, Object* proc);
+int isPredefinedFunction(Compiler* compiler, Object* func);
 
-void initCodeBuffer(void);
-void printCodeBuffer(void);
-void cleanCodeBuffer(void);
+void initCodeBuffer(Compiler* compiler);
+void printCodeBuffer(Compiler* compiler);
+void cleanCodeBuffer(Compiler* compiler);
+void resetCodeBuffer(Compiler* compiler);
 
-int serialize(char* fileName);
+int serializeSymbols(Compiler* compiler, char* fileName);
+int serialize(Compiler* compiler, char* fileName);
 
 #endif
@@ -0,0 +1,122 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include "compiler.h"
+#include "codegen.h"
+#include "symtab.h"
+#include "ast.h"
+#include "stats.h"
+
+void initCompiler(Compiler* compiler) {
+  memset(compiler, 0, sizeof(Compiler));
+  initCodeBuffer(compiler);
+}
+
+void cleanCompiler(Compiler* compiler) {
+  cleanCodeBuffer(compiler);
+  if (compiler->symtab != NULL)
+    cleanSymTab(compiler);
+  compiler->symtab = NULL;
+  if (compiler->ast != NULL)
+    cleanAst(compiler);
+  countedFree(compiler->diagnostics, compiler->diagnosticsSize);
+  compiler->diagnostics = NULL;
+}
+
+// Forgets the previous compilation, keeping the buffers for the next one
+void resetCompiler(Compiler* compiler) {
+  resetCodeBuffer(compiler);
+  if (compiler->ast != NULL)
+    resetAst(compiler);
+  compiler->diagnosticsLength = 0;
+  if (compiler->diagnostics != NULL)
+    compiler->diagnostics[0] = '\0';
+  compiler->errorCount = 0;
+}
+
+void addDiagnostic(Compiler* compiler, const char* format, ...) {
+  va_list args;
+  int length;
+  int size;
+
+  va_start(args, format);
+  length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  if (compiler->diagnosticsLength + length + 1 > compiler->diagnosticsSize) {
+    size = 2 * (compiler->diagnosticsLength + length + 1);
+    compiler->diagnostics = (char*) countedRealloc(compiler->diagnostics, compiler->diagnosticsSize, size);
+    compiler->diagnosticsSize = size;
+  }
+
+  va_start(args, format);
+  vsnprintf(compiler->diagnostics + compiler->diagnosticsLength, length + 1, format, args);
+  va_end(args);
+  compiler->diagnosticsLength += length;
+}
+
+struct DiagnosticLine_ {
+  char* text;
+  int length;
+  int lineNo, colNo;      // INT_MAX for a line with no position
+  int index;              // keeps lines at the same position in order
+};
+
+typedef struct DiagnosticLine_ DiagnosticLine;
+
+static int compareDiagnosticLines(const void* a, const void* b) {
+  const DiagnosticLine* x = (const DiagnosticLine*) a;
+  const DiagnosticLine* y = (const DiagnosticLine*) b;
+
+  if (x->lineNo != y->lineNo) return (x->lineNo < y->lineNo) ? -1 : 1;
+  if (x->colNo != y->colNo) return (x->colNo < y->colNo) ? -1 : 1;
+  return x->index - y->index;
+}
+
+// Puts the "line-column:message" lines in source order. Lines with no
+// position, such as "Too many errors", stay last.
+void sortDiagnostics(Compiler* compiler) {
+  DiagnosticLine* lines;
+  char* sorted;
+  char* p;
+  char* end;
+  int count = 0;
+  int i;
+
+  if (compiler->diagnosticsLength == 0) return;
+  for (p = compiler->diagnostics; *p != '\0'; p++)
+    if (*p == '\n') count ++;
+  lines = (DiagnosticLine*) countedMalloc((count + 1) * sizeof(DiagnosticLine));
+
+  count = 0;
+  for (p = compiler->diagnostics; *p != '\0'; p = end) {
+    end = strchr(p, '\n');
+    end = (end == NULL) ? p + strlen(p) : end + 1;
+    lines[count].text = p;
+    lines[count].length = end - p;
+    if (sscanf(p, "%d-%d:", &lines[count].lineNo, &lines[count].colNo) != 2)
+      lines[count].lineNo = lines[count].colNo = INT_MAX;
+    lines[count].index = count;
+    count ++;
+  }
+  qsort(lines, count, sizeof(DiagnosticLine), compareDiagnosticLines);
+
+  sorted = (char*) countedMalloc(compiler->diagnosticsSize);
+  p = sorted;
+  for (i = 0; i < count; i++) {
+    memcpy(p, lines[i].text, lines[i].length);
+    p += lines[i].length;
+  }
+  *p = '\0';
+  countedFree(compiler->diagnostics, compiler->diagnosticsSize);
+  compiler->diagnostics = sorted;
+  countedFree(lines, (count + 1) * sizeof(DiagnosticLine));
+}
@@ -0,0 +1,77 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __COMPILER_H__
+#define __COMPILER_H__
+
+#include <stdio.h>
+#include <setjmp.h>
+#include "token.h"
+#include "instructions.h"
+
+struct SymTab_;
+struct Type_;
+struct Object_;
+struct CodeSymbol_;
+struct Ast_;
+
+/*
+ * Everything one compilation works on. The reader, scanner, parser,
+ * symbol table and code generator all take the compiler they belong to,
+ * so several sources can be compiled at once on different threads.
+ * A compiler can compile any number of sources one after the other: it
+ * keeps its code buffer and predefined objects from one to the next.
+ */
+struct Compiler_ {
+  // reader
+  FILE *inputStream;
+  int lineNo, colNo;
+  int currentChar;
+
+  // parser
+  Token *currentToken;
+  Token *lookAhead;
+
+  // symbol table
+  struct SymTab_* symtab;
+  struct Type_* intType;
+  struct Type_* charType;
+  struct Object_* writeiProcedure;
+  struct Object_* writecProcedure;
+  struct Object_* writelnProcedure;
+  struct Object_* readiFunction;
+  struct Object_* readcFunction;
+
+  // code generator
+  CodeBlock* codeBlock;
+  struct CodeSymbol_* codeSymbols;
+
+  // The syntax tree, for a compiler that builds one (see initAst()), or
+  // NULL for a single pass from source to code
+  struct Ast_* ast;
+
+  // Error messages, one per line, in the format kplc prints them
+  char* diagnostics;
+  int diagnosticsLength;
+  int diagnosticsSize;
+  int errorCount;
+  int lastErrorLineNo, lastErrorColNo;
+  // error() jumps to the innermost recovery point the parser has set,
+  // or to errorJump in compile() to abandon the compilation
+  jmp_buf* recovery;
+  jmp_buf errorJump;
+};
+
+typedef struct Compiler_ Compiler;
+
+void initCompiler(Compiler* compiler);
+void cleanCompiler(Compiler* compiler);
+void resetCompiler(Compiler* compiler);
+
+void addDiagnostic(Compiler* compiler, const char* format, ...);
+void sortDiagnostics(Compiler* compiler);
+
+#endif
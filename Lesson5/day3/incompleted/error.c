@@ -6,16 +6,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
 #include "error.h"
 
-#define NUM_OF_ERRORS 29
+#define NUM_OF_ERRORS 30
 
 struct ErrorMessage {
   ErrorCode errorCode;
   char *message;
 };
 
-struct ErrorMessage errors[29] = {
+struct ErrorMessage errors[30] = {
   {ERR_END_OF_COMMENT, "End of comment expected."},
   {ERR_IDENT_TOO_LONG, "Identifier too long."},
   {ERR_INVALID_CONSTANT_CHAR, "Invalid char constant."},
@@ -44,21 +45,58 @@ struct ErrorMessage errors[29] = {
   {ERR_UNDECLARED_PROCEDURE, "Undeclared procedure."},
   {ERR_DUPLICATE_IDENT, "Duplicate identifier."},
   {ERR_TYPE_INCONSISTENCY, "Type inconsistency"},
-  {ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, "The number of arguments and the number of parameters are inconsistent."}
+  {ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, "The number of arguments and the number of parameters are inconsistent."},
+  {ERR_CODE_TOO_LARGE, "The program is too large."}
 };
 
-void error(ErrorCode err, int lineNo, int colNo) {
+// Recovery reports one error at a position at most, which also keeps
+// a construct that failed from cascading into its callers
+static int addError(Compiler* compiler, int lineNo, int colNo) {
+  if ((compiler->errorCount > 0) && (lineNo == compiler->lastErrorLineNo) && (colNo == compiler->lastErrorColNo))
+    return 0;
+  compiler->errorCount ++;
+  compiler->lastErrorLineNo = lineNo;
+  compiler->lastErrorColNo = colNo;
+  return 1;
+}
+
+// Past MAX_ERRORS the compilation is abandoned
+static void checkErrorCount(Compiler* compiler) {
+  if (compiler->errorCount >= MAX_ERRORS) {
+    addDiagnostic(compiler, "Too many errors, giving up.\n");
+    longjmp(compiler->errorJump, 1);
+  }
+}
+
+static void recover(Compiler* compiler) {
+  checkErrorCount(compiler);
+  if (compiler->recovery != NULL)
+    longjmp(*(compiler->recovery), 1);
+  longjmp(compiler->errorJump, 1);
+}
+
+void reportError(Compiler* compiler, ErrorCode err, int lineNo, int colNo) {
   int i;
+
+  if (!addError(compiler, lineNo, colNo))
+    return;
   for (i = 0 ; i < NUM_OF_ERRORS; i ++) 
     if (errors[i].errorCode == err) {
-      printf("%d-%d:%s\n", lineNo, colNo, errors[i].message);
-      exit(0);
+      addDiagnostic(compiler, "%d-%d:%s\n", lineNo, colNo, errors[i].message);
+      break;
     }
+  checkErrorCount(compiler);
+}
+
+void error(Compiler* compiler, ErrorCode err, int lineNo, int colNo) {
+  reportError(compiler, err, lineNo, colNo);
+  recover(compiler);
 }
 
-void missingToken(TokenType tokenType, int lineNo, int colNo) {
-  printf("%d-%d:Missing %s\n", lineNo, colNo, tokenToString(tokenType));
-  exit(0);
+void missingToken(Compiler* compiler, TokenType tokenType, int lineNo, int colNo) {
+  if (addError(compiler, lineNo, colNo))
+    addDiagnostic(compiler, "%d-%d:Missing %s\n", lineNo, colNo, tokenToString(tokenType));
+  recover(compiler);
 }
 
 void assert(char *msg) {
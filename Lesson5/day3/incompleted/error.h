@@ -7,6 +7,7 @@
 #ifndef __ERROR_H__
 #define __ERROR_H__
 #include "token.h"
+#include "compiler.h"
 
 typedef enum {
   ERR_END_OF_COMMENT,
@@ -37,11 +38,18 @@ typedef enum {
   ERR_UNDECLARED_PROCEDURE,
   ERR_DUPLICATE_IDENT,
   ERR_TYPE_INCONSISTENCY,
-  ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY
+  ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY,
+  ERR_CODE_TOO_LARGE
 } ErrorCode;
 
-void error(ErrorCode err, int lineNo, int colNo);
-void missingToken(TokenType tokenType, int lineNo, int colNo);
+#define MAX_ERRORS 20
+
+// Adds the error to compiler->diagnostics; the caller carries on
+void reportError(Compiler* compiler, ErrorCode err, int lineNo, int colNo);
+// Both report the error and give up the construct being compiled: they
+// jump to the innermost recovery point of the parser
+void error(Compiler* compiler, ErrorCode err, int lineNo, int colNo);
+void missingToken(Compiler* compiler, TokenType tokenType, int lineNo, int colNo);
 void assert(char *msg);
 
 #endif
@@ -0,0 +1,374 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "generator.h"
+
+#define CONSTANT_COUNT 4
+#define MAX_NESTING 3       // of IF and FOR statements, one loop variable each
+#define LOOP_COUNT 3        // iterations of every FOR
+#define READ_VARIABLES 8    // of each kind the statements read, and so assign first
+
+struct Generator_ {
+  FILE* f;
+  Shape* shape;
+  unsigned random;
+  int indent;
+  int lineCount;
+  int procedureCount;       // numbers the procedures
+};
+
+typedef struct Generator_ Generator;
+
+// What the statements of a block may call: the procedures nested in it
+struct Block_ {
+  int level;                // 0 for the program
+  int* callable;
+  int callableCount;
+};
+
+typedef struct Block_ Block;
+
+void initShape(Shape* shape) {
+  shape->globals = 10;
+  shape->arrays = 2;
+  shape->arraySize = 10;
+  shape->procedures = 2;
+  shape->depth = 2;
+  shape->params = 2;
+  shape->locals = 4;
+  shape->statements = 10;
+  shape->expressionLength = 3;
+  shape->seed = 1;
+}
+
+static int nextRandom(Generator* gen, int bound) {
+  // xorshift32: the same program for the same seed everywhere
+  gen->random ^= gen->random << 13;
+  gen->random ^= gen->random >> 17;
+  gen->random ^= gen->random << 5;
+  return gen->random % bound;
+}
+
+static void put(Generator* gen, const char* format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(gen->f, format, args);
+  va_end(args);
+}
+
+static void startLine(Generator* gen) {
+  fprintf(gen->f, "%*s", 2 * gen->indent, "");
+}
+
+static void endLine(Generator* gen) {
+  fputc('\n', gen->f);
+  gen->lineCount ++;
+}
+
+/******************************************************************/
+
+static int hasScalar(Generator* gen, Block* block) {
+  Shape* shape = gen->shape;
+
+  return (shape->globals > 0) || ((block->level > 0) && (shape->locals + shape->params > 0));
+}
+
+// The variables of a kind, count of them, that may be read
+static int readable(int count, int target) {
+  return (target || (count < READ_VARIABLES)) ? count : READ_VARIABLES;
+}
+
+// Puts an integer variable that can be assigned and passed as a VAR
+// argument, any of them if it is the target of an assignment. Returns 0
+// if the block has none.
+static int putScalar(Generator* gen, Block* block, int target) {
+  Shape* shape = gen->shape;
+  int choice;
+
+  if (!hasScalar(gen, block))
+    return 0;
+
+  while (1) {
+    choice = nextRandom(gen, 3);
+    if ((choice == 0) && (shape->globals > 0)) {
+      put(gen, "G%d", nextRandom(gen, readable(shape->globals, target)));
+      return 1;
+    }
+    if ((choice == 1) && (block->level > 0) && (shape->locals > 0)) {
+      // A local of this procedure or of one it is nested in
+      put(gen, "L%dV%d", 1 + nextRandom(gen, block->level), nextRandom(gen, readable(shape->locals, target)));
+      return 1;
+    }
+    if ((choice == 2) && (block->level > 0) && (shape->params > 0)) {
+      put(gen, "X%d", nextRandom(gen, shape->params));
+      return 1;
+    }
+  }
+}
+
+static void putArrayElement(Generator* gen, int target) {
+  put(gen, "A%d(. %d .)", nextRandom(gen, readable(gen->shape->arrays, target)),
+      nextRandom(gen, gen->shape->arraySize));
+}
+
+static void putTerm(Generator* gen, Block* block) {
+  switch (nextRandom(gen, 4)) {
+  case 0:
+    put(gen, "%d", nextRandom(gen, 100));
+    return;
+  case 1:
+    put(gen, "C%d", nextRandom(gen, CONSTANT_COUNT));
+    return;
+  case 2:
+    if (gen->shape->arrays > 0) {
+      putArrayElement(gen, 0);
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+  if (!putScalar(gen, block, 0))
+    put(gen, "%d", nextRandom(gen, 100));
+}
+
+static void putExpression(Generator* gen, Block* block) {
+  static char* operators[] = { " + ", " - ", " * " };
+  int i;
+
+  putTerm(gen, block);
+  for (i = 1; i < gen->shape->expressionLength; i++) {
+    put(gen, "%s", operators[nextRandom(gen, 3)]);
+    putTerm(gen, block);
+  }
+}
+
+static void putCondition(Generator* gen, Block* block) {
+  static char* operators[] = { " = ", " != ", " < ", " <= ", " > ", " >= " };
+
+  putExpression(gen, block);
+  put(gen, "%s", operators[nextRandom(gen, 6)]);
+  putExpression(gen, block);
+}
+
+static void putCall(Generator* gen, Block* block) {
+  int i;
+
+  put(gen, "CALL P%d", block->callable[nextRandom(gen, block->callableCount)]);
+  if (gen->shape->params == 0) return;
+  put(gen, "(");
+  for (i = 0; i < gen->shape->params; i++) {
+    if (i > 0) put(gen, ", ");
+    if (i % 2 == 0)
+      putExpression(gen, block);
+    else putScalar(gen, block, 0);
+  }
+  put(gen, ")");
+}
+
+static void generateStatement(Generator* gen, Block* block, int nesting);
+
+// BEGIN s1; s2 END, its lines one level deeper
+static void generateGroup(Generator* gen, Block* block, int nesting) {
+  put(gen, "BEGIN");
+  endLine(gen);
+  gen->indent ++;
+  startLine(gen);
+  generateStatement(gen, block, nesting);
+  put(gen, ";");
+  endLine(gen);
+  startLine(gen);
+  generateStatement(gen, block, nesting);
+  endLine(gen);
+  gen->indent --;
+  startLine(gen);
+  put(gen, "END");
+}
+
+static void generateStatement(Generator* gen, Block* block, int nesting) {
+  int choice = nextRandom(gen, 10);
+
+  if ((choice == 0) && (nesting < MAX_NESTING)) {
+    put(gen, "IF ");
+    putCondition(gen, block);
+    put(gen, " THEN ");
+    generateGroup(gen, block, nesting + 1);
+    put(gen, " ELSE ");
+    generateGroup(gen, block, nesting + 1);
+    return;
+  }
+  if ((choice == 1) && (nesting < MAX_NESTING)) {
+    // Only FOR statements assign the loop variables
+    put(gen, "FOR K%d := 1 TO %d DO ", nesting, LOOP_COUNT);
+    generateGroup(gen, block, nesting + 1);
+    return;
+  }
+  // VAR arguments need a variable
+  if ((choice == 2) && (block->callableCount > 0) && (hasScalar(gen, block) || (gen->shape->params < 2))) {
+    putCall(gen, block);
+    return;
+  }
+  if ((choice == 3) && (gen->shape->arrays > 0)) {
+    putArrayElement(gen, 1);
+    put(gen, " := ");
+    putExpression(gen, block);
+    return;
+  }
+  if ((choice == 4) || !putScalar(gen, block, 1)) {
+    put(gen, "CALL WRITEI(");
+    putExpression(gen, block);
+    put(gen, ")");
+    return;
+  }
+  put(gen, " := ");
+  putExpression(gen, block);
+}
+
+// Assigns the variables of the block the statements read before they can
+// read them: locals of a procedure, or globals and arrays of the program.
+// There are at most READ_VARIABLES of each, so that the code of a program
+// doesn't grow with its declarations.
+static void generateInitialisation(Generator* gen, Block* block) {
+  Shape* shape = gen->shape;
+  int globals = readable(shape->globals, 0);
+  int count = (block->level > 0) ? readable(shape->locals, 0) : globals + readable(shape->arrays, 0);
+  int i;
+
+  for (i = 0; i < count; i++) {
+    startLine(gen);
+    if (block->level > 0)
+      put(gen, "L%dV%d := 0", block->level, i);
+    else if (i < globals)
+      put(gen, "G%d := 0", i);
+    else put(gen, "FOR K0 := 0 TO %d DO A%d(. K0 .) := 0", shape->arraySize - 1, i - globals);
+    if ((i < count - 1) || (shape->statements > 0)) put(gen, ";");
+    endLine(gen);
+  }
+}
+
+/******************************************************************/
+
+static void generateBlock(Generator* gen, Block* block);
+
+static void generateProcedure(Generator* gen, int number, int level) {
+  Block block;
+  int i;
+
+  startLine(gen);
+  put(gen, "PROCEDURE P%d", number);
+  if (gen->shape->params > 0) {
+    put(gen, "(");
+    for (i = 0; i < gen->shape->params; i++) {
+      if (i > 0) put(gen, "; ");
+      put(gen, "%sX%d : INTEGER", (i % 2 == 1) ? "VAR " : "", i);
+    }
+    put(gen, ")");
+  }
+  put(gen, ";");
+  endLine(gen);
+
+  block.level = level;
+  gen->indent ++;
+  generateBlock(gen, &block);
+  gen->indent --;
+  put(gen, ";");
+  endLine(gen);
+}
+
+// The declarations and body of the program or of a procedure at
+// block->level, ending on the line of the closing END
+static void generateBlock(Generator* gen, Block* block) {
+  Shape* shape = gen->shape;
+  int i;
+
+  startLine(gen);
+  put(gen, "VAR K0 : INTEGER;");
+  endLine(gen);
+  for (i = 1; i < MAX_NESTING; i++) {
+    startLine(gen);
+    put(gen, "    K%d : INTEGER;", i);
+    endLine(gen);
+  }
+  for (i = 0; (block->level > 0) && (i < shape->locals); i++) {
+    startLine(gen);
+    put(gen, "    L%dV%d : INTEGER;", block->level, i);
+    endLine(gen);
+  }
+  for (i = 0; (block->level == 0) && (i < shape->arrays); i++) {
+    put(gen, "    A%d : T;", i);
+    endLine(gen);
+  }
+  for (i = 0; (block->level == 0) && (i < shape->globals); i++) {
+    put(gen, "    G%d : INTEGER;", i);
+    endLine(gen);
+  }
+
+  block->callable = NULL;
+  block->callableCount = 0;
+  if (block->level < shape->depth) {
+    block->callable = (int*) malloc(shape->procedures * sizeof(int));
+    for (i = 0; i < shape->procedures; i++) {
+      endLine(gen);
+      block->callable[i] = gen->procedureCount ++;
+      generateProcedure(gen, block->callable[i], block->level + 1);
+      block->callableCount ++;
+    }
+  }
+
+  startLine(gen);
+  put(gen, "BEGIN");
+  endLine(gen);
+  gen->indent ++;
+  generateInitialisation(gen, block);
+  for (i = 0; i < shape->statements; i++) {
+    startLine(gen);
+    generateStatement(gen, block, 0);
+    if (i < shape->statements - 1) put(gen, ";");
+    endLine(gen);
+  }
+  gen->indent --;
+  startLine(gen);
+  put(gen, "END");
+  free(block->callable);
+}
+
+int generateProgram(FILE* f, Shape* shape) {
+  Generator gen;
+  Block program;
+  int i;
+
+  gen.f = f;
+  gen.shape = shape;
+  gen.random = (shape->seed == 0) ? 1 : shape->seed;
+  gen.indent = 0;
+  gen.lineCount = 0;
+  gen.procedureCount = 0;
+
+  put(&gen, "PROGRAM GENERATED;");
+  endLine(&gen);
+  put(&gen, "CONST C0 = 1;");
+  endLine(&gen);
+  for (i = 1; i < CONSTANT_COUNT; i++) {
+    put(&gen, "      C%d = %d;", i, i + 1);
+    endLine(&gen);
+  }
+  if (shape->arrays > 0) {
+    put(&gen, "TYPE T = ARRAY(. %d .) OF INTEGER;", shape->arraySize);
+    endLine(&gen);
+  }
+  endLine(&gen);
+
+  program.level = 0;
+  generateBlock(&gen, &program);
+  put(&gen, ".");
+  endLine(&gen);
+  return gen.lineCount;
+}
@@ -0,0 +1,43 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __GENERATOR_H__
+#define __GENERATOR_H__
+
+#include <stdio.h>
+
+/*
+ * The size and shape of a generated program. Every procedure, at every
+ * level, has the same number of parameters, locals, nested procedures
+ * and statements.
+ */
+struct Shape_ {
+  int globals;          // integer variables of the program
+  int arrays;           // array variables of the program
+  int arraySize;
+  int procedures;       // procedures declared in each block
+  int depth;            // levels of procedures nested in procedures
+  int params;           // parameters of each procedure, every other one VAR
+  int locals;           // integer variables of each procedure
+  int statements;       // statements of each block
+  int expressionLength; // terms of each expression
+  unsigned seed;
+};
+
+typedef struct Shape_ Shape;
+
+void initShape(Shape* shape);
+
+/*
+ * Writes a valid KPL program of the given shape to f and returns the
+ * number of lines written. The program terminates when run: there is no
+ * recursion, every loop is a FOR with constant bounds and every array
+ * index is within bounds. Its output depends only on the shape: the
+ * variables the statements read are assigned at the start of their body.
+ */
+int generateProgram(FILE* f, Shape* shape);
+
+#endif
@@ -0,0 +1,631 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+/*
+ * Strength reduction of induction variables, on the SSA form. A basic
+ * induction variable is a phi of the header of a loop that the loop
+ * steps by a constant or an invariant. A value of the form
+ * scale * i + invariants, as the address of A(.I.) is, then becomes a
+ * phi of its own, stepped by scale * step on every iteration, instead of
+ * being computed again with a MUL. Arithmetic wraps as the VM's does,
+ * so the values are the same. When the loop then only compares i with a
+ * constant bound, the compare is made on the new value and i goes.
+ *
+ * The VM pays for instructions, not for multiplications: a value kept
+ * in the frame costs an LV where it is used and LA, LV, LC, AD, ST to
+ * step, so a value is only reduced when that removes more.
+ */
+
+#define MAX_TERMS 2
+#define STEP_COST 5
+// The values compared in place of i stay this small, and do not wrap
+#define MAX_COMPARED_VALUE (1 << 20)
+
+// A basic induction variable: phi := PHI(init, update), update := phi + step
+struct BasicIv_ {
+  IrInst* phi;
+  IrInst* update;
+  IrOperand init;
+  IrOperand step;
+};
+
+typedef struct BasicIv_ BasicIv;
+
+// A value of the loop: scale * ivs[iv] + terms + constant, the terms invariant temps
+struct Affine_ {
+  char valid;
+  int iv;
+  int scale;
+  int termCount;
+  int terms[MAX_TERMS];
+  int constant;
+};
+
+typedef struct Affine_ Affine;
+
+struct Reducer_ {
+  Compiler* compiler;
+  IrFunction* function;
+  IrLoop* loop;
+  IrInst** defs;
+  int* useCounts;
+  Affine* forms;
+  char* dies;
+  int tempCount;            // what the arrays are sized for
+  BasicIv* ivs;
+  int ivCount;
+  IrInst** roots;
+  int rootCount;
+};
+
+typedef struct Reducer_ Reducer;
+
+static int wrapAdd(int x, int y) {
+  return (int) ((unsigned) x + (unsigned) y);
+}
+
+static int wrapMul(int x, int y) {
+  return (int) ((unsigned) x * (unsigned) y);
+}
+
+static int inLoop(Reducer* r, IrInst* inst) {
+  return (inst != NULL) && r->loop->body[inst->block->id];
+}
+
+static IrInst* definitionOf(Reducer* r, IrOperand* operand) {
+  return (operand->kind == OPD_TEMP) ? r->defs[operand->value] : NULL;
+}
+
+static void analyseUses(Reducer* r) {
+  IrFunction* function = r->function;
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  int i;
+
+  free(r->defs);
+  free(r->useCounts);
+  free(r->forms);
+  free(r->dies);
+  r->tempCount = function->tempCount;
+  r->defs = findDefinitions(function);
+  r->useCounts = (int*) calloc(r->tempCount + 1, sizeof(int));
+  r->forms = (Affine*) calloc(r->tempCount + 1, sizeof(Affine));
+  r->dies = (char*) calloc(r->tempCount + 1, sizeof(char));
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if (operand->kind == OPD_TEMP)
+	  r->useCounts[operand->value] ++;
+      }
+}
+
+/******************************************************************/
+
+static void findBasicIvs(Reducer* r, IrBlock* latch) {
+  IrBlock* header = r->loop->header;
+  IrInst* inst;
+  IrInst* update;
+  BasicIv* iv;
+  int i;
+
+  r->ivCount = 0;
+  for (inst = header->first; (inst != NULL) && (inst->op == IR_PHI); inst = inst->next) {
+    iv = r->ivs + r->ivCount;
+    update = NULL;
+    for (i = 0; i < inst->argCount; i++)
+      if (inst->argBlocks[i] == latch)
+	update = definitionOf(r, inst->args + i);
+      else iv->init = inst->args[i];
+    if (!inLoop(r, update) || (update->a.kind != OPD_TEMP) || (update->a.value != inst->dest))
+      continue;
+    if ((update->op == IR_ADD) && (update->b.kind == OPD_TEMP) && !inLoop(r, definitionOf(r, &update->b)))
+      iv->step = update->b;
+    else if (((update->op == IR_ADD) || (update->op == IR_SUB)) && (update->b.kind == OPD_CONST) &&
+	     (update->b.value != 0))
+      iv->step = constOperand((update->op == IR_ADD) ? update->b.value : wrapMul(update->b.value, -1));
+    else continue;
+    iv->phi = inst;
+    iv->update = update;
+    r->ivCount ++;
+  }
+}
+
+static int operandForm(Reducer* r, IrOperand* operand, Affine* form) {
+  IrInst* def;
+
+  memset(form, 0, sizeof(Affine));
+  form->valid = 1;
+  if (operand->kind == OPD_CONST) {
+    form->constant = operand->value;
+    return 1;
+  }
+  def = r->defs[operand->value];
+  if (inLoop(r, def)) {
+    *form = r->forms[operand->value];
+    return form->valid;
+  }
+  form->termCount = 1;
+  form->terms[0] = operand->value;
+  return 1;
+}
+
+// x := x + sign * y, a term subtracted only if x has it
+static int addForm(Affine* x, Affine* y, int sign) {
+  int i, j;
+
+  if ((x->scale != 0) && (y->scale != 0) && (x->iv != y->iv))
+    return 0;
+  if ((sign > 0) && (x->termCount + y->termCount > MAX_TERMS))
+    return 0;
+  for (i = 0; (sign < 0) && (i < y->termCount); i++) {
+    for (j = 0; (j < x->termCount) && (x->terms[j] != y->terms[i]); j++);
+    if (j == x->termCount)
+      return 0;
+    x->terms[j] = x->terms[-- x->termCount];
+  }
+  if (x->scale == 0)
+    x->iv = y->iv;
+  x->scale = wrapAdd(x->scale, wrapMul(sign, y->scale));
+  x->constant = wrapAdd(x->constant, wrapMul(sign, y->constant));
+  for (i = 0; (sign > 0) && (i < y->termCount); i++)
+    x->terms[x->termCount ++] = y->terms[i];
+  return 1;
+}
+
+static int scaleForm(Affine* x, int factor) {
+  if ((x->termCount > 0) && (factor != 1))
+    return 0;
+  x->scale = wrapMul(x->scale, factor);
+  x->constant = wrapMul(x->constant, factor);
+  return 1;
+}
+
+static void computeForm(Reducer* r, IrInst* inst) {
+  Affine* form = r->forms + inst->dest;
+  Affine a, b;
+  int i;
+
+  memset(form, 0, sizeof(Affine));
+  for (i = 0; i < r->ivCount; i++)
+    if (r->ivs[i].phi == inst) {
+      form->valid = 1;
+      form->iv = i;
+      form->scale = 1;
+      return;
+    }
+
+  switch (inst->op) {
+  case IR_ADDR:
+    form->valid = 1;
+    form->termCount = 1;
+    form->terms[0] = inst->dest;
+    return;
+  case IR_ADD:
+  case IR_SUB:
+    if (!operandForm(r, &inst->a, &a) || !operandForm(r, &inst->b, &b) ||
+	!addForm(&a, &b, (inst->op == IR_ADD) ? 1 : -1))
+      return;
+    break;
+  case IR_MUL:
+    if (!operandForm(r, &inst->a, &a) || !operandForm(r, &inst->b, &b))
+      return;
+    if ((b.scale == 0) && (b.termCount == 0)) {
+      if (!scaleForm(&a, b.constant))
+	return;
+    } else if ((a.scale == 0) && (a.termCount == 0)) {
+      if (!scaleForm(&b, a.constant))
+	return;
+      a = b;
+    } else return;
+    break;
+  case IR_NEG:
+    if (!operandForm(r, &inst->a, &a) || !scaleForm(&a, -1))
+      return;
+    break;
+  default:
+    return;
+  }
+  if (a.scale == 0)
+    a.iv = 0;
+  *form = a;
+}
+
+static int isUpdate(Reducer* r, IrInst* inst) {
+  int i;
+
+  for (i = 0; i < r->ivCount; i++)
+    if ((r->ivs[i].phi == inst) || (r->ivs[i].update == inst))
+      return 1;
+  return 0;
+}
+
+static int hasAffineForm(Reducer* r, IrInst* inst) {
+  return inLoop(r, inst) && (inst->dest != NO_TEMP) && (inst->op != IR_PHI) && r->forms[inst->dest].valid;
+}
+
+/*
+ * The roots are the values that depend on an induction variable and are
+ * used by more than arithmetic of the loop: an address, a compare.
+ */
+static void findRoots(Reducer* r) {
+  IrFunction* function = r->function;
+  char* consumed = (char*) calloc(r->tempCount + 1, sizeof(char));
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if (hasAffineForm(r, inst)) continue;
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if (operand->kind == OPD_TEMP)
+	  consumed[operand->value] = 1;
+      }
+    }
+
+  r->rootCount = 0;
+  for (i = r->loop->header->rpo; i < function->orderCount; i++) {
+    block = function->order[i];
+    if (!r->loop->body[block->id]) continue;
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (hasAffineForm(r, inst) && consumed[inst->dest] && (r->forms[inst->dest].scale != 0) &&
+	  !isUpdate(r, inst))
+	r->roots[r->rootCount ++] = inst;
+  }
+  free(consumed);
+}
+
+/******************************************************************/
+
+static int isPowerOfTwo(int value) {
+  return (value > 0) && ((value & (value - 1)) == 0);
+}
+
+/*
+ * The instructions of the VM that computing inst takes, counting what it
+ * uses that nothing else does, which goes with it. These die if mark.
+ */
+static int removedCost(Reducer* r, IrInst* inst, int mark) {
+  IrOperand* operand;
+  IrInst* def;
+  int cost = 1;
+  int i;
+
+  if (mark)
+    r->dies[inst->dest] = 1;
+  for (i = 0; i < irOperandCount(inst); i++) {
+    operand = irOperand(inst, i);
+    if (operand->kind == OPD_CONST) {
+      // The code generator shifts in place of a MUL by a power of two
+      if ((inst->op != IR_MUL) || !isPowerOfTwo(operand->value))
+	cost ++;
+      continue;
+    }
+    def = r->defs[operand->value];
+    if (hasAffineForm(r, def) && (r->useCounts[operand->value] == 1) && !isUpdate(r, def))
+      cost += removedCost(r, def, mark);
+    else cost ++;
+  }
+  return cost;
+}
+
+static IrOperand emitBefore(Reducer* r, IrInst* position, int op, IrOperand a, IrOperand b) {
+  IrInst* inst;
+
+  if ((a.kind == OPD_CONST) && (b.kind == OPD_CONST))
+    return constOperand((op == IR_ADD) ? wrapAdd(a.value, b.value) : wrapMul(a.value, b.value));
+  if ((b.kind == OPD_CONST) && (b.value == ((op == IR_ADD) ? 0 : 1)))
+    return a;
+  if ((a.kind == OPD_CONST) && (a.value == ((op == IR_ADD) ? 0 : 1)))
+    return b;
+  inst = createIrInst(r->compiler, op);
+  inst->lineNo = position->lineNo;
+  inst->dest = newTemp(r->function);
+  inst->a = a;
+  inst->b = b;
+  insertIrInstBefore(position, inst);
+  return tempOperand(inst->dest);
+}
+
+// An address taken in the loop is taken again before it, once
+static IrOperand termOperand(Reducer* r, int term) {
+  IrInst* position = r->loop->preheader->last;
+  IrInst* def = r->defs[term];
+  IrInst* inst;
+
+  if (!inLoop(r, def))
+    return tempOperand(term);
+  for (inst = r->loop->preheader->first; inst != position; inst = inst->next)
+    if ((inst->op == IR_ADDR) && (inst->level == def->level) && (inst->offset == def->offset))
+      return tempOperand(inst->dest);
+  inst = createIrInst(r->compiler, IR_ADDR);
+  inst->lineNo = position->lineNo;
+  inst->dest = newTemp(r->function);
+  inst->level = def->level;
+  inst->offset = def->offset;
+  insertIrInstBefore(position, inst);
+  return tempOperand(inst->dest);
+}
+
+// scale * value + the terms and the constant of form, at the end of the preheader
+static IrOperand emitForm(Reducer* r, Affine* form, IrOperand value) {
+  IrInst* position = r->loop->preheader->last;
+  int constant = form->constant;
+  int i;
+
+  value = emitBefore(r, position, IR_MUL, value, constOperand(form->scale));
+  if (value.kind == OPD_CONST) {
+    constant = wrapAdd(constant, value.value);
+    value = constOperand(0);
+  }
+  for (i = 0; i < form->termCount; i++)
+    value = emitBefore(r, position, IR_ADD, value, termOperand(r, form->terms[i]));
+  return emitBefore(r, position, IR_ADD, value, constOperand(constant));
+}
+
+// The root becomes a phi of the header, stepped where its induction variable is
+static int reduceRoot(Reducer* r, IrInst* root) {
+  Affine form = r->forms[root->dest];
+  BasicIv* iv = r->ivs + form.iv;
+  IrBlock* header = r->loop->header;
+  IrOperand first, step;
+  IrInst* phi;
+  IrInst* next;
+  int i;
+
+  first = emitForm(r, &form, iv->init);
+  step = emitBefore(r, r->loop->preheader->last, IR_MUL, iv->step, constOperand(form.scale));
+
+  phi = createIrInst(r->compiler, IR_PHI);
+  phi->lineNo = header->first->lineNo;
+  phi->dest = newTemp(r->function);
+  phi->argCount = header->predCount;
+  phi->args = (IrOperand*) arenaAlloc(&r->compiler->ast->arena, phi->argCount * sizeof(IrOperand));
+  phi->argBlocks = (IrBlock**) arenaAlloc(&r->compiler->ast->arena, phi->argCount * sizeof(IrBlock*));
+  insertIrInstBefore(header->first, phi);
+
+  next = createIrInst(r->compiler, IR_ADD);
+  next->lineNo = iv->update->lineNo;
+  next->dest = newTemp(r->function);
+  next->a = tempOperand(phi->dest);
+  next->b = step;
+  insertIrInstBefore(iv->update->next, next);
+
+  for (i = 0; i < phi->argCount; i++) {
+    phi->argBlocks[i] = header->preds[i];
+    phi->args[i] = (header->preds[i] == r->loop->preheader) ? first : tempOperand(next->dest);
+  }
+
+  root->op = IR_COPY;
+  root->a = tempOperand(phi->dest);
+  root->b.kind = OPD_NONE;
+  return phi->dest;
+}
+
+/******************************************************************/
+
+static int mirroredCompare(int op) {
+  switch (op) {
+  case IR_LT:
+    return IR_GT;
+  case IR_LE:
+    return IR_GE;
+  case IR_GT:
+    return IR_LT;
+  case IR_GE:
+    return IR_LE;
+  default:
+    return op;
+  }
+}
+
+static int isSmall(long long value) {
+  return (value > - MAX_COMPARED_VALUE) && (value < MAX_COMPARED_VALUE);
+}
+
+/*
+ * The compare of the header that leaves the loop, on iv and a constant,
+ * if it is all iv is used for besides the roots. The compare is then
+ * made on what the root takes in place of iv.
+ */
+static IrInst* findExitCompare(Reducer* r, BasicIv* iv) {
+  IrBlock* header = r->loop->header;
+  IrInst* branch = header->last;
+  IrInst* compare = NULL;
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  int phi = iv->phi->dest;
+  int update = iv->update->dest;
+  int i, op;
+
+  if ((iv->init.kind != OPD_CONST) || (iv->step.kind != OPD_CONST) || (branch->op != IR_BRANCH) ||
+      !r->loop->body[branch->block->succ[0]->id] || r->loop->body[branch->block->succ[1]->id])
+    return NULL;
+
+  for (block = r->function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if ((inst == iv->update) || (inst == iv->phi) || ((inst->dest != NO_TEMP) && r->dies[inst->dest]))
+	continue;
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if ((operand->kind != OPD_TEMP) || ((operand->value != phi) && (operand->value != update)))
+	  continue;
+	if ((operand->value == update) || (compare != NULL) || (inst->block != header))
+	  return NULL;
+	compare = inst;
+      }
+    }
+
+  if ((compare == NULL) || (branch->a.kind != OPD_TEMP) || (branch->a.value != compare->dest))
+    return NULL;
+  op = compare->op;
+  if ((compare->b.kind == OPD_TEMP) && (compare->b.value == phi)) {
+    if (compare->a.kind != OPD_CONST)
+      return NULL;
+    op = mirroredCompare(op);
+  } else if (compare->b.kind != OPD_CONST)
+    return NULL;
+  // Stepping towards the bound, iv stays between init and bound + step
+  if ((iv->step.value > 0) && ((op == IR_LT) || (op == IR_LE)))
+    return compare;
+  if ((iv->step.value < 0) && ((op == IR_GT) || (op == IR_GE)))
+    return compare;
+  return NULL;
+}
+
+// Whether the compare can be made on the value of root
+static int canReplaceCompare(Reducer* r, BasicIv* iv, IrInst* compare, IrInst* root) {
+  Affine* form = r->forms + root->dest;
+  long long bound = (compare->a.kind == OPD_CONST) ? compare->a.value : compare->b.value;
+  long long init = iv->init.value;
+  long long step = iv->step.value;
+  IrInst* def;
+
+  if (form->termCount > 1)
+    return 0;
+  if (form->termCount == 1) {
+    // An address is small enough
+    def = r->defs[form->terms[0]];
+    if ((def == NULL) || (def->op != IR_ADDR))
+      return 0;
+  }
+  return isSmall(init) && isSmall(bound) && isSmall(step) && isSmall(form->scale) &&
+    isSmall(form->constant) && isSmall(form->scale * init + form->constant) &&
+    isSmall(form->scale * bound + form->constant) && isSmall(form->scale * (bound + step) + form->constant);
+}
+
+static void replaceCompare(Reducer* r, IrInst* compare, int phi, int reduced, Affine* form) {
+  IrOperand* bound;
+  IrOperand limit;
+
+  if ((compare->b.kind == OPD_TEMP) && (compare->b.value == phi)) {
+    compare->b = compare->a;
+    compare->op = mirroredCompare(compare->op);
+  }
+  bound = &compare->b;
+  limit = emitForm(r, form, *bound);
+  compare->a = tempOperand(reduced);
+  compare->b = limit;
+  if (form->scale < 0)
+    compare->op = mirroredCompare(compare->op);
+}
+
+/*
+ * Reduces all the roots of iv when its compare goes with them, or those
+ * that gain on their own.
+ */
+static int reduceIv(Reducer* r, int index) {
+  BasicIv* iv = r->ivs + index;
+  int* gains = (int*) malloc((r->rootCount + 1) * sizeof(int));
+  IrInst* compare;
+  IrInst* target = NULL;
+  Affine form;
+  int gain = 0, all = STEP_COST;
+  int changed = 0;
+  int i, reduced;
+
+  memset(r->dies, 0, r->tempCount + 1);
+  for (i = 0; i < r->rootCount; i++) {
+    if (r->forms[r->roots[i]->dest].iv != index) continue;
+    gains[i] = removedCost(r, r->roots[i], 1) - 1 - STEP_COST;
+    all += gains[i];
+    if (gains[i] > 0)
+      gain += gains[i];
+  }
+
+  compare = findExitCompare(r, iv);
+  if ((compare != NULL) && (all > gain))
+    for (i = 0; i < r->rootCount; i++)
+      if ((r->forms[r->roots[i]->dest].iv == index) && canReplaceCompare(r, iv, compare, r->roots[i])) {
+	target = r->roots[i];
+	break;
+      }
+
+  if ((target != NULL) || (gain > 0))
+    for (i = 0; i < r->rootCount; i++) {
+      if ((r->forms[r->roots[i]->dest].iv != index) || ((target == NULL) && (gains[i] <= 0)))
+	continue;
+      form = r->forms[r->roots[i]->dest];
+      reduced = reduceRoot(r, r->roots[i]);
+      if (r->roots[i] == target)
+	replaceCompare(r, compare, iv->phi->dest, reduced, &form);
+      changed = 1;
+    }
+  free(gains);
+  return changed;
+}
+
+static int reduceLoop(Reducer* r) {
+  IrFunction* function = r->function;
+  IrBlock* header = r->loop->header;
+  IrBlock* latch;
+  IrBlock* block;
+  IrInst* inst;
+  int changed = 0;
+  int count = 0;
+  int i;
+
+  if ((r->loop->preheader == NULL) || (header->predCount != 2))
+    return 0;
+  latch = (header->preds[0] == r->loop->preheader) ? header->preds[1] : header->preds[0];
+
+  for (inst = header->first; (inst != NULL) && (inst->op == IR_PHI); inst = inst->next)
+    count ++;
+  if (count == 0)
+    return 0;
+  r->ivs = (BasicIv*) malloc(count * sizeof(BasicIv));
+  findBasicIvs(r, latch);
+
+  if (r->ivCount > 0) {
+    count = 0;
+    for (i = header->rpo; i < function->orderCount; i++) {
+      block = function->order[i];
+      if (!r->loop->body[block->id]) continue;
+      for (inst = block->first; inst != NULL; inst = inst->next)
+	if (inst->dest != NO_TEMP) {
+	  computeForm(r, inst);
+	  count ++;
+	}
+    }
+    r->roots = (IrInst**) malloc((count + 1) * sizeof(IrInst*));
+    findRoots(r);
+    // What is reduced changes the uses, they are found again for the next
+    for (i = 0; (i < r->ivCount) && !changed; i++)
+      changed = reduceIv(r, i);
+    free(r->roots);
+  }
+  free(r->ivs);
+  return changed;
+}
+
+// Needs the dominators of analyseControlFlow() and SSA form
+void reduceStrength(Compiler* compiler, IrFunction* function) {
+  Reducer r;
+  IrLoop* loop;
+
+  memset(&r, 0, sizeof(Reducer));
+  r.compiler = compiler;
+  r.function = function;
+  analyseUses(&r);
+  for (loop = findLoops(compiler, function); loop != NULL; loop = loop->next) {
+    r.loop = loop;
+    while (reduceLoop(&r))
+      analyseUses(&r);
+  }
+  free(r.defs);
+  free(r.useCounts);
+  free(r.forms);
+  free(r.dies);
+}
@@ -0,0 +1,290 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include "ir.h"
+#include "codegen.h"
+
+/*
+ * Inlining, before the other optimisations: a call to a small function
+ * or procedure, or to one called only there, becomes a copy of its body.
+ * The frame of the callee becomes words added to the frame of the
+ * caller, the arguments are stored into its parameters as CALL would
+ * push them, and its return value is loaded from its word afterwards. A
+ * VAR parameter holds the address of the argument, as it does in a
+ * frame. Only callees that call nothing and declare nothing are copied,
+ * so recursion is left alone; a callee becomes one once the calls in it
+ * are inlined. A function that is never called any more is dropped.
+ */
+
+// A caller stops growing at this many instructions
+#define MAX_INLINED_SIZE 2000
+// and the program at this percentage of its size more
+#define MAX_GROWTH_PERCENT 50
+
+struct Inliner_ {
+  Compiler* compiler;
+  IrFunction** functions;   // every function of the program, the program first
+  IrFunction** parents;
+  int* sizes;
+  int* callCounts;
+  int functionCount;
+  int limit;
+  int growth;               // the instructions the program may still grow by
+};
+
+typedef struct Inliner_ Inliner;
+
+static int countFunctions(IrFunction* function) {
+  IrFunction* child;
+  int count = 1;
+
+  for (child = function->children; child != NULL; child = child->next)
+    count += countFunctions(child);
+  return count;
+}
+
+static void listFunctions(Inliner* in, IrFunction* function, IrFunction* parent) {
+  IrFunction* child;
+
+  in->functions[in->functionCount] = function;
+  in->parents[in->functionCount] = parent;
+  in->functionCount ++;
+  for (child = function->children; child != NULL; child = child->next)
+    listFunctions(in, child, function);
+}
+
+static int indexOf(Inliner* in, Object* owner) {
+  int i;
+
+  for (i = 0; i < in->functionCount; i++)
+    if ((in->functions[i] != NULL) && (in->functions[i]->owner == owner))
+      return i;
+  return -1;
+}
+
+static int sizeOf(IrFunction* function) {
+  IrBlock* block;
+  IrInst* inst;
+  int size = 0;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      size ++;
+  return size;
+}
+
+static int callsAnything(IrFunction* function) {
+  IrBlock* block;
+  IrInst* inst;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (inst->op == IR_CALL)
+	return 1;
+  return 0;
+}
+
+static IrOperand remapOperand(IrOperand operand, int tempBase) {
+  if (operand.kind == OPD_TEMP)
+    operand.value += tempBase;
+  return operand;
+}
+
+/*
+ * Copies the blocks of callee after block, returns the copy of its entry.
+ * A word of the callee's frame is at frameBase in the caller's, and the
+ * frame level links away from the callee's is callLevel + level - 1 away.
+ */
+static IrBlock* copyBody(Inliner* in, IrFunction* caller, IrFunction* callee, IrBlock* block,
+			 IrBlock* after, int callLevel, int frameBase) {
+  IrBlock** copies = (IrBlock**) calloc(callee->blockCount, sizeof(IrBlock*));
+  int tempBase = caller->tempCount;
+  IrBlock* from;
+  IrBlock* to;
+  IrBlock* last = block;
+  IrInst* inst;
+  IrInst* copy;
+  int i;
+
+  caller->tempCount += callee->tempCount;
+  for (from = callee->blocks; from != NULL; from = from->next) {
+    to = createIrBlock(in->compiler, caller);
+    copies[from->id] = to;
+    to->next = last->next;
+    last->next = to;
+    last = to;
+  }
+
+  for (from = callee->blocks; from != NULL; from = from->next) {
+    to = copies[from->id];
+    for (inst = from->first; inst != NULL; inst = inst->next) {
+      copy = createIrInst(in->compiler, inst->op);
+      copy->lineNo = inst->lineNo;
+      copy->dest = (inst->dest == NO_TEMP) ? NO_TEMP : inst->dest + tempBase;
+      copy->a = remapOperand(inst->a, tempBase);
+      copy->b = remapOperand(inst->b, tempBase);
+      if ((inst->op == IR_ADDR) || (inst->op == IR_LOAD) || (inst->op == IR_STORE)) {
+	if (inst->level == 0)
+	  copy->offset = frameBase + inst->offset;
+	else {
+	  copy->level = callLevel + inst->level - 1;
+	  copy->offset = inst->offset;
+	}
+      }
+      if (copy->op == IR_RETURN)
+	copy->op = IR_JUMP;
+      appendIrInst(to, copy);
+    }
+    for (i = 0; i < 2; i++)
+      if (from->succ[i] != NULL)
+	to->succ[i] = copies[from->succ[i]->id];
+    if ((from->last != NULL) && (from->last->op == IR_RETURN))
+      to->succ[0] = after;
+  }
+
+  to = copies[callee->blocks->id];
+  free(copies);
+  return to;
+}
+
+static void inlineCall(Inliner* in, IrFunction* caller, IrInst* call, IrFunction* callee) {
+  Compiler* compiler = in->compiler;
+  IrBlock* block = call->block;
+  IrBlock* after = createIrBlock(compiler, caller);
+  int frameBase = caller->frameSize;
+  ObjectNode* param;
+  IrInst* inst;
+  IrInst* next;
+  int i;
+
+  // The block goes on after the body
+  for (inst = call->next; inst != NULL; inst = next) {
+    next = inst->next;
+    removeIrInst(inst);
+    appendIrInst(after, inst);
+  }
+  after->succ[0] = block->succ[0];
+  after->succ[1] = block->succ[1];
+  after->next = block->next;
+  block->next = after;
+  if (caller->lastBlock == block)
+    caller->lastBlock = after;
+
+  caller->frameSize += callee->frameSize;
+  param = (call->callee->kind == OBJ_FUNCTION) ? call->callee->funcAttrs->paramList :
+    call->callee->procAttrs->paramList;
+  for (i = 0; i < call->argCount; i++, param = param->next) {
+    inst = createIrInst(compiler, IR_STORE);
+    inst->lineNo = call->lineNo;
+    inst->offset = frameBase + PARAMETER_OFFSET(param->object);
+    inst->a = call->args[i];
+    insertIrInstBefore(call, inst);
+  }
+
+  block->succ[0] = copyBody(in, caller, callee, block, after, call->level, frameBase);
+  block->succ[1] = NULL;
+  removeIrInst(call);
+  inst = createIrInst(compiler, IR_JUMP);
+  inst->lineNo = call->lineNo;
+  appendIrInst(block, inst);
+
+  if (call->dest != NO_TEMP) {
+    inst = createIrInst(compiler, IR_LOAD);
+    inst->lineNo = call->lineNo;
+    inst->dest = call->dest;
+    inst->offset = frameBase + RETURN_VALUE_OFFSET;
+    insertIrInstBefore(after->first, inst);
+  }
+}
+
+static int canInline(Inliner* in, int caller, int callee) {
+  IrFunction* function = in->functions[callee];
+
+  if ((caller == callee) || (function->children != NULL) || callsAnything(function) ||
+      (in->sizes[caller] + in->sizes[callee] > MAX_INLINED_SIZE))
+    return 0;
+  // The only call of a function costs nothing, the function goes
+  if (in->callCounts[callee] == 1)
+    return 1;
+  return (in->sizes[callee] <= in->limit) && (in->sizes[callee] <= in->growth);
+}
+
+static void dropFunction(Inliner* in, int index) {
+  IrFunction* function = in->functions[index];
+  IrFunction** link = &in->parents[index]->children;
+
+  while (*link != function)
+    link = &(*link)->next;
+  *link = function->next;
+  in->functions[index] = NULL;
+}
+
+// Inlines the calls of one function, returns whether there was one
+static int inlineCalls(Inliner* in, int caller) {
+  IrFunction* function = in->functions[caller];
+  IrBlock* block;
+  IrInst* inst;
+  int callee;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if (inst->op != IR_CALL) continue;
+      callee = indexOf(in, inst->callee);
+      if ((callee < 0) || !canInline(in, caller, callee)) continue;
+
+      inlineCall(in, function, inst, in->functions[callee]);
+      in->sizes[caller] += in->sizes[callee];
+      in->callCounts[callee] --;
+      if (in->callCounts[callee] == 0)
+	dropFunction(in, callee);
+      else in->growth -= in->sizes[callee];
+      return 1;
+    }
+  return 0;
+}
+
+void inlineFunctions(Compiler* compiler, IrFunction* program, int limit) {
+  int count = countFunctions(program);
+  Inliner in;
+  IrBlock* block;
+  IrInst* inst;
+  int changed = 1;
+  int i, callee;
+
+  if (limit <= 0) return;
+  in.compiler = compiler;
+  in.functions = (IrFunction**) malloc(count * sizeof(IrFunction*));
+  in.parents = (IrFunction**) malloc(count * sizeof(IrFunction*));
+  in.sizes = (int*) malloc(count * sizeof(int));
+  in.callCounts = (int*) calloc(count, sizeof(int));
+  in.functionCount = 0;
+  in.limit = limit;
+  listFunctions(&in, program, NULL);
+
+  in.growth = 0;
+  for (i = 0; i < count; i++) {
+    in.sizes[i] = sizeOf(in.functions[i]);
+    in.growth += in.sizes[i] * MAX_GROWTH_PERCENT / 100;
+    for (block = in.functions[i]->blocks; block != NULL; block = block->next)
+      for (inst = block->first; inst != NULL; inst = inst->next)
+	if ((inst->op == IR_CALL) && ((callee = indexOf(&in, inst->callee)) >= 0))
+	  in.callCounts[callee] ++;
+  }
+
+  while (changed) {
+    changed = 0;
+    for (i = 0; i < count; i++)
+      if (in.functions[i] != NULL)
+	while (inlineCalls(&in, i))
+	  changed = 1;
+  }
+
+  free(in.functions);
+  free(in.parents);
+  free(in.sizes);
+  free(in.callCounts);
+}
@@ -6,32 +6,97 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "instructions.h"
+#include "stats.h"
 
 #define MAX_BLOCK 50
 
 CodeBlock* createCodeBlock(int maxSize) {
-  CodeBlock* codeBlock = (CodeBlock*) malloc(sizeof(CodeBlock));
+  CodeBlock* codeBlock = (CodeBlock*) countedMalloc(sizeof(CodeBlock));
 
-  codeBlock->code = (Instruction*) malloc(maxSize * sizeof(Instruction));
+  codeBlock->code = (Instruction*) countedMalloc(maxSize * sizeof(Instruction));
   codeBlock->codeSize = 0;
   codeBlock->maxSize = maxSize;
+  codeBlock->lines = NULL;
+  codeBlock->lineCount = 0;
+  codeBlock->maxLines = 0;
+  codeBlock->currentLine = 0;
   return codeBlock;
 }
 
 void freeCodeBlock(CodeBlock* codeBlock) {
-  free(codeBlock->code);
-  free(codeBlock);
+  countedFree(codeBlock->lines, codeBlock->maxLines * sizeof(LineEntry));
+  countedFree(codeBlock->code, codeBlock->maxSize * sizeof(Instruction));
+  countedFree(codeBlock, sizeof(CodeBlock));
+}
+
+// Empties the block, keeping its buffers for the next program
+void resetCodeBlock(CodeBlock* codeBlock) {
+  codeBlock->codeSize = 0;
+  codeBlock->lineCount = 0;
+  codeBlock->currentLine = 0;
+}
+
+// Takes back the instruction emitted last
+void dropLastCode(CodeBlock* codeBlock) {
+  codeBlock->codeSize --;
+  if ((codeBlock->lineCount > 0) && (codeBlock->lines[codeBlock->lineCount - 1].address == codeBlock->codeSize))
+    codeBlock->lineCount --;
+  if (currentStats != NULL)
+    currentStats->instructionCount --;
+}
+
+static void addLineEntry(CodeBlock* codeBlock, CodeAddress address, int lineNo) {
+  int maxLines = (codeBlock->maxLines == 0) ? 64 : codeBlock->maxLines * 2;
+
+  if (codeBlock->lineCount >= codeBlock->maxLines) {
+    codeBlock->lines = (LineEntry*) countedRealloc(codeBlock->lines, codeBlock->maxLines * sizeof(LineEntry),
+						   maxLines * sizeof(LineEntry));
+    codeBlock->maxLines = maxLines;
+  }
+  codeBlock->lines[codeBlock->lineCount].address = address;
+  codeBlock->lines[codeBlock->lineCount].lineNo = lineNo;
+  codeBlock->lineCount ++;
+}
+
+void setCurrentLine(CodeBlock* codeBlock, int lineNo) {
+  codeBlock->currentLine = lineNo;
+}
+
+// Returns the source line of the instruction at address, or 0 if unknown
+int lineOfCode(CodeBlock* codeBlock, CodeAddress address) {
+  int low = 0, high = codeBlock->lineCount - 1, mid;
+
+  if ((high < 0) || (address < codeBlock->lines[0].address))
+    return 0;
+  while (low < high) {
+    mid = (low + high + 1) / 2;
+    if (codeBlock->lines[mid].address <= address)
+      low = mid;
+    else high = mid - 1;
+  }
+  return codeBlock->lines[low].lineNo;
 }
 
 int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q) {
   Instruction* bottom = codeBlock->code + codeBlock->codeSize;
+  int stage;
 
   if (codeBlock->codeSize >= codeBlock->maxSize) return 0;
+  stage = enterStage(STAGE_CODEGEN);
 
   bottom->op = op;
   bottom->p = p;
   bottom->q = q;
+
+  if ((codeBlock->currentLine > 0) &&
+      ((codeBlock->lineCount == 0) ||
+       (codeBlock->lines[codeBlock->lineCount - 1].lineNo != codeBlock->currentLine)))
+    addLineEntry(codeBlock, codeBlock->codeSize, codeBlock->currentLine);
+
   codeBlock->codeSize ++;
+  if (currentStats != NULL)
+    currentStats->instructionCount ++;
+  leaveStage(stage);
   return 1;
 }
 
@@ -65,6 +130,8 @@ int emitGT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GT, DC_VALUE, D
 int emitLT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LT, DC_VALUE, DC_VALUE); }
 int emitGE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GE, DC_VALUE, DC_VALUE); }
 int emitLE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LE, DC_VALUE, DC_VALUE); }
+int emitSL(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_SL, DC_VALUE, q); }
+int emitSR(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_SR, DC_VALUE, q); }
 
 int emitBP(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_BP, DC_VALUE, DC_VALUE); }
 
@@ -101,6 +168,8 @@ void printInstruction(Instruction* inst) {
   case OP_LT: printf("LT"); break;
   case OP_GE: printf("GE"); break;
   case OP_LE: printf("LE"); break;
+  case OP_SL: printf("SL %d", inst->q); break;
+  case OP_SR: printf("SR %d", inst->q); break;
 
   case OP_BP: printf("BP"); break;
   default: break;
@@ -121,17 +190,50 @@ void printCodeBlock(CodeBlock* codeBlock) {
 
 void loadCode(CodeBlock* codeBlock, FILE* f) {
   Instruction* code = codeBlock->code;
-  int n;
+  Instruction* trailer;
+  int n, count, i;
 
   codeBlock->codeSize = 0;
-  while (!feof(f)) {
-    n = fread(code, sizeof(Instruction), MAX_BLOCK, f);
+  codeBlock->lineCount = 0;
+  while (!feof(f) && (codeBlock->codeSize < codeBlock->maxSize)) {
+    n = codeBlock->maxSize - codeBlock->codeSize;
+    if (n > MAX_BLOCK) n = MAX_BLOCK;
+    n = fread(code, sizeof(Instruction), n, f);
+    if (n == 0) break;
     code += n;
     codeBlock->codeSize += n;
   }
+
+  // Split off the source line table, if there is one
+  if (codeBlock->codeSize == 0) return;
+  trailer = codeBlock->code + codeBlock->codeSize - 1;
+  count = trailer->p;
+  if (((int) trailer->op != LINE_TABLE_MAGIC) || (count < 0) || (count >= codeBlock->codeSize))
+    return;
+
+  codeBlock->codeSize -= count + 1;
+  for (i = 0; i < count; i ++) {
+    trailer = codeBlock->code + codeBlock->codeSize + i;
+    addLineEntry(codeBlock, (CodeAddress) trailer->op, trailer->p);
+  }
 }
 
 
 void saveCode(CodeBlock* codeBlock, FILE* f) {
+  Instruction record;
+  int i;
+
   fwrite(codeBlock->code, sizeof(Instruction), codeBlock->codeSize, f);
+  if (codeBlock->lineCount == 0) return;
+
+  for (i = 0; i < codeBlock->lineCount; i ++) {
+    record.op = (enum OpCode) codeBlock->lines[i].address;
+    record.p = codeBlock->lines[i].lineNo;
+    record.q = 0;
+    fwrite(&record, sizeof(Instruction), 1, f);
+  }
+  record.op = (enum OpCode) LINE_TABLE_MAGIC;
+  record.p = codeBlock->lineCount;
+  record.q = 0;
+  fwrite(&record, sizeof(Instruction), 1, f);
 }
@@ -0,0 +1,445 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ir.h"
+
+// The IR lives in the arena of the syntax tree
+static void* irAlloc(Compiler* compiler, size_t size) {
+  return arenaAlloc(&compiler->ast->arena, size);
+}
+
+IrFunction* createIrFunction(Compiler* compiler, Object* owner) {
+  IrFunction* function = (IrFunction*) irAlloc(compiler, sizeof(IrFunction));
+
+  function->owner = owner;
+  switch (owner->kind) {
+  case OBJ_FUNCTION:
+    function->scope = owner->funcAttrs->scope;
+    break;
+  case OBJ_PROCEDURE:
+    function->scope = owner->procAttrs->scope;
+    break;
+  default:
+    function->scope = owner->progAttrs->scope;
+    break;
+  }
+  function->frameSize = function->scope->frameSize;
+  return function;
+}
+
+// A block that is not laid out yet: see placeIrBlock()
+IrBlock* createIrBlock(Compiler* compiler, IrFunction* function) {
+  IrBlock* block = (IrBlock*) irAlloc(compiler, sizeof(IrBlock));
+
+  block->id = function->blockCount ++;
+  return block;
+}
+
+void placeIrBlock(IrFunction* function, IrBlock* block) {
+  if (function->lastBlock == NULL)
+    function->blocks = block;
+  else function->lastBlock->next = block;
+  function->lastBlock = block;
+}
+
+IrInst* createIrInst(Compiler* compiler, int op) {
+  IrInst* inst = (IrInst*) irAlloc(compiler, sizeof(IrInst));
+
+  inst->op = op;
+  inst->dest = NO_TEMP;
+  return inst;
+}
+
+void appendIrInst(IrBlock* block, IrInst* inst) {
+  inst->block = block;
+  inst->prev = block->last;
+  inst->next = NULL;
+  if (block->last == NULL)
+    block->first = inst;
+  else block->last->next = inst;
+  block->last = inst;
+}
+
+void insertIrInstBefore(IrInst* position, IrInst* inst) {
+  IrBlock* block = position->block;
+
+  inst->block = block;
+  inst->prev = position->prev;
+  inst->next = position;
+  if (position->prev == NULL)
+    block->first = inst;
+  else position->prev->next = inst;
+  position->prev = inst;
+}
+
+void removeIrInst(IrInst* inst) {
+  IrBlock* block = inst->block;
+
+  if (inst->prev == NULL)
+    block->first = inst->next;
+  else inst->prev->next = inst->next;
+  if (inst->next == NULL)
+    block->last = inst->prev;
+  else inst->next->prev = inst->prev;
+  inst->block = NULL;
+}
+
+int newTemp(IrFunction* function) {
+  return function->tempCount ++;
+}
+
+IrOperand tempOperand(int temp) {
+  IrOperand operand;
+
+  operand.kind = OPD_TEMP;
+  operand.value = temp;
+  return operand;
+}
+
+IrOperand constOperand(int value) {
+  IrOperand operand;
+
+  operand.kind = OPD_CONST;
+  operand.value = value;
+  return operand;
+}
+
+// The operands of a call or a phi are its args, a and b are not used
+int irOperandCount(IrInst* inst) {
+  if ((inst->op == IR_CALL) || (inst->op == IR_PHI))
+    return inst->argCount;
+  if (inst->b.kind != OPD_NONE)
+    return 2;
+  if (inst->a.kind != OPD_NONE)
+    return 1;
+  return 0;
+}
+
+IrOperand* irOperand(IrInst* inst, int i) {
+  if ((inst->op == IR_CALL) || (inst->op == IR_PHI))
+    return inst->args + i;
+  return (i == 0) ? &inst->a : &inst->b;
+}
+
+int isTerminator(IrInst* inst) {
+  return (inst->op == IR_JUMP) || (inst->op == IR_BRANCH) || (inst->op == IR_RETURN);
+}
+
+// Whether removing inst, when its value is not used, changes what the program does
+int hasSideEffects(IrInst* inst) {
+  switch (inst->op) {
+  case IR_COPY:
+  case IR_ADDR:
+  case IR_LOAD:
+  case IR_LOADI:
+  case IR_NEG:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+  case IR_EQ:
+  case IR_NE:
+  case IR_LT:
+  case IR_LE:
+  case IR_GT:
+  case IR_GE:
+  case IR_PHI:
+    return 0;
+  case IR_DIV:
+    // Dividing by zero stops the program
+    return (inst->b.kind != OPD_CONST) || (inst->b.value == 0);
+  default:
+    return 1;
+  }
+}
+
+// The instruction defining every temp, NULL for none
+IrInst** findDefinitions(IrFunction* function) {
+  IrInst** defs = (IrInst**) calloc(function->tempCount + 1, sizeof(IrInst*));
+  IrBlock* block;
+  IrInst* inst;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (inst->dest != NO_TEMP)
+	defs[inst->dest] = inst;
+  return defs;
+}
+
+// The scope of the frame level static links away from the function
+Scope* scopeAtLevel(IrFunction* function, int level) {
+  Scope* scope = function->scope;
+
+  for (; level > 0; level--)
+    scope = scope->outer;
+  return scope;
+}
+
+int sameOperand(IrOperand* x, IrOperand* y) {
+  return (x->kind == y->kind) && (x->value == y->value);
+}
+
+int successorCount(IrBlock* block) {
+  if (block->last == NULL)
+    return 0;
+  switch (block->last->op) {
+  case IR_JUMP:
+    return 1;
+  case IR_BRANCH:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+// A phi keeps the args of the blocks that are still predecessors
+static void prunePhis(IrFunction* function) {
+  IrBlock* block;
+  IrInst* inst;
+  int i, j, k;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; (inst != NULL) && (inst->op == IR_PHI); inst = inst->next) {
+      k = 0;
+      for (i = 0; i < inst->argCount; i++)
+	for (j = 0; j < block->predCount; j++)
+	  if (block->preds[j] == inst->argBlocks[i]) {
+	    inst->args[k] = inst->args[i];
+	    inst->argBlocks[k] = inst->argBlocks[i];
+	    k ++;
+	    break;
+	  }
+      inst->argCount = k;
+    }
+}
+
+void computePredecessors(Compiler* compiler, IrFunction* function) {
+  IrBlock* block;
+  IrBlock* succ;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    block->predCount = 0;
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (i = 0; i < successorCount(block); i++)
+      block->succ[i]->predCount ++;
+
+  for (block = function->blocks; block != NULL; block = block->next) {
+    block->preds = (IrBlock**) irAlloc(compiler, block->predCount * sizeof(IrBlock*));
+    block->mark = 0;
+  }
+  // mark counts the predecessors filled in
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (i = 0; i < successorCount(block); i++) {
+      succ = block->succ[i];
+      succ->preds[succ->mark ++] = block;
+    }
+  for (block = function->blocks; block != NULL; block = block->next)
+    block->mark = 0;
+  prunePhis(function);
+}
+
+static void visitBlock(IrBlock* block, IrBlock** postorder, int* count) {
+  int i;
+
+  block->mark = 1;
+  for (i = 0; i < successorCount(block); i++)
+    if (!block->succ[i]->mark)
+      visitBlock(block->succ[i], postorder, count);
+  postorder[(*count) ++] = block;
+}
+
+static IrBlock* intersect(IrBlock* x, IrBlock* y) {
+  while (x != y) {
+    while (x->rpo > y->rpo)
+      x = x->idom;
+    while (y->rpo > x->rpo)
+      y = y->idom;
+  }
+  return x;
+}
+
+// The iterative algorithm of Cooper, Harvey and Kennedy
+static void computeDominators(IrFunction* function) {
+  IrBlock* block;
+  IrBlock* idom;
+  int changed = 1;
+  int i, j;
+
+  for (i = 0; i < function->orderCount; i++)
+    function->order[i]->idom = NULL;
+  function->blocks->idom = function->blocks;
+
+  while (changed) {
+    changed = 0;
+    for (i = 1; i < function->orderCount; i++) {
+      block = function->order[i];
+      idom = NULL;
+      for (j = 0; j < block->predCount; j++)
+	if (block->preds[j]->idom != NULL)
+	  idom = (idom == NULL) ? block->preds[j] : intersect(block->preds[j], idom);
+      if (block->idom != idom) {
+	block->idom = idom;
+	changed = 1;
+      }
+    }
+  }
+}
+
+void analyseControlFlow(Compiler* compiler, IrFunction* function) {
+  IrBlock** postorder = (IrBlock**) irAlloc(compiler, function->blockCount * sizeof(IrBlock*));
+  IrBlock* block;
+  IrBlock* last = NULL;
+  int count = 0;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    block->mark = 0;
+  visitBlock(function->blocks, postorder, &count);
+
+  // The layout keeps its order, without the blocks never reached
+  for (block = function->blocks; block != NULL; block = block->next)
+    if (block->mark) {
+      if (last != NULL)
+	last->next = block;
+      last = block;
+    }
+  last->next = NULL;
+  function->lastBlock = last;
+
+  function->order = (IrBlock**) irAlloc(compiler, count * sizeof(IrBlock*));
+  function->orderCount = count;
+  for (i = 0; i < count; i++) {
+    function->order[i] = postorder[count - 1 - i];
+    function->order[i]->rpo = i;
+  }
+
+  computePredecessors(compiler, function);
+  computeDominators(function);
+}
+
+/*
+ * Out of SSA form: a jump to a block that only jumps goes where that
+ * block goes, a jump to a block that only returns returns, and a block
+ * jumping to a block with no other predecessor takes its instructions.
+ */
+void simplifyControlFlow(Compiler* compiler, IrFunction* function) {
+  IrBlock* block;
+  IrBlock* target;
+  IrInst* inst;
+  int i, steps;
+
+  for (block = function->blocks; block != NULL; block = block->next) {
+    for (i = 0; i < successorCount(block); i++) {
+      target = block->succ[i];
+      for (steps = 0; (steps < function->blockCount) && (target->first == target->last) &&
+	     (target->first->op == IR_JUMP); steps++)
+	target = target->succ[0];
+      block->succ[i] = target;
+    }
+    target = block->succ[0];
+    if ((block->last->op == IR_JUMP) && (target->first == target->last) && (target->first->op == IR_RETURN)) {
+      block->last->op = IR_RETURN;
+      block->succ[0] = NULL;
+    }
+  }
+
+  analyseControlFlow(compiler, function);
+  for (block = function->blocks; block != NULL; block = block->next)
+    while ((block->last != NULL) && (block->last->op == IR_JUMP) && (block->succ[0] != block) &&
+	   (block->succ[0] != function->blocks) && (block->succ[0]->predCount == 1)) {
+      target = block->succ[0];
+      removeIrInst(block->last);
+      while ((inst = target->first) != NULL) {
+	removeIrInst(inst);
+	appendIrInst(block, inst);
+      }
+      block->succ[0] = target->succ[0];
+      block->succ[1] = target->succ[1];
+      target->succ[0] = target->succ[1] = NULL;
+    }
+  analyseControlFlow(compiler, function);
+}
+
+int dominates(IrBlock* x, IrBlock* y) {
+  while ((y != x) && (y->idom != y))
+    y = y->idom;
+  return y == x;
+}
+
+/******************************************************************/
+
+static char* opNames[] = {
+  "COPY", "ADDR", "LOAD", "STORE", "LOADI", "STOREI",
+  "NEG", "ADD", "SUB", "MUL", "DIV",
+  "EQ", "NE", "LT", "LE", "GT", "GE",
+  "CALL", "READI", "READC", "WRITEI", "WRITEC", "WRITELN", "PHI",
+  "JUMP", "BRANCH", "RETURN"
+};
+
+static void printOperand(IrOperand* operand) {
+  if (operand->kind == OPD_TEMP)
+    printf("t%d", operand->value);
+  else printf("%d", operand->value);
+}
+
+static void printIrInst(IrInst* inst) {
+  int i;
+
+  printf("    ");
+  if (inst->dest != NO_TEMP)
+    printf("t%d := ", inst->dest);
+  printf("%s", opNames[inst->op]);
+
+  switch (inst->op) {
+  case IR_ADDR:
+  case IR_LOAD:
+  case IR_STORE:
+    printf(" %d,%d", inst->level, inst->offset);
+    break;
+  case IR_CALL:
+    printf(" %s/%d", inst->callee->name, inst->level);
+    break;
+  default:
+    break;
+  }
+
+  for (i = 0; i < irOperandCount(inst); i++) {
+    printf((i == 0) ? " " : ", ");
+    printOperand(irOperand(inst, i));
+    if (inst->op == IR_PHI)
+      printf(" (B%d)", inst->argBlocks[i]->id);
+  }
+
+  switch (inst->op) {
+  case IR_JUMP:
+    printf(" B%d", inst->block->succ[0]->id);
+    break;
+  case IR_BRANCH:
+    printf(" B%d, B%d", inst->block->succ[0]->id, inst->block->succ[1]->id);
+    break;
+  default:
+    break;
+  }
+  printf("\n");
+}
+
+void printIr(IrFunction* function) {
+  IrFunction* child;
+  IrBlock* block;
+  IrInst* inst;
+
+  for (child = function->children; child != NULL; child = child->next)
+    printIr(child);
+
+  printf("%s (frame %d, %d temps):\n", function->owner->name, function->frameSize, function->tempCount);
+  for (block = function->blocks; block != NULL; block = block->next) {
+    printf("  B%d:\n", block->id);
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      printIrInst(inst);
+  }
+}
@@ -0,0 +1,201 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include "symtab.h"
+#include "instructions.h"
+#include "compiler.h"
+#include "ast.h"
+
+/*
+ * The intermediate representation between the syntax tree and the code
+ * of the VM: three-address code on virtual registers, the temps of a
+ * function, in basic blocks linked by the edges of the control-flow graph.
+ * Variables stay in the frames of the VM and are read and written by
+ * LOAD and STORE; only the values of expressions are in temps.
+ */
+enum IrOp {
+  IR_COPY,      // dest := a
+  IR_ADDR,      // dest := the address of the word at level, offset
+  IR_LOAD,      // dest := the word at level, offset
+  IR_STORE,     // the word at level, offset := a
+  IR_LOADI,     // dest := the word at address a
+  IR_STOREI,    // the word at address a := b
+  IR_NEG,       // dest := - a
+  IR_ADD,       // dest := a + b, and so on
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_EQ,        // dest := 1 if a = b else 0, and so on
+  IR_NE,
+  IR_LT,
+  IR_LE,
+  IR_GT,
+  IR_GE,
+  IR_CALL,      // [dest :=] callee(args), level the static link to pass
+  IR_READI,     // dest := an integer read
+  IR_READC,     // dest := a character read
+  IR_WRITEI,    // write the integer a
+  IR_WRITEC,    // write the character a
+  IR_WRITELN,
+  IR_PHI,       // dest := the arg of the predecessor control came from
+
+  // The terminators, last in every block
+  IR_JUMP,      // to succ[0]
+  IR_BRANCH,    // to succ[0] if a is not 0, to succ[1] if it is
+  IR_RETURN     // from the function, or halt the program
+};
+
+#define NO_TEMP (-1)
+
+enum IrOperandKind {
+  OPD_NONE,
+  OPD_TEMP,
+  OPD_CONST
+};
+
+struct IrOperand_ {
+  unsigned char kind;
+  int value;                // the temp, or the constant
+};
+
+typedef struct IrOperand_ IrOperand;
+
+struct IrBlock_;
+
+struct IrInst_ {
+  unsigned char op;
+  int lineNo;
+  int dest;                 // the temp defined, or NO_TEMP
+  IrOperand a, b;
+  int level, offset;
+  Object* callee;
+  IrOperand* args;
+  int argCount;
+  struct IrBlock_** argBlocks;    // the predecessor of each arg of a PHI
+  struct IrBlock_* block;
+  struct IrInst_* prev;
+  struct IrInst_* next;
+};
+
+typedef struct IrInst_ IrInst;
+
+struct IrBlock_ {
+  int id;
+  IrInst* first;
+  IrInst* last;             // the terminator, once the block is complete
+  struct IrBlock_* succ[2];
+  struct IrBlock_** preds;  // set by computePredecessors()
+  int predCount;
+  struct IrBlock_* next;    // in the order the code is laid out
+  CodeAddress address;      // set when the code is emitted
+  int rpo;                  // the position in reverse postorder
+  struct IrBlock_* idom;    // the immediate dominator, the entry's is itself
+  int mark;                 // for the passes to use
+};
+
+typedef struct IrBlock_ IrBlock;
+
+/*
+ * The IR of the program, a function or a procedure. Levels in LOAD,
+ * STORE, ADDR and CALL count static links from the frame of the function.
+ */
+struct IrFunction_ {
+  Object* owner;
+  Scope* scope;
+  IrBlock* blocks;          // the entry block first, in layout order
+  IrBlock* lastBlock;
+  int blockCount;
+  int tempCount;
+  int frameSize;            // of the frame of the VM, with the temps kept in it
+  IrBlock** order;          // the blocks in reverse postorder
+  int orderCount;
+  int* homes;               // the word of the frame that keeps a temp, or -1
+  int homeCount;
+  struct IrFunction_* children;   // the functions declared in this one
+  struct IrFunction_* next;
+};
+
+typedef struct IrFunction_ IrFunction;
+
+// A natural loop, the blocks from its header back to the header
+struct IrLoop_ {
+  IrBlock* header;
+  IrBlock* preheader;       // the only block entering the loop, NULL if there are more
+  char* body;               // whether each block, by id, is in the loop
+  struct IrLoop_* next;     // the inner loops come before the loops around them
+};
+
+typedef struct IrLoop_ IrLoop;
+
+// A word of a frame whose address is taken, for a VAR argument or an array
+struct TakenAddress_ {
+  Scope* scope;
+  int offset;
+  struct TakenAddress_* next;
+};
+
+typedef struct TakenAddress_ TakenAddress;
+
+IrFunction* createIrFunction(Compiler* compiler, Object* owner);
+IrBlock* createIrBlock(Compiler* compiler, IrFunction* function);
+void placeIrBlock(IrFunction* function, IrBlock* block);
+IrInst* createIrInst(Compiler* compiler, int op);
+void appendIrInst(IrBlock* block, IrInst* inst);
+void insertIrInstBefore(IrInst* position, IrInst* inst);
+void removeIrInst(IrInst* inst);
+int newTemp(IrFunction* function);
+
+IrOperand tempOperand(int temp);
+IrOperand constOperand(int value);
+int irOperandCount(IrInst* inst);
+IrOperand* irOperand(IrInst* inst, int i);
+int isTerminator(IrInst* inst);
+int successorCount(IrBlock* block);
+
+int hasSideEffects(IrInst* inst);
+IrInst** findDefinitions(IrFunction* function);
+Scope* scopeAtLevel(IrFunction* function, int level);
+int sameOperand(IrOperand* x, IrOperand* y);
+
+void computePredecessors(Compiler* compiler, IrFunction* function);
+// Drops the unreachable blocks, then orders the others and finds their dominators
+void analyseControlFlow(Compiler* compiler, IrFunction* function);
+int dominates(IrBlock* x, IrBlock* y);
+void simplifyControlFlow(Compiler* compiler, IrFunction* function);
+
+// The IR of the program as built from a checked syntax tree (irbuild.c)
+IrFunction* buildIr(Compiler* compiler, Node* program);
+// Its code in the code buffer (iremit.c)
+void emitIr(Compiler* compiler, IrFunction* function);
+
+// SSA form for the scalar words of a frame (ssa.c)
+void buildSsa(Compiler* compiler, IrFunction* function);
+void leaveSsa(Compiler* compiler, IrFunction* function);
+
+// Loops, and what can be moved out of them (loops.c)
+IrLoop* findLoops(Compiler* compiler, IrFunction* function);
+TakenAddress* findTakenAddresses(Compiler* compiler, IrFunction* program);
+int isAddressTaken(TakenAddress* taken, Scope* scope, int offset);
+void hoistInvariants(Compiler* compiler, IrFunction* function, TakenAddress* taken);
+
+// Strength reduction of induction variables (induction.c)
+void reduceStrength(Compiler* compiler, IrFunction* function);
+
+// Self-recursive calls in tail position become jumps (tailcall.c)
+void eliminateTailCalls(Compiler* compiler, IrFunction* function);
+
+// Inlining of small functions and procedures (inline.c)
+void inlineFunctions(Compiler* compiler, IrFunction* program, int limit);
+
+// The optimisations of -O2 on the program and all its functions (opt.c)
+void optimizeIr(Compiler* compiler, IrFunction* program);
+
+void printIr(IrFunction* function);
+
+#endif
@@ -0,0 +1,593 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include "ir.h"
+#include "codegen.h"
+
+/*
+ * Lowering of a checked syntax tree to the IR. Expressions are evaluated
+ * in the order the parser evaluates them, so that the IR of an
+ * expression can be emitted as the same stack code.
+ */
+
+// The nodes the body of an unrolled FOR may have, in all its copies. A node
+// is about two VM instructions, and the JIT of kplrun only compiles loops
+// of at most JIT_MAX_TRACE (256) instructions.
+#define MAX_UNROLLED_SIZE 100
+// and the nodes the program may grow by: a percentage of its own, or at least
+#define MAX_UNROLL_GROWTH_PERCENT 10
+#define MIN_UNROLL_GROWTH 500
+
+struct IrBuilder_ {
+  Compiler* compiler;
+  IrFunction* function;
+  IrBlock* block;           // being filled
+  int lineNo;
+  int unrolling;            // inside the copies of an unrolled FOR
+};
+
+typedef struct IrBuilder_ IrBuilder;
+
+// Where an assignment stores: a word of a frame, or the address in a temp
+struct Place_ {
+  int direct;
+  int level, offset;
+  IrOperand address;
+};
+
+typedef struct Place_ Place;
+
+static IrInst* emit(IrBuilder* b, int op) {
+  IrInst* inst = createIrInst(b->compiler, op);
+
+  inst->lineNo = b->lineNo;
+  appendIrInst(b->block, inst);
+  return inst;
+}
+
+static IrOperand emitValue(IrBuilder* b, int op, IrOperand x, IrOperand y) {
+  IrInst* inst = emit(b, op);
+
+  inst->a = x;
+  inst->b = y;
+  inst->dest = newTemp(b->function);
+  return tempOperand(inst->dest);
+}
+
+static IrOperand noOperand(void) {
+  IrOperand operand;
+
+  operand.kind = OPD_NONE;
+  operand.value = 0;
+  return operand;
+}
+
+static void startBlock(IrBuilder* b, IrBlock* block) {
+  placeIrBlock(b->function, block);
+  b->block = block;
+}
+
+static void endWithJump(IrBuilder* b, IrBlock* target) {
+  emit(b, IR_JUMP);
+  b->block->succ[0] = target;
+}
+
+static void endWithBranch(IrBuilder* b, IrOperand condition, IrBlock* ifTrue, IrBlock* ifFalse) {
+  emit(b, IR_BRANCH)->a = condition;
+  b->block->succ[0] = ifTrue;
+  b->block->succ[1] = ifFalse;
+}
+
+static int levelOf(IrBuilder* b, Scope* scope) {
+  return computeNestedLevel(b->compiler, scope);
+}
+
+/******************************************************************/
+
+static IrOperand buildValue(IrBuilder* b, Node* node);
+
+static IrOperand buildAddress(IrBuilder* b, Node* node) {
+  Object* obj;
+  IrOperand base, index, offset;
+  IrInst* inst;
+
+  b->lineNo = node->lineNo;
+  if (node->kind == AST_INDEX) {
+    base = buildAddress(b, node->kids[0]);
+    index = buildValue(b, node->kids[1]);
+    offset = emitValue(b, IR_MUL, index, constOperand(sizeOfType(node->type)));
+    return emitValue(b, IR_ADD, base, offset);
+  }
+
+  obj = node->object;
+  if ((obj->kind == OBJ_PARAMETER) && (obj->paramAttrs->kind == PARAM_REFERENCE))
+    inst = emit(b, IR_LOAD);
+  else inst = emit(b, IR_ADDR);
+  switch (obj->kind) {
+  case OBJ_VARIABLE:
+    inst->level = levelOf(b, VARIABLE_SCOPE(obj));
+    inst->offset = VARIABLE_OFFSET(obj);
+    break;
+  case OBJ_PARAMETER:
+    inst->level = levelOf(b, PARAMETER_SCOPE(obj));
+    inst->offset = PARAMETER_OFFSET(obj);
+    break;
+  default:
+    inst->level = levelOf(b, FUNCTION_SCOPE(obj));
+    inst->offset = RETURN_VALUE_OFFSET;
+    break;
+  }
+  inst->dest = newTemp(b->function);
+  return tempOperand(inst->dest);
+}
+
+// Variables, value parameters and return values are words of a frame
+static void buildPlace(IrBuilder* b, Node* node, Place* place) {
+  Object* obj = node->object;
+
+  place->direct = 0;
+  if ((node->kind == AST_INDEX) ||
+      ((obj->kind == OBJ_PARAMETER) && (obj->paramAttrs->kind == PARAM_REFERENCE))) {
+    place->address = buildAddress(b, node);
+    return;
+  }
+
+  place->direct = 1;
+  switch (obj->kind) {
+  case OBJ_VARIABLE:
+    place->level = levelOf(b, VARIABLE_SCOPE(obj));
+    place->offset = VARIABLE_OFFSET(obj);
+    break;
+  case OBJ_PARAMETER:
+    place->level = levelOf(b, PARAMETER_SCOPE(obj));
+    place->offset = PARAMETER_OFFSET(obj);
+    break;
+  default:
+    place->level = levelOf(b, FUNCTION_SCOPE(obj));
+    place->offset = RETURN_VALUE_OFFSET;
+    break;
+  }
+}
+
+static IrOperand loadPlace(IrBuilder* b, Place* place) {
+  IrInst* inst;
+
+  if (!place->direct)
+    return emitValue(b, IR_LOADI, place->address, noOperand());
+  inst = emit(b, IR_LOAD);
+  inst->level = place->level;
+  inst->offset = place->offset;
+  inst->dest = newTemp(b->function);
+  return tempOperand(inst->dest);
+}
+
+static void storePlace(IrBuilder* b, Place* place, IrOperand value) {
+  IrInst* inst;
+
+  if (!place->direct) {
+    inst = emit(b, IR_STOREI);
+    inst->a = place->address;
+    inst->b = value;
+    return;
+  }
+  inst = emit(b, IR_STORE);
+  inst->level = place->level;
+  inst->offset = place->offset;
+  inst->a = value;
+}
+
+// Returns the value of a function, no operand for a procedure
+static IrOperand buildCall(IrBuilder* b, Node* node) {
+  Compiler* compiler = b->compiler;
+  Object* obj = node->object;
+  ObjectNode* param;
+  Node* arg;
+  IrInst* inst;
+  IrOperand value;
+  int i;
+
+  b->lineNo = node->lineNo;
+  if (obj == compiler->readiFunction)
+    return emitValue(b, IR_READI, noOperand(), noOperand());
+  if (obj == compiler->readcFunction)
+    return emitValue(b, IR_READC, noOperand(), noOperand());
+  if (obj == compiler->writelnProcedure) {
+    emit(b, IR_WRITELN);
+    return noOperand();
+  }
+  if ((obj == compiler->writeiProcedure) || (obj == compiler->writecProcedure)) {
+    value = buildValue(b, node->kids[0]);
+    b->lineNo = node->lineNo;
+    emit(b, (obj == compiler->writeiProcedure) ? IR_WRITEI : IR_WRITEC)->a = value;
+    return noOperand();
+  }
+
+  if (obj->kind == OBJ_FUNCTION) {
+    param = obj->funcAttrs->paramList;
+    i = FUNCTION_PARAM_COUNT(obj);
+  } else {
+    param = obj->procAttrs->paramList;
+    i = PROCEDURE_PARAM_COUNT(obj);
+  }
+  inst = createIrInst(compiler, IR_CALL);
+  inst->args = (IrOperand*) arenaAlloc(&compiler->ast->arena, i * sizeof(IrOperand));
+  inst->argCount = i;
+  for (i = 0, arg = node->kids[0]; arg != NULL; i++, arg = arg->next, param = param->next)
+    if (param->object->paramAttrs->kind == PARAM_VALUE)
+      inst->args[i] = buildValue(b, arg);
+    else inst->args[i] = buildAddress(b, arg);
+
+  b->lineNo = node->lineNo;
+  inst->lineNo = b->lineNo;
+  inst->callee = obj;
+  if (obj->kind == OBJ_FUNCTION) {
+    inst->level = levelOf(b, FUNCTION_SCOPE(obj)->outer);
+    inst->dest = newTemp(b->function);
+  } else inst->level = levelOf(b, PROCEDURE_SCOPE(obj)->outer);
+  appendIrInst(b->block, inst);
+  return (inst->dest == NO_TEMP) ? noOperand() : tempOperand(inst->dest);
+}
+
+static IrOperand buildValue(IrBuilder* b, Node* node) {
+  Place place;
+  IrOperand x, y;
+
+  switch (node->kind) {
+  case AST_NUMBER:
+  case AST_CHAR:
+    return constOperand(node->value);
+  case AST_NAME:
+    b->lineNo = node->lineNo;
+    buildPlace(b, node, &place);
+    return loadPlace(b, &place);
+  case AST_INDEX:
+    x = buildAddress(b, node);
+    return emitValue(b, IR_LOADI, x, noOperand());
+  case AST_CALL:
+    return buildCall(b, node);
+  case AST_PLUS:
+    return buildValue(b, node->kids[0]);
+  case AST_NEG:
+    x = buildValue(b, node->kids[0]);
+    b->lineNo = node->lineNo;
+    return emitValue(b, IR_NEG, x, noOperand());
+  default:
+    // AST_ADD to AST_GE are in the order of IR_ADD to IR_GE
+    x = buildValue(b, node->kids[0]);
+    y = buildValue(b, node->kids[1]);
+    b->lineNo = node->lineNo;
+    return emitValue(b, IR_ADD + (node->kind - AST_ADD), x, y);
+  }
+}
+
+/******************************************************************/
+
+static void buildStatement(IrBuilder* b, Node* node);
+
+static void buildIf(IrBuilder* b, Node* node) {
+  IrBlock* thenBlock = createIrBlock(b->compiler, b->function);
+  IrBlock* elseBlock = NULL;
+  IrBlock* join = createIrBlock(b->compiler, b->function);
+
+  if (node->kids[2] != NULL)
+    elseBlock = createIrBlock(b->compiler, b->function);
+  endWithBranch(b, buildValue(b, node->kids[0]), thenBlock, (elseBlock != NULL) ? elseBlock : join);
+
+  startBlock(b, thenBlock);
+  buildStatement(b, node->kids[1]);
+  endWithJump(b, join);
+  if (elseBlock != NULL) {
+    startBlock(b, elseBlock);
+    buildStatement(b, node->kids[2]);
+    endWithJump(b, join);
+  }
+  startBlock(b, join);
+}
+
+static void buildWhile(IrBuilder* b, Node* node) {
+  IrBlock* header = createIrBlock(b->compiler, b->function);
+  IrBlock* body = createIrBlock(b->compiler, b->function);
+  IrBlock* exit = createIrBlock(b->compiler, b->function);
+
+  endWithJump(b, header);
+  startBlock(b, header);
+  endWithBranch(b, buildValue(b, node->kids[0]), body, exit);
+  startBlock(b, body);
+  buildStatement(b, node->kids[1]);
+  endWithJump(b, header);
+  startBlock(b, exit);
+}
+
+// Whether an expression is a constant, as the parser leaves CONST objects
+static int constantValue(Node* node, int* value) {
+  int x, y;
+
+  switch (node->kind) {
+  case AST_NUMBER:
+  case AST_CHAR:
+    *value = node->value;
+    return 1;
+  case AST_PLUS:
+    return constantValue(node->kids[0], value);
+  case AST_NEG:
+    if (!constantValue(node->kids[0], &x)) return 0;
+    *value = - x;
+    return 1;
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MUL:
+  case AST_DIV:
+    if (!constantValue(node->kids[0], &x) || !constantValue(node->kids[1], &y)) return 0;
+    switch (node->kind) {
+    case AST_ADD: *value = x + y; break;
+    case AST_SUB: *value = x - y; break;
+    case AST_MUL: *value = x * y; break;
+    default:
+      if (y == 0) return 0;
+      *value = x / y;
+      break;
+    }
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// The copies of a body of size nodes that fit in MAX_UNROLLED_SIZE, at
+// most the factor of -unroll
+static int unrollFactor(Compiler* compiler, int size) {
+  int factor = compiler->ast->unrollFactor;
+
+  if ((size > 0) && (factor > MAX_UNROLLED_SIZE / size))
+    factor = MAX_UNROLLED_SIZE / size;
+  return factor;
+}
+
+// The copies of its body a nested FOR of body size nodes becomes, or 0 if
+// it stays a loop
+static int unrolledCopies(Compiler* compiler, Node* node, int size) {
+  int factor = unrollFactor(compiler, size);
+  int from, to;
+
+  if ((factor <= 1) || (size < 0) ||
+      !constantValue(node->kids[0]->kids[1], &from) || !constantValue(node->kids[1], &to))
+    return 0;
+  if (to < from)
+    return 1;
+  return ((long long) to - from < factor) ? to - from + 1 : 0;
+}
+
+/*
+ * The nodes of a statement once unrolled, or -1 if it may change the
+ * variable var or has a loop in it. Copies of an inner loop would each be
+ * traced on their own, and a trace never spans two loops.
+ */
+static int unrollSize(Compiler* compiler, Node* node, Object* var) {
+  Object* obj;
+  int size = 0;
+  int i, n, copies;
+
+  for (; node != NULL; node = node->next) {
+    if ((node->kind == AST_ASSIGN) && (node->kids[0]->kind == AST_NAME)) {
+      // A VAR parameter may be var itself
+      obj = node->kids[0]->object;
+      if ((obj == var) || ((obj->kind == OBJ_PARAMETER) && (obj->paramAttrs->kind == PARAM_REFERENCE)))
+	return -1;
+    }
+    if (node->kind == AST_CALL) {
+      // Any other routine might change var through a static link
+      obj = node->object;
+      if ((obj != compiler->writeiProcedure) && (obj != compiler->writecProcedure) &&
+	  (obj != compiler->writelnProcedure) && (obj != compiler->readiFunction) &&
+	  (obj != compiler->readcFunction))
+	return -1;
+    }
+    if (node->kind == AST_WHILE)
+      return -1;
+    size ++;
+    for (i = 0; i < 3; i++)
+      if (node->kids[i] != NULL) {
+	n = unrollSize(compiler, node->kids[i], var);
+	if (n < 0) return -1;
+	// A nested FOR may be unrolled entirely
+	if ((node->kind == AST_FOR) && (i == 2)) {
+	  copies = unrolledCopies(compiler, node, n);
+	  if (copies == 0) return -1;
+	  n *= copies;
+	}
+	size += n;
+      }
+  }
+  return size;
+}
+
+static void buildForBody(IrBuilder* b, Node* node, Place* var, int copies) {
+  IrOperand value;
+
+  b->unrolling ++;
+  for (; copies > 0; copies--) {
+    buildStatement(b, node->kids[2]);
+    b->lineNo = node->lineNo;
+    value = loadPlace(b, var);
+    storePlace(b, var, emitValue(b, IR_ADD, value, constOperand(1)));
+  }
+  b->unrolling --;
+}
+
+/*
+ * A FOR with constant bounds and a body that leaves its variable alone,
+ * unrolled by the factor of -unroll, or less for a big body: with at most
+ * factor trips, the copies of the body replace the loop; with more, the
+ * loop runs factor copies per trip, and the trips that remain run in a
+ * loop of one copy.
+ */
+static int unrollFor(IrBuilder* b, Node* node, Place* var) {
+  Object* obj = node->kids[0]->kids[0]->object;
+  IrBlock* header;
+  IrBlock* body;
+  IrBlock* exit;
+  int from, to, count, size, factor, last, growth;
+
+  if (!var->direct || !constantValue(node->kids[0]->kids[1], &from) || !constantValue(node->kids[1], &to))
+    return 0;
+  size = unrollSize(b->compiler, node->kids[2], obj);
+  if (size < 0)
+    return 0;
+  factor = unrollFactor(b->compiler, size);
+  if (factor <= 1)
+    return 0;
+
+  if ((long long) to - from + 1 > INT_MAX)
+    return 0;
+  count = (to >= from) ? to - from + 1 : 0;
+  // The size of an outer FOR counts the copies of the ones nested in it
+  if (b->unrolling == 0) {
+    growth = (count <= factor) ? size * (count - 1) : size * factor;
+    if (growth > b->compiler->ast->unrollGrowth)
+      return 0;
+    b->compiler->ast->unrollGrowth -= growth;
+  }
+
+  storePlace(b, var, constOperand(from));
+  if (count <= factor) {
+    buildForBody(b, node, var, count);
+    return 1;
+  }
+
+  // The trips of factor copies start at from, ... last
+  last = from + (count / factor - 1) * factor;
+  header = createIrBlock(b->compiler, b->function);
+  body = createIrBlock(b->compiler, b->function);
+  exit = createIrBlock(b->compiler, b->function);
+  endWithJump(b, header);
+  startBlock(b, header);
+  b->lineNo = node->lineNo;
+  endWithBranch(b, emitValue(b, IR_LE, loadPlace(b, var), constOperand(last)), body, exit);
+  startBlock(b, body);
+  buildForBody(b, node, var, factor);
+  endWithJump(b, header);
+  startBlock(b, exit);
+  if (count % factor == 0)
+    return 1;
+
+  header = createIrBlock(b->compiler, b->function);
+  body = createIrBlock(b->compiler, b->function);
+  exit = createIrBlock(b->compiler, b->function);
+  endWithJump(b, header);
+  startBlock(b, header);
+  b->lineNo = node->lineNo;
+  endWithBranch(b, emitValue(b, IR_LE, loadPlace(b, var), constOperand(to)), body, exit);
+  startBlock(b, body);
+  buildForBody(b, node, var, 1);
+  endWithJump(b, header);
+  startBlock(b, exit);
+  return 1;
+}
+
+// The loop variable is found once, and the bound evaluated on every trip
+static void buildFor(IrBuilder* b, Node* node) {
+  IrBlock* header = createIrBlock(b->compiler, b->function);
+  IrBlock* body = createIrBlock(b->compiler, b->function);
+  IrBlock* exit = createIrBlock(b->compiler, b->function);
+  Place var;
+  IrOperand value, bound;
+
+  buildPlace(b, node->kids[0]->kids[0], &var);
+  if ((b->compiler->ast->unrollFactor > 1) && unrollFor(b, node, &var))
+    return;
+  storePlace(b, &var, buildValue(b, node->kids[0]->kids[1]));
+  endWithJump(b, header);
+
+  startBlock(b, header);
+  value = loadPlace(b, &var);
+  bound = buildValue(b, node->kids[1]);
+  b->lineNo = node->lineNo;
+  endWithBranch(b, emitValue(b, IR_LE, value, bound), body, exit);
+
+  startBlock(b, body);
+  buildStatement(b, node->kids[2]);
+  b->lineNo = node->lineNo;
+  value = loadPlace(b, &var);
+  storePlace(b, &var, emitValue(b, IR_ADD, value, constOperand(1)));
+  endWithJump(b, header);
+  startBlock(b, exit);
+}
+
+static void buildStatement(IrBuilder* b, Node* node) {
+  Place place;
+  Node* n;
+
+  b->lineNo = node->lineNo;
+  switch (node->kind) {
+  case AST_GROUP:
+    for (n = node->kids[0]; n != NULL; n = n->next)
+      buildStatement(b, n);
+    break;
+  case AST_ASSIGN:
+    buildPlace(b, node->kids[0], &place);
+    storePlace(b, &place, buildValue(b, node->kids[1]));
+    break;
+  case AST_CALL:
+    buildCall(b, node);
+    break;
+  case AST_IF:
+    buildIf(b, node);
+    break;
+  case AST_WHILE:
+    buildWhile(b, node);
+    break;
+  case AST_FOR:
+    buildFor(b, node);
+    break;
+  default:
+    break;
+  }
+}
+
+static int countNodes(Node* node) {
+  int count = 0;
+  int i;
+
+  for (; node != NULL; node = node->next) {
+    count ++;
+    for (i = 0; i < 3; i++)
+      if (node->kids[i] != NULL)
+	count += countNodes(node->kids[i]);
+  }
+  return count;
+}
+
+// The program, a function or a procedure, with the ones nested in it
+IrFunction* buildIr(Compiler* compiler, Node* node) {
+  IrFunction* function = createIrFunction(compiler, node->object);
+  IrFunction** last = &function->children;
+  Node* block = node->kids[0];
+  IrBuilder b;
+  Node* n;
+
+  if (node->object->kind == OBJ_PROGRAM) {
+    compiler->ast->unrollGrowth = countNodes(node) * MAX_UNROLL_GROWTH_PERCENT / 100;
+    if (compiler->ast->unrollGrowth < MIN_UNROLL_GROWTH)
+      compiler->ast->unrollGrowth = MIN_UNROLL_GROWTH;
+  }
+  for (n = block->kids[0]->kids[0]; n != NULL; n = n->next) {
+    *last = buildIr(compiler, n);
+    last = &((*last)->next);
+  }
+
+  enterBlock(compiler, function->scope);
+  b.compiler = compiler;
+  b.function = function;
+  b.lineNo = node->lineNo;
+  b.unrolling = 0;
+  startBlock(&b, createIrBlock(compiler, function));
+  buildStatement(&b, block->kids[1]);
+  emit(&b, IR_RETURN);
+  exitBlock(compiler);
+  return function;
+}
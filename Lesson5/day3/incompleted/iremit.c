@@ -0,0 +1,358 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include "ir.h"
+#include "codegen.h"
+
+/*
+ * Lowering of the IR to the code of the VM. A temp used once, right
+ * after it is defined in the same block, is kept on the stack: its
+ * definition is emitted as part of the instruction using it, so the IR of
+ * an expression becomes the usual stack code. Other temps are kept in
+ * words added to the frame. When an operand is pushed right after the
+ * same value, as the address in a(.i.) := a(.i.) + 1, CV copies it.
+ */
+
+#define COPY_NONE 0
+#define COPY_AFTER 1              // CV after the code of the temp
+#define COPY_ON_STACK 2           // no code, the value is already there
+
+struct Fixup_ {
+  Instruction* jmp;
+  IrBlock* target;
+  struct Fixup_* next;
+};
+
+typedef struct Fixup_ Fixup;
+
+struct Emitter_ {
+  Compiler* compiler;
+  IrFunction* function;
+  int* useCount;
+  int* defCount;
+  IrInst** def;
+  char* stacked;
+  char* copy;
+  int* slot;
+  Fixup* fixups;
+};
+
+typedef struct Emitter_ Emitter;
+
+static void analyseTemps(Emitter* e) {
+  IrBlock* block;
+  IrInst* inst;
+  IrOperand* operand;
+  int i;
+
+  for (block = e->function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if (operand->kind == OPD_TEMP)
+	  e->useCount[operand->value] ++;
+      }
+      if (inst->dest != NO_TEMP) {
+	e->defCount[inst->dest] ++;
+	e->def[inst->dest] = inst;
+      }
+    }
+}
+
+// Whether two operands on the stack have the same code, with nothing between them
+static int sameCode(Emitter* e, IrOperand* x, IrOperand* y) {
+  IrInst* p;
+  IrInst* q;
+  int i;
+
+  if ((x->kind != y->kind) || (x->kind == OPD_NONE))
+    return 0;
+  if ((x->kind == OPD_CONST) || (x->value == y->value))
+    return x->value == y->value;
+  if (!e->stacked[x->value] || !e->stacked[y->value])
+    return 0;
+
+  p = e->def[x->value];
+  q = e->def[y->value];
+  if ((p->op != q->op) || (p->op == IR_COPY) || hasSideEffects(p) ||
+      (p->level != q->level) || (p->offset != q->offset) || (irOperandCount(p) != irOperandCount(q)))
+    return 0;
+  for (i = 0; i < irOperandCount(p); i++)
+    if (!sameCode(e, irOperand(p, i), irOperand(q, i)))
+      return 0;
+  return 1;
+}
+
+/*
+ * The operand pushed first by the stack code of operand, its own first
+ * operand and so on: when one of them has the code of the operand pushed
+ * just before, a copy of that takes its place.
+ */
+static void copyOperand(Emitter* e, IrOperand* previous, IrOperand* operand) {
+  IrInst* def;
+
+  while ((operand->kind == OPD_TEMP) && (e->copy[operand->value] != COPY_ON_STACK)) {
+    if (e->stacked[operand->value] && (e->copy[operand->value] == COPY_NONE) &&
+	(operand->value != previous->value) && sameCode(e, previous, operand)) {
+      e->copy[previous->value] = COPY_AFTER;
+      e->copy[operand->value] = COPY_ON_STACK;
+      return;
+    }
+    def = e->def[operand->value];
+    if (!e->stacked[operand->value] || (def->op == IR_CALL) || (irOperandCount(def) == 0))
+      return;
+    operand = irOperand(def, 0);
+  }
+}
+
+// Whether the temp is the operand pushed first by the stack code of operand
+static int pushesFirst(Emitter* e, IrOperand* operand, int temp) {
+  IrInst* def;
+
+  while ((operand->kind == OPD_TEMP) && (e->copy[operand->value] != COPY_ON_STACK)) {
+    if (operand->value == temp)
+      return 1;
+    def = e->def[operand->value];
+    if (!e->stacked[operand->value] || (def->op == IR_CALL) || (irOperandCount(def) == 0))
+      return 0;
+    operand = irOperand(def, 0);
+  }
+  return 0;
+}
+
+// Returns the instruction before the stack code of inst and its operands
+static IrInst* stackOperands(Emitter* e, IrInst* inst) {
+  IrInst* cursor = inst->prev;
+  IrOperand* operand;
+  IrOperand* next;
+  int i, t;
+
+  for (i = irOperandCount(inst) - 1; i >= 0; i--) {
+    operand = irOperand(inst, i);
+    next = (i + 1 < irOperandCount(inst)) ? irOperand(inst, i + 1) : NULL;
+    if ((operand->kind != OPD_TEMP) || (cursor == NULL) || (cursor->dest != operand->value))
+      continue;
+    t = operand->value;
+    if (e->defCount[t] != 1)
+      continue;
+
+    if (e->useCount[t] == 1) {
+      e->stacked[t] = 1;
+      cursor = stackOperands(e, cursor);
+      if ((next != NULL) && (irOperandCount(e->def[t]) > 0))
+	copyOperand(e, operand, next);
+    } else if ((e->useCount[t] == 2) && (next != NULL) && pushesFirst(e, next, t)) {
+      // Both uses of t: pushed, then copied
+      e->stacked[t] = 1;
+      e->copy[t] = COPY_AFTER;
+      cursor = stackOperands(e, cursor);
+    }
+  }
+  return cursor;
+}
+
+static void assignSlots(Emitter* e) {
+  IrBlock* block;
+  IrInst* inst;
+  int t;
+
+  for (block = e->function->blocks; block != NULL; block = block->next) {
+    inst = block->last;
+    while (inst != NULL)
+      inst = stackOperands(e, inst);
+  }
+
+  // A temp of a variable may live in the word of the variable
+  for (t = 0; t < e->function->tempCount; t++)
+    if (!e->stacked[t] && (e->useCount[t] > 0)) {
+      if ((t < e->function->homeCount) && (e->function->homes[t] >= 0))
+	e->slot[t] = e->function->homes[t];
+      else e->slot[t] = e->function->frameSize ++;
+    }
+}
+
+static void addFixup(Emitter* e, Instruction* jmp, IrBlock* target) {
+  Fixup* fixup = (Fixup*) arenaAlloc(&e->compiler->ast->arena, sizeof(Fixup));
+
+  fixup->jmp = jmp;
+  fixup->target = target;
+  fixup->next = e->fixups;
+  e->fixups = fixup;
+}
+
+static void emitInst(Emitter* e, IrInst* inst);
+
+static void emitOperand(Emitter* e, IrOperand* operand) {
+  if (operand->kind == OPD_CONST)
+    genLC(e->compiler, operand->value);
+  else if (e->copy[operand->value] == COPY_ON_STACK)
+    return;
+  else if (e->stacked[operand->value]) {
+    emitInst(e, e->def[operand->value]);
+    if (e->copy[operand->value] == COPY_AFTER) {
+      genCV(e->compiler);
+      e->copy[operand->value] = COPY_ON_STACK;
+    }
+  } else genLV(e->compiler, 0, e->slot[operand->value]);
+}
+
+static void emitOp(Emitter* e, IrInst* inst) {
+  Compiler* compiler = e->compiler;
+  IrBlock* block = inst->block;
+  Object* obj;
+
+  switch (inst->op) {
+  case IR_ADDR: genLA(compiler, inst->level, inst->offset); break;
+  case IR_LOAD: genLV(compiler, inst->level, inst->offset); break;
+  case IR_STORE:
+  case IR_STOREI: genST(compiler); break;
+  case IR_LOADI: genLI(compiler); break;
+  case IR_NEG: genNEG(compiler); break;
+  case IR_ADD: genAD(compiler); break;
+  case IR_SUB: genSB(compiler); break;
+  case IR_MUL:
+    if (compiler->ast->optLevel >= 2)
+      genShiftedML(compiler);
+    else genML(compiler);
+    break;
+  case IR_DIV:
+    if (compiler->ast->optLevel >= 2)
+      genShiftedDV(compiler);
+    else genDV(compiler);
+    break;
+  case IR_EQ: genEQ(compiler); break;
+  case IR_NE: genNE(compiler); break;
+  case IR_LT: genLT(compiler); break;
+  case IR_LE: genLE(compiler); break;
+  case IR_GT: genGT(compiler); break;
+  case IR_GE: genGE(compiler); break;
+  case IR_READI: genRI(compiler); break;
+  case IR_READC: genRC(compiler); break;
+  case IR_WRITEI: genWRI(compiler); break;
+  case IR_WRITEC: genWRC(compiler); break;
+  case IR_WRITELN: genWLN(compiler); break;
+  case IR_CALL:
+    obj = inst->callee;
+    genDCT(compiler, RESERVED_WORDS + inst->argCount);
+    if (obj->kind == OBJ_FUNCTION)
+      genCALL(compiler, inst->level, obj->funcAttrs->codeAddress);
+    else genCALL(compiler, inst->level, obj->procAttrs->codeAddress);
+    break;
+  case IR_JUMP:
+    if (block->succ[0] != block->next)
+      addFixup(e, genJ(compiler, DC_VALUE), block->succ[0]);
+    break;
+  case IR_BRANCH:
+    addFixup(e, genFJ(compiler, DC_VALUE), block->succ[1]);
+    if (block->succ[0] != block->next)
+      addFixup(e, genJ(compiler, DC_VALUE), block->succ[0]);
+    break;
+  case IR_RETURN:
+    switch (e->function->owner->kind) {
+    case OBJ_FUNCTION: genEF(compiler); break;
+    case OBJ_PROCEDURE: genEP(compiler); break;
+    default: genHL(compiler); break;
+    }
+    break;
+  default:
+    // IR_COPY: the value of a is already where dest is
+    break;
+  }
+}
+
+static void emitInst(Emitter* e, IrInst* inst) {
+  Compiler* compiler = e->compiler;
+  int t = inst->dest;
+  int i;
+
+  setSourceLine(compiler, inst->lineNo);
+  if ((t != NO_TEMP) && !e->stacked[t] && (e->useCount[t] > 0))
+    genLA(compiler, 0, e->slot[t]);
+  if (inst->op == IR_STORE)
+    genLA(compiler, inst->level, inst->offset);
+  else if (inst->op == IR_CALL)
+    genINT(compiler, RESERVED_WORDS);
+
+  for (i = 0; i < irOperandCount(inst); i++)
+    emitOperand(e, irOperand(inst, i));
+
+  setSourceLine(compiler, inst->lineNo);
+  emitOp(e, inst);
+
+  if ((t != NO_TEMP) && !e->stacked[t]) {
+    if (e->useCount[t] > 0)
+      genST(compiler);
+    else genDCT(compiler, 1);
+  }
+}
+
+static void emitBlocks(Emitter* e) {
+  IrBlock* block;
+  IrInst* inst;
+  Fixup* fixup;
+
+  for (block = e->function->blocks; block != NULL; block = block->next) {
+    block->address = getCurrentCodeAddress(e->compiler);
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if ((inst->dest == NO_TEMP) || !e->stacked[inst->dest])
+	emitInst(e, inst);
+  }
+
+  for (fixup = e->fixups; fixup != NULL; fixup = fixup->next)
+    updateJ(fixup->jmp, fixup->target->address);
+}
+
+// The code of a function follows the code of the functions nested in it
+void emitIr(Compiler* compiler, IrFunction* function) {
+  Object* obj = function->owner;
+  int tempCount = function->tempCount;
+  IrFunction* child;
+  Instruction* jmp;
+  Emitter e;
+
+  if (function->blocks->first != NULL)
+    setSourceLine(compiler, function->blocks->first->lineNo);
+  switch (obj->kind) {
+  case OBJ_FUNCTION:
+    obj->funcAttrs->codeAddress = getCurrentCodeAddress(compiler);
+    break;
+  case OBJ_PROCEDURE:
+    obj->procAttrs->codeAddress = getCurrentCodeAddress(compiler);
+    break;
+  default:
+    obj->progAttrs->codeAddress = getCurrentCodeAddress(compiler);
+    break;
+  }
+  addCodeSymbol(compiler, obj);
+
+  jmp = genJ(compiler, DC_VALUE);
+  for (child = function->children; child != NULL; child = child->next)
+    emitIr(compiler, child);
+  updateJ(jmp, getCurrentCodeAddress(compiler));
+
+  e.compiler = compiler;
+  e.function = function;
+  e.useCount = (int*) calloc(tempCount + 1, sizeof(int));
+  e.defCount = (int*) calloc(tempCount + 1, sizeof(int));
+  e.def = (IrInst**) calloc(tempCount + 1, sizeof(IrInst*));
+  e.stacked = (char*) calloc(tempCount + 1, sizeof(char));
+  e.copy = (char*) calloc(tempCount + 1, sizeof(char));
+  e.slot = (int*) calloc(tempCount + 1, sizeof(int));
+  e.fixups = NULL;
+
+  analyseTemps(&e);
+  assignSlots(&e);
+  genINT(compiler, function->frameSize);
+  emitBlocks(&e);
+
+  free(e.useCount);
+  free(e.defCount);
+  free(e.def);
+  free(e.stacked);
+  free(e.copy);
+  free(e.slot);
+}
@@ -0,0 +1,228 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * kplc-bench: measures how fast the compiler gets through generated
+ * programs of growing size. Every shape stretches one dimension of the
+ * program (globals, nesting, expression length, parameters, arrays,
+ * statements) through four doublings, and the compile time should double
+ * with it: a shape whose time grows faster than that is reported, which
+ * is how linear searches in the symbol table and the code buffer show up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "generator.h"
+
+#define STEP_COUNT 4
+#define MAX_GROWTH 1.5     // time ~ size^1.5 and over is reported
+
+struct Benchmark_ {
+  char* name;
+  int* dimension;          // the field of shape that grows
+  int start;
+  Shape shape;
+};
+
+typedef struct Benchmark_ Benchmark;
+
+int repeatCount = 5;
+char* onlyBenchmark = NULL;
+
+void printUsage(void) {
+  printf("Usage: kplc-bench [-repeat=N] [-shape=name]\n");
+  printf("   -repeat=N: compile each program N times and keep the fastest (default: 5)\n");
+  printf("   -shape=name: only run the named shape\n");
+}
+
+int analyseParam(char* param) {
+  if (strncmp(param, "-repeat=", 8) == 0) {
+    repeatCount = atoi(param + 8);
+    return repeatCount > 0;
+  }
+  if (strncmp(param, "-shape=", 7) == 0) {
+    onlyBenchmark = param + 7;
+    return 1;
+  }
+  return 0;
+}
+
+static double now(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// The largest program of every shape must fit in the code size of kplc
+static void initBenchmarks(Benchmark* benchmarks, int* count) {
+  Benchmark* b = benchmarks;
+
+  // A long program body
+  b->name = "statements";
+  initShape(&b->shape);
+  b->shape.depth = 0;
+  b->dimension = &b->shape.statements;
+  b->start = 25;
+  b ++;
+
+  b->name = "globals";
+  initShape(&b->shape);
+  b->shape.statements = 20;
+  b->dimension = &b->shape.globals;
+  b->start = 1000;
+  b ++;
+
+  // One procedure in each block
+  b->name = "nesting";
+  initShape(&b->shape);
+  b->shape.procedures = 1;
+  b->shape.statements = 5;
+  b->dimension = &b->shape.depth;
+  b->start = 4;
+  b ++;
+
+  b->name = "expressions";
+  initShape(&b->shape);
+  b->shape.depth = 0;
+  b->shape.statements = 2;
+  b->dimension = &b->shape.expressionLength;
+  b->start = 50;
+  b ++;
+
+  b->name = "parameters";
+  initShape(&b->shape);
+  b->shape.depth = 1;
+  b->shape.statements = 4;
+  b->shape.expressionLength = 1;
+  b->dimension = &b->shape.params;
+  b->start = 100;
+  b ++;
+
+  // Many big arrays
+  b->name = "arrays";
+  initShape(&b->shape);
+  b->shape.arraySize = 1000;
+  b->shape.statements = 20;
+  b->dimension = &b->shape.arrays;
+  b->start = 100;
+  b ++;
+
+  *count = b - benchmarks;
+}
+
+/*
+ * Compiles fileName repeatCount times on one compiler and returns the
+ * fastest time, or a negative number if it doesn't compile.
+ */
+static double timeCompile(Compiler* compiler, char* fileName, int* instructions) {
+  double best = -1;
+  double start, time;
+  int i;
+
+  for (i = 0; i < repeatCount; i++) {
+    start = now();
+    if (compile(compiler, fileName) != IO_SUCCESS) {
+      printf("%s", compiler->diagnostics);
+      return -1;
+    }
+    time = now() - start;
+    if ((best < 0) || (time < best)) best = time;
+  }
+  *instructions = compiler->codeBlock->codeSize;
+  return best;
+}
+
+// Returns 1 if the compile time grew too fast with the size
+static int runBenchmark(Compiler* compiler, Benchmark* b, char* fileName) {
+  double times[STEP_COUNT];
+  long bytes[STEP_COUNT];
+  int lines;
+  int instructions;
+  double growth = 0;
+  FILE* f;
+  int step;
+
+  printf("%s:\n", b->name);
+  printf("  %8s %8s %12s %10s %12s %14s\n", "size", "lines", "instructions", "time (ms)", "lines/s", "instructions/s");
+  *(b->dimension) = b->start;
+  for (step = 0; step < STEP_COUNT; step++) {
+    f = fopen(fileName, "w");
+    if (f == NULL) {
+      printf("kplc-bench: Can\'t write %s!\n", fileName);
+      return 0;
+    }
+    lines = generateProgram(f, &b->shape);
+    bytes[step] = ftell(f);
+    fclose(f);
+
+    times[step] = timeCompile(compiler, fileName, &instructions);
+    if (times[step] < 0) {
+      printf("kplc-bench: The %s program of size %d doesn\'t compile!\n", b->name, *(b->dimension));
+      return 1;
+    }
+    printf("  %8d %8d %12d %10.3f %12.0f %14.0f\n", *(b->dimension), lines, instructions,
+	   times[step] * 1000, lines / times[step], instructions / times[step]);
+    *(b->dimension) *= 2;
+  }
+
+  // The exponent of time against the size of the source over the last
+  // doubling: the shapes are random, so the source doesn't exactly double
+  growth = log(times[STEP_COUNT - 1] / times[STEP_COUNT - 2]) /
+    log((double) bytes[STEP_COUNT - 1] / bytes[STEP_COUNT - 2]);
+  if (growth >= MAX_GROWTH) {
+    printf("  SUPERLINEAR: time grows as size^%.2f\n", growth);
+    return 1;
+  }
+  printf("  time grows as size^%.2f\n", growth);
+  return 0;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  Benchmark benchmarks[10];
+  int benchmarkCount;
+  Compiler compiler;
+  char fileName[] = "/tmp/kplc-bench-XXXXXX";
+  int fd;
+  int failures = 0;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    if (analyseParam(argv[i]) == 0) {
+      printUsage();
+      return -1;
+    }
+
+  fd = mkstemp(fileName);
+  if (fd < 0) {
+    printf("kplc-bench: Can\'t create a temporary file!\n");
+    return -1;
+  }
+  close(fd);
+
+  initBenchmarks(benchmarks, &benchmarkCount);
+  initCompiler(&compiler);
+  for (i = 0; i < benchmarkCount; i++)
+    if ((onlyBenchmark == NULL) || (strcmp(onlyBenchmark, benchmarks[i].name) == 0))
+      failures += runBenchmark(&compiler, benchmarks + i, fileName);
+  cleanCompiler(&compiler);
+  unlink(fileName);
+
+  if (failures > 0) {
+    printf("kplc-bench: %d shape(s) compile in superlinear time or not at all.\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,220 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * kplcd: a compile server. It keeps a few warm compilers (code buffer and
+ * predefined objects already built) and serves compile requests from
+ * clients on a Unix domain socket, so a compilation costs neither a
+ * process start nor initSymTab().
+ */
+
+#define _GNU_SOURCE         // for struct ucred
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "codegen.h"
+#include "ast.h"
+#include "kplcd.h"
+
+char* socketName = NULL;
+char defaultName[FILENAME_MAX];
+int workerCount = 0;
+CodeOptions codeOptions;
+int listener;
+
+void printUsage(void) {
+  printf("Usage: kplcd [-socket=path] [-j=workers] [-ast] [-O2 [-inline=N]] [-unroll=N]\n");
+  printf("   -socket=path: listen on path (default: $XDG_RUNTIME_DIR/%s, or %sUID/%s)\n",
+	 KPLCD_SOCKET_FILE, KPLCD_SOCKET_DIRECTORY, KPLCD_SOCKET_FILE);
+  printf("   -j=workers: number of requests served at once (default: one per processor)\n");
+  printf("   -ast, -O2, -inline=N, -unroll=N: generate code as kplc does with them, for every request\n");
+}
+
+int analyseParam(char* param) {
+  if (strncmp(param, "-socket=", 8) == 0) {
+    socketName = param + 8;
+    return 1;
+  }
+  if (strncmp(param, "-j=", 3) == 0) {
+    workerCount = atoi(param + 3);
+    return workerCount > 0;
+  }
+  // -ir would print to the server's terminal
+  if (strcmp(param, "-ir") == 0)
+    return 0;
+  return analyseCodeOption(&codeOptions, param);
+}
+
+// One line without its newline, 0 at the end of the connection
+static int readLine(FILE* in, char* line, int size) {
+  int length;
+
+  if (fgets(line, size, in) == NULL)
+    return 0;
+  length = strlen(line);
+  if ((length > 0) && (line[length - 1] == '\n'))
+    line[length - 1] = '\0';
+  return 1;
+}
+
+static int compileRequest(Compiler* compiler, char* input, char* output) {
+  switch (compile(compiler, input)) {
+  case IO_ERROR:
+    return KPLCD_READ_ERROR;
+  case COMPILE_ERROR:
+    return KPLCD_COMPILE_ERROR;
+  default:
+    break;
+  }
+  if (serialize(compiler, output) == IO_ERROR)
+    return KPLCD_WRITE_ERROR;
+  return KPLCD_OK;
+}
+
+// Whether the client runs as the user running the server
+static int isOwner(int connection) {
+#ifdef SO_PEERCRED
+  struct ucred credentials;
+  socklen_t length = sizeof(credentials);
+
+  if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0)
+    return 0;
+  return credentials.uid == getuid();
+#else
+  uid_t uid;
+  gid_t gid;
+
+  if (getpeereid(connection, &uid, &gid) < 0)
+    return 0;
+  return uid == getuid();
+#endif
+}
+
+/*
+ * Serves the requests of one connection; returns 0 when asked to shut
+ * down. A compile request reads and writes files as the user running the
+ * server, so a client of any other user is refused before it is read.
+ */
+static int serveClient(Compiler* compiler, int connection) {
+  FILE* in;
+  FILE* out;
+  char command[32];
+  char input[FILENAME_MAX], output[FILENAME_MAX];
+  int status;
+  int running = 1;
+
+  if (!isOwner(connection)) {
+    out = fdopen(connection, "w");
+    fprintf(out, "%s %d\n", KPLCD_STATUS, KPLCD_NOT_ALLOWED);
+    fclose(out);
+    return 1;
+  }
+
+  in = fdopen(dup(connection), "r");
+  out = fdopen(connection, "w");
+  while (readLine(in, command, sizeof(command))) {
+    if (strcmp(command, "shutdown") == 0) {
+      running = 0;
+      break;
+    }
+
+    if ((strcmp(command, "compile") == 0) &&
+	readLine(in, input, sizeof(input)) && readLine(in, output, sizeof(output))) {
+      status = compileRequest(compiler, input, output);
+      if (status == KPLCD_COMPILE_ERROR)
+	fputs(compiler->diagnostics, out);
+    } else status = KPLCD_BAD_REQUEST;
+
+    fprintf(out, "%s %d\n", KPLCD_STATUS, status);
+    fflush(out);
+    if (status == KPLCD_BAD_REQUEST) break;
+  }
+
+  fclose(in);
+  fclose(out);
+  return running;
+}
+
+static void* runWorker(void* arg) {
+  Compiler compiler;
+  int connection;
+
+  initCompiler(&compiler);
+  applyCodeOptions(&compiler, &codeOptions);
+  while (1) {
+    connection = accept(listener, NULL, NULL);
+    if (connection < 0) continue;
+    if (!serveClient(&compiler, connection)) {
+      unlink(socketName);
+      exit(0);
+    }
+  }
+  return NULL;
+}
+
+static int openListener(void) {
+  struct sockaddr_un address;
+
+  if (strlen(socketName) >= sizeof(address.sun_path)) return 0;
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) return 0;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketName);
+  unlink(socketName);
+  if ((bind(listener, (struct sockaddr*) &address, sizeof(address)) < 0) ||
+      (listen(listener, 64) < 0)) {
+    close(listener);
+    return 0;
+  }
+  return 1;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  pthread_t worker;
+  int i;
+
+  initCodeOptions(&codeOptions);
+  for (i = 1; i < argc; i ++)
+    if (analyseParam(argv[i]) == 0) {
+      printUsage();
+      return -1;
+    }
+  if (workerCount == 0)
+    workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if ((socketName == NULL) && defaultSocketName(defaultName, sizeof(defaultName), 1))
+    socketName = defaultName;
+  if (socketName == NULL) {
+    printf("kplcd: No directory of your own for the socket, use -socket=path!\n");
+    return -1;
+  }
+
+  // A client that goes away must not take the server with it
+  signal(SIGPIPE, SIG_IGN);
+
+  if (!openListener()) {
+    printf("kplcd: Can\'t listen on %s!\n", socketName);
+    return -1;
+  }
+
+  for (i = 1; i < workerCount; i ++)
+    pthread_create(&worker, NULL, runWorker, NULL);
+  runWorker(NULL);
+  return 0;
+}
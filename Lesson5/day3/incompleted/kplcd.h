@@ -0,0 +1,41 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __KPLCD_H__
+#define __KPLCD_H__
+
+/*
+ * The protocol between kplcd and its clients, over a Unix domain socket.
+ * A request is a command line followed by its arguments, one per line:
+ *
+ *   compile\n<source>\n<output>\n
+ *   shutdown\n
+ *
+ * File names are taken relative to the server's working directory, so
+ * clients send absolute ones. The answer to compile is the diagnostics,
+ * then a "status N" line with one of the KPLCD_* codes below. A client
+ * may send any number of requests on one connection. Only clients of the
+ * user running the server are served: any other gets KPLCD_NOT_ALLOWED
+ * as soon as it connects, and the connection is closed.
+ */
+
+#define KPLCD_SOCKET_FILE "kplcd.socket"
+#define KPLCD_SOCKET_DIRECTORY "/tmp/kplcd-"   // followed by the uid, without $XDG_RUNTIME_DIR
+
+#define KPLCD_OK           0
+#define KPLCD_COMPILE_ERROR 1
+#define KPLCD_READ_ERROR   2
+#define KPLCD_WRITE_ERROR  3
+#define KPLCD_BAD_REQUEST  4
+#define KPLCD_NOT_ALLOWED  5
+
+#define KPLCD_STATUS "status"
+
+// The socket of the user's server into name; create makes its directory.
+// Returns 0 if there is no directory only the user can enter (kplcdsocket.c)
+int defaultSocketName(char* name, int size, int create);
+
+#endif
@@ -0,0 +1,269 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * kplcd-client: compiles a file on a running kplcd, printing what kplc
+ * would. With -bench it measures the latency of compiling the same file
+ * over and over, and with -kplc that of starting kplc for it instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "kplcd.h"
+
+char* socketName = NULL;
+char defaultName[FILENAME_MAX];
+int benchCount = 0;
+char* kplcPath = NULL;
+int shutdownServer = 0;
+
+void printUsage(void) {
+  printf("Usage: kplcd-client input output [-socket=path] [-bench=N [-kplc=path]]\n");
+  printf("       kplcd-client -shutdown [-socket=path]\n");
+  printf("   input: input kpl program\n");
+  printf("   output: executable\n");
+  printf("   -socket=path: the server's socket (default: $XDG_RUNTIME_DIR/%s, or %sUID/%s)\n",
+	 KPLCD_SOCKET_FILE, KPLCD_SOCKET_DIRECTORY, KPLCD_SOCKET_FILE);
+  printf("   -bench=N: compile N times and report the latency\n");
+  printf("   -kplc=path: also time N runs of the kplc at path, for comparison\n");
+  printf("   -shutdown: stop the server\n");
+}
+
+int analyseParam(char* param) {
+  if (strncmp(param, "-socket=", 8) == 0) {
+    socketName = param + 8;
+    return 1;
+  }
+  if (strncmp(param, "-bench=", 7) == 0) {
+    benchCount = atoi(param + 7);
+    return benchCount > 0;
+  }
+  if (strncmp(param, "-kplc=", 6) == 0) {
+    kplcPath = param + 6;
+    return 1;
+  }
+  if (strcmp(param, "-shutdown") == 0) {
+    shutdownServer = 1;
+    return 1;
+  }
+  return 0;
+}
+
+static int connectToServer(void) {
+  struct sockaddr_un address;
+  int connection;
+
+  if (strlen(socketName) >= sizeof(address.sun_path)) return -1;
+  connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) return -1;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketName);
+  if (connect(connection, (struct sockaddr*) &address, sizeof(address)) < 0) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+// The server resolves names against its own directory, so send absolute ones
+static void makeAbsolute(char* fileName, char* path) {
+  char directory[PATH_MAX];
+
+  if ((fileName[0] == '/') || (getcwd(directory, sizeof(directory)) == NULL) ||
+      (snprintf(path, PATH_MAX, "%s/%s", directory, fileName) >= PATH_MAX))
+    snprintf(path, PATH_MAX, "%s", fileName);
+}
+
+// Reads up to the status line, copying what comes before it to stdout if
+// echo is set. Returns the status, -1 if the connection ends first.
+static int requestAnswer(FILE* in, int echo) {
+  char line[1024];
+  int status;
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (sscanf(line, KPLCD_STATUS " %d", &status) == 1)
+      return status;
+    if (echo) fputs(line, stdout);
+  }
+  return -1;
+}
+
+// Sends one compile request and copies the diagnostics to stdout if echo is
+// set. Returns the status the server answered, -1 if the connection failed.
+static int requestCompile(FILE* in, FILE* out, char* input, char* output, int echo) {
+  fprintf(out, "compile\n%s\n%s\n", input, output);
+  fflush(out);
+  return requestAnswer(in, echo);
+}
+
+static double now(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int compareTimes(const void* a, const void* b) {
+  double x = *(double*) a, y = *(double*) b;
+  return (x > y) - (x < y);
+}
+
+static void printLatency(char* title, double* times, int count) {
+  double total = 0;
+  int i;
+
+  for (i = 0; i < count; i ++)
+    total += times[i];
+  qsort(times, count, sizeof(double), compareTimes);
+  printf("%s: %d compiles, mean %.1f us, median %.1f us, p99 %.1f us, max %.1f us\n",
+	 title, count, total / count * 1e6, times[count / 2] * 1e6,
+	 times[(count * 99) / 100] * 1e6, times[count - 1] * 1e6);
+}
+
+static int runKplc(char* input, char* output) {
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    execl(kplcPath, kplcPath, input, output, (char*) NULL);
+    _exit(127);
+  }
+  if ((pid < 0) || (waitpid(pid, &status, 0) < 0))
+    return 0;
+  return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static int bench(FILE* in, FILE* out, char* input, char* output) {
+  double* times = (double*) malloc(benchCount * sizeof(double));
+  double start;
+  int i;
+
+  for (i = 0; i < benchCount; i ++) {
+    start = now();
+    if (requestCompile(in, out, input, output, 0) != KPLCD_OK) {
+      printf("kplcd-client: %s doesn\'t compile!\n", input);
+      free(times);
+      return -1;
+    }
+    times[i] = now() - start;
+  }
+  printLatency("kplcd", times, benchCount);
+
+  if (kplcPath != NULL) {
+    for (i = 0; i < benchCount; i ++) {
+      start = now();
+      if (!runKplc(input, output)) {
+	printf("kplcd-client: Can\'t run %s!\n", kplcPath);
+	free(times);
+	return -1;
+      }
+      times[i] = now() - start;
+    }
+    printLatency("kplc", times, benchCount);
+  }
+
+  free(times);
+  return 0;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  char input[PATH_MAX], output[PATH_MAX];
+  FILE* in;
+  FILE* out;
+  int connection;
+  int firstParam;
+  int result = 0;
+  int i;
+
+  firstParam = ((argc > 1) && (argv[1][0] == '-')) ? 1 : 3;
+  for (i = firstParam; i < argc; i ++)
+    if (analyseParam(argv[i]) == 0) {
+      printUsage();
+      return -1;
+    }
+
+  if (!shutdownServer && (firstParam == 1 || argc <= 2)) {
+    printf("kplcd-client: no input or output file.\n");
+    printUsage();
+    return -1;
+  }
+
+  if ((socketName == NULL) && defaultSocketName(defaultName, sizeof(defaultName), 0))
+    socketName = defaultName;
+  if (socketName == NULL) {
+    printf("kplcd-client: No directory of your own for the socket, use -socket=path!\n");
+    return -1;
+  }
+
+  connection = connectToServer();
+  if (connection < 0) {
+    printf("kplcd-client: Can\'t connect to %s!\n", socketName);
+    return -1;
+  }
+  // A refused client still reads the answer after its request fails
+  signal(SIGPIPE, SIG_IGN);
+  in = fdopen(dup(connection), "r");
+  out = fdopen(connection, "w");
+
+  if (shutdownServer) {
+    fprintf(out, "shutdown\n");
+    fflush(out);
+    // The server only answers when it refuses
+    if (requestAnswer(in, 0) == KPLCD_NOT_ALLOWED) {
+      printf("kplcd-client: Only the user running the server can use it!\n");
+      result = -1;
+    }
+  } else {
+    makeAbsolute(argv[1], input);
+    makeAbsolute(argv[2], output);
+
+    if (benchCount > 0)
+      result = bench(in, out, input, output);
+    else switch (requestCompile(in, out, input, output, 1)) {
+      case KPLCD_OK:
+	break;
+      case KPLCD_READ_ERROR:
+	printf("Can\'t read input file!\n");
+	result = -1;
+	break;
+      case KPLCD_WRITE_ERROR:
+	printf("Can\'t write output file!\n");
+	result = -1;
+	break;
+      case KPLCD_COMPILE_ERROR:
+	result = -1;
+	break;
+      case KPLCD_NOT_ALLOWED:
+	printf("kplcd-client: Only the user running the server can use it!\n");
+	result = -1;
+	break;
+      default:
+	printf("kplcd-client: The server didn\'t answer!\n");
+	result = -1;
+	break;
+      }
+  }
+
+  fclose(in);
+  fclose(out);
+  return result;
+}
@@ -0,0 +1,42 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "kplcd.h"
+
+/*
+ * The default socket lives in a directory of the user's own, so no other
+ * user can take its name before the server does or connect to it: the
+ * runtime directory of $XDG_RUNTIME_DIR, or /tmp/kplcd-UID made for it.
+ */
+
+// Whether only the user can enter the directory
+static int isPrivateDirectory(char* directory) {
+  struct stat status;
+
+  return (lstat(directory, &status) == 0) && S_ISDIR(status.st_mode) &&
+    (status.st_uid == getuid()) && ((status.st_mode & (S_IRWXG | S_IRWXO)) == 0);
+}
+
+int defaultSocketName(char* name, int size, int create) {
+  char directory[FILENAME_MAX];
+  char* runtimeDirectory = getenv("XDG_RUNTIME_DIR");
+
+  if ((runtimeDirectory != NULL) && (runtimeDirectory[0] == '/') && isPrivateDirectory(runtimeDirectory))
+    return snprintf(name, size, "%s/%s", runtimeDirectory, KPLCD_SOCKET_FILE) < size;
+
+  snprintf(directory, sizeof(directory), KPLCD_SOCKET_DIRECTORY "%d", (int) getuid());
+  if (create)
+    mkdir(directory, 0700);
+  if (!isPrivateDirectory(directory))
+    return 0;
+  return snprintf(name, size, "%s/%s", directory, KPLCD_SOCKET_FILE) < size;
+}
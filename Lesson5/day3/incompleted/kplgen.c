@@ -0,0 +1,102 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * kplgen: writes a synthetic KPL program of a given size and shape, to
+ * feed the compiler something bigger than the examples.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+
+Shape shape;
+
+void printUsage(void) {
+  printf("Usage: kplgen output [-globals=N] [-arrays=N] [-array-size=N] [-procedures=N] [-depth=N]\n");
+  printf("              [-params=N] [-locals=N] [-statements=N] [-expression=N] [-seed=N]\n");
+  printf("   output: the kpl program to write, - for the standard output\n");
+  printf("   -globals=N: integer variables of the program (default: %d)\n", shape.globals);
+  printf("   -arrays=N: array variables of the program (default: %d)\n", shape.arrays);
+  printf("   -array-size=N: elements of each array (default: %d)\n", shape.arraySize);
+  printf("   -procedures=N: procedures declared in each block (default: %d)\n", shape.procedures);
+  printf("   -depth=N: levels of nested procedures (default: %d)\n", shape.depth);
+  printf("   -params=N: parameters of each procedure (default: %d)\n", shape.params);
+  printf("   -locals=N: variables of each procedure (default: %d)\n", shape.locals);
+  printf("   -statements=N: statements of each block (default: %d)\n", shape.statements);
+  printf("   -expression=N: terms of each expression (default: %d)\n", shape.expressionLength);
+  printf("   -seed=N: the program for another seed has the same shape (default: %u)\n", shape.seed);
+}
+
+// Parses -name=N into *value
+static int analyseNumber(char* param, char* name, int* value) {
+  int length = strlen(name);
+
+  if ((strncmp(param, name, length) != 0) || (param[length] != '='))
+    return 0;
+  *value = atoi(param + length + 1);
+  return 1;
+}
+
+int analyseParam(char* param) {
+  int seed;
+
+  if (analyseNumber(param, "-globals", &shape.globals) ||
+      analyseNumber(param, "-arrays", &shape.arrays) ||
+      analyseNumber(param, "-array-size", &shape.arraySize) ||
+      analyseNumber(param, "-procedures", &shape.procedures) ||
+      analyseNumber(param, "-depth", &shape.depth) ||
+      analyseNumber(param, "-params", &shape.params) ||
+      analyseNumber(param, "-locals", &shape.locals) ||
+      analyseNumber(param, "-statements", &shape.statements) ||
+      analyseNumber(param, "-expression", &shape.expressionLength))
+    return 1;
+  if (analyseNumber(param, "-seed", &seed)) {
+    shape.seed = seed;
+    return 1;
+  }
+  return 0;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  FILE* f;
+  int i;
+
+  initShape(&shape);
+
+  if (argc <= 1) {
+    printf("kplgen: no output file.\n");
+    printUsage();
+    return -1;
+  }
+
+  for (i = 2; i < argc; i++)
+    if (analyseParam(argv[i]) == 0) {
+      printUsage();
+      return -1;
+    }
+
+  if ((shape.arraySize < 1) || (shape.expressionLength < 1)) {
+    printUsage();
+    return -1;
+  }
+
+  if (strcmp(argv[1], "-") == 0)
+    f = stdout;
+  else f = fopen(argv[1], "w");
+  if (f == NULL) {
+    printf("kplgen: Can\'t write output file!\n");
+    return -1;
+  }
+
+  generateProgram(f, &shape);
+  if (f != stdout) fclose(f);
+  return 0;
+}
@@ -0,0 +1,338 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+/*
+ * The natural loops of a function, and loop-invariant code motion on its
+ * SSA form: what computes the same value on every iteration is computed
+ * once, at the end of the preheader. Words of frames that are not
+ * promoted stay in memory, so a LOAD or LOADI only moves when nothing in
+ * the loop can write its word: a STORE to it, a STOREI to it when its
+ * address is taken, as for a VAR argument, or a call that can see it.
+ */
+
+static void* loopAlloc(Compiler* compiler, size_t size) {
+  return arenaAlloc(&compiler->ast->arena, size);
+}
+
+// The blocks that reach the latch without going through the header
+static void addLoopBody(IrBlock* header, IrBlock* latch, char* body, IrBlock** work) {
+  IrBlock* block;
+  int workCount = 0;
+  int i;
+
+  body[header->id] = 1;
+  if (!body[latch->id]) {
+    body[latch->id] = 1;
+    work[workCount ++] = latch;
+  }
+  while (workCount > 0) {
+    block = work[-- workCount];
+    for (i = 0; i < block->predCount; i++)
+      if (!body[block->preds[i]->id]) {
+	body[block->preds[i]->id] = 1;
+	work[workCount ++] = block->preds[i];
+      }
+  }
+}
+
+// Needs the dominators of analyseControlFlow()
+IrLoop* findLoops(Compiler* compiler, IrFunction* function) {
+  IrLoop** loopOf = (IrLoop**) calloc(function->blockCount, sizeof(IrLoop*));
+  IrBlock** work = (IrBlock**) malloc(function->blockCount * sizeof(IrBlock*));
+  IrLoop* loops = NULL;
+  IrLoop* loop;
+  IrBlock* block;
+  IrBlock* header;
+  int i, j;
+
+  for (i = 0; i < function->orderCount; i++) {
+    block = function->order[i];
+    for (j = 0; j < successorCount(block); j++) {
+      header = block->succ[j];
+      if (!dominates(header, block)) continue;
+      loop = loopOf[header->id];
+      if (loop == NULL) {
+	loop = (IrLoop*) loopAlloc(compiler, sizeof(IrLoop));
+	loop->header = header;
+	loop->body = (char*) loopAlloc(compiler, function->blockCount);
+	loopOf[header->id] = loop;
+      }
+      addLoopBody(header, block, loop->body, work);
+    }
+  }
+
+  // An inner loop has its header later in reverse postorder
+  for (i = 0; i < function->orderCount; i++) {
+    header = function->order[i];
+    loop = loopOf[header->id];
+    if (loop == NULL) continue;
+    for (j = 0; j < header->predCount; j++)
+      if (!loop->body[header->preds[j]->id]) {
+	if (loop->preheader != NULL) break;
+	loop->preheader = header->preds[j];
+      }
+    if ((j < header->predCount) || (loop->preheader == NULL) ||
+	(loop->preheader->last->op != IR_JUMP))
+      loop->preheader = NULL;
+    loop->next = loops;
+    loops = loop;
+  }
+
+  free(loopOf);
+  free(work);
+  return loops;
+}
+
+/******************************************************************/
+
+static TakenAddress* collectTakenAddresses(Compiler* compiler, IrFunction* function, TakenAddress* taken) {
+  TakenAddress* address;
+  IrFunction* child;
+  IrBlock* block;
+  IrInst* inst;
+  Scope* scope;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if (inst->op != IR_ADDR) continue;
+      scope = scopeAtLevel(function, inst->level);
+      if (isAddressTaken(taken, scope, inst->offset)) continue;
+      address = (TakenAddress*) loopAlloc(compiler, sizeof(TakenAddress));
+      address->scope = scope;
+      address->offset = inst->offset;
+      address->next = taken;
+      taken = address;
+    }
+
+  for (child = function->children; child != NULL; child = child->next)
+    taken = collectTakenAddresses(compiler, child, taken);
+  return taken;
+}
+
+// The words of all frames whose address the program takes
+TakenAddress* findTakenAddresses(Compiler* compiler, IrFunction* program) {
+  return collectTakenAddresses(compiler, program, NULL);
+}
+
+int isAddressTaken(TakenAddress* taken, Scope* scope, int offset) {
+  for (; taken != NULL; taken = taken->next)
+    if ((taken->scope == scope) && (taken->offset == offset))
+      return 1;
+  return 0;
+}
+
+/******************************************************************/
+
+// What the instructions of a loop can write
+struct LoopWrites_ {
+  IrInst** stores;
+  int storeCount;
+  int hasStoreToTaken;      // a STORE to a word whose address is taken
+  int hasStoreI;
+  int hasCall;
+  int hasNestedCall;        // of a function declared in this one, that sees its frame
+};
+
+typedef struct LoopWrites_ LoopWrites;
+
+struct Hoister_ {
+  Compiler* compiler;
+  IrFunction* function;
+  TakenAddress* taken;
+  IrInst** defs;
+  char* invariant;          // whether a temp has the same value on every iteration
+  char* hoisted;
+};
+
+typedef struct Hoister_ Hoister;
+
+static int isTaken(Hoister* h, int level, int offset) {
+  return isAddressTaken(h->taken, scopeAtLevel(h->function, level), offset);
+}
+
+static void findLoopWrites(Hoister* h, IrLoop* loop, LoopWrites* writes) {
+  IrFunction* function = h->function;
+  IrBlock* block;
+  IrInst* inst;
+  int i;
+
+  memset(writes, 0, sizeof(LoopWrites));
+  for (i = loop->header->rpo; i < function->orderCount; i++) {
+    block = function->order[i];
+    if (!loop->body[block->id]) continue;
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      switch (inst->op) {
+      case IR_STORE:
+	if (isTaken(h, inst->level, inst->offset))
+	  writes->hasStoreToTaken = 1;
+	writes->storeCount ++;
+	break;
+      case IR_STOREI:
+	writes->hasStoreI = 1;
+	break;
+      case IR_CALL:
+	writes->hasCall = 1;
+	if (inst->level == 0)
+	  writes->hasNestedCall = 1;
+	break;
+      default:
+	break;
+      }
+  }
+
+  writes->stores = (IrInst**) malloc((writes->storeCount + 1) * sizeof(IrInst*));
+  writes->storeCount = 0;
+  for (i = loop->header->rpo; i < function->orderCount; i++) {
+    block = function->order[i];
+    if (!loop->body[block->id]) continue;
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (inst->op == IR_STORE)
+	writes->stores[writes->storeCount ++] = inst;
+  }
+}
+
+// Whether the word a LOAD or LOADI reads is the same on every iteration
+static int isUnwritten(Hoister* h, LoopWrites* writes, IrInst* inst) {
+  IrInst* address;
+  int taken;
+  int i;
+
+  if (inst->op == IR_LOADI) {
+    // Only through an address that is valid wherever it is read
+    address = (inst->a.kind == OPD_TEMP) ? h->defs[inst->a.value] : NULL;
+    if ((address == NULL) || ((address->op != IR_ADDR) && (address->op != IR_LOAD)))
+      return 0;
+    return !writes->hasStoreI && !writes->hasCall && !writes->hasStoreToTaken;
+  }
+
+  for (i = 0; i < writes->storeCount; i++)
+    if ((writes->stores[i]->level == inst->level) && (writes->stores[i]->offset == inst->offset))
+      return 0;
+  taken = isTaken(h, inst->level, inst->offset);
+  if (taken && writes->hasStoreI)
+    return 0;
+  if (writes->hasCall && (taken || (inst->level > 0)))
+    return 0;
+  return !writes->hasNestedCall;
+}
+
+static int isInvariant(Hoister* h, IrLoop* loop, LoopWrites* writes, IrInst* inst) {
+  IrOperand* operand;
+  IrInst* def;
+  int i;
+
+  if ((inst->dest == NO_TEMP) || (inst->op == IR_PHI) || hasSideEffects(inst))
+    return 0;
+  for (i = 0; i < irOperandCount(inst); i++) {
+    operand = irOperand(inst, i);
+    if (operand->kind != OPD_TEMP) continue;
+    def = h->defs[operand->value];
+    if ((def != NULL) && loop->body[def->block->id] && !h->invariant[operand->value])
+      return 0;
+  }
+  if ((inst->op == IR_LOAD) || (inst->op == IR_LOADI))
+    return isUnwritten(h, writes, inst);
+  return 1;
+}
+
+/*
+ * A temp kept in the frame is read with one LV, so alone an ADDR or LOAD
+ * only gains when it follows static links more than one at a time.
+ */
+static int isWorthHoisting(IrInst* inst) {
+  switch (inst->op) {
+  case IR_ADDR:
+  case IR_LOAD:
+    return inst->level > 1;
+  case IR_COPY:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+static void hoistLoop(Hoister* h, IrLoop* loop) {
+  IrFunction* function = h->function;
+  LoopWrites writes;
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  IrInst* next;
+  int i, j;
+
+  findLoopWrites(h, loop, &writes);
+  for (i = loop->header->rpo; i < function->orderCount; i++) {
+    block = function->order[i];
+    if (!loop->body[block->id]) continue;
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (isInvariant(h, loop, &writes, inst)) {
+	h->invariant[inst->dest] = 1;
+	h->hoisted[inst->dest] = isWorthHoisting(inst);
+      }
+  }
+
+  // What a hoisted instruction uses moves with it; definitions come first
+  for (i = function->orderCount - 1; i >= loop->header->rpo; i--) {
+    block = function->order[i];
+    if (!loop->body[block->id]) continue;
+    for (inst = block->last; inst != NULL; inst = inst->prev) {
+      if ((inst->dest == NO_TEMP) || !h->hoisted[inst->dest]) continue;
+      for (j = 0; j < irOperandCount(inst); j++) {
+	operand = irOperand(inst, j);
+	if ((operand->kind == OPD_TEMP) && h->invariant[operand->value])
+	  h->hoisted[operand->value] = 1;
+      }
+    }
+  }
+
+  for (i = loop->header->rpo; i < function->orderCount; i++) {
+    block = function->order[i];
+    if (!loop->body[block->id]) continue;
+    for (inst = block->first; inst != NULL; inst = next) {
+      next = inst->next;
+      if ((inst->dest == NO_TEMP) || !h->hoisted[inst->dest]) continue;
+      removeIrInst(inst);
+      insertIrInstBefore(loop->preheader->last, inst);
+      h->invariant[inst->dest] = 0;
+      h->hoisted[inst->dest] = 0;
+    }
+  }
+
+  // Left in the loop, an invariant is not hoisted with an outer loop
+  for (i = loop->header->rpo; i < function->orderCount; i++) {
+    block = function->order[i];
+    if (!loop->body[block->id]) continue;
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (inst->dest != NO_TEMP)
+	h->invariant[inst->dest] = h->hoisted[inst->dest] = 0;
+  }
+  free(writes.stores);
+}
+
+// Needs the dominators of analyseControlFlow() and SSA form
+void hoistInvariants(Compiler* compiler, IrFunction* function, TakenAddress* taken) {
+  Hoister h;
+  IrLoop* loop;
+
+  h.compiler = compiler;
+  h.function = function;
+  h.taken = taken;
+  h.defs = findDefinitions(function);
+  h.invariant = (char*) calloc(function->tempCount + 1, sizeof(char));
+  h.hoisted = (char*) calloc(function->tempCount + 1, sizeof(char));
+
+  for (loop = findLoops(compiler, function); loop != NULL; loop = loop->next)
+    if (loop->preheader != NULL)
+      hoistLoop(&h, loop);
+
+  free(h.defs);
+  free(h.invariant);
+  free(h.hoisted);
+}
@@ -7,19 +7,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "reader.h"
 #include "parser.h"
 #include "codegen.h"
+#include "batch.h"
+#include "cache.h"
+#include "stats.h"
+#include "ast.h"
 
 
 int dumpCode = 0;
+int statsMode = 0;
+CodeOptions codeOptions;
+int workerCount = 0;
+char* batchFile = NULL;
+char* cacheDirectory = NULL;
+long long cacheSize = DEFAULT_CACHE_SIZE;
 
 void printUsage(void) {
-  printf("Usage: kplc input output [-dump]\n");
+  printf("Usage: kplc input output [-dump] [-stats] [-ast] [-ir] [-O2 [-inline=N]] [-unroll=N] [-cache=directory [-cache-size=MB]]\n");
+  printf("       kplc [-j N] [-ast] [-O2 [-inline=N]] [-unroll=N] --batch list\n");
+  printf("       kplc -cache-stats=directory\n");
   printf("   input: input kpl program\n");
   printf("   output: executable\n");
   printf("   -dump: code dump\n");
+  printf("   -stats: report the time and memory each stage of the compiler took\n");
+  printf("   -ast: build a syntax tree, then check it and generate code in separate passes\n");
+  printf("   -ir: print the intermediate code the syntax tree is lowered to (implies -ast)\n");
+  printf("   -O2: optimise the intermediate code: tail calls, inlining, constants, copies, common, invariant and dead code, induction variables (implies -ast)\n");
+  printf("   -inline=N: inline the functions and procedures of at most N instructions of intermediate code (default: %d, 0 for none)\n",
+	 DEFAULT_INLINE_LIMIT);
+  printf("   -unroll=N: unroll FOR loops with constant bounds N times, entirely if they run at most N times (implies -ast)\n");
+  printf("   -cache=directory: reuse the executable compiled before from the same source\n");
+  printf("   -cache-size=MB: evict the least recently used executables beyond MB (default: %d)\n",
+	 DEFAULT_CACHE_SIZE / (1024 * 1024));
+  printf("   --batch list: compile every \"input output\" pair listed in list, one per line\n");
+  printf("   -j N: compile the batch on N threads (default: one per processor)\n");
 }
 
 int analyseParam(char* param) {
@@ -27,15 +52,185 @@ int analyseParam(char* param) {
     dumpCode = 1;
     return 1;
   } 
+  if (strcmp(param, "-stats") == 0) {
+    statsMode = 1;
+    return 1;
+  }
+  if (analyseCodeOption(&codeOptions, param))
+    return 1;
+  if (strncmp(param, "-cache=", 7) == 0) {
+    cacheDirectory = param + 7;
+    return 1;
+  }
+  if (strncmp(param, "-cache-size=", 12) == 0) {
+    cacheSize = atoll(param + 12) * 1024 * 1024;
+    return 1;
+  }
+  return 0;
+}
+
+// Picks --batch and -j out of the command line: 1 for a batch, 0 if there
+// is none, -1 if a worker count is wrong. A batch also takes the options
+// that change the code; -ir, -dump, -stats and the cache are for one file.
+int analyseBatchParams(int argc, char *argv[]) {
+  int i;
+
+  for (i = 1; i < argc - 1; i ++) {
+    if (strcmp(argv[i], "--batch") == 0)
+      batchFile = argv[++i];
+    else if (strcmp(argv[i], "-j") == 0) {
+      workerCount = atoi(argv[++i]);
+      if (workerCount < 1) return -1;
+    }
+  }
+  if (batchFile == NULL) return 0;
+
+  for (i = 1; i < argc; i ++) {
+    if ((strcmp(argv[i], "--batch") == 0) || (strcmp(argv[i], "-j") == 0))
+      i ++;
+    else if ((strcmp(argv[i], "-ir") == 0) || !analyseCodeOption(&codeOptions, argv[i])) {
+      printf("kplc: %s can\'t be used with --batch.\n", argv[i]);
+      return -1;
+    }
+  }
+  return 1;
+}
+
+int runBatch(void) {
+  int failures;
+
+  if (workerCount == 0)
+    workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+  failures = compileBatch(batchFile, workerCount, &codeOptions);
+  if (failures < 0) return -1;
+  if (failures > 0) {
+    printf("kplc: %d file(s) failed to compile.\n", failures);
+    return 1;
+  }
+  return 0;
+}
+
+// The options that change the generated code, and so the cache key
+void describeCodeFlags(char* flags) {
+  flags[0] = '\0';
+  if (codeOptions.ast) strcat(flags, "-ast");
+  if (codeOptions.optLevel >= 2) sprintf(flags + strlen(flags), " -O2 -inline=%d", codeOptions.inlineLimit);
+  if (codeOptions.unrollFactor > 1) sprintf(flags + strlen(flags), " -unroll=%d", codeOptions.unrollFactor);
+}
+
+// Compiles input into output, printing what went wrong
+int compileFile(char* input, char* output) {
+  Compiler compiler;
+  Stats stats;
+
+  if (statsMode) startStats(&stats);
+  initCompiler(&compiler);
+  applyCodeOptions(&compiler, &codeOptions);
+
+  switch (compile(&compiler, input)) {
+  case IO_ERROR:
+    if (statsMode) stopStats(&stats);
+    printf("Can\'t read input file!\n");
+    cleanCompiler(&compiler);
+    return -1;
+  case COMPILE_ERROR:
+    // Not 0, as the first kplc exited with after one error: make and
+    // scripts see the failure
+    if (statsMode) stopStats(&stats);
+    printf("%s", compiler.diagnostics);
+    cleanCompiler(&compiler);
+    return -1;
+  default:
+    break;
+  }
+
+  if (serialize(&compiler, output) == IO_ERROR) {
+    if (statsMode) stopStats(&stats);
+    printf("Can\'t write output file!\n");
+    cleanCompiler(&compiler);
+    return -1;
+  }
+
+  if (statsMode) {
+    stopStats(&stats);
+    printStats(&stats, input);
+  }
+
+  if (dumpCode) printCodeBuffer(&compiler);
+    
+  cleanCompiler(&compiler);
+
+  return 0;
+}
+
+/*
+ * With a cache, an unchanged source costs a hash and a copy of the entry.
+ * The output is unlinked rather than overwritten when the source did
+ * change, in case another program still reads it.
+ */
+int compileCached(char* input, char* output) {
+  Cache cache;
+  char key[CACHE_KEY_LENGTH + 1];
+  char flags[100];
+  char* outputSymbols;
+
+  if (!openCache(&cache, cacheDirectory, cacheSize)) {
+    printf("kplc: Can\'t use cache directory %s!\n", cacheDirectory);
+    return compileFile(input, output);
+  }
+
+  describeCodeFlags(flags);
+  if (!makeCacheKey(input, flags, key)) {
+    printf("Can\'t read input file!\n");
+    return -1;
+  }
+  if (fetchFromCache(&cache, key, output))
+    return 0;
+
+  outputSymbols = (char*) malloc(strlen(output) + strlen(SYMBOL_FILE_EXT) + 1);
+  strcpy(outputSymbols, output);
+  strcat(outputSymbols, SYMBOL_FILE_EXT);
+  unlink(output);
+  unlink(outputSymbols);
+  free(outputSymbols);
+
+  if (compileFile(input, output) != 0)
+    return -1;
+  storeInCache(&cache, key, output);
   return 0;
 }
 
+int printCacheReport(char* directory) {
+  Cache cache;
+
+  if (!openCache(&cache, directory, cacheSize)) {
+    printf("kplc: Can\'t use cache directory %s!\n", directory);
+    return -1;
+  }
+  printCacheStats(&cache);
+  return 0;
+}
 
 /******************************************************************/
 
 int main(int argc, char *argv[]) {
   int i; 
 
+  initCodeOptions(&codeOptions);
+  switch (analyseBatchParams(argc, argv)) {
+  case -1:
+    printUsage();
+    return -1;
+  case 1:
+    return runBatch();
+  default:
+    break;
+  }
+
+  if ((argc > 1) && (strncmp(argv[1], "-cache-stats=", 13) == 0))
+    return printCacheReport(argv[1] + 13);
+
   if (argc <= 1) {
     printf("kplc: no input file.\n");
     printUsage();
@@ -51,21 +246,8 @@ int main(int argc, char *argv[]) {
   for ( i = 3; i < argc; i ++) 
     analyseParam(argv[i]);
 
-  initCodeBuffer();
-
-  if (compile(argv[1]) == IO_ERROR) {
-    printf("Can\'t read input file!\n");
-    return -1;
-  }
-
-  if (serialize(argv[2]) == IO_ERROR) {
-    printf("Can\'t write output file!\n");
-    return -1;
-  }
-
-  if (dumpCode) printCodeBuffer();
-    
-  cleanCodeBuffer();
-
-  return 0;
+  // -dump and -stats need a compilation, which a cache hit doesn't have
+  if ((cacheDirectory != NULL) && !dumpCode && !statsMode)
+    return compileCached(argv[1], argv[2]);
+  return compileFile(argv[1], argv[2]);
 }
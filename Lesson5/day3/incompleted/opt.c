@@ -0,0 +1,546 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "ir.h"
+
+/*
+ * The optimisations of -O2, on the SSA form of every function: sparse
+ * conditional constant propagation, copy propagation, global value
+ * numbering, loop-invariant code motion, strength reduction of
+ * induction variables and dead code elimination.
+ */
+
+#define LATTICE_TOP 0             // no value seen yet
+#define LATTICE_CONST 1
+#define LATTICE_BOTTOM 2          // not a constant
+
+#define GVN_TABLE_SIZE 1024
+// A value on the stack of the VM costs this much to keep in the frame
+#define GVN_MIN_COST 4
+#define MAX_COST_DEPTH 8
+
+struct Lattice_ {
+  unsigned char state;
+  int value;
+};
+
+typedef struct Lattice_ Lattice;
+
+static IrOperand* newReplacements(IrFunction* function) {
+  return (IrOperand*) calloc(function->tempCount + 1, sizeof(IrOperand));
+}
+
+static void resolve(IrOperand* replacements, IrOperand* operand) {
+  while ((operand->kind == OPD_TEMP) && (replacements[operand->value].kind != OPD_NONE))
+    *operand = replacements[operand->value];
+}
+
+static void replaceUses(IrFunction* function, IrOperand* replacements) {
+  IrBlock* block;
+  IrInst* inst;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      for (i = 0; i < irOperandCount(inst); i++)
+	resolve(replacements, irOperand(inst, i));
+}
+
+// Arithmetic as the VM does it; 0 when it would stop the program
+static int fold(int op, int x, int y, int* result) {
+  switch (op) {
+  case IR_NEG: *result = (int) (- (unsigned) x); return 1;
+  case IR_ADD: *result = (int) ((unsigned) x + (unsigned) y); return 1;
+  case IR_SUB: *result = (int) ((unsigned) x - (unsigned) y); return 1;
+  case IR_MUL: *result = (int) ((unsigned) x * (unsigned) y); return 1;
+  case IR_DIV:
+    if ((y == 0) || ((y == -1) && (x == INT_MIN))) return 0;
+    *result = x / y;
+    return 1;
+  case IR_EQ: *result = (x == y); return 1;
+  case IR_NE: *result = (x != y); return 1;
+  case IR_LT: *result = (x < y); return 1;
+  case IR_LE: *result = (x <= y); return 1;
+  case IR_GT: *result = (x > y); return 1;
+  case IR_GE: *result = (x >= y); return 1;
+  default: return 0;
+  }
+}
+
+static int isArithmetic(int op) {
+  return (op == IR_NEG) || ((op >= IR_ADD) && (op <= IR_GE));
+}
+
+/******************************************************************/
+
+struct Propagator_ {
+  IrFunction* function;
+  Lattice* values;
+  char* executable;         // blocks
+  char* edges;              // two per block, for succ[0] and succ[1]
+  int changed;
+};
+
+typedef struct Propagator_ Propagator;
+
+static Lattice latticeOf(Propagator* p, IrOperand* operand) {
+  Lattice lattice;
+
+  if (operand->kind == OPD_TEMP)
+    return p->values[operand->value];
+  lattice.state = LATTICE_CONST;
+  lattice.value = operand->value;
+  return lattice;
+}
+
+static void meet(Lattice* x, Lattice y) {
+  if ((y.state == LATTICE_TOP) || (x->state == LATTICE_BOTTOM))
+    return;
+  if (x->state == LATTICE_TOP)
+    *x = y;
+  else if ((y.state == LATTICE_BOTTOM) || (x->value != y.value))
+    x->state = LATTICE_BOTTOM;
+}
+
+static void markEdge(Propagator* p, IrBlock* block, int i) {
+  if (p->edges[block->id * 2 + i]) return;
+  p->edges[block->id * 2 + i] = 1;
+  p->executable[block->succ[i]->id] = 1;
+  p->changed = 1;
+}
+
+static int isEdgeExecutable(Propagator* p, IrBlock* from, IrBlock* to) {
+  int i;
+
+  for (i = 0; i < successorCount(from); i++)
+    if ((from->succ[i] == to) && p->edges[from->id * 2 + i])
+      return 1;
+  return 0;
+}
+
+static Lattice evaluate(Propagator* p, IrInst* inst) {
+  Lattice result, x, y;
+  int i;
+
+  result.state = LATTICE_BOTTOM;
+  result.value = 0;
+  if (inst->op == IR_PHI) {
+    result.state = LATTICE_TOP;
+    for (i = 0; i < inst->argCount; i++)
+      if (isEdgeExecutable(p, inst->argBlocks[i], inst->block))
+	meet(&result, latticeOf(p, inst->args + i));
+    return result;
+  }
+  if (inst->op == IR_COPY)
+    return latticeOf(p, &inst->a);
+  if (!isArithmetic(inst->op))
+    return result;
+
+  x = latticeOf(p, &inst->a);
+  y = (inst->op == IR_NEG) ? x : latticeOf(p, &inst->b);
+  if ((x.state == LATTICE_BOTTOM) || (y.state == LATTICE_BOTTOM))
+    return result;
+  if ((x.state == LATTICE_TOP) || (y.state == LATTICE_TOP)) {
+    result.state = LATTICE_TOP;
+    return result;
+  }
+  if (fold(inst->op, x.value, y.value, &result.value))
+    result.state = LATTICE_CONST;
+  return result;
+}
+
+static void propagateBlock(Propagator* p, IrBlock* block) {
+  Lattice value;
+  IrInst* inst;
+
+  for (inst = block->first; inst != NULL; inst = inst->next) {
+    if (inst->dest != NO_TEMP) {
+      value = evaluate(p, inst);
+      if ((value.state != p->values[inst->dest].state) || (value.value != p->values[inst->dest].value)) {
+	p->values[inst->dest] = value;
+	p->changed = 1;
+      }
+    }
+
+    if (inst->op == IR_JUMP)
+      markEdge(p, block, 0);
+    else if (inst->op == IR_BRANCH) {
+      value = latticeOf(p, &inst->a);
+      if (value.state == LATTICE_BOTTOM) {
+	markEdge(p, block, 0);
+	markEdge(p, block, 1);
+      } else if (value.state == LATTICE_CONST)
+	markEdge(p, block, (value.value != 0) ? 0 : 1);
+    }
+  }
+}
+
+/*
+ * Sparse conditional constant propagation, by iterating over the blocks
+ * found executable until nothing changes. Returns whether branches were
+ * folded.
+ */
+static int propagateConstants(IrFunction* function) {
+  IrOperand* replacements = newReplacements(function);
+  IrBlock* block;
+  IrInst* inst;
+  Propagator p;
+  int folded = 0;
+  int i, t;
+
+  p.function = function;
+  p.values = (Lattice*) calloc(function->tempCount + 1, sizeof(Lattice));
+  p.executable = (char*) calloc(function->blockCount, sizeof(char));
+  p.edges = (char*) calloc(function->blockCount * 2, sizeof(char));
+  p.executable[function->blocks->id] = 1;
+  p.changed = 1;
+  while (p.changed) {
+    p.changed = 0;
+    for (i = 0; i < function->orderCount; i++)
+      if (p.executable[function->order[i]->id])
+	propagateBlock(&p, function->order[i]);
+  }
+
+  for (t = 0; t < function->tempCount; t++)
+    if (p.values[t].state == LATTICE_CONST)
+      replacements[t] = constOperand(p.values[t].value);
+  replaceUses(function, replacements);
+
+  for (block = function->blocks; block != NULL; block = block->next) {
+    inst = block->last;
+    if (!p.executable[block->id] || (inst == NULL) || (inst->op != IR_BRANCH)) continue;
+    if (!p.edges[block->id * 2] || !p.edges[block->id * 2 + 1]) {
+      if (!p.edges[block->id * 2])
+	block->succ[0] = block->succ[1];
+      block->succ[1] = NULL;
+      inst->op = IR_JUMP;
+      inst->a.kind = OPD_NONE;
+      folded = 1;
+    }
+  }
+
+  free(replacements);
+  free(p.values);
+  free(p.executable);
+  free(p.edges);
+  return folded;
+}
+
+/******************************************************************/
+
+// The operand a phi merges, if there is only one apart from itself
+static int mergedOperand(IrInst* phi, IrOperand* operand) {
+  IrOperand self = tempOperand(phi->dest);
+  int found = 0;
+  int i;
+
+  for (i = 0; i < phi->argCount; i++) {
+    if (sameOperand(phi->args + i, &self)) continue;
+    if (found && !sameOperand(phi->args + i, operand)) return 0;
+    *operand = phi->args[i];
+    found = 1;
+  }
+  return found;
+}
+
+static void propagateCopies(IrFunction* function) {
+  IrOperand* replacements = newReplacements(function);
+  IrOperand operand;
+  IrBlock* block;
+  IrInst* inst;
+  IrInst* next;
+  int changed = 1;
+
+  while (changed) {
+    changed = 0;
+    for (block = function->blocks; block != NULL; block = block->next)
+      for (inst = block->first; inst != NULL; inst = next) {
+	next = inst->next;
+	if ((inst->op == IR_COPY) && (inst->dest != NO_TEMP))
+	  operand = inst->a;
+	else if ((inst->op != IR_PHI) || !mergedOperand(inst, &operand))
+	  continue;
+	resolve(replacements, &operand);
+	if ((operand.kind == OPD_TEMP) && (operand.value == inst->dest)) continue;
+	replacements[inst->dest] = operand;
+	removeIrInst(inst);
+	changed = 1;
+      }
+    replaceUses(function, replacements);
+  }
+  free(replacements);
+}
+
+/******************************************************************/
+
+struct ValueEntry_ {
+  IrInst* inst;
+  struct ValueEntry_* next;       // in its bucket
+  struct ValueEntry_* scopeNext;  // the entries of the same block
+};
+
+typedef struct ValueEntry_ ValueEntry;
+
+struct Numbering_ {
+  IrFunction* function;
+  IrOperand* replacements;
+  IrInst** defs;
+  ValueEntry* table[GVN_TABLE_SIZE];
+  IrBlock** firstChild;
+  IrBlock** nextSibling;
+};
+
+typedef struct Numbering_ Numbering;
+
+static int isCommutative(int op) {
+  return (op == IR_ADD) || (op == IR_MUL) || (op == IR_EQ) || (op == IR_NE);
+}
+
+static unsigned hashOperand(IrOperand* operand) {
+  return operand->kind * 31u + (unsigned) operand->value * 2654435761u;
+}
+
+static unsigned hashInst(IrInst* inst) {
+  unsigned x = hashOperand(&inst->a);
+  unsigned y = hashOperand(&inst->b);
+
+  // The same for both orders of the operands of a commutative op
+  if (isCommutative(inst->op))
+    return (inst->op * 7u + (x ^ y)) % GVN_TABLE_SIZE;
+  return (inst->op * 7u + x * 3u + y + inst->level * 11u + inst->offset * 13u) % GVN_TABLE_SIZE;
+}
+
+static int sameValue(IrInst* x, IrInst* y) {
+  if ((x->op != y->op) || (x->level != y->level) || (x->offset != y->offset))
+    return 0;
+  if (sameOperand(&x->a, &y->a) && sameOperand(&x->b, &y->b))
+    return 1;
+  return isCommutative(x->op) && sameOperand(&x->a, &y->b) && sameOperand(&x->b, &y->a);
+}
+
+// Roughly the instructions computing operand on the stack of the VM
+static int operandCost(Numbering* n, IrOperand* operand, int depth);
+
+static int instCost(Numbering* n, IrInst* inst, int depth) {
+  int cost = 1;
+  int i;
+
+  for (i = 0; i < irOperandCount(inst); i++)
+    cost += operandCost(n, irOperand(inst, i), depth + 1);
+  return cost;
+}
+
+static int operandCost(Numbering* n, IrOperand* operand, int depth) {
+  IrInst* def;
+
+  if ((operand->kind != OPD_TEMP) || (depth >= MAX_COST_DEPTH))
+    return 1;
+  def = n->defs[operand->value];
+  if ((def == NULL) || !(isArithmetic(def->op) || (def->op == IR_ADDR)))
+    return 1;
+  return instCost(n, def, depth);
+}
+
+// An operation with an operand that makes it trivial
+static int simplify(IrInst* inst, IrOperand* result) {
+  IrOperand* x = &inst->a;
+  IrOperand* y = &inst->b;
+
+  switch (inst->op) {
+  case IR_ADD:
+    if ((x->kind == OPD_CONST) && (x->value == 0)) { *result = *y; return 1; }
+    if ((y->kind == OPD_CONST) && (y->value == 0)) { *result = *x; return 1; }
+    return 0;
+  case IR_SUB:
+    if ((y->kind == OPD_CONST) && (y->value == 0)) { *result = *x; return 1; }
+    if (sameOperand(x, y)) { *result = constOperand(0); return 1; }
+    return 0;
+  case IR_MUL:
+    if ((x->kind == OPD_CONST) && (x->value == 1)) { *result = *y; return 1; }
+    if ((y->kind == OPD_CONST) && (y->value == 1)) { *result = *x; return 1; }
+    if (((x->kind == OPD_CONST) && (x->value == 0)) || ((y->kind == OPD_CONST) && (y->value == 0))) {
+      *result = constOperand(0);
+      return 1;
+    }
+    return 0;
+  case IR_DIV:
+    if ((y->kind == OPD_CONST) && (y->value == 1)) { *result = *x; return 1; }
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+static void numberBlock(Numbering* n, IrBlock* block) {
+  ValueEntry* scope = NULL;
+  ValueEntry* entry;
+  IrOperand result;
+  IrBlock* child;
+  IrInst* inst;
+  IrInst* next;
+  unsigned bucket;
+  int i;
+
+  for (inst = block->first; inst != NULL; inst = next) {
+    next = inst->next;
+    for (i = 0; i < irOperandCount(inst); i++)
+      resolve(n->replacements, irOperand(inst, i));
+    if ((inst->dest == NO_TEMP) || !(isArithmetic(inst->op) || (inst->op == IR_ADDR)))
+      continue;
+
+    if (simplify(inst, &result)) {
+      n->replacements[inst->dest] = result;
+      removeIrInst(inst);
+      continue;
+    }
+
+    bucket = hashInst(inst);
+    for (entry = n->table[bucket]; entry != NULL; entry = entry->next)
+      if (sameValue(entry->inst, inst)) break;
+    if (entry != NULL) {
+      if (instCost(n, inst, 0) >= GVN_MIN_COST) {
+	n->replacements[inst->dest] = tempOperand(entry->inst->dest);
+	removeIrInst(inst);
+      }
+      continue;
+    }
+
+    entry = (ValueEntry*) malloc(sizeof(ValueEntry));
+    entry->inst = inst;
+    entry->next = n->table[bucket];
+    n->table[bucket] = entry;
+    entry->scopeNext = scope;
+    scope = entry;
+  }
+
+  for (child = n->firstChild[block->id]; child != NULL; child = n->nextSibling[child->id])
+    numberBlock(n, child);
+
+  // What this block defined does not dominate its siblings
+  while (scope != NULL) {
+    entry = scope;
+    scope = scope->scopeNext;
+    n->table[hashInst(entry->inst)] = entry->next;
+    free(entry);
+  }
+}
+
+// Global value numbering over the dominator tree
+static void numberValues(IrFunction* function) {
+  Numbering n;
+  IrBlock* block;
+  int i;
+
+  memset(n.table, 0, sizeof(n.table));
+  n.function = function;
+  n.replacements = newReplacements(function);
+  n.defs = findDefinitions(function);
+  n.firstChild = (IrBlock**) calloc(function->blockCount, sizeof(IrBlock*));
+  n.nextSibling = (IrBlock**) calloc(function->blockCount, sizeof(IrBlock*));
+  for (i = function->orderCount - 1; i > 0; i--) {
+    block = function->order[i];
+    n.nextSibling[block->id] = n.firstChild[block->idom->id];
+    n.firstChild[block->idom->id] = block;
+  }
+
+  numberBlock(&n, function->blocks);
+  replaceUses(function, n.replacements);
+
+  free(n.replacements);
+  free(n.defs);
+  free(n.firstChild);
+  free(n.nextSibling);
+}
+
+/******************************************************************/
+
+// Keeps what has side effects and what it uses, transitively
+static void eliminateDeadCode(IrFunction* function) {
+  IrInst** defs = findDefinitions(function);
+  IrInst** work = (IrInst**) malloc((function->tempCount + 1) * sizeof(IrInst*));
+  char* live = (char*) calloc(function->tempCount + 1, sizeof(char));
+  int workCount = 0;
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  IrInst* next;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if (!hasSideEffects(inst)) continue;
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if ((operand->kind == OPD_TEMP) && !live[operand->value]) {
+	  live[operand->value] = 1;
+	  if (defs[operand->value] != NULL)
+	    work[workCount ++] = defs[operand->value];
+	}
+      }
+      if (inst->dest != NO_TEMP)
+	live[inst->dest] = 1;
+    }
+
+  while (workCount > 0) {
+    inst = work[-- workCount];
+    for (i = 0; i < irOperandCount(inst); i++) {
+      operand = irOperand(inst, i);
+      if ((operand->kind == OPD_TEMP) && !live[operand->value]) {
+	live[operand->value] = 1;
+	if (defs[operand->value] != NULL)
+	  work[workCount ++] = defs[operand->value];
+      }
+    }
+  }
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = next) {
+      next = inst->next;
+      if ((inst->dest != NO_TEMP) && !live[inst->dest] && !hasSideEffects(inst))
+	removeIrInst(inst);
+    }
+
+  free(defs);
+  free(work);
+  free(live);
+}
+
+/******************************************************************/
+
+static void optimizeFunction(Compiler* compiler, IrFunction* function, TakenAddress* taken) {
+  int round;
+
+  analyseControlFlow(compiler, function);
+  buildSsa(compiler, function);
+  for (round = 0; round < 2; round++) {
+    if (propagateConstants(function))
+      analyseControlFlow(compiler, function);
+    propagateCopies(function);
+    numberValues(function);
+    hoistInvariants(compiler, function, taken);
+    if (round == 0)
+      reduceStrength(compiler, function);
+    eliminateDeadCode(function);
+  }
+  leaveSsa(compiler, function);
+}
+
+static void optimizeFunctions(Compiler* compiler, IrFunction* function, TakenAddress* taken) {
+  IrFunction* child;
+
+  for (child = function->children; child != NULL; child = child->next)
+    optimizeFunctions(compiler, child, taken);
+  optimizeFunction(compiler, function, taken);
+}
+
+void optimizeIr(Compiler* compiler, IrFunction* program) {
+  eliminateTailCalls(compiler, program);
+  inlineFunctions(compiler, program, compiler->ast->inlineLimit);
+  optimizeFunctions(compiler, program, findTakenAddresses(compiler, program));
+}
@@ -5,6 +5,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
 
 #include "reader.h"
 #include "scanner.h"
@@ -13,381 +14,520 @@
 #include "error.h"
 #include "debug.h"
 #include "codegen.h"
+#include "stats.h"
+#include "ast.h"
+#include "ir.h"
+
+void scan(Compiler* compiler) {
+  Token* tmp = compiler->currentToken;
+  compiler->currentToken = compiler->lookAhead;
+  compiler->lookAhead = getValidToken(compiler);
+  countedFree(tmp, sizeof(Token));
+  setSourceLine(compiler, compiler->currentToken->lineNo);
+}
+
+void eat(Compiler* compiler, TokenType tokenType) {
+  if (compiler->lookAhead->tokenType == tokenType) {
+    //    printToken(compiler->lookAhead);
+    scan(compiler);
+  } else missingToken(compiler, tokenType, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
+}
+
+/*
+ * Panic-mode error recovery. compileStatement(), compileExpression() and
+ * the declarations set recovery points; error() reports and jumps to the
+ * innermost one, which drops tokens up to one that may follow the
+ * construct and lets its caller go on as if it had compiled. An
+ * expression that failed has type NULL, which the type checks accept.
+ */
+
+int isExpressionFollow(TokenType tokenType) {
+  switch (tokenType) {
+  case KW_TO:
+  case KW_DO:
+  case SB_RPAR:
+  case SB_COMMA:
+  case SB_EQ:
+  case SB_NEQ:
+  case SB_LE:
+  case SB_LT:
+  case SB_GE:
+  case SB_GT:
+  case SB_RSEL:
+  case SB_SEMICOLON:
+  case KW_END:
+  case KW_ELSE:
+  case KW_THEN:
+    return 1;
+  default:
+    return 0;
+  }
+}
 
-Token *currentToken;
-Token *lookAhead;
+int isStatementFollow(TokenType tokenType) {
+  return (tokenType == SB_SEMICOLON) || (tokenType == KW_END) || (tokenType == KW_ELSE);
+}
 
-extern Type* intType;
-extern Type* charType;
-extern SymTab* symtab;
+int isParamFollow(TokenType tokenType) {
+  return (tokenType == SB_SEMICOLON) || (tokenType == SB_RPAR);
+}
 
-void scan(void) {
-  Token* tmp = currentToken;
-  currentToken = lookAhead;
-  lookAhead = getValidToken();
-  free(tmp);
+int isDeclarationFollow(TokenType tokenType) {
+  switch (tokenType) {
+  case SB_SEMICOLON:
+  case KW_CONST:
+  case KW_TYPE:
+  case KW_VAR:
+  case KW_FUNCTION:
+  case KW_PROCEDURE:
+  case KW_BEGIN:
+    return 1;
+  default:
+    return 0;
+  }
 }
 
-void eat(TokenType tokenType) {
-  if (lookAhead->tokenType == tokenType) {
-    //    printToken(lookAhead);
-    scan();
-  } else missingToken(tokenType, lookAhead->lineNo, lookAhead->colNo);
+void skipTo(Compiler* compiler, int (*isFollow)(TokenType)) {
+  while ((compiler->lookAhead->tokenType != TK_EOF) && !isFollow(compiler->lookAhead->tokenType))
+    scan(compiler);
 }
 
-void compileProgram(void) {
+// Compiles one construct with a recovery point: returns 0 if it failed
+// and the rest of it was skipped. The current scope is restored, in case
+// the construct failed between enterBlock() and exitBlock(), and so is
+// the node stack.
+int compileRecovering(Compiler* compiler, void (*compileConstruct)(Compiler*), int (*isFollow)(TokenType)) {
+  jmp_buf recovery;
+  jmp_buf* outer = compiler->recovery;
+  Scope* scope = compiler->symtab->currentScope;
+  int depth = (compiler->ast != NULL) ? nodeDepth(compiler) : 0;
+  int compiled = 1;
+
+  compiler->recovery = &recovery;
+  if (setjmp(recovery) == 0)
+    compileConstruct(compiler);
+  else {
+    compiler->symtab->currentScope = scope;
+    if (compiler->ast != NULL)
+      dropNodes(compiler, depth);
+    skipTo(compiler, isFollow);
+    compiled = 0;
+  }
+  compiler->recovery = outer;
+  return compiled;
+}
+
+// A declaration that failed has its terminating semicolon eaten here
+void compileDeclaration(Compiler* compiler, void (*compileDecl)(Compiler*)) {
+  if (!compileRecovering(compiler, compileDecl, isDeclarationFollow) &&
+      (compiler->lookAhead->tokenType == SB_SEMICOLON))
+    eat(compiler, SB_SEMICOLON);
+}
+
+void compileProgram(Compiler* compiler) {
   Object* program;
 
-  eat(KW_PROGRAM);
-  eat(TK_IDENT);
+  eat(compiler, KW_PROGRAM);
+  eat(compiler, TK_IDENT);
 
-  program = createProgramObject(currentToken->string);
-  program->progAttrs->codeAddress = getCurrentCodeAddress();
-  enterBlock(program->progAttrs->scope);
+  program = createProgramObject(compiler, compiler->currentToken->string);
+  if (compiler->ast == NULL) {
+    program->progAttrs->codeAddress = getCurrentCodeAddress(compiler);
+    addCodeSymbol(compiler, program);
+  }
+  enterBlock(compiler, program->progAttrs->scope);
 
-  eat(SB_SEMICOLON);
+  eat(compiler, SB_SEMICOLON);
 
-  compileBlock();
-  eat(SB_PERIOD);
+  compileBlock(compiler);
+  eat(compiler, SB_PERIOD);
 
-  genHL();
+  if (compiler->ast != NULL) {
+    buildNode(compiler, AST_PROGRAM, 1)->object = program;
+    compiler->ast->program = popNode(compiler);
+  } else genHL(compiler);
 
-  exitBlock();
+  exitBlock(compiler);
 }
 
-void compileConstDecls(void) {
+void compileConstDecls(Compiler* compiler) {
+  if (compiler->lookAhead->tokenType == KW_CONST) {
+    eat(compiler, KW_CONST);
+    do {
+      compileDeclaration(compiler, compileConstDecl);
+    } while (compiler->lookAhead->tokenType == TK_IDENT);
+  }
+}
+
+void compileConstDecl(Compiler* compiler) {
   Object* constObj;
   ConstantValue* constValue;
 
-  if (lookAhead->tokenType == KW_CONST) {
-    eat(KW_CONST);
-    do {
-      eat(TK_IDENT);
-      checkFreshIdent(currentToken->string);
-      constObj = createConstantObject(currentToken->string);
-      declareObject(constObj);
+  eat(compiler, TK_IDENT);
+  checkFreshIdent(compiler, compiler->currentToken->string);
+  constObj = createConstantObject(compiler->currentToken->string);
       
-      eat(SB_EQ);
-      constValue = compileConstant();
-      constObj->constAttrs->value = constValue;
+  eat(compiler, SB_EQ);
+  constValue = compileConstant(compiler);
+  constObj->constAttrs->value = constValue;
+  declareObject(compiler, constObj);
       
-      eat(SB_SEMICOLON);
-    } while (lookAhead->tokenType == TK_IDENT);
-  }
+  eat(compiler, SB_SEMICOLON);
+}
+
+void compileTypeDecls(Compiler* compiler) {
+  if (compiler->lookAhead->tokenType == KW_TYPE) {
+    eat(compiler, KW_TYPE);
+    do {
+      compileDeclaration(compiler, compileTypeDecl);
+    } while (compiler->lookAhead->tokenType == TK_IDENT);
+  } 
 }
 
-void compileTypeDecls(void) {
+void compileTypeDecl(Compiler* compiler) {
   Object* typeObj;
   Type* actualType;
 
-  if (lookAhead->tokenType == KW_TYPE) {
-    eat(KW_TYPE);
-    do {
-      eat(TK_IDENT);
+  eat(compiler, TK_IDENT);
       
-      checkFreshIdent(currentToken->string);
-      typeObj = createTypeObject(currentToken->string);
-      declareObject(typeObj);
+  checkFreshIdent(compiler, compiler->currentToken->string);
+  typeObj = createTypeObject(compiler->currentToken->string);
       
-      eat(SB_EQ);
-      actualType = compileType();
-      typeObj->typeAttrs->actualType = actualType;
+  eat(compiler, SB_EQ);
+  actualType = compileType(compiler);
+  typeObj->typeAttrs->actualType = actualType;
+  declareObject(compiler, typeObj);
       
-      eat(SB_SEMICOLON);
-    } while (lookAhead->tokenType == TK_IDENT);
+  eat(compiler, SB_SEMICOLON);
+}
+
+void compileVarDecls(Compiler* compiler) {
+  if (compiler->lookAhead->tokenType == KW_VAR) {
+    eat(compiler, KW_VAR);
+    do {
+      compileDeclaration(compiler, compileVarDecl);
+    } while (compiler->lookAhead->tokenType == TK_IDENT);
   } 
 }
 
-void compileVarDecls(void) {
+void compileVarDecl(Compiler* compiler) {
   Object* varObj;
   Type* varType;
 
-  if (lookAhead->tokenType == KW_VAR) {
-    eat(KW_VAR);
-    do {
-      eat(TK_IDENT);
-      checkFreshIdent(currentToken->string);
-      varObj = createVariableObject(currentToken->string);
-      eat(SB_COLON);
-      varType = compileType();
-      varObj->varAttrs->type = varType;
-      declareObject(varObj);      
-      eat(SB_SEMICOLON);
-    } while (lookAhead->tokenType == TK_IDENT);
-  } 
+  eat(compiler, TK_IDENT);
+  checkFreshIdent(compiler, compiler->currentToken->string);
+  varObj = createVariableObject(compiler->currentToken->string);
+  eat(compiler, SB_COLON);
+  varType = compileType(compiler);
+  varObj->varAttrs->type = varType;
+  declareObject(compiler, varObj);      
+  eat(compiler, SB_SEMICOLON);
 }
 
-void compileBlock(void) {
-  Instruction* jmp;
-  
-  jmp = genJ(DC_VALUE);
+void compileBlock(Compiler* compiler) {
+  Instruction* jmp = NULL;
+  int depth = 0;
 
-  compileConstDecls();
-  compileTypeDecls();
-  compileVarDecls();
-  compileSubDecls();
+  if (compiler->ast != NULL)
+    depth = nodeDepth(compiler);
+  else jmp = genJ(compiler, DC_VALUE);
 
-  updateJ(jmp,getCurrentCodeAddress());
-  genINT(symtab->currentScope->frameSize);
+  compileConstDecls(compiler);
+  compileTypeDecls(compiler);
+  compileVarDecls(compiler);
+  compileSubDecls(compiler);
 
-  eat(KW_BEGIN);
-  compileStatements();
-  eat(KW_END);
+  if (compiler->ast != NULL)
+    buildList(compiler, AST_GROUP, depth);
+  else {
+    updateJ(jmp,getCurrentCodeAddress(compiler));
+    genINT(compiler, compiler->symtab->currentScope->frameSize);
+  }
+
+  eat(compiler, KW_BEGIN);
+  compileStatements(compiler);
+  eat(compiler, KW_END);
+
+  if (compiler->ast != NULL)
+    buildNode(compiler, AST_BLOCK, 2);
 }
 
-void compileSubDecls(void) {
-  while ((lookAhead->tokenType == KW_FUNCTION) || (lookAhead->tokenType == KW_PROCEDURE)) {
-    if (lookAhead->tokenType == KW_FUNCTION)
-      compileFuncDecl();
-    else compileProcDecl();
+void compileSubDecls(Compiler* compiler) {
+  while ((compiler->lookAhead->tokenType == KW_FUNCTION) || (compiler->lookAhead->tokenType == KW_PROCEDURE)) {
+    if (compiler->lookAhead->tokenType == KW_FUNCTION)
+      compileDeclaration(compiler, compileFuncDecl);
+    else compileDeclaration(compiler, compileProcDecl);
   }
 }
 
-void compileFuncDecl(void) {
+void compileFuncDecl(Compiler* compiler) {
   Object* funcObj;
   Type* returnType;
 
-  eat(KW_FUNCTION);
-  eat(TK_IDENT);
+  eat(compiler, KW_FUNCTION);
+  eat(compiler, TK_IDENT);
 
-  checkFreshIdent(currentToken->string);
-  funcObj = createFunctionObject(currentToken->string);
-  funcObj->funcAttrs->codeAddress = getCurrentCodeAddress();
-  declareObject(funcObj);
+  checkFreshIdent(compiler, compiler->currentToken->string);
+  funcObj = createFunctionObject(compiler->currentToken->string);
+  declareObject(compiler, funcObj);
+  if (compiler->ast == NULL) {
+    funcObj->funcAttrs->codeAddress = getCurrentCodeAddress(compiler);
+    addCodeSymbol(compiler, funcObj);
+  }
 
-  enterBlock(funcObj->funcAttrs->scope);
+  enterBlock(compiler, funcObj->funcAttrs->scope);
   
-  compileParams();
+  compileParams(compiler);
 
-  eat(SB_COLON);
-  returnType = compileBasicType();
+  eat(compiler, SB_COLON);
+  returnType = compileBasicType(compiler);
   funcObj->funcAttrs->returnType = returnType;
 
-  eat(SB_SEMICOLON);
+  eat(compiler, SB_SEMICOLON);
 
-  compileBlock();
+  compileBlock(compiler);
 
-  genEF();
-  eat(SB_SEMICOLON);
+  if (compiler->ast != NULL)
+    buildNode(compiler, AST_FUNCTION, 1)->object = funcObj;
+  else genEF(compiler);
+  eat(compiler, SB_SEMICOLON);
 
-  exitBlock();
+  exitBlock(compiler);
 }
 
-void compileProcDecl(void) {
+void compileProcDecl(Compiler* compiler) {
   Object* procObj;
 
-  eat(KW_PROCEDURE);
-  eat(TK_IDENT);
+  eat(compiler, KW_PROCEDURE);
+  eat(compiler, TK_IDENT);
 
-  checkFreshIdent(currentToken->string);
-  procObj = createProcedureObject(currentToken->string);
-  procObj->procAttrs->codeAddress = getCurrentCodeAddress();
-  declareObject(procObj);
+  checkFreshIdent(compiler, compiler->currentToken->string);
+  procObj = createProcedureObject(compiler->currentToken->string);
+  declareObject(compiler, procObj);
+  if (compiler->ast == NULL) {
+    procObj->procAttrs->codeAddress = getCurrentCodeAddress(compiler);
+    addCodeSymbol(compiler, procObj);
+  }
 
-  enterBlock(procObj->procAttrs->scope);
+  enterBlock(compiler, procObj->procAttrs->scope);
 
-  compileParams();
+  compileParams(compiler);
 
-  eat(SB_SEMICOLON);
-  compileBlock();
+  eat(compiler, SB_SEMICOLON);
+  compileBlock(compiler);
 
-  genEP();
-  eat(SB_SEMICOLON);
+  if (compiler->ast != NULL)
+    buildNode(compiler, AST_PROCEDURE, 1)->object = procObj;
+  else genEP(compiler);
+  eat(compiler, SB_SEMICOLON);
 
-  exitBlock();
+  exitBlock(compiler);
 }
 
-ConstantValue* compileUnsignedConstant(void) {
+ConstantValue* compileUnsignedConstant(Compiler* compiler) {
   ConstantValue* constValue;
   Object* obj;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case TK_NUMBER:
-    eat(TK_NUMBER);
-    constValue = makeIntConstant(currentToken->value);
+    eat(compiler, TK_NUMBER);
+    constValue = makeIntConstant(compiler->currentToken->value);
     break;
   case TK_IDENT:
-    eat(TK_IDENT);
+    eat(compiler, TK_IDENT);
 
-    obj = checkDeclaredConstant(currentToken->string);
+    obj = checkDeclaredConstant(compiler, compiler->currentToken->string);
     constValue = duplicateConstantValue(obj->constAttrs->value);
 
     break;
   case TK_CHAR:
-    eat(TK_CHAR);
-    constValue = makeCharConstant(currentToken->string[0]);
+    eat(compiler, TK_CHAR);
+    constValue = makeCharConstant(compiler->currentToken->string[0]);
     break;
   default:
-    error(ERR_INVALID_CONSTANT, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_CONSTANT, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
     break;
   }
   return constValue;
 }
 
-ConstantValue* compileConstant(void) {
+ConstantValue* compileConstant(Compiler* compiler) {
   ConstantValue* constValue;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case SB_PLUS:
-    eat(SB_PLUS);
-    constValue = compileConstant2();
+    eat(compiler, SB_PLUS);
+    constValue = compileConstant2(compiler);
     break;
   case SB_MINUS:
-    eat(SB_MINUS);
-    constValue = compileConstant2();
+    eat(compiler, SB_MINUS);
+    constValue = compileConstant2(compiler);
     constValue->intValue = - constValue->intValue;
     break;
   case TK_CHAR:
-    eat(TK_CHAR);
-    constValue = makeCharConstant(currentToken->string[0]);
+    eat(compiler, TK_CHAR);
+    constValue = makeCharConstant(compiler->currentToken->string[0]);
     break;
   default:
-    constValue = compileConstant2();
+    constValue = compileConstant2(compiler);
     break;
   }
   return constValue;
 }
 
-ConstantValue* compileConstant2(void) {
+ConstantValue* compileConstant2(Compiler* compiler) {
   ConstantValue* constValue;
   Object* obj;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case TK_NUMBER:
-    eat(TK_NUMBER);
-    constValue = makeIntConstant(currentToken->value);
+    eat(compiler, TK_NUMBER);
+    constValue = makeIntConstant(compiler->currentToken->value);
     break;
   case TK_IDENT:
-    eat(TK_IDENT);
-    obj = checkDeclaredConstant(currentToken->string);
+    eat(compiler, TK_IDENT);
+    obj = checkDeclaredConstant(compiler, compiler->currentToken->string);
     if (obj->constAttrs->value->type == TP_INT)
       constValue = duplicateConstantValue(obj->constAttrs->value);
     else
-      error(ERR_UNDECLARED_INT_CONSTANT,currentToken->lineNo, currentToken->colNo);
+      error(compiler, ERR_UNDECLARED_INT_CONSTANT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
     break;
   default:
-    error(ERR_INVALID_CONSTANT, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_CONSTANT, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
     break;
   }
   return constValue;
 }
 
-Type* compileType(void) {
+Type* compileType(Compiler* compiler) {
   Type* type;
   Type* elementType;
   int arraySize;
   Object* obj;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case KW_INTEGER: 
-    eat(KW_INTEGER);
+    eat(compiler, KW_INTEGER);
     type =  makeIntType();
     break;
   case KW_CHAR: 
-    eat(KW_CHAR); 
+    eat(compiler, KW_CHAR); 
     type = makeCharType();
     break;
   case KW_ARRAY:
-    eat(KW_ARRAY);
-    eat(SB_LSEL);
-    eat(TK_NUMBER);
+    eat(compiler, KW_ARRAY);
+    eat(compiler, SB_LSEL);
+    eat(compiler, TK_NUMBER);
 
-    arraySize = currentToken->value;
+    arraySize = compiler->currentToken->value;
 
-    eat(SB_RSEL);
-    eat(KW_OF);
-    elementType = compileType();
+    eat(compiler, SB_RSEL);
+    eat(compiler, KW_OF);
+    elementType = compileType(compiler);
     type = makeArrayType(arraySize, elementType);
     break;
   case TK_IDENT:
-    eat(TK_IDENT);
-    obj = checkDeclaredType(currentToken->string);
+    eat(compiler, TK_IDENT);
+    obj = checkDeclaredType(compiler, compiler->currentToken->string);
     type = duplicateType(obj->typeAttrs->actualType);
     break;
   default:
-    error(ERR_INVALID_TYPE, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_TYPE, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
     break;
   }
   return type;
 }
 
-Type* compileBasicType(void) {
+Type* compileBasicType(Compiler* compiler) {
   Type* type;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case KW_INTEGER: 
-    eat(KW_INTEGER); 
+    eat(compiler, KW_INTEGER); 
     type = makeIntType();
     break;
   case KW_CHAR: 
-    eat(KW_CHAR); 
+    eat(compiler, KW_CHAR); 
     type = makeCharType();
     break;
   default:
-    error(ERR_INVALID_BASICTYPE, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_BASICTYPE, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
     break;
   }
   return type;
 }
 
-void compileParams(void) {
-  if (lookAhead->tokenType == SB_LPAR) {
-    eat(SB_LPAR);
-    compileParam();
-    while (lookAhead->tokenType == SB_SEMICOLON) {
-      eat(SB_SEMICOLON);
-      compileParam();
+void compileParams(Compiler* compiler) {
+  if (compiler->lookAhead->tokenType == SB_LPAR) {
+    eat(compiler, SB_LPAR);
+    compileRecovering(compiler, compileParam, isParamFollow);
+    while (compiler->lookAhead->tokenType == SB_SEMICOLON) {
+      eat(compiler, SB_SEMICOLON);
+      compileRecovering(compiler, compileParam, isParamFollow);
     }
-    eat(SB_RPAR);
+    eat(compiler, SB_RPAR);
   }
 }
 
-void compileParam(void) {
+void compileParam(Compiler* compiler) {
   Object* param;
   Type* type;
   enum ParamKind paramKind = PARAM_VALUE;
 
-  if (lookAhead->tokenType == KW_VAR) {
+  if (compiler->lookAhead->tokenType == KW_VAR) {
     paramKind = PARAM_REFERENCE;
-    eat(KW_VAR);
+    eat(compiler, KW_VAR);
   }
 
-  eat(TK_IDENT);
-  checkFreshIdent(currentToken->string);
-  param = createParameterObject(currentToken->string, paramKind);
-  eat(SB_COLON);
-  type = compileBasicType();
+  eat(compiler, TK_IDENT);
+  checkFreshIdent(compiler, compiler->currentToken->string);
+  param = createParameterObject(compiler->currentToken->string, paramKind);
+  eat(compiler, SB_COLON);
+  type = compileBasicType(compiler);
   param->paramAttrs->type = type;
-  declareObject(param);
+  declareObject(compiler, param);
 }
 
-void compileStatements(void) {
-  compileStatement();
-  while (lookAhead->tokenType == SB_SEMICOLON) {
-    eat(SB_SEMICOLON);
-    compileStatement();
+void compileStatements(Compiler* compiler) {
+  int depth = (compiler->ast != NULL) ? nodeDepth(compiler) : 0;
+
+  compileStatement(compiler);
+  while (compiler->lookAhead->tokenType == SB_SEMICOLON) {
+    eat(compiler, SB_SEMICOLON);
+    compileStatement(compiler);
   }
+  if (compiler->ast != NULL)
+    buildList(compiler, AST_GROUP, depth);
+}
+
+void compileStatement(Compiler* compiler) {
+  int depth = (compiler->ast != NULL) ? nodeDepth(compiler) : 0;
+
+  compileRecovering(compiler, compileStatement2, isStatementFollow);
+  // An empty statement, or one that failed, is an empty group
+  if ((compiler->ast != NULL) && (nodeDepth(compiler) == depth))
+    buildList(compiler, AST_GROUP, depth);
 }
 
-void compileStatement(void) {
-  switch (lookAhead->tokenType) {
+void compileStatement2(Compiler* compiler) {
+  switch (compiler->lookAhead->tokenType) {
   case TK_IDENT:
-    compileAssignSt();
+    compileAssignSt(compiler);
     break;
   case KW_CALL:
-    compileCallSt();
+    compileCallSt(compiler);
     break;
   case KW_BEGIN:
-    compileGroupSt();
+    compileGroupSt(compiler);
     break;
   case KW_IF:
-    compileIfSt();
+    compileIfSt(compiler);
     break;
   case KW_WHILE:
-    compileWhileSt();
+    compileWhileSt(compiler);
     break;
   case KW_FOR:
-    compileForSt();
+    compileForSt(compiler);
     break;
     // EmptySt needs to check FOLLOW tokens
   case SB_SEMICOLON:
@@ -396,276 +536,341 @@ void compileStatement(void) {
     break;
     // Error occurs
   default:
-    error(ERR_INVALID_STATEMENT, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_STATEMENT, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
     break;
   }
 }
 
-Type* compileLValue(void) {
+Type* compileLValue(Compiler* compiler) {
   Object* var;
   Type* varType;
 
-  eat(TK_IDENT);
+  eat(compiler, TK_IDENT);
   
-  var = checkDeclaredLValueIdent(currentToken->string);
+  var = checkDeclaredLValueIdent(compiler, compiler->currentToken->string);
+
+  // The checking pass types the tree
+  if (compiler->ast != NULL) {
+    buildNode(compiler, AST_NAME, 0)->object = var;
+    if ((var->kind == OBJ_VARIABLE) && (var->varAttrs->type->typeClass == TP_ARRAY))
+      compileIndexes(compiler, var->varAttrs->type);
+    return NULL;
+  }
 
   switch (var->kind) {
   case OBJ_VARIABLE:
-    genVariableAddress(var);
+    genVariableAddress(compiler, var);
 
     if (var->varAttrs->type->typeClass == TP_ARRAY) {
-      varType = compileIndexes(var->varAttrs->type);
+      varType = compileIndexes(compiler, var->varAttrs->type);
     }
     else
       varType = var->varAttrs->type;
     break;
   case OBJ_PARAMETER:
-    // TODO: push parameter value onto stack if the parameter is a reference (defined with keyword VAR
-    //       push parameter address onto stack if the parameter is a value
+    genParameterAddress(compiler, var);
     varType = var->paramAttrs->type;
     break;
   case OBJ_FUNCTION:
-    // TODO: push the return value address onto the stack
+    genReturnValueAddress(compiler, var);
     varType = var->funcAttrs->returnType;
     break;
   default: 
-    error(ERR_INVALID_LVALUE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_LVALUE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   }
 
   return varType;
 }
 
-void compileAssignSt(void) {
+void compileAssignSt(Compiler* compiler) {
   Type* varType;
   Type* expType;
 
-  varType = compileLValue();
+  varType = compileLValue(compiler);
   
-  eat(SB_ASSIGN);
-  expType = compileExpression();
-  checkTypeEquality(varType, expType);
-
-  genST();
+  eat(compiler, SB_ASSIGN);
+  expType = compileExpression(compiler);
+
+  if (compiler->ast != NULL)
+    buildNode(compiler, AST_ASSIGN, 2);
+  else {
+    checkTypeEquality(compiler, varType, expType);
+    genST(compiler);
+  }
 }
 
-void compileCallSt(void) {
-  // TODO: generate call-statement
+void compileCallSt(Compiler* compiler) {
   Object* proc;
+  int depth;
 
-  eat(KW_CALL);
-  eat(TK_IDENT);
+  eat(compiler, KW_CALL);
+  eat(compiler, TK_IDENT);
 
-  proc = checkDeclaredProcedure(currentToken->string);
+  proc = checkDeclaredProcedure(compiler, compiler->currentToken->string);
 
-  
-  if (isPredefinedProcedure(proc)) {
-    compileArguments(proc->procAttrs->paramList);
-    genPredefinedProcedureCall(proc);
+  if (compiler->ast != NULL) {
+    depth = nodeDepth(compiler);
+    compileArguments(compiler, proc->procAttrs->paramList);
+    buildList(compiler, AST_CALL, depth)->object = proc;
+  } else if (isPredefinedProcedure(compiler, proc)) {
+    compileArguments(compiler, proc->procAttrs->paramList);
+    genPredefinedProcedureCall(compiler, proc);
   } else {
-    compileArguments(proc->procAttrs->paramList);
+    // Room for the frame header, the arguments go right above it
+    genINT(compiler, RESERVED_WORDS);
+    compileArguments(compiler, proc->procAttrs->paramList);
+    genDCT(compiler, RESERVED_WORDS + PROCEDURE_PARAM_COUNT(proc));
+    genProcedureCall(compiler, proc);
   }
 }
 
-void compileGroupSt(void) {
-  eat(KW_BEGIN);
-  compileStatements();
-  eat(KW_END);
+void compileGroupSt(Compiler* compiler) {
+  eat(compiler, KW_BEGIN);
+  compileStatements(compiler);
+  eat(compiler, KW_END);
 }
 
-void compileIfSt(void) {
+void compileIfSt(Compiler* compiler) {
   Instruction* fjInstruction;
   Instruction* jInstruction;
 
-  eat(KW_IF);
-  compileCondition();
-  eat(KW_THEN);
-
-  fjInstruction = genFJ(DC_VALUE);
-  compileStatement();
-  if (lookAhead->tokenType == KW_ELSE) {
-    jInstruction = genJ(DC_VALUE);
-    updateFJ(fjInstruction, getCurrentCodeAddress());
-    eat(KW_ELSE);
-    compileStatement();
-    updateJ(jInstruction, getCurrentCodeAddress());
+  eat(compiler, KW_IF);
+  compileCondition(compiler);
+  eat(compiler, KW_THEN);
+
+  if (compiler->ast != NULL) {
+    compileStatement(compiler);
+    if (compiler->lookAhead->tokenType == KW_ELSE) {
+      eat(compiler, KW_ELSE);
+      compileStatement(compiler);
+      buildNode(compiler, AST_IF, 3);
+    } else buildNode(compiler, AST_IF, 2);
+    return;
+  }
+
+  fjInstruction = genFJ(compiler, DC_VALUE);
+  compileStatement(compiler);
+  if (compiler->lookAhead->tokenType == KW_ELSE) {
+    jInstruction = genJ(compiler, DC_VALUE);
+    updateFJ(fjInstruction, getCurrentCodeAddress(compiler));
+    eat(compiler, KW_ELSE);
+    compileStatement(compiler);
+    updateJ(jInstruction, getCurrentCodeAddress(compiler));
   } else {
-    updateFJ(fjInstruction, getCurrentCodeAddress());
+    updateFJ(fjInstruction, getCurrentCodeAddress(compiler));
   }
 }
 
-void compileWhileSt(void) {
+void compileWhileSt(Compiler* compiler) {
   CodeAddress beginWhile;
   Instruction* fjInstruction;
 
-  beginWhile = getCurrentCodeAddress();
-  eat(KW_WHILE);
-  compileCondition();
-  fjInstruction = genFJ(DC_VALUE);
-  eat(KW_DO);
-  compileStatement();
-  genJ(beginWhile);
-  updateFJ(fjInstruction, getCurrentCodeAddress());
+  beginWhile = getCurrentCodeAddress(compiler);
+  eat(compiler, KW_WHILE);
+  compileCondition(compiler);
+  if (compiler->ast != NULL) {
+    eat(compiler, KW_DO);
+    compileStatement(compiler);
+    buildNode(compiler, AST_WHILE, 2);
+    return;
+  }
+  fjInstruction = genFJ(compiler, DC_VALUE);
+  eat(compiler, KW_DO);
+  compileStatement(compiler);
+  genJ(compiler, beginWhile);
+  updateFJ(fjInstruction, getCurrentCodeAddress(compiler));
 }
 
-void compileForSt(void) {
+void compileForSt(Compiler* compiler) {
   CodeAddress beginLoop;
   Instruction* fjInstruction;
   Type* varType;
   Type *type;
 
-  eat(KW_FOR);
-
-  varType = compileLValue();
-  eat(SB_ASSIGN);
-
-  genCV();
-  type = compileExpression();
-  checkTypeEquality(varType, type);
-  genST();
-  genCV();
-  genLI();
-  beginLoop = getCurrentCodeAddress();
-  eat(KW_TO);
+  eat(compiler, KW_FOR);
 
-  type = compileExpression();
-  checkTypeEquality(varType, type);
-  genLE();
-  fjInstruction = genFJ(DC_VALUE);
+  varType = compileLValue(compiler);
+  eat(compiler, SB_ASSIGN);
 
-  eat(KW_DO);
-  compileStatement();
-
-  genCV();  
-  genCV();
-  genLI();
-  genLC(1);
-  genAD();
-  genST();
-
-  genCV();
-  genLI();
+  if (compiler->ast != NULL) {
+    compileExpression(compiler);
+    buildNode(compiler, AST_ASSIGN, 2);
+    eat(compiler, KW_TO);
+    compileExpression(compiler);
+    eat(compiler, KW_DO);
+    compileStatement(compiler);
+    buildNode(compiler, AST_FOR, 3);
+    return;
+  }
 
-  genJ(beginLoop);
-  updateFJ(fjInstruction, getCurrentCodeAddress());
-  genDCT(1);
+  genCV(compiler);
+  type = compileExpression(compiler);
+  checkTypeEquality(compiler, varType, type);
+  genST(compiler);
+  genCV(compiler);
+  genLI(compiler);
+  beginLoop = getCurrentCodeAddress(compiler);
+  eat(compiler, KW_TO);
+
+  type = compileExpression(compiler);
+  checkTypeEquality(compiler, varType, type);
+  genLE(compiler);
+  fjInstruction = genFJ(compiler, DC_VALUE);
+
+  eat(compiler, KW_DO);
+  compileStatement(compiler);
+
+  genCV(compiler);  
+  genCV(compiler);
+  genLI(compiler);
+  genLC(compiler, 1);
+  genAD(compiler);
+  genST(compiler);
+
+  genCV(compiler);
+  genLI(compiler);
+
+  genJ(compiler, beginLoop);
+  updateFJ(fjInstruction, getCurrentCodeAddress(compiler));
+  genDCT(compiler, 1);
 
 }
 
-void compileArgument(Object* param) {
+void compileArgument(Compiler* compiler, Object* param) {
   Type* type;
 
   if (param->paramAttrs->kind == PARAM_VALUE) {
-    type = compileExpression();
-    checkTypeEquality(type, param->paramAttrs->type);
+    type = compileExpression(compiler);
+    checkTypeEquality(compiler, type, param->paramAttrs->type);
   } else {
-    type = compileLValue();
-    checkTypeEquality(type, param->paramAttrs->type);
+    type = compileLValue(compiler);
+    checkTypeEquality(compiler, type, param->paramAttrs->type);
+  }
+}
+
+/*
+ * The argument for the parameter node, or an expression when there is no
+ * parameter left. A wrong number of arguments is a semantic error: it is
+ * reported once, and the arguments are still parsed to the ')'.
+ */
+static ObjectNode* compileNextArgument(Compiler* compiler, ObjectNode* node, int* mismatch) {
+  if (node != NULL) {
+    compileArgument(compiler, node->object);
+    return node->next;
   }
+  if (!*mismatch)
+    reportError(compiler, ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
+  *mismatch = 1;
+  compileExpression(compiler);
+  return NULL;
 }
 
-void compileArguments(ObjectNode* paramList) {
+void compileArguments(Compiler* compiler, ObjectNode* paramList) {
   ObjectNode* node = paramList;
+  int mismatch = 0;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case SB_LPAR:
-    eat(SB_LPAR);
-    if (node == NULL)
-      error(ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
-    compileArgument(node->object);
-    node = node->next;
-
-    while (lookAhead->tokenType == SB_COMMA) {
-      eat(SB_COMMA);
-      if (node == NULL)
-	error(ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
-      compileArgument(node->object);
-      node = node->next;
+    eat(compiler, SB_LPAR);
+    node = compileNextArgument(compiler, node, &mismatch);
+
+    while (compiler->lookAhead->tokenType == SB_COMMA) {
+      eat(compiler, SB_COMMA);
+      node = compileNextArgument(compiler, node, &mismatch);
     }
 
-    if (node != NULL)
-      error(ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+    if ((node != NULL) && !mismatch)
+      reportError(compiler, ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
     
-    eat(SB_RPAR);
+    eat(compiler, SB_RPAR);
     break;
     // Check FOLLOW set 
   case SB_TIMES:
   case SB_SLASH:
   case SB_PLUS:
   case SB_MINUS:
-  case KW_TO:
-  case KW_DO:
-  case SB_RPAR:
-  case SB_COMMA:
+    break;
+  default:
+    if (!isExpressionFollow(compiler->lookAhead->tokenType))
+      error(compiler, ERR_INVALID_ARGUMENTS, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
+  }
+}
+
+static int comparisonKind(TokenType op) {
+  switch (op) {
   case SB_EQ:
+    return AST_EQ;
   case SB_NEQ:
+    return AST_NE;
   case SB_LE:
+    return AST_LE;
   case SB_LT:
+    return AST_LT;
   case SB_GE:
-  case SB_GT:
-  case SB_RSEL:
-  case SB_SEMICOLON:
-  case KW_END:
-  case KW_ELSE:
-  case KW_THEN:
-    break;
+    return AST_GE;
   default:
-    error(ERR_INVALID_ARGUMENTS, lookAhead->lineNo, lookAhead->colNo);
+    return AST_GT;
   }
 }
 
-void compileCondition(void) {
+void compileCondition(Compiler* compiler) {
   Type* type1;
   Type* type2;
   TokenType op;
 
-  type1 = compileExpression();
-  checkBasicType(type1);
+  type1 = compileExpression(compiler);
+  checkBasicType(compiler, type1);
 
-  op = lookAhead->tokenType;
+  op = compiler->lookAhead->tokenType;
   switch (op) {
   case SB_EQ:
-    eat(SB_EQ);
+    eat(compiler, SB_EQ);
     break;
   case SB_NEQ:
-    eat(SB_NEQ);
+    eat(compiler, SB_NEQ);
     break;
   case SB_LE:
-    eat(SB_LE);
+    eat(compiler, SB_LE);
     break;
   case SB_LT:
-    eat(SB_LT);
+    eat(compiler, SB_LT);
     break;
   case SB_GE:
-    eat(SB_GE);
+    eat(compiler, SB_GE);
     break;
   case SB_GT:
-    eat(SB_GT);
+    eat(compiler, SB_GT);
     break;
   default:
-    error(ERR_INVALID_COMPARATOR, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_COMPARATOR, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
   }
 
-  type2 = compileExpression();
-  checkTypeEquality(type1,type2);
+  type2 = compileExpression(compiler);
+
+  if (compiler->ast != NULL) {
+    buildNode(compiler, comparisonKind(op), 2);
+    return;
+  }
+  checkTypeEquality(compiler, type1,type2);
 
   switch (op) {
   case SB_EQ:
-    genEQ();
+    genEQ(compiler);
     break;
   case SB_NEQ:
-    genNE();
+    genNE(compiler);
     break;
   case SB_LE:
-    genLE();
+    genLE(compiler);
     break;
   case SB_LT:
-    genLT();
+    genLT(compiler);
     break;
   case SB_GE:
-    genGE();
+    genGE(compiler);
     break;
   case SB_GT:
-    genGT();
+    genGT(compiler);
     break;
   default:
     break;
@@ -673,253 +878,355 @@ void compileCondition(void) {
 
 }
 
-Type* compileExpression(void) {
+Type* compileExpression(Compiler* compiler) {
+  jmp_buf recovery;
+  jmp_buf* outer = compiler->recovery;
+  Type* volatile type = NULL;
+  int depth = (compiler->ast != NULL) ? nodeDepth(compiler) : 0;
+
+  compiler->recovery = &recovery;
+  if (setjmp(recovery) == 0)
+    type = compileExpression1(compiler);
+  else {
+    skipTo(compiler, isExpressionFollow);
+    type = NULL;
+    if (compiler->ast != NULL) {
+      dropNodes(compiler, depth);
+      buildNode(compiler, AST_ERROR, 0);
+    }
+  }
+  compiler->recovery = outer;
+  return type;
+}
+
+Type* compileExpression1(Compiler* compiler) {
   Type* type;
   
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case SB_PLUS:
-    eat(SB_PLUS);
-    type = compileExpression2();
-    checkIntType(type);
+    eat(compiler, SB_PLUS);
+    type = compileExpression2(compiler);
+    checkIntType(compiler, type);
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_PLUS, 1);
     break;
   case SB_MINUS:
-    eat(SB_MINUS);
-    type = compileExpression2();
-    checkIntType(type);
-    genNEG();
+    eat(compiler, SB_MINUS);
+    type = compileExpression2(compiler);
+    checkIntType(compiler, type);
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_NEG, 1);
+    else genNEG(compiler);
     break;
   default:
-    type = compileExpression2();
+    type = compileExpression2(compiler);
   }
   return type;
 }
 
-Type* compileExpression2(void) {
+Type* compileExpression2(Compiler* compiler) {
   Type* type;
 
-  type = compileTerm();
-  type = compileExpression3(type);
+  type = compileTerm(compiler);
+  type = compileExpression3(compiler, type);
 
   return type;
 }
 
 
-Type* compileExpression3(Type* argType1) {
+Type* compileExpression3(Compiler* compiler, Type* argType1) {
   Type* argType2;
   Type* resultType;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case SB_PLUS:
-    eat(SB_PLUS);
-    checkIntType(argType1);
-    argType2 = compileTerm();
-    checkIntType(argType2);
+    eat(compiler, SB_PLUS);
+    checkIntType(compiler, argType1);
+    argType2 = compileTerm(compiler);
+    checkIntType(compiler, argType2);
 
-    genAD();
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_ADD, 2);
+    else genAD(compiler);
 
-    resultType = compileExpression3(argType1);
+    resultType = compileExpression3(compiler, argType1);
     break;
   case SB_MINUS:
-    eat(SB_MINUS);
-    checkIntType(argType1);
-    argType2 = compileTerm();
-    checkIntType(argType2);
+    eat(compiler, SB_MINUS);
+    checkIntType(compiler, argType1);
+    argType2 = compileTerm(compiler);
+    checkIntType(compiler, argType2);
 
-    genSB();
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_SUB, 2);
+    else genSB(compiler);
 
-    resultType = compileExpression3(argType1);
+    resultType = compileExpression3(compiler, argType1);
     break;
+  default:
     // check the FOLLOW set
-  case KW_TO:
-  case KW_DO:
-  case SB_RPAR:
-  case SB_COMMA:
-  case SB_EQ:
-  case SB_NEQ:
-  case SB_LE:
-  case SB_LT:
-  case SB_GE:
-  case SB_GT:
-  case SB_RSEL:
-  case SB_SEMICOLON:
-  case KW_END:
-  case KW_ELSE:
-  case KW_THEN:
+    if (!isExpressionFollow(compiler->lookAhead->tokenType))
+      error(compiler, ERR_INVALID_EXPRESSION, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
     resultType = argType1;
-    break;
-  default:
-    error(ERR_INVALID_EXPRESSION, lookAhead->lineNo, lookAhead->colNo);
   }
   return resultType;
 }
 
-Type* compileTerm(void) {
+Type* compileTerm(Compiler* compiler) {
   Type* type;
-  type = compileFactor();
-  type = compileTerm2(type);
+  type = compileFactor(compiler);
+  type = compileTerm2(compiler, type);
 
   return type;
 }
 
-Type* compileTerm2(Type* argType1) {
+Type* compileTerm2(Compiler* compiler, Type* argType1) {
   Type* argType2;
   Type* resultType;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case SB_TIMES:
-    eat(SB_TIMES);
-    checkIntType(argType1);
-    argType2 = compileFactor();
-    checkIntType(argType2);
+    eat(compiler, SB_TIMES);
+    checkIntType(compiler, argType1);
+    argType2 = compileFactor(compiler);
+    checkIntType(compiler, argType2);
 
-    genML();
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_MUL, 2);
+    else genML(compiler);
 
-    resultType = compileTerm2(argType1);
+    resultType = compileTerm2(compiler, argType1);
     break;
   case SB_SLASH:
-    eat(SB_SLASH);
-    checkIntType(argType1);
-    argType2 = compileFactor();
-    checkIntType(argType2);
+    eat(compiler, SB_SLASH);
+    checkIntType(compiler, argType1);
+    argType2 = compileFactor(compiler);
+    checkIntType(compiler, argType2);
 
-    genDV();
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_DIV, 2);
+    else genDV(compiler);
 
-    resultType = compileTerm2(argType1);
+    resultType = compileTerm2(compiler, argType1);
     break;
     // check the FOLLOW set
   case SB_PLUS:
   case SB_MINUS:
-  case KW_TO:
-  case KW_DO:
-  case SB_RPAR:
-  case SB_COMMA:
-  case SB_EQ:
-  case SB_NEQ:
-  case SB_LE:
-  case SB_LT:
-  case SB_GE:
-  case SB_GT:
-  case SB_RSEL:
-  case SB_SEMICOLON:
-  case KW_END:
-  case KW_ELSE:
-  case KW_THEN:
     resultType = argType1;
     break;
   default:
-    error(ERR_INVALID_TERM, lookAhead->lineNo, lookAhead->colNo);
+    if (!isExpressionFollow(compiler->lookAhead->tokenType))
+      error(compiler, ERR_INVALID_TERM, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
+    resultType = argType1;
   }
   return resultType;
 }
 
-Type* compileFactor(void) {
+Type* compileFactor(Compiler* compiler) {
   Type* type;
   Object* obj;
+  int depth;
 
-  switch (lookAhead->tokenType) {
+  switch (compiler->lookAhead->tokenType) {
   case TK_NUMBER:
-    eat(TK_NUMBER);
-    type = intType;
-    genLC(currentToken->value);
+    eat(compiler, TK_NUMBER);
+    type = compiler->intType;
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_NUMBER, 0)->value = compiler->currentToken->value;
+    else genLC(compiler, compiler->currentToken->value);
     break;
   case TK_CHAR:
-    eat(TK_CHAR);
-    type = charType;
-    genLC(currentToken->value);
+    eat(compiler, TK_CHAR);
+    type = compiler->charType;
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_CHAR, 0)->value = compiler->currentToken->value;
+    else genLC(compiler, compiler->currentToken->value);
     break;
   case TK_IDENT:
-    eat(TK_IDENT);
-    obj = checkDeclaredIdent(currentToken->string);
+    eat(compiler, TK_IDENT);
+    obj = checkDeclaredIdent(compiler, compiler->currentToken->string);
 
     switch (obj->kind) {
     case OBJ_CONSTANT:
       switch (obj->constAttrs->value->type) {
       case TP_INT:
-	type = intType;
-	genLC(obj->constAttrs->value->intValue);
+	type = compiler->intType;
+	if (compiler->ast != NULL)
+	  buildNode(compiler, AST_NUMBER, 0)->value = obj->constAttrs->value->intValue;
+	else genLC(compiler, obj->constAttrs->value->intValue);
 	break;
       case TP_CHAR:
-	type = charType;
-	genLC(obj->constAttrs->value->charValue);
+	type = compiler->charType;
+	if (compiler->ast != NULL)
+	  buildNode(compiler, AST_CHAR, 0)->value = obj->constAttrs->value->charValue;
+	else genLC(compiler, obj->constAttrs->value->charValue);
 	break;
       default:
 	break;
       }
       break;
     case OBJ_VARIABLE:
-      if (obj->varAttrs->type->typeClass == TP_ARRAY) {
-	genVariableAddress(obj);
-	type = compileIndexes(obj->varAttrs->type);
-	genLI();
+      if (compiler->ast != NULL) {
+	buildNode(compiler, AST_NAME, 0)->object = obj;
+	if (obj->varAttrs->type->typeClass == TP_ARRAY)
+	  compileIndexes(compiler, obj->varAttrs->type);
+      } else if (obj->varAttrs->type->typeClass == TP_ARRAY) {
+	genVariableAddress(compiler, obj);
+	type = compileIndexes(compiler, obj->varAttrs->type);
+	genLI(compiler);
       } else {
 	type = obj->varAttrs->type;
-	genVariableValue(obj);
+	genVariableValue(compiler, obj);
       }
       break;
     case OBJ_PARAMETER:
-      // TODO: push parameter's value onto the stack
+      if (compiler->ast != NULL)
+	buildNode(compiler, AST_NAME, 0)->object = obj;
+      else genParameterValue(compiler, obj);
       type = obj->paramAttrs->type;
       break;
     case OBJ_FUNCTION:
-      // TODO: generate function call
-      if (isPredefinedFunction(obj)) {
-	compileArguments(obj->funcAttrs->paramList);
-	genPredefinedFunctionCall(obj);
+      if (compiler->ast != NULL) {
+	depth = nodeDepth(compiler);
+	compileArguments(compiler, obj->funcAttrs->paramList);
+	buildList(compiler, AST_CALL, depth)->object = obj;
+      } else if (isPredefinedFunction(compiler, obj)) {
+	compileArguments(compiler, obj->funcAttrs->paramList);
+	genPredefinedFunctionCall(compiler, obj);
       } else {
-	compileArguments(obj->funcAttrs->paramList);
+	// The return value is left on the stack where the frame was
+	genINT(compiler, RESERVED_WORDS);
+	compileArguments(compiler, obj->funcAttrs->paramList);
+	genDCT(compiler, RESERVED_WORDS + FUNCTION_PARAM_COUNT(obj));
+	genFunctionCall(compiler, obj);
       }
       type = obj->funcAttrs->returnType;
       break;
     default: 
-      error(ERR_INVALID_FACTOR,currentToken->lineNo, currentToken->colNo);
+      error(compiler, ERR_INVALID_FACTOR,compiler->currentToken->lineNo, compiler->currentToken->colNo);
       break;
     }
     break;
   case SB_LPAR:
-    eat(SB_LPAR);
-    type = compileExpression();
-    eat(SB_RPAR);
+    eat(compiler, SB_LPAR);
+    type = compileExpression(compiler);
+    eat(compiler, SB_RPAR);
     break;
   default:
-    error(ERR_INVALID_FACTOR, lookAhead->lineNo, lookAhead->colNo);
+    error(compiler, ERR_INVALID_FACTOR, compiler->lookAhead->lineNo, compiler->lookAhead->colNo);
   }
-  
+
+  // The checking pass types the tree
+  if (compiler->ast != NULL)
+    return NULL;
   return type;
 }
 
-Type* compileIndexes(Type* arrayType) {
-  // TODO: Generate code for computing array element address
+// The address of the array is on the stack: adds index * element size
+// for every index
+Type* compileIndexes(Compiler* compiler, Type* arrayType) {
   Type* type;
 
-  
-  while (lookAhead->tokenType == SB_LSEL) {
-    eat(SB_LSEL);
-    type = compileExpression();
-    checkIntType(type);
-    checkArrayType(arrayType);
-
-    arrayType = arrayType->elementType;
-    eat(SB_RSEL);
+  while (compiler->lookAhead->tokenType == SB_LSEL) {
+    eat(compiler, SB_LSEL);
+    type = compileExpression(compiler);
+
+    if (compiler->ast != NULL)
+      buildNode(compiler, AST_INDEX, 2);
+    else {
+      checkIntType(compiler, type);
+      checkArrayType(compiler, arrayType);
+      if (arrayType != NULL) {
+	arrayType = arrayType->elementType;
+	genLC(compiler, sizeOfType(arrayType));
+	genML(compiler);
+	genAD(compiler);
+      }
+    }
+    eat(compiler, SB_RSEL);
   }
-  checkBasicType(arrayType);
+  if (compiler->ast != NULL)
+    return NULL;
+  checkBasicType(compiler, arrayType);
   return arrayType;
 }
 
-int compile(char *fileName) {
-  if (openInputStream(fileName) == IO_ERROR)
-    return IO_ERROR;
+// The passes over the syntax tree: every type is checked, then code is
+// generated if there was no error at all
+static void compileTree(Compiler* compiler) {
+  Node* program = compiler->ast->program;
+  IrFunction* ir;
+  int stage;
+
+  checkTree(compiler, program);
+  if (compiler->errorCount > 0) return;
+
+  stage = enterStage(STAGE_CODEGEN);
+  ir = buildIr(compiler, program);
+  if (compiler->ast->optLevel >= 2)
+    optimizeIr(compiler, ir);
+  if (compiler->ast->printIr)
+    printIr(ir);
+  emitIr(compiler, ir);
+  leaveStage(stage);
+}
 
-  currentToken = NULL;
-  lookAhead = getValidToken();
+// What the parser built before it gave up: the complete subtrees left on
+// the node stack, statements and declarations among them
+static void checkPartialTree(Compiler* compiler) {
+  int i;
 
-  initSymTab();
+  for (i = 0; i < compiler->ast->stackTop; i++)
+    checkTree(compiler, compiler->ast->stack[i]);
+}
 
-  compileProgram();
+int compile(Compiler* compiler, char *fileName) {
+  int result = IO_SUCCESS;
+  volatile int abandoned = 0;
 
-  cleanSymTab();
-  free(currentToken);
-  free(lookAhead);
-  closeInputStream();
-  return IO_SUCCESS;
+  resetCompiler(compiler);
+  if (openInputStream(compiler, fileName) == IO_ERROR)
+    return IO_ERROR;
+
+  compiler->currentToken = NULL;
+  compiler->lookAhead = NULL;
+  if (compiler->symtab == NULL)
+    initSymTab(compiler);
+
+  // Errors the parser can't recover from, and too many errors, land here
+  compiler->recovery = NULL;
+  if (setjmp(compiler->errorJump) == 0) {
+    compiler->lookAhead = getValidToken(compiler);
+    compileProgram(compiler);
+    if (compiler->ast != NULL)
+      compileTree(compiler);
+    // The code buffer drops what doesn't fit
+    if (compiler->codeBlock->codeSize >= compiler->codeBlock->maxSize)
+      reportError(compiler, ERR_CODE_TOO_LARGE, compiler->currentToken->lineNo, compiler->currentToken->colNo);
+    if (compiler->errorCount > 0)
+      result = COMPILE_ERROR;
+  } else {
+    // The jump may have come from inside the scanner
+    leaveStage(STAGE_PARSER);
+    // An error in scan() leaves lookAhead still pointing at currentToken
+    if (compiler->lookAhead == compiler->currentToken)
+      compiler->lookAhead = NULL;
+    result = COMPILE_ERROR;
+    abandoned = 1;
+  }
+  // The type errors of what was parsed are reported all the same, as the
+  // single pass reports them as it goes
+  if (abandoned && (compiler->ast != NULL) && (compiler->errorCount < MAX_ERRORS) &&
+      (setjmp(compiler->errorJump) == 0))
+    checkPartialTree(compiler);
+  // The tree is checked after it is parsed: its type errors come last
+  if ((result == COMPILE_ERROR) && (compiler->ast != NULL))
+    sortDiagnostics(compiler);
+
+  resetSymTab(compiler);
+  countedFree(compiler->currentToken, sizeof(Token));
+  countedFree(compiler->lookAhead, sizeof(Token));
+  closeInputStream(compiler);
+  return result;
 
 }
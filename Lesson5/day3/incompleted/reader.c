@@ -6,32 +6,32 @@
 
 #include <stdio.h>
 #include "reader.h"
+#include "stats.h"
 
-FILE *inputStream;
-int lineNo, colNo;
-int currentChar;
+int readChar(Compiler* compiler) {
+  int stage = enterStage(STAGE_READER);
 
-int readChar(void) {
-  currentChar = getc(inputStream);
-  colNo ++;
-  if (currentChar == '\n') {
-    lineNo ++;
-    colNo = 0;
+  compiler->currentChar = getc(compiler->inputStream);
+  compiler->colNo ++;
+  if (compiler->currentChar == '\n') {
+    compiler->lineNo ++;
+    compiler->colNo = 0;
   }
-  return currentChar;
+  leaveStage(stage);
+  return compiler->currentChar;
 }
 
-int openInputStream(char *fileName) {
-  inputStream = fopen(fileName, "rt");
-  if (inputStream == NULL)
+int openInputStream(Compiler* compiler, char *fileName) {
+  compiler->inputStream = fopen(fileName, "rt");
+  if (compiler->inputStream == NULL)
     return IO_ERROR;
-  lineNo = 1;
-  colNo = 0;
-  readChar();
+  compiler->lineNo = 1;
+  compiler->colNo = 0;
+  readChar(compiler);
   return IO_SUCCESS;
 }
 
-void closeInputStream() {
-  fclose(inputStream);
+void closeInputStream(Compiler* compiler) {
+  fclose(compiler->inputStream);
 }
 
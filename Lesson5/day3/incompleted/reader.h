@@ -7,11 +7,13 @@
 #ifndef __READER_H__
 #define __READER_H__
 
+#include "compiler.h"
+
 #define IO_ERROR 0
 #define IO_SUCCESS 1
 
-int readChar(void);
-int openInputStream(char *fileName);
-void closeInputStream(void);
+int readChar(Compiler* compiler);
+int openInputStream(Compiler* compiler, char *fileName);
+void closeInputStream(Compiler* compiler);
 
 #endif
@@ -13,25 +13,22 @@
 #include "token.h"
 #include "error.h"
 #include "scanner.h"
+#include "stats.h"
 
 
-extern int lineNo;
-extern int colNo;
-extern int currentChar;
-
 extern CharCode charCodes[];
 
 /***************************************************************/
 
-void skipBlank() {
-  while ((currentChar != EOF) && (charCodes[currentChar] == CHAR_SPACE))
-    readChar();
+void skipBlank(Compiler* compiler) {
+  while ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_SPACE))
+    readChar(compiler);
 }
 
-void skipComment() {
+void skipComment(Compiler* compiler) {
   int state = 0;
-  while ((currentChar != EOF) && (state < 2)) {
-    switch (charCodes[currentChar]) {
+  while ((compiler->currentChar != EOF) && (state < 2)) {
+    switch (charCodes[compiler->currentChar]) {
     case CHAR_TIMES:
       state = 1;
       break;
@@ -42,27 +39,27 @@ void skipComment() {
     default:
       state = 0;
     }
-    readChar();
+    readChar(compiler);
   }
   if (state != 2) 
-    error(ERR_END_OF_COMMENT, lineNo, colNo);
+    reportError(compiler, ERR_END_OF_COMMENT, compiler->lineNo, compiler->colNo);
 }
 
-Token* readIdentKeyword(void) {
-  Token *token = makeToken(TK_NONE, lineNo, colNo);
+Token* readIdentKeyword(Compiler* compiler) {
+  Token *token = makeToken(TK_NONE, compiler->lineNo, compiler->colNo);
   int count = 1;
 
-  token->string[0] = toupper((char)currentChar);
-  readChar();
+  token->string[0] = toupper((char)compiler->currentChar);
+  readChar(compiler);
 
-  while ((currentChar != EOF) && 
-	 ((charCodes[currentChar] == CHAR_LETTER) || (charCodes[currentChar] == CHAR_DIGIT))) {
-    if (count <= MAX_IDENT_LEN) token->string[count++] = toupper((char)currentChar);
-    readChar();
+  while ((compiler->currentChar != EOF) && 
+	 ((charCodes[compiler->currentChar] == CHAR_LETTER) || (charCodes[compiler->currentChar] == CHAR_DIGIT))) {
+    if (count <= MAX_IDENT_LEN) token->string[count++] = toupper((char)compiler->currentChar);
+    readChar(compiler);
   }
 
   if (count > MAX_IDENT_LEN) {
-    error(ERR_IDENT_TOO_LONG, token->lineNo, token->colNo);
+    reportError(compiler, ERR_IDENT_TOO_LONG, token->lineNo, token->colNo);
     return token;
   }
 
@@ -75,13 +72,13 @@ Token* readIdentKeyword(void) {
   return token;
 }
 
-Token* readNumber(void) {
-  Token *token = makeToken(TK_NUMBER, lineNo, colNo);
+Token* readNumber(Compiler* compiler) {
+  Token *token = makeToken(TK_NUMBER, compiler->lineNo, compiler->colNo);
   int count = 0;
 
-  while ((currentChar != EOF) && (charCodes[currentChar] == CHAR_DIGIT)) {
-    token->string[count++] = (char)currentChar;
-    readChar();
+  while ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_DIGIT)) {
+    token->string[count++] = (char)compiler->currentChar;
+    readChar(compiler);
   }
 
   token->string[count] = '\0';
@@ -89,157 +86,167 @@ Token* readNumber(void) {
   return token;
 }
 
-Token* readConstChar(void) {
-  Token *token = makeToken(TK_CHAR, lineNo, colNo);
+Token* readConstChar(Compiler* compiler) {
+  Token *token = makeToken(TK_CHAR, compiler->lineNo, compiler->colNo);
 
-  readChar();
-  if (currentChar == EOF) {
+  readChar(compiler);
+  if (compiler->currentChar == EOF) {
     token->tokenType = TK_NONE;
-    error(ERR_INVALID_CONSTANT_CHAR, token->lineNo, token->colNo);
+    reportError(compiler, ERR_INVALID_CONSTANT_CHAR, token->lineNo, token->colNo);
     return token;
   }
     
-  token->string[0] = currentChar;
+  token->string[0] = compiler->currentChar;
   token->string[1] = '\0';
-  token->value = currentChar;
+  token->value = compiler->currentChar;
 
-  readChar();
-  if (currentChar == EOF) {
+  readChar(compiler);
+  if (compiler->currentChar == EOF) {
     token->tokenType = TK_NONE;
-    error(ERR_INVALID_CONSTANT_CHAR, token->lineNo, token->colNo);
+    reportError(compiler, ERR_INVALID_CONSTANT_CHAR, token->lineNo, token->colNo);
     return token;
   }
 
-  if (charCodes[currentChar] == CHAR_SINGLEQUOTE) {
-    readChar();
+  if (charCodes[compiler->currentChar] == CHAR_SINGLEQUOTE) {
+    readChar(compiler);
     return token;
   } else {
     token->tokenType = TK_NONE;
-    error(ERR_INVALID_CONSTANT_CHAR, token->lineNo, token->colNo);
+    reportError(compiler, ERR_INVALID_CONSTANT_CHAR, token->lineNo, token->colNo);
     return token;
   }
 }
 
-Token* getToken(void) {
+static Token* scanToken(Compiler* compiler) {
   Token *token;
   int ln, cn;
 
-  if (currentChar == EOF) 
-    return makeToken(TK_EOF, lineNo, colNo);
+  if (compiler->currentChar == EOF) 
+    return makeToken(TK_EOF, compiler->lineNo, compiler->colNo);
 
-  switch (charCodes[currentChar]) {
-  case CHAR_SPACE: skipBlank(); return getToken();
-  case CHAR_LETTER: return readIdentKeyword();
-  case CHAR_DIGIT: return readNumber();
+  switch (charCodes[compiler->currentChar]) {
+  case CHAR_SPACE: skipBlank(compiler); return scanToken(compiler);
+  case CHAR_LETTER: return readIdentKeyword(compiler);
+  case CHAR_DIGIT: return readNumber(compiler);
   case CHAR_PLUS: 
-    token = makeToken(SB_PLUS, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_PLUS, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_MINUS:
-    token = makeToken(SB_MINUS, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_MINUS, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_TIMES:
-    token = makeToken(SB_TIMES, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_TIMES, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_SLASH:
-    token = makeToken(SB_SLASH, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_SLASH, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_LT:
-    ln = lineNo;
-    cn = colNo;
-    readChar();
-    if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
-      readChar();
+    ln = compiler->lineNo;
+    cn = compiler->colNo;
+    readChar(compiler);
+    if ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_EQ)) {
+      readChar(compiler);
       return makeToken(SB_LE, ln, cn);
     } else return makeToken(SB_LT, ln, cn);
   case CHAR_GT:
-    ln = lineNo;
-    cn = colNo;
-    readChar();
-    if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
-      readChar();
+    ln = compiler->lineNo;
+    cn = compiler->colNo;
+    readChar(compiler);
+    if ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_EQ)) {
+      readChar(compiler);
       return makeToken(SB_GE, ln, cn);
     } else return makeToken(SB_GT, ln, cn);
   case CHAR_EQ: 
-    token = makeToken(SB_EQ, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_EQ, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_EXCLAIMATION:
-    ln = lineNo;
-    cn = colNo;
-    readChar();
-    if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
-      readChar();
+    ln = compiler->lineNo;
+    cn = compiler->colNo;
+    readChar(compiler);
+    if ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_EQ)) {
+      readChar(compiler);
       return makeToken(SB_NEQ, ln, cn);
     } else {
       token = makeToken(TK_NONE, ln, cn);
-      error(ERR_INVALID_SYMBOL, ln, cn);
+      reportError(compiler, ERR_INVALID_SYMBOL, ln, cn);
       return token;
     }
   case CHAR_COMMA:
-    token = makeToken(SB_COMMA, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_COMMA, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_PERIOD:
-    ln = lineNo;
-    cn = colNo;
-    readChar();
-    if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_RPAR)) {
-      readChar();
+    ln = compiler->lineNo;
+    cn = compiler->colNo;
+    readChar(compiler);
+    if ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_RPAR)) {
+      readChar(compiler);
       return makeToken(SB_RSEL, ln, cn);
     } else return makeToken(SB_PERIOD, ln, cn);
   case CHAR_SEMICOLON:
-    token = makeToken(SB_SEMICOLON, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_SEMICOLON, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   case CHAR_COLON:
-    ln = lineNo;
-    cn = colNo;
-    readChar();
-    if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
-      readChar();
+    ln = compiler->lineNo;
+    cn = compiler->colNo;
+    readChar(compiler);
+    if ((compiler->currentChar != EOF) && (charCodes[compiler->currentChar] == CHAR_EQ)) {
+      readChar(compiler);
       return makeToken(SB_ASSIGN, ln, cn);
     } else return makeToken(SB_COLON, ln, cn);
-  case CHAR_SINGLEQUOTE: return readConstChar();
+  case CHAR_SINGLEQUOTE: return readConstChar(compiler);
   case CHAR_LPAR:
-    ln = lineNo;
-    cn = colNo;
-    readChar();
+    ln = compiler->lineNo;
+    cn = compiler->colNo;
+    readChar(compiler);
 
-    if (currentChar == EOF) 
+    if (compiler->currentChar == EOF) 
       return makeToken(SB_LPAR, ln, cn);
 
-    switch (charCodes[currentChar]) {
+    switch (charCodes[compiler->currentChar]) {
     case CHAR_PERIOD:
-      readChar();
+      readChar(compiler);
       return makeToken(SB_LSEL, ln, cn);
     case CHAR_TIMES:
-      readChar();
-      skipComment();
-      return getToken();
+      readChar(compiler);
+      skipComment(compiler);
+      return scanToken(compiler);
     default:
       return makeToken(SB_LPAR, ln, cn);
     }
   case CHAR_RPAR:
-    token = makeToken(SB_RPAR, lineNo, colNo);
-    readChar(); 
+    token = makeToken(SB_RPAR, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   default:
-    token = makeToken(TK_NONE, lineNo, colNo);
-    error(ERR_INVALID_SYMBOL, lineNo, colNo);
-    readChar(); 
+    token = makeToken(TK_NONE, compiler->lineNo, compiler->colNo);
+    reportError(compiler, ERR_INVALID_SYMBOL, compiler->lineNo, compiler->colNo);
+    readChar(compiler); 
     return token;
   }
 }
 
-Token* getValidToken(void) {
-  Token *token = getToken();
+Token* getToken(Compiler* compiler) {
+  int stage = enterStage(STAGE_SCANNER);
+  Token* token = scanToken(compiler);
+
+  if (currentStats != NULL)
+    currentStats->tokenCount ++;
+  leaveStage(stage);
+  return token;
+}
+
+Token* getValidToken(Compiler* compiler) {
+  Token *token = getToken(compiler);
   while (token->tokenType == TK_NONE) {
-    free(token);
-    token = getToken();
+    countedFree(token, sizeof(Token));
+    token = getToken(compiler);
   }
   return token;
 }
@@ -8,9 +8,10 @@
 #define __SCANNER_H__
 
 #include "token.h"
+#include "compiler.h"
 
-Token* getToken(void);
-Token* getValidToken(void);
+Token* getToken(Compiler* compiler);
+Token* getValidToken(Compiler* compiler);
 void printToken(Token *token);
 
 #endif
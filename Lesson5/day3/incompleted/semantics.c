@@ -10,11 +10,8 @@
 #include "semantics.h"
 #include "error.h"
 
-extern SymTab* symtab;
-extern Token* currentToken;
-
-Object* lookupObject(char *name) {
-  Scope* scope = symtab->currentScope;
+Object* lookupObject(Compiler* compiler, char *name) {
+  Scope* scope = compiler->symtab->currentScope;
   Object* obj;
 
   while (scope != NULL) {
@@ -22,128 +19,311 @@ Object* lookupObject(char *name) {
     if (obj != NULL) return obj;
     scope = scope->outer;
   }
-  obj = findObject(symtab->globalObjectList, name);
+  obj = findObject(compiler->symtab->globalObjectList, name);
   if (obj != NULL) return obj;
   return NULL;
 }
 
-void checkFreshIdent(char *name) {
-  if (findObject(symtab->currentScope->objList, name) != NULL)
-    error(ERR_DUPLICATE_IDENT, currentToken->lineNo, currentToken->colNo);
+void checkFreshIdent(Compiler* compiler, char *name) {
+  if (findObject(compiler->symtab->currentScope->objList, name) != NULL)
+    error(compiler, ERR_DUPLICATE_IDENT, compiler->currentToken->lineNo, compiler->currentToken->colNo);
 }
 
-Object* checkDeclaredIdent(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredIdent(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   if (obj == NULL) {
-    error(ERR_UNDECLARED_IDENT,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_IDENT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   }
   return obj;
 }
 
-Object* checkDeclaredConstant(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredConstant(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   if (obj == NULL)
-    error(ERR_UNDECLARED_CONSTANT,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_CONSTANT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   if (obj->kind != OBJ_CONSTANT)
-    error(ERR_INVALID_CONSTANT,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_CONSTANT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
 
   return obj;
 }
 
-Object* checkDeclaredType(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredType(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   if (obj == NULL)
-    error(ERR_UNDECLARED_TYPE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_TYPE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   if (obj->kind != OBJ_TYPE)
-    error(ERR_INVALID_TYPE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_TYPE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
 
   return obj;
 }
 
-Object* checkDeclaredVariable(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredVariable(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   if (obj == NULL)
-    error(ERR_UNDECLARED_VARIABLE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_VARIABLE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   if (obj->kind != OBJ_VARIABLE)
-    error(ERR_INVALID_VARIABLE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_VARIABLE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
 
   return obj;
 }
 
-Object* checkDeclaredFunction(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredFunction(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   if (obj == NULL)
-    error(ERR_UNDECLARED_FUNCTION,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_FUNCTION,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   if (obj->kind != OBJ_FUNCTION)
-    error(ERR_INVALID_FUNCTION,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_FUNCTION,compiler->currentToken->lineNo, compiler->currentToken->colNo);
 
   return obj;
 }
 
-Object* checkDeclaredProcedure(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredProcedure(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   if (obj == NULL) 
-    error(ERR_UNDECLARED_PROCEDURE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_PROCEDURE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   if (obj->kind != OBJ_PROCEDURE)
-    error(ERR_INVALID_PROCEDURE,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_PROCEDURE,compiler->currentToken->lineNo, compiler->currentToken->colNo);
 
   return obj;
 }
 
-Object* checkDeclaredLValueIdent(char* name) {
-  Object* obj = lookupObject(name);
+Object* checkDeclaredLValueIdent(Compiler* compiler, char* name) {
+  Object* obj = lookupObject(compiler, name);
   Scope* scope;
 
   if (obj == NULL)
-    error(ERR_UNDECLARED_IDENT,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_UNDECLARED_IDENT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
 
   switch (obj->kind) {
   case OBJ_VARIABLE:
   case OBJ_PARAMETER:
     break;
   case OBJ_FUNCTION:
-    scope = symtab->currentScope;
+    scope = compiler->symtab->currentScope;
     while ((scope != NULL) && (scope != obj->funcAttrs->scope)) 
       scope = scope->outer;
 
     if (scope == NULL)
-      error(ERR_INVALID_IDENT,currentToken->lineNo, currentToken->colNo);
+      error(compiler, ERR_INVALID_IDENT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
     break;
   default:
-    error(ERR_INVALID_IDENT,currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_INVALID_IDENT,compiler->currentToken->lineNo, compiler->currentToken->colNo);
   }
 
   return obj;
 }
 
 
-void checkIntType(Type* type) {
-  if ((type != NULL) && (type->typeClass == TP_INT))
+// A NULL type comes from an expression whose error was already reported
+
+void checkIntType(Compiler* compiler, Type* type) {
+  if ((type == NULL) || (type->typeClass == TP_INT))
     return;
-  else error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+  else error(compiler, ERR_TYPE_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
 }
 
-void checkCharType(Type* type) {
-  if ((type != NULL) && (type->typeClass == TP_CHAR))
+void checkCharType(Compiler* compiler, Type* type) {
+  if ((type == NULL) || (type->typeClass == TP_CHAR))
     return;
-  else error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+  else error(compiler, ERR_TYPE_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
 }
 
-void checkBasicType(Type* type) {
-  if ((type != NULL) && ((type->typeClass == TP_INT) || (type->typeClass == TP_CHAR)))
+void checkBasicType(Compiler* compiler, Type* type) {
+  if ((type == NULL) || (type->typeClass == TP_INT) || (type->typeClass == TP_CHAR))
     return;
-  else error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+  else error(compiler, ERR_TYPE_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
 }
 
-void checkArrayType(Type* type) {
-  if ((type != NULL) && (type->typeClass == TP_ARRAY))
+void checkArrayType(Compiler* compiler, Type* type) {
+  if ((type == NULL) || (type->typeClass == TP_ARRAY))
     return;
-  else error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+  else error(compiler, ERR_TYPE_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
 }
 
-void checkTypeEquality(Type* type1, Type* type2) {
+void checkTypeEquality(Compiler* compiler, Type* type1, Type* type2) {
+  if ((type1 == NULL) || (type2 == NULL))
+    return;
   if (compareType(type1, type2) == 0)
-    error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+    error(compiler, ERR_TYPE_INCONSISTENCY, compiler->currentToken->lineNo, compiler->currentToken->colNo);
+}
+
+
+/******************* The checking pass ******************************/
+
+// The node then has type NULL, which keeps the error from cascading into
+// the nodes above it
+static Type* typeError(Compiler* compiler, Node* node) {
+  reportError(compiler, ERR_TYPE_INCONSISTENCY, node->lineNo, node->colNo);
+  return NULL;
+}
+
+static int isIntType(Type* type) {
+  return (type == NULL) || (type->typeClass == TP_INT);
+}
+
+static int isBasicType(Type* type) {
+  return (type == NULL) || (type->typeClass == TP_INT) || (type->typeClass == TP_CHAR);
+}
+
+static int areEqualTypes(Type* type1, Type* type2) {
+  return (type1 == NULL) || (type2 == NULL) || compareType(type1, type2);
+}
+
+static Type* checkValue(Compiler* compiler, Node* node);
+
+// A variable, parameter or return value, or an element of an array,
+// which may be an array itself
+static Type* checkReference(Compiler* compiler, Node* node) {
+  Object* obj;
+  Type* arrayType;
+
+  switch (node->kind) {
+  case AST_NAME:
+    obj = node->object;
+    if (obj->kind == OBJ_VARIABLE)
+      node->type = obj->varAttrs->type;
+    else if (obj->kind == OBJ_PARAMETER)
+      node->type = obj->paramAttrs->type;
+    else node->type = obj->funcAttrs->returnType;
+    break;
+  case AST_INDEX:
+    arrayType = checkReference(compiler, node->kids[0]);
+    if (!isIntType(checkValue(compiler, node->kids[1])))
+      node->type = typeError(compiler, node);
+    else if (arrayType == NULL)
+      node->type = NULL;
+    else if (arrayType->typeClass != TP_ARRAY)
+      node->type = typeError(compiler, node);
+    else node->type = arrayType->elementType;
+    break;
+  default:
+    node->type = checkValue(compiler, node);
+    break;
+  }
+  return node->type;
+}
+
+static void checkArguments(Compiler* compiler, Node* call) {
+  Node* arg = call->kids[0];
+  ObjectNode* param;
+  Type* type;
+
+  if (call->object->kind == OBJ_FUNCTION)
+    param = call->object->funcAttrs->paramList;
+  else param = call->object->procAttrs->paramList;
+
+  // The parser has reported different numbers of arguments and parameters
+  for (; (arg != NULL) && (param != NULL); arg = arg->next, param = param->next) {
+    type = checkValue(compiler, arg);
+    if (!areEqualTypes(type, param->object->paramAttrs->type))
+      typeError(compiler, arg);
+  }
 }
 
+// An expression, whose value is of a basic type
+static Type* checkValue(Compiler* compiler, Node* node) {
+  Type* type1;
+  Type* type2;
 
+  switch (node->kind) {
+  case AST_NUMBER:
+    node->type = compiler->intType;
+    break;
+  case AST_CHAR:
+    node->type = compiler->charType;
+    break;
+  case AST_NAME:
+  case AST_INDEX:
+    // An array must have all its indexes
+    if (!isBasicType(checkReference(compiler, node)))
+      return typeError(compiler, node);
+    break;
+  case AST_CALL:
+    checkArguments(compiler, node);
+    node->type = node->object->funcAttrs->returnType;
+    break;
+  case AST_PLUS:
+  case AST_NEG:
+    type1 = checkValue(compiler, node->kids[0]);
+    node->type = isIntType(type1) ? type1 : typeError(compiler, node);
+    break;
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MUL:
+  case AST_DIV:
+    type1 = checkValue(compiler, node->kids[0]);
+    type2 = checkValue(compiler, node->kids[1]);
+    if (!isIntType(type1) || !isIntType(type2))
+      node->type = typeError(compiler, node);
+    else node->type = compiler->intType;
+    break;
+  case AST_EQ:
+  case AST_NE:
+  case AST_LT:
+  case AST_LE:
+  case AST_GT:
+  case AST_GE:
+    type1 = checkValue(compiler, node->kids[0]);
+    type2 = checkValue(compiler, node->kids[1]);
+    if (!isBasicType(type1) || !areEqualTypes(type1, type2))
+      node->type = typeError(compiler, node);
+    else node->type = compiler->intType;
+    break;
+  default:
+    node->type = NULL;
+    break;
+  }
+  return node->type;
+}
+
+static void checkAssignment(Compiler* compiler, Node* node) {
+  Type* varType = checkValue(compiler, node->kids[0]);
+  Type* expType = checkValue(compiler, node->kids[1]);
+
+  if (!areEqualTypes(varType, expType))
+    typeError(compiler, node);
+}
+
+void checkTree(Compiler* compiler, Node* node) {
+  Node* n;
+
+  if (node == NULL) return;
+  switch (node->kind) {
+  case AST_PROGRAM:
+  case AST_FUNCTION:
+  case AST_PROCEDURE:
+    checkTree(compiler, node->kids[0]);
+    break;
+  case AST_BLOCK:
+    checkTree(compiler, node->kids[0]);
+    checkTree(compiler, node->kids[1]);
+    break;
+  case AST_GROUP:
+    for (n = node->kids[0]; n != NULL; n = n->next)
+      checkTree(compiler, n);
+    break;
+  case AST_ASSIGN:
+    checkAssignment(compiler, node);
+    break;
+  case AST_CALL:
+    checkArguments(compiler, node);
+    break;
+  case AST_IF:
+    checkValue(compiler, node->kids[0]);
+    checkTree(compiler, node->kids[1]);
+    checkTree(compiler, node->kids[2]);
+    break;
+  case AST_WHILE:
+    checkValue(compiler, node->kids[0]);
+    checkTree(compiler, node->kids[1]);
+    break;
+  case AST_FOR:
+    checkAssignment(compiler, node->kids[0]);
+    if (!areEqualTypes(node->kids[0]->kids[0]->type, checkValue(compiler, node->kids[1])))
+      typeError(compiler, node->kids[1]);
+    checkTree(compiler, node->kids[2]);
+    break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,626 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "codegen.h"
+
+/*
+ * SSA form for the words of a frame that only LOAD and STORE of the
+ * function itself access: scalar variables and parameters whose address
+ * is never taken, as for a VAR argument, and which no nested function
+ * uses. Their values become temps, with phis where control flow joins.
+ * Out of SSA form, the temps that can share a word of the frame do, and
+ * preferably the word of the variable they came from.
+ *
+ * The tables kept for words are indexed by the words the instructions
+ * use, sorted, never by the whole frame: an array may make it huge.
+ */
+
+#define MAX_COALESCED_TEMPS 4096
+
+struct BlockList_ {
+  IrBlock* block;
+  struct BlockList_* next;
+};
+
+typedef struct BlockList_ BlockList;
+
+struct WordList_ {
+  int* words;               // sorted, without duplicates
+  int count;
+  int maxCount;
+};
+
+typedef struct WordList_ WordList;
+
+struct Renamer_ {
+  Compiler* compiler;
+  IrFunction* function;
+  WordList used;            // the words loaded, stored or addressed
+  int* varOf;               // the variable of a used word, or -1
+  int varCount;
+  IrBlock** firstChild;     // in the dominator tree
+  IrBlock** nextSibling;
+};
+
+typedef struct Renamer_ Renamer;
+
+static void* ssaAlloc(Compiler* compiler, size_t size) {
+  return arenaAlloc(&compiler->ast->arena, size);
+}
+
+// Returns 0 if out of memory
+static int addWord(WordList* list, int word) {
+  int* words;
+
+  if (list->count >= list->maxCount) {
+    list->maxCount = (list->maxCount == 0) ? 64 : list->maxCount * 2;
+    words = (int*) realloc(list->words, list->maxCount * sizeof(int));
+    if (words == NULL) return 0;
+    list->words = words;
+  }
+  list->words[list->count ++] = word;
+  return 1;
+}
+
+static int compareWords(const void* a, const void* b) {
+  int x = *(const int*) a, y = *(const int*) b;
+  return (x > y) - (x < y);
+}
+
+static void sortWords(WordList* list) {
+  int i, n = 0;
+
+  if (list->count == 0) return;
+  qsort(list->words, list->count, sizeof(int), compareWords);
+  for (i = 1; i < list->count; i++)
+    if (list->words[i] != list->words[n])
+      list->words[++ n] = list->words[i];
+  list->count = n + 1;
+}
+
+// The index of word in the sorted list, or -1
+static int findWord(WordList* list, int word) {
+  int low = 0, high = list->count - 1, mid;
+
+  while (low <= high) {
+    mid = (low + high) / 2;
+    if (list->words[mid] == word) return mid;
+    if (list->words[mid] < word) low = mid + 1;
+    else high = mid - 1;
+  }
+  return -1;
+}
+
+static int isCandidate(IrInst* inst, int depth, int frameSize) {
+  return ((inst->op == IR_ADDR) || (inst->op == IR_LOAD) || (inst->op == IR_STORE)) &&
+    (inst->level == depth) && (inst->offset < frameSize) && (inst->offset >= RESERVED_WORDS);
+}
+
+// The words of the frame the function and its nested functions access.
+// Returns 0 if out of memory.
+static int findUsedWords(IrFunction* function, int depth, WordList* used, int frameSize) {
+  IrFunction* child;
+  IrBlock* block;
+  IrInst* inst;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next)
+      if (isCandidate(inst, depth, frameSize) && !addWord(used, inst->offset))
+	return 0;
+
+  for (child = function->children; child != NULL; child = child->next)
+    if (!findUsedWords(child, depth + 1, used, frameSize))
+      return 0;
+  return 1;
+}
+
+/*
+ * A word is promoted when the function loads or stores it, and neither
+ * it nor a nested function, depth static links away, does anything else.
+ */
+static void findPromotable(IrFunction* function, int depth, WordList* used, char* promotable, int frameSize) {
+  IrFunction* child;
+  IrBlock* block;
+  IrInst* inst;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if (!isCandidate(inst, depth, frameSize))
+	continue;
+      i = findWord(used, inst->offset);
+      if ((depth > 0) || (inst->op == IR_ADDR))
+	promotable[i] = -1;
+      else if (promotable[i] == 0)
+	promotable[i] = 1;
+    }
+
+  for (child = function->children; child != NULL; child = child->next)
+    findPromotable(child, depth + 1, used, promotable, frameSize);
+}
+
+// The variable of a word of the frame, or -1
+static int varOfWord(Renamer* r, int word) {
+  int i = findWord(&r->used, word);
+  return (i < 0) ? -1 : r->varOf[i];
+}
+
+static int isPromoted(Renamer* r, IrInst* inst) {
+  return ((inst->op == IR_LOAD) || (inst->op == IR_STORE)) && (inst->level == 0) &&
+    (varOfWord(r, inst->offset) >= 0);
+}
+
+static void setHome(IrFunction* function, int temp, int word) {
+  if (temp < function->homeCount)
+    function->homes[temp] = word;
+}
+
+static IrInst* createPhi(Renamer* r, IrBlock* block, int word) {
+  IrInst* phi = createIrInst(r->compiler, IR_PHI);
+  int i;
+
+  phi->offset = word;
+  if (block->first != NULL)
+    phi->lineNo = block->first->lineNo;
+  phi->dest = newTemp(r->function);
+  phi->argCount = block->predCount;
+  phi->args = (IrOperand*) ssaAlloc(r->compiler, block->predCount * sizeof(IrOperand));
+  phi->argBlocks = (IrBlock**) ssaAlloc(r->compiler, block->predCount * sizeof(IrBlock*));
+  for (i = 0; i < block->predCount; i++)
+    phi->argBlocks[i] = block->preds[i];
+  if (block->first == NULL)
+    appendIrInst(block, phi);
+  else insertIrInstBefore(block->first, phi);
+  return phi;
+}
+
+// The dominance frontiers, as in Cooper, Harvey and Kennedy
+static BlockList** computeFrontiers(Renamer* r) {
+  IrFunction* function = r->function;
+  BlockList** frontiers = (BlockList**) ssaAlloc(r->compiler, function->blockCount * sizeof(BlockList*));
+  BlockList* node;
+  IrBlock* block;
+  IrBlock* runner;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next) {
+    if (block->predCount < 2) continue;
+    for (i = 0; i < block->predCount; i++)
+      for (runner = block->preds[i]; runner != block->idom; runner = runner->idom) {
+	if ((frontiers[runner->id] != NULL) && (frontiers[runner->id]->block == block))
+	  continue;
+	node = (BlockList*) ssaAlloc(r->compiler, sizeof(BlockList));
+	node->block = block;
+	node->next = frontiers[runner->id];
+	frontiers[runner->id] = node;
+      }
+  }
+  return frontiers;
+}
+
+static void placePhis(Renamer* r) {
+  IrFunction* function = r->function;
+  BlockList** frontiers = computeFrontiers(r);
+  IrBlock** work = (IrBlock**) malloc(function->blockCount * sizeof(IrBlock*));
+  int* hasPhi = (int*) malloc(function->blockCount * sizeof(int));
+  int* queued = (int*) malloc(function->blockCount * sizeof(int));
+  int i, word, workCount;
+  BlockList* node;
+  IrBlock* block;
+  IrInst* inst;
+
+  for (word = 0; word < function->blockCount; word++)
+    hasPhi[word] = queued[word] = -1;
+
+  for (i = 0; i < r->used.count; i++) {
+    if (r->varOf[i] < 0) continue;
+    word = r->used.words[i];
+
+    workCount = 0;
+    for (block = function->blocks; block != NULL; block = block->next)
+      for (inst = block->first; inst != NULL; inst = inst->next)
+	if ((inst->op == IR_STORE) && isPromoted(r, inst) && (inst->offset == word) &&
+	    (queued[block->id] != word)) {
+	  queued[block->id] = word;
+	  work[workCount ++] = block;
+	}
+
+    while (workCount > 0) {
+      block = work[-- workCount];
+      for (node = frontiers[block->id]; node != NULL; node = node->next) {
+	if (hasPhi[node->block->id] == word) continue;
+	hasPhi[node->block->id] = word;
+	createPhi(r, node->block, word);
+	if (queued[node->block->id] != word) {
+	  queued[node->block->id] = word;
+	  work[workCount ++] = node->block;
+	}
+      }
+    }
+  }
+
+  free(work);
+  free(hasPhi);
+  free(queued);
+}
+
+// Walks the dominator tree with the current value of every variable
+static void renameBlock(Renamer* r, IrBlock* block, IrOperand* current) {
+  IrOperand* saved = (IrOperand*) malloc(r->varCount * sizeof(IrOperand));
+  IrInst* inst;
+  IrInst* next;
+  IrBlock* child;
+  int i, j;
+
+  memcpy(saved, current, r->varCount * sizeof(IrOperand));
+  for (inst = block->first; inst != NULL; inst = next) {
+    next = inst->next;
+    if (inst->op == IR_PHI)
+      current[varOfWord(r, inst->offset)] = tempOperand(inst->dest);
+    else if (isPromoted(r, inst)) {
+      if (inst->op == IR_LOAD) {
+	inst->op = IR_COPY;
+	inst->a = current[varOfWord(r, inst->offset)];
+      } else {
+	current[varOfWord(r, inst->offset)] = inst->a;
+	removeIrInst(inst);
+      }
+    }
+  }
+
+  for (i = 0; i < successorCount(block); i++)
+    for (inst = block->succ[i]->first; (inst != NULL) && (inst->op == IR_PHI); inst = inst->next)
+      for (j = 0; j < inst->argCount; j++)
+	if (inst->argBlocks[j] == block)
+	  inst->args[j] = current[varOfWord(r, inst->offset)];
+
+  for (child = r->firstChild[block->id]; child != NULL; child = r->nextSibling[child->id])
+    renameBlock(r, child, current);
+
+  memcpy(current, saved, r->varCount * sizeof(IrOperand));
+  free(saved);
+}
+
+/*
+ * Out of memory for the tables of the words, the function is left as it
+ * is: it is correct without promotion.
+ */
+void buildSsa(Compiler* compiler, IrFunction* function) {
+  int frameSize = function->frameSize;
+  char* promotable;
+  IrOperand* current;
+  IrBlock* entry = function->blocks;
+  IrBlock* block;
+  IrInst* inst;
+  Renamer r;
+  int word, i;
+
+  r.compiler = compiler;
+  r.function = function;
+  r.used.words = NULL;
+  r.used.count = r.used.maxCount = 0;
+  if (!findUsedWords(function, 0, &r.used, frameSize)) {
+    free(r.used.words);
+    return;
+  }
+  sortWords(&r.used);
+
+  promotable = (char*) calloc(r.used.count + 1, sizeof(char));
+  r.varOf = (int*) malloc((r.used.count + 1) * sizeof(int));
+  if ((promotable == NULL) || (r.varOf == NULL)) {
+    free(promotable);
+    free(r.varOf);
+    free(r.used.words);
+    return;
+  }
+  findPromotable(function, 0, &r.used, promotable, frameSize);
+
+  r.varCount = 0;
+  for (i = 0; i < r.used.count; i++)
+    r.varOf[i] = (promotable[i] > 0) ? r.varCount ++ : -1;
+  free(promotable);
+  if (r.varCount == 0) {
+    free(r.varOf);
+    free(r.used.words);
+    return;
+  }
+
+  r.firstChild = (IrBlock**) calloc(function->blockCount, sizeof(IrBlock*));
+  r.nextSibling = (IrBlock**) calloc(function->blockCount, sizeof(IrBlock*));
+  for (i = function->orderCount - 1; i > 0; i--) {
+    block = function->order[i];
+    r.nextSibling[block->id] = r.firstChild[block->idom->id];
+    r.firstChild[block->idom->id] = block;
+  }
+
+  placePhis(&r);
+
+  // Every variable starts with what its word holds on entry
+  current = (IrOperand*) malloc(r.varCount * sizeof(IrOperand));
+  for (i = 0; i < r.used.count; i++)
+    if (r.varOf[i] >= 0)
+      current[r.varOf[i]] = tempOperand(newTemp(function));
+  renameBlock(&r, entry, current);
+
+  function->homeCount = function->tempCount;
+  function->homes = (int*) ssaAlloc(compiler, function->homeCount * sizeof(int));
+  for (i = 0; i < function->homeCount; i++)
+    function->homes[i] = -1;
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; (inst != NULL) && (inst->op == IR_PHI); inst = inst->next)
+      setHome(function, inst->dest, inst->offset);
+
+  for (i = r.used.count - 1; i >= 0; i--)
+    if (r.varOf[i] >= 0) {
+      word = r.used.words[i];
+      inst = createIrInst(compiler, IR_LOAD);
+      inst->level = 0;
+      inst->offset = word;
+      inst->dest = current[r.varOf[i]].value;
+      inst->lineNo = (entry->first != NULL) ? entry->first->lineNo : 0;
+      if (entry->first == NULL)
+	appendIrInst(entry, inst);
+      else insertIrInstBefore(entry->first, inst);
+      setHome(function, inst->dest, word);
+    }
+
+  free(current);
+  free(r.varOf);
+  free(r.used.words);
+  free(r.firstChild);
+  free(r.nextSibling);
+}
+
+/******************************************************************/
+
+static int isLive(unsigned* set, int temp) {
+  return (set[temp >> 5] >> (temp & 31)) & 1;
+}
+
+static void setLive(unsigned* set, int temp) {
+  set[temp >> 5] |= 1u << (temp & 31);
+}
+
+static void clearLive(unsigned* set, int temp) {
+  set[temp >> 5] &= ~(1u << (temp & 31));
+}
+
+static int findClass(int* parent, int temp) {
+  while (parent[temp] != temp)
+    temp = parent[temp] = parent[parent[temp]];
+  return temp;
+}
+
+// The temps live at the end of every block
+static unsigned* computeLiveness(IrFunction* function, int words) {
+  unsigned* liveOut = (unsigned*) calloc(function->blockCount * words, sizeof(unsigned));
+  unsigned* live = (unsigned*) malloc(words * sizeof(unsigned));
+  unsigned* in = (unsigned*) calloc(function->blockCount * words, sizeof(unsigned));
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  int changed = 1;
+  int b, i, j;
+
+  while (changed) {
+    changed = 0;
+    for (b = function->orderCount - 1; b >= 0; b--) {
+      block = function->order[b];
+      for (i = 0; i < successorCount(block); i++)
+	for (j = 0; j < words; j++)
+	  if ((liveOut[block->id * words + j] | in[block->succ[i]->id * words + j]) != liveOut[block->id * words + j]) {
+	    liveOut[block->id * words + j] |= in[block->succ[i]->id * words + j];
+	    changed = 1;
+	  }
+
+      memcpy(live, liveOut + block->id * words, words * sizeof(unsigned));
+      for (inst = block->last; inst != NULL; inst = inst->prev) {
+	if (inst->dest != NO_TEMP)
+	  clearLive(live, inst->dest);
+	for (i = 0; i < irOperandCount(inst); i++) {
+	  operand = irOperand(inst, i);
+	  if (operand->kind == OPD_TEMP)
+	    setLive(live, operand->value);
+	}
+      }
+      memcpy(in + block->id * words, live, words * sizeof(unsigned));
+    }
+  }
+
+  free(live);
+  free(in);
+  return liveOut;
+}
+
+/*
+ * Temps joined by a copy share a word when they don't interfere: when
+ * neither is live where the other is defined. The interference matrix
+ * is kept for the representatives of the classes only.
+ */
+static void coalesce(IrFunction* function, int* parent) {
+  int count = function->tempCount;
+  int words = (count + 31) / 32;
+  unsigned* liveOut = computeLiveness(function, words);
+  unsigned* matrix = (unsigned*) calloc((size_t) count * words, sizeof(unsigned));
+  unsigned* live = (unsigned*) malloc(words * sizeof(unsigned));
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  int x, y, t, i;
+
+  for (block = function->blocks; block != NULL; block = block->next) {
+    memcpy(live, liveOut + block->id * words, words * sizeof(unsigned));
+    for (inst = block->last; inst != NULL; inst = inst->prev) {
+      if (inst->dest != NO_TEMP) {
+	clearLive(live, inst->dest);
+	for (t = 0; t < count; t++)
+	  if (isLive(live, t) && !((inst->op == IR_COPY) && (inst->a.kind == OPD_TEMP) && (inst->a.value == t))) {
+	    setLive(matrix + (size_t) inst->dest * words, t);
+	    setLive(matrix + (size_t) t * words, inst->dest);
+	  }
+      }
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if (operand->kind == OPD_TEMP)
+	  setLive(live, operand->value);
+      }
+    }
+  }
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if ((inst->op != IR_COPY) || (inst->a.kind != OPD_TEMP)) continue;
+      x = findClass(parent, inst->dest);
+      y = findClass(parent, inst->a.value);
+      if ((x == y) || isLive(matrix + (size_t) x * words, y)) continue;
+
+      parent[y] = x;
+      for (i = 0; i < words; i++)
+	matrix[(size_t) x * words + i] |= matrix[(size_t) y * words + i];
+      for (t = 0; t < count; t++)
+	if (isLive(matrix + (size_t) y * words, t))
+	  setLive(matrix + (size_t) t * words, x);
+    }
+
+  free(liveOut);
+  free(matrix);
+  free(live);
+}
+
+static void renameTemps(IrFunction* function, int* parent) {
+  IrOperand* operand;
+  IrBlock* block;
+  IrInst* inst;
+  IrInst* next;
+  int i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = next) {
+      next = inst->next;
+      if (inst->dest != NO_TEMP)
+	inst->dest = findClass(parent, inst->dest);
+      for (i = 0; i < irOperandCount(inst); i++) {
+	operand = irOperand(inst, i);
+	if (operand->kind == OPD_TEMP)
+	  operand->value = findClass(parent, operand->value);
+      }
+      if ((inst->op == IR_COPY) && (inst->a.kind == OPD_TEMP) && (inst->a.value == inst->dest))
+	removeIrInst(inst);
+    }
+}
+
+/*
+ * A class lives in the word of one of its variables, if no other class
+ * does. The word of a variable read on entry can only be the home of the
+ * class of what is read. Out of memory, no class gets a home.
+ */
+static void assignHomes(Compiler* compiler, IrFunction* function, int* parent) {
+  int* homes = (int*) ssaAlloc(compiler, function->tempCount * sizeof(int));
+  int* varHomes = function->homes;
+  int homeCount = function->homeCount;
+  WordList words = { NULL, 0, 0 };
+  char* taken = NULL;
+  char* readOnEntry = NULL;
+  IrBlock* entry = function->blocks;
+  IrInst* inst;
+  IrInst* next;
+  int t, x, i, ok = 1;
+
+  for (t = 0; t < function->tempCount; t++)
+    homes[t] = -1;
+  function->homes = homes;
+  function->homeCount = function->tempCount;
+
+  // The tables are indexed by the words of the variables
+  for (t = 0; ok && (t < homeCount); t++)
+    if (varHomes[t] >= 0)
+      ok = addWord(&words, varHomes[t]);
+  if (ok) {
+    sortWords(&words);
+    taken = (char*) calloc(words.count + 1, sizeof(char));
+    readOnEntry = (char*) calloc(words.count + 1, sizeof(char));
+  }
+  if (!ok || (taken == NULL) || (readOnEntry == NULL)) {
+    free(words.words);
+    free(taken);
+    free(readOnEntry);
+    return;
+  }
+
+  for (inst = entry->first; (inst != NULL) && (inst->op == IR_LOAD); inst = inst->next) {
+    if ((inst->level != 0) || (inst->dest >= homeCount) || (varHomes[inst->dest] != inst->offset))
+      continue;
+    i = findWord(&words, inst->offset);
+    readOnEntry[i] = 1;
+    x = findClass(parent, inst->dest);
+    if ((homes[x] < 0) && !taken[i]) {
+      homes[x] = inst->offset;
+      taken[i] = 1;
+    }
+  }
+  for (t = 0; t < homeCount; t++) {
+    if (varHomes[t] < 0) continue;
+    i = findWord(&words, varHomes[t]);
+    x = findClass(parent, t);
+    if ((homes[x] < 0) && !taken[i] && !readOnEntry[i]) {
+      homes[x] = varHomes[t];
+      taken[i] = 1;
+    }
+  }
+
+  // What the word holds on entry is already there
+  for (inst = entry->first; (inst != NULL) && (inst->op == IR_LOAD); inst = next) {
+    next = inst->next;
+    if ((inst->level == 0) && (homes[inst->dest] == inst->offset))
+      removeIrInst(inst);
+  }
+  free(words.words);
+  free(taken);
+  free(readOnEntry);
+}
+
+/*
+ * A phi becomes copies to a new temp at the end of its predecessors,
+ * and a copy from it where the phi was; coalescing then removes most of
+ * the copies.
+ */
+void leaveSsa(Compiler* compiler, IrFunction* function) {
+  IrBlock* block;
+  IrInst* inst;
+  IrInst* copy;
+  int* parent;
+  int temp, i;
+
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; (inst != NULL) && (inst->op == IR_PHI); inst = inst->next) {
+      temp = newTemp(function);
+      for (i = 0; i < inst->argCount; i++) {
+	copy = createIrInst(compiler, IR_COPY);
+	copy->dest = temp;
+	copy->a = inst->args[i];
+	copy->lineNo = inst->argBlocks[i]->last->lineNo;
+	insertIrInstBefore(inst->argBlocks[i]->last, copy);
+      }
+      inst->op = IR_COPY;
+      inst->a = tempOperand(temp);
+      inst->argCount = 0;
+    }
+
+  parent = (int*) malloc((function->tempCount + 1) * sizeof(int));
+  for (temp = 0; temp < function->tempCount; temp++)
+    parent[temp] = temp;
+  if (function->tempCount <= MAX_COALESCED_TEMPS)
+    coalesce(function, parent);
+  renameTemps(function, parent);
+  if (function->homes != NULL)
+    assignHomes(compiler, function, parent);
+  free(parent);
+
+  simplifyControlFlow(compiler, function);
+}
@@ -0,0 +1,148 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define CLOCK_SAMPLES 1000
+
+__thread Stats* currentStats = NULL;
+
+static char* stageNames[STAGE_COUNT] = {
+  "reader",
+  "scanner",
+  "parser/semantics",
+  "codegen/serialize"
+};
+
+static double secondsBetween(struct timespec* from, struct timespec* to) {
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double measureClockCost(void) {
+  struct timespec start, now;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < CLOCK_SAMPLES; i++)
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  return secondsBetween(&start, &now) / CLOCK_SAMPLES;
+}
+
+void startStats(Stats* stats) {
+  memset(stats, 0, sizeof(Stats));
+  stats->clockCost = measureClockCost();
+  stats->stage = STAGE_PARSER;
+  clock_gettime(CLOCK_MONOTONIC, &stats->startTime);
+  stats->switchTime = stats->startTime;
+  currentStats = stats;
+}
+
+// Charges the time since the last switch to the current stage
+static void chargeStage(Stats* stats) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  stats->stageTime[stats->stage] += secondsBetween(&stats->switchTime, &now);
+  stats->switches[stats->stage] ++;
+  stats->switchTime = now;
+}
+
+void stopStats(Stats* stats) {
+  chargeStage(stats);
+  currentStats = NULL;
+}
+
+int enterStage(int stage) {
+  Stats* stats = currentStats;
+  int previous;
+
+  if (stats == NULL) return stage;
+  previous = stats->stage;
+  if (previous != stage) {
+    chargeStage(stats);
+    stats->stage = stage;
+  }
+  return previous;
+}
+
+void leaveStage(int previous) {
+  Stats* stats = currentStats;
+
+  if ((stats == NULL) || (stats->stage == previous)) return;
+  chargeStage(stats);
+  stats->stage = previous;
+}
+
+void printStats(Stats* stats, char* fileName) {
+  double total = secondsBetween(&stats->startTime, &stats->switchTime);
+  double measured = 0;
+  double stageTime;
+  long allocations = 0;
+  long long allocatedBytes = 0;
+  int stage;
+
+  printf("Statistics for %s:\n", fileName);
+  printf("  %-20s %10s %12s %14s\n", "stage", "time (ms)", "allocations", "bytes");
+  for (stage = 0; stage < STAGE_COUNT; stage++) {
+    stageTime = stats->stageTime[stage] - stats->switches[stage] * stats->clockCost;
+    if (stageTime < 0) stageTime = 0;
+    measured += stageTime;
+    allocations += stats->allocations[stage];
+    allocatedBytes += stats->allocatedBytes[stage];
+    printf("  %-20s %10.3f %12ld %14lld\n", stageNames[stage], stageTime * 1000,
+	   stats->allocations[stage], stats->allocatedBytes[stage]);
+  }
+  printf("  %-20s %10.3f %12ld %14lld\n", "total", total * 1000, allocations, allocatedBytes);
+  printf("  %-20s %10.3f\n", "timer overhead", (total - measured) * 1000);
+  printf("  tokens: %ld\n", stats->tokenCount);
+  printf("  objects declared: %ld\n", stats->objectCount);
+  printf("  instructions emitted: %ld\n", stats->instructionCount);
+  printf("  peak heap: %lld bytes\n", stats->peakHeapBytes);
+}
+
+static void countAllocation(Stats* stats, size_t size) {
+  stats->allocations[stats->stage] ++;
+  stats->allocatedBytes[stats->stage] += size;
+  stats->heapBytes += size;
+  if (stats->heapBytes > stats->peakHeapBytes)
+    stats->peakHeapBytes = stats->heapBytes;
+}
+
+void* countedMalloc(size_t size) {
+  void* ptr = malloc(size);
+
+  if ((currentStats != NULL) && (ptr != NULL))
+    countAllocation(currentStats, size);
+  return ptr;
+}
+
+void* countedCalloc(size_t count, size_t size) {
+  void* ptr = calloc(count, size);
+
+  if ((currentStats != NULL) && (ptr != NULL))
+    countAllocation(currentStats, count * size);
+  return ptr;
+}
+
+void* countedRealloc(void* ptr, size_t oldSize, size_t size) {
+  void* newPtr = realloc(ptr, size);
+
+  if ((currentStats != NULL) && (newPtr != NULL)) {
+    currentStats->heapBytes -= (ptr != NULL) ? oldSize : 0;
+    countAllocation(currentStats, size);
+  }
+  return newPtr;
+}
+
+void countedFree(void* ptr, size_t size) {
+  if ((currentStats != NULL) && (ptr != NULL))
+    currentStats->heapBytes -= size;
+  free(ptr);
+}
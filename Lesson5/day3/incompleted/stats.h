@@ -0,0 +1,73 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include <time.h>
+
+enum Stage {
+  STAGE_READER,
+  STAGE_SCANNER,
+  STAGE_PARSER,       // parser, semantic checks and symbol table
+  STAGE_CODEGEN,      // emitting instructions and serializing them
+  STAGE_COUNT
+};
+
+/*
+ * What kplc -stats reports. While a Stats is started on a thread, the
+ * reader, scanner, code generator and serializer switch the current stage
+ * as they are entered and left, and every counted allocation on that thread
+ * is charged to the current stage. The compiler is single pass, so stages interleave
+ * at every character and token: the cost of reading the clock at each
+ * switch is measured once and taken out of the stage times.
+ */
+struct Stats_ {
+  int stage;
+  struct timespec startTime;
+  struct timespec switchTime;      // when the current stage was entered
+  double clockCost;                // seconds per clock reading
+
+  double stageTime[STAGE_COUNT];   // seconds
+  long switches[STAGE_COUNT];      // clock readings charged to the stage
+  long allocations[STAGE_COUNT];
+  long long allocatedBytes[STAGE_COUNT];
+
+  long long heapBytes;
+  long long peakHeapBytes;
+
+  long tokenCount;
+  long objectCount;
+  long instructionCount;
+};
+
+typedef struct Stats_ Stats;
+
+// The stats being collected on this thread, NULL most of the time
+extern __thread Stats* currentStats;
+
+void startStats(Stats* stats);
+void stopStats(Stats* stats);
+
+// enterStage returns the stage to give back to leaveStage
+int enterStage(int stage);
+void leaveStage(int previous);
+
+void printStats(Stats* stats, char* fileName);
+
+/*
+ * malloc, calloc, realloc and free for the compiler's own data: tokens,
+ * the symbol table, the arena, the code block and the diagnostics. The
+ * caller gives the size of the block it frees or grows; heap bytes are
+ * the bytes asked for, not what the allocator rounds them up to.
+ */
+void* countedMalloc(size_t size);
+void* countedCalloc(size_t count, size_t size);
+void* countedRealloc(void* ptr, size_t oldSize, size_t size);
+void countedFree(void* ptr, size_t size);
+
+#endif
@@ -10,37 +10,29 @@
 #include "symtab.h"
 #include "error.h"
 #include "codegen.h"
+#include "stats.h"
 
 void freeObject(Object* obj);
 void freeScope(Scope* scope);
 void freeObjectList(ObjectNode *objList);
 void freeReferenceList(ObjectNode *objList);
 
-SymTab* symtab;
-Type* intType;
-Type* charType;
-Object* writeiProcedure;
-Object* writecProcedure;
-Object* writelnProcedure;
-Object* readiFunction;
-Object* readcFunction;
-
 /******************* Type utilities ******************************/
 
 Type* makeIntType(void) {
-  Type* type = (Type*) malloc(sizeof(Type));
+  Type* type = (Type*) countedMalloc(sizeof(Type));
   type->typeClass = TP_INT;
   return type;
 }
 
 Type* makeCharType(void) {
-  Type* type = (Type*) malloc(sizeof(Type));
+  Type* type = (Type*) countedMalloc(sizeof(Type));
   type->typeClass = TP_CHAR;
   return type;
 }
 
 Type* makeArrayType(int arraySize, Type* elementType) {
-  Type* type = (Type*) malloc(sizeof(Type));
+  Type* type = (Type*) countedMalloc(sizeof(Type));
   type->typeClass = TP_ARRAY;
   type->arraySize = arraySize;
   type->elementType = elementType;
@@ -48,7 +40,7 @@ Type* makeArrayType(int arraySize, Type* elementType) {
 }
 
 Type* duplicateType(Type* type) {
-  Type* resultType = (Type*) malloc(sizeof(Type));
+  Type* resultType = (Type*) countedMalloc(sizeof(Type));
   resultType->typeClass = type->typeClass;
   if (type->typeClass == TP_ARRAY) {
     resultType->arraySize = type->arraySize;
@@ -68,10 +60,11 @@ int compareType(Type* type1, Type* type2) {
 }
 
 void freeType(Type* type) {
+  if (type == NULL) return;
   switch (type->typeClass) {
   case TP_INT:
   case TP_CHAR:
-    free(type);
+    countedFree(type, sizeof(Type));
     break;
   case TP_ARRAY:
     freeType(type->elementType);
@@ -95,21 +88,21 @@ int sizeOfType(Type* type) {
 /******************* Constant utility ******************************/
 
 ConstantValue* makeIntConstant(int i) {
-  ConstantValue* value = (ConstantValue*) malloc(sizeof(ConstantValue));
+  ConstantValue* value = (ConstantValue*) countedMalloc(sizeof(ConstantValue));
   value->type = TP_INT;
   value->intValue = i;
   return value;
 }
 
 ConstantValue* makeCharConstant(char ch) {
-  ConstantValue* value = (ConstantValue*) malloc(sizeof(ConstantValue));
+  ConstantValue* value = (ConstantValue*) countedMalloc(sizeof(ConstantValue));
   value->type = TP_CHAR;
   value->charValue = ch;
   return value;
 }
 
 ConstantValue* duplicateConstantValue(ConstantValue* v) {
-  ConstantValue* value = (ConstantValue*) malloc(sizeof(ConstantValue));
+  ConstantValue* value = (ConstantValue*) countedMalloc(sizeof(ConstantValue));
   value->type = v->type;
   if (v->type == TP_INT) 
     value->intValue = v->intValue;
@@ -121,7 +114,7 @@ ConstantValue* duplicateConstantValue(ConstantValue* v) {
 /******************* Object utilities ******************************/
 
 Scope* createScope(Object* owner) {
-  Scope* scope = (Scope*) malloc(sizeof(Scope));
+  Scope* scope = (Scope*) countedMalloc(sizeof(Scope));
   scope->objList = NULL;
   scope->owner = owner;
   scope->outer = NULL;
@@ -129,39 +122,41 @@ Scope* createScope(Object* owner) {
   return scope;
 }
 
-Object* createProgramObject(char *programName) {
-  Object* program = (Object*) malloc(sizeof(Object));
+Object* createProgramObject(Compiler* compiler, char *programName) {
+  Object* program = (Object*) countedMalloc(sizeof(Object));
   strcpy(program->name, programName);
   program->kind = OBJ_PROGRAM;
-  program->progAttrs = (ProgramAttributes*) malloc(sizeof(ProgramAttributes));
+  program->progAttrs = (ProgramAttributes*) countedMalloc(sizeof(ProgramAttributes));
   program->progAttrs->scope = createScope(program);
   program->progAttrs->codeAddress = DC_VALUE;
-  symtab->program = program;
+  compiler->symtab->program = program;
 
   return program;
 }
 
 Object* createConstantObject(char *name) {
-  Object* obj = (Object*) malloc(sizeof(Object));
+  Object* obj = (Object*) countedMalloc(sizeof(Object));
   strcpy(obj->name, name);
   obj->kind = OBJ_CONSTANT;
-  obj->constAttrs = (ConstantAttributes*) malloc(sizeof(ConstantAttributes));
+  obj->constAttrs = (ConstantAttributes*) countedMalloc(sizeof(ConstantAttributes));
+  obj->constAttrs->value = NULL;
   return obj;
 }
 
 Object* createTypeObject(char *name) {
-  Object* obj = (Object*) malloc(sizeof(Object));
+  Object* obj = (Object*) countedMalloc(sizeof(Object));
   strcpy(obj->name, name);
   obj->kind = OBJ_TYPE;
-  obj->typeAttrs = (TypeAttributes*) malloc(sizeof(TypeAttributes));
+  obj->typeAttrs = (TypeAttributes*) countedMalloc(sizeof(TypeAttributes));
+  obj->typeAttrs->actualType = NULL;
   return obj;
 }
 
 Object* createVariableObject(char *name) {
-  Object* obj = (Object*) malloc(sizeof(Object));
+  Object* obj = (Object*) countedMalloc(sizeof(Object));
   strcpy(obj->name, name);
   obj->kind = OBJ_VARIABLE;
-  obj->varAttrs = (VariableAttributes*) malloc(sizeof(VariableAttributes));
+  obj->varAttrs = (VariableAttributes*) countedMalloc(sizeof(VariableAttributes));
   obj->varAttrs->type = NULL;
   obj->varAttrs->scope = NULL;
   obj->varAttrs->localOffset = 0;
@@ -169,10 +164,10 @@ Object* createVariableObject(char *name) {
 }
 
 Object* createFunctionObject(char *name) {
-  Object* obj = (Object*) malloc(sizeof(Object));
+  Object* obj = (Object*) countedMalloc(sizeof(Object));
   strcpy(obj->name, name);
   obj->kind = OBJ_FUNCTION;
-  obj->funcAttrs = (FunctionAttributes*) malloc(sizeof(FunctionAttributes));
+  obj->funcAttrs = (FunctionAttributes*) countedMalloc(sizeof(FunctionAttributes));
   obj->funcAttrs->returnType = NULL;
   obj->funcAttrs->paramList = NULL;
   obj->funcAttrs->paramCount = 0;
@@ -182,10 +177,10 @@ Object* createFunctionObject(char *name) {
 }
 
 Object* createProcedureObject(char *name) {
-  Object* obj = (Object*) malloc(sizeof(Object));
+  Object* obj = (Object*) countedMalloc(sizeof(Object));
   strcpy(obj->name, name);
   obj->kind = OBJ_PROCEDURE;
-  obj->procAttrs = (ProcedureAttributes*) malloc(sizeof(ProcedureAttributes));
+  obj->procAttrs = (ProcedureAttributes*) countedMalloc(sizeof(ProcedureAttributes));
   obj->procAttrs->paramList = NULL;
   obj->procAttrs->paramCount = 0;
   obj->procAttrs->codeAddress = DC_VALUE;
@@ -194,10 +189,10 @@ Object* createProcedureObject(char *name) {
 }
 
 Object* createParameterObject(char *name, enum ParamKind kind) {
-  Object* obj = (Object*) malloc(sizeof(Object));
+  Object* obj = (Object*) countedMalloc(sizeof(Object));
   strcpy(obj->name, name);
   obj->kind = OBJ_PARAMETER;
-  obj->paramAttrs = (ParameterAttributes*) malloc(sizeof(ParameterAttributes));
+  obj->paramAttrs = (ParameterAttributes*) countedMalloc(sizeof(ParameterAttributes));
   obj->paramAttrs->kind = kind;
   obj->paramAttrs->type = NULL;
   obj->paramAttrs->scope = NULL;
@@ -208,42 +203,42 @@ Object* createParameterObject(char *name, enum ParamKind kind) {
 void freeObject(Object* obj) {
   switch (obj->kind) {
   case OBJ_CONSTANT:
-    free(obj->constAttrs->value);
-    free(obj->constAttrs);
+    countedFree(obj->constAttrs->value, sizeof(ConstantValue));
+    countedFree(obj->constAttrs, sizeof(ConstantAttributes));
     break;
   case OBJ_TYPE:
-    free(obj->typeAttrs->actualType);
-    free(obj->typeAttrs);
+    countedFree(obj->typeAttrs->actualType, sizeof(Type));
+    countedFree(obj->typeAttrs, sizeof(TypeAttributes));
     break;
   case OBJ_VARIABLE:
-    free(obj->varAttrs->type);
-    free(obj->varAttrs);
+    countedFree(obj->varAttrs->type, sizeof(Type));
+    countedFree(obj->varAttrs, sizeof(VariableAttributes));
     break;
   case OBJ_FUNCTION:
     freeReferenceList(obj->funcAttrs->paramList);
     freeType(obj->funcAttrs->returnType);
     freeScope(obj->funcAttrs->scope);
-    free(obj->funcAttrs);
+    countedFree(obj->funcAttrs, sizeof(FunctionAttributes));
     break;
   case OBJ_PROCEDURE:
     freeReferenceList(obj->procAttrs->paramList);
     freeScope(obj->procAttrs->scope);
-    free(obj->procAttrs);
+    countedFree(obj->procAttrs, sizeof(ProcedureAttributes));
     break;
   case OBJ_PROGRAM:
     freeScope(obj->progAttrs->scope);
-    free(obj->progAttrs);
+    countedFree(obj->progAttrs, sizeof(ProgramAttributes));
     break;
   case OBJ_PARAMETER:
     freeType(obj->paramAttrs->type);
-    free(obj->paramAttrs);
+    countedFree(obj->paramAttrs, sizeof(ParameterAttributes));
   }
-  free(obj);
+  countedFree(obj, sizeof(Object));
 }
 
 void freeScope(Scope* scope) {
   freeObjectList(scope->objList);
-  free(scope);
+  countedFree(scope, sizeof(Scope));
 }
 
 void freeObjectList(ObjectNode *objList) {
@@ -253,7 +248,7 @@ void freeObjectList(ObjectNode *objList) {
     ObjectNode* node = list;
     list = list->next;
     freeObject(node->object);
-    free(node);
+    countedFree(node, sizeof(ObjectNode));
   }
 }
 
@@ -263,12 +258,12 @@ void freeReferenceList(ObjectNode *objList) {
   while (list != NULL) {
     ObjectNode* node = list;
     list = list->next;
-    free(node);
+    countedFree(node, sizeof(ObjectNode));
   }
 }
 
 void addObject(ObjectNode **objList, Object* obj) {
-  ObjectNode* node = (ObjectNode*) malloc(sizeof(ObjectNode));
+  ObjectNode* node = (ObjectNode*) countedMalloc(sizeof(ObjectNode));
   node->object = obj;
   node->next = NULL;
   if ((*objList) == NULL) 
@@ -292,79 +287,91 @@ Object* findObject(ObjectNode *objList, char *name) {
 
 /******************* others ******************************/
 
-void initSymTab(void) {
+void initSymTab(Compiler* compiler) {
   Object* param;
 
-  symtab = (SymTab*) malloc(sizeof(SymTab));
-  symtab->globalObjectList = NULL;
-  symtab->program = NULL;
-  symtab->currentScope = NULL;
+  compiler->symtab = (SymTab*) countedMalloc(sizeof(SymTab));
+  compiler->symtab->globalObjectList = NULL;
+  compiler->symtab->program = NULL;
+  compiler->symtab->currentScope = NULL;
   
-  readcFunction = createFunctionObject("READC");
-  declareObject(readcFunction);
-  readcFunction->funcAttrs->returnType = makeCharType();
+  compiler->readcFunction = createFunctionObject("READC");
+  declareObject(compiler, compiler->readcFunction);
+  compiler->readcFunction->funcAttrs->returnType = makeCharType();
 
-  readiFunction = createFunctionObject("READI");
-  declareObject(readiFunction);
-  readiFunction->funcAttrs->returnType = makeIntType();
+  compiler->readiFunction = createFunctionObject("READI");
+  declareObject(compiler, compiler->readiFunction);
+  compiler->readiFunction->funcAttrs->returnType = makeIntType();
 
 
-  writeiProcedure = createProcedureObject("WRITEI");
-  declareObject(writeiProcedure);
-  enterBlock(writeiProcedure->procAttrs->scope);
+  compiler->writeiProcedure = createProcedureObject("WRITEI");
+  declareObject(compiler, compiler->writeiProcedure);
+  enterBlock(compiler, compiler->writeiProcedure->procAttrs->scope);
     param = createParameterObject("i", PARAM_VALUE);
     param->paramAttrs->type = makeIntType();
-    declareObject(param);
-  exitBlock();
+    declareObject(compiler, param);
+  exitBlock(compiler);
 
-  writecProcedure = createProcedureObject("WRITEC");
-  declareObject(writecProcedure);
-  enterBlock(writecProcedure->procAttrs->scope);
+  compiler->writecProcedure = createProcedureObject("WRITEC");
+  declareObject(compiler, compiler->writecProcedure);
+  enterBlock(compiler, compiler->writecProcedure->procAttrs->scope);
     param = createParameterObject("ch", PARAM_VALUE);
     param->paramAttrs->type = makeCharType();
-    declareObject(param);
-  exitBlock();
+    declareObject(compiler, param);
+  exitBlock(compiler);
+
+  compiler->writelnProcedure = createProcedureObject("WRITELN");
+  declareObject(compiler, compiler->writelnProcedure);
 
-  writelnProcedure = createProcedureObject("WRITELN");
-  declareObject(writelnProcedure);
+  compiler->intType = makeIntType();
+  compiler->charType = makeCharType();
+}
 
-  intType = makeIntType();
-  charType = makeCharType();
+void cleanSymTab(Compiler* compiler) {
+  resetSymTab(compiler);
+  freeObjectList(compiler->symtab->globalObjectList);
+  countedFree(compiler->symtab, sizeof(SymTab));
+  freeType(compiler->intType);
+  freeType(compiler->charType);
 }
 
-void cleanSymTab(void) {
-  freeObject(symtab->program);
-  freeObjectList(symtab->globalObjectList);
-  free(symtab);
-  freeType(intType);
-  freeType(charType);
+// Drops the program compiled last. The predefined objects stay, so that
+// a compiler can go on to the next program without initSymTab().
+void resetSymTab(Compiler* compiler) {
+  if (compiler->symtab->program != NULL)
+    freeObject(compiler->symtab->program);
+  compiler->symtab->program = NULL;
+  compiler->symtab->currentScope = NULL;
 }
 
-void enterBlock(Scope* scope) {
-  symtab->currentScope = scope;
+void enterBlock(Compiler* compiler, Scope* scope) {
+  compiler->symtab->currentScope = scope;
 }
 
-void exitBlock(void) {
-  symtab->currentScope = symtab->currentScope->outer;
+void exitBlock(Compiler* compiler) {
+  compiler->symtab->currentScope = compiler->symtab->currentScope->outer;
 }
 
-void declareObject(Object* obj) {
+void declareObject(Compiler* compiler, Object* obj) {
   Object* owner;
 
-  if (symtab->currentScope == NULL)  //  globalObject
-    addObject(&(symtab->globalObjectList), obj);
+  if (currentStats != NULL)
+    currentStats->objectCount ++;
+
+  if (compiler->symtab->currentScope == NULL)  //  globalObject
+    addObject(&(compiler->symtab->globalObjectList), obj);
   else {
     switch (obj->kind) {
     case OBJ_VARIABLE:
-      obj->varAttrs->scope = symtab->currentScope;
-      obj->varAttrs->localOffset = symtab->currentScope->frameSize;
-      symtab->currentScope->frameSize += sizeOfType(obj->varAttrs->type);
+      obj->varAttrs->scope = compiler->symtab->currentScope;
+      obj->varAttrs->localOffset = compiler->symtab->currentScope->frameSize;
+      compiler->symtab->currentScope->frameSize += sizeOfType(obj->varAttrs->type);
       break;
     case OBJ_PARAMETER:
-      obj->paramAttrs->scope = symtab->currentScope;
-      obj->paramAttrs->localOffset = symtab->currentScope->frameSize;
-      symtab->currentScope->frameSize ++;
-      owner = symtab->currentScope->owner;
+      obj->paramAttrs->scope = compiler->symtab->currentScope;
+      obj->paramAttrs->localOffset = compiler->symtab->currentScope->frameSize;
+      compiler->symtab->currentScope->frameSize ++;
+      owner = compiler->symtab->currentScope->owner;
       switch (owner->kind) {
       case OBJ_FUNCTION:
 	addObject(&(owner->funcAttrs->paramList), obj);
@@ -379,14 +386,14 @@ void declareObject(Object* obj) {
       }
       break;
     case OBJ_FUNCTION:
-      obj->funcAttrs->scope->outer = symtab->currentScope;
+      obj->funcAttrs->scope->outer = compiler->symtab->currentScope;
       break;
     case OBJ_PROCEDURE:
-      obj->procAttrs->scope->outer = symtab->currentScope;
+      obj->procAttrs->scope->outer = compiler->symtab->currentScope;
       break;
     default: break;
     }
-    addObject(&(symtab->currentScope->objList), obj);
+    addObject(&(compiler->symtab->currentScope->objList), obj);
   }
   
 }
@@ -9,6 +9,7 @@
 
 #include "token.h"
 #include "instructions.h"
+#include "compiler.h"
 
 enum TypeClass {
   TP_INT,
@@ -162,7 +163,7 @@ ConstantValue* duplicateConstantValue(ConstantValue* v);
 
 Scope* createScope(Object* owner);
 
-Object* createProgramObject(char *programName);
+Object* createProgramObject(Compiler* compiler, char *programName);
 Object* createConstantObject(char *name);
 Object* createTypeObject(char *name);
 Object* createVariableObject(char *name);
@@ -172,10 +173,11 @@ Object* createParameterObject(char *name, enum ParamKind kind);
 
 Object* findObject(ObjectNode *objList, char *name);
 
-void initSymTab(void);
-void cleanSymTab(void);
-void enterBlock(Scope* scope);
-void exitBlock(void);
-void declareObject(Object* obj);
+void initSymTab(Compiler* compiler);
+void cleanSymTab(Compiler* compiler);
+void resetSymTab(Compiler* compiler);
+void enterBlock(Compiler* compiler, Scope* scope);
+void exitBlock(Compiler* compiler);
+void declareObject(Compiler* compiler, Object* obj);
 
 #endif
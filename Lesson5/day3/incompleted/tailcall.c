@@ -0,0 +1,148 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include "ir.h"
+#include "codegen.h"
+
+/*
+ * Tail-call elimination: a function or procedure calling itself last,
+ * with nothing after the call but the assignment of its value to the
+ * function's name, stores the arguments into its parameters and jumps
+ * back to the start of its body instead. The frame is reused, so deep
+ * recursion runs in constant stack space. The call passes the same
+ * static link as the frame has, so only the arguments differ; a VAR
+ * argument that points into the frame itself would see it reused, and
+ * keeps the call.
+ */
+
+// Whether control goes from block straight to the return of the function
+static int returnsNext(IrFunction* function, IrBlock* block) {
+  int steps;
+
+  if (block->last->op == IR_RETURN)
+    return 1;
+  if (block->last->op != IR_JUMP)
+    return 0;
+  block = block->succ[0];
+  for (steps = 0; steps < function->blockCount; steps++) {
+    if (block->first != block->last)
+      return 0;
+    if (block->first->op == IR_RETURN)
+      return 1;
+    if (block->first->op != IR_JUMP)
+      return 0;
+    block = block->succ[0];
+  }
+  return 0;
+}
+
+// Whether the address is in the frame of the function, as ADDR 0, or based on it
+static int isFrameAddress(IrInst** defs, IrOperand* address) {
+  IrInst* def;
+
+  while (address->kind == OPD_TEMP) {
+    def = defs[address->value];
+    if (def == NULL)
+      return 0;
+    if (def->op == IR_ADDR)
+      return def->level == 0;
+    if (def->op != IR_ADD)
+      return 0;
+    address = &def->a;
+  }
+  return 0;
+}
+
+static int isTailCall(IrFunction* function, IrInst** defs, IrInst* call) {
+  IrInst* next = call->next;
+  ObjectNode* param;
+  int i;
+
+  if ((call->op != IR_CALL) || (call->callee != function->owner))
+    return 0;
+  if (call->dest != NO_TEMP) {
+    // The value of the call goes to the function's name
+    if ((next->op != IR_STORE) || (next->level != 0) || (next->offset != RETURN_VALUE_OFFSET) ||
+	(next->a.kind != OPD_TEMP) || (next->a.value != call->dest))
+      return 0;
+    next = next->next;
+  }
+  if ((next != call->block->last) || !returnsNext(function, call->block))
+    return 0;
+
+  param = (function->owner->kind == OBJ_FUNCTION) ? function->owner->funcAttrs->paramList :
+    function->owner->procAttrs->paramList;
+  for (i = 0; i < call->argCount; i++, param = param->next)
+    if ((param->object->paramAttrs->kind == PARAM_REFERENCE) && isFrameAddress(defs, call->args + i))
+      return 0;
+  return 1;
+}
+
+static void eliminateTailCall(Compiler* compiler, IrFunction* function, IrInst* call, IrBlock* body) {
+  IrBlock* block = call->block;
+  ObjectNode* param;
+  IrInst* inst;
+  int i;
+
+  param = (function->owner->kind == OBJ_FUNCTION) ? function->owner->funcAttrs->paramList :
+    function->owner->procAttrs->paramList;
+  for (i = 0; i < call->argCount; i++, param = param->next) {
+    inst = createIrInst(compiler, IR_STORE);
+    inst->lineNo = call->lineNo;
+    inst->offset = PARAMETER_OFFSET(param->object);
+    inst->a = call->args[i];
+    insertIrInstBefore(call, inst);
+  }
+
+  while (call->next != NULL)
+    removeIrInst(call->next);
+  call->op = IR_JUMP;
+  call->dest = NO_TEMP;
+  call->level = 0;
+  call->callee = NULL;
+  call->args = NULL;
+  call->argCount = 0;
+  block->succ[0] = body;
+  block->succ[1] = NULL;
+}
+
+void eliminateTailCalls(Compiler* compiler, IrFunction* function) {
+  IrFunction* child;
+  IrInst** defs;
+  IrBlock* block;
+  IrBlock* body = NULL;
+  IrBlock* entry;
+  IrInst* inst;
+  IrInst* jump;
+
+  for (child = function->children; child != NULL; child = child->next)
+    eliminateTailCalls(compiler, child);
+  if (function->owner->kind == OBJ_PROGRAM)
+    return;
+
+  defs = findDefinitions(function);
+  for (block = function->blocks; block != NULL; block = block->next)
+    for (inst = block->first; inst != NULL; inst = inst->next) {
+      if (!isTailCall(function, defs, inst)) continue;
+
+      // The body becomes a loop, entered from a block of its own
+      if (body == NULL) {
+	body = function->blocks;
+	entry = createIrBlock(compiler, function);
+	entry->next = body;
+	entry->succ[0] = body;
+	function->blocks = entry;
+	jump = createIrInst(compiler, IR_JUMP);
+	if (body->first != NULL)
+	  jump->lineNo = body->first->lineNo;
+	appendIrInst(entry, jump);
+      }
+      eliminateTailCall(compiler, function, inst, body);
+      break;
+    }
+  free(defs);
+}
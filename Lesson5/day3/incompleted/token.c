@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include "token.h"
+#include "stats.h"
 
 struct {
   char string[MAX_IDENT_LEN + 1];
@@ -51,7 +52,7 @@ TokenType checkKeyword(char *string) {
 }
 
 Token* makeToken(TokenType tokenType, int lineNo, int colNo) {
-  Token *token = (Token*)malloc(sizeof(Token));
+  Token *token = (Token*) countedMalloc(sizeof(Token));
   token->tokenType = tokenType;
   token->lineNo = lineNo;
   token->colNo = colNo;
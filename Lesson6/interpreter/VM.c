@@ -6,309 +6,349 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <curses.h>
 
 #include "vm.h"
 
-CodeBlock *codeBlock;
-WORD* stack;
-WORD* global;
-int t;
-int b;
-int pc;
-int ps;
-int stackSize;
-int codeSize;
-int debugMode;
-
-void resetVM(void) {
-  pc = 0;
-  t = -1;
-  b = 0;
-  ps = PS_INACTIVE;
+/*
+ * The stack is mapped between two PROT_NONE guard regions, with its top
+ * word at the end of a page, so running off either end faults instead of
+ * needing a bounds check on every push and pop. The SIGSEGV handler turns
+ * a fault inside a guard region of the VM running on the faulting thread
+ * into PS_STACK_OVERFLOW.
+ */
+static __thread VM* runningVM;
+static pthread_once_t handlerOnce = PTHREAD_ONCE_INIT;
+static struct sigaction previousAction;
+
+void resetVM(VM* vm) {
+  vm->pc = 0;
+  vm->t = -1;
+  vm->b = 0;
+  vm->ps = PS_INACTIVE;
+}
+
+static size_t roundToPages(size_t size, size_t pageSize) {
+  return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+static void allocateStack(VM* vm) {
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t stackBytes = roundToPages(vm->stackSize * sizeof(WORD), pageSize);
+
+  vm->guardSize = roundToPages(GUARD_SIZE, pageSize);
+  vm->stackMappingSize = vm->guardSize + stackBytes + vm->guardSize;
+  vm->stackMapping = mmap(NULL, vm->stackMappingSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (vm->stackMapping == MAP_FAILED) {
+    vm->stackMapping = NULL;
+    vm->stack = NULL;
+    return;
+  }
+
+  vm->lowerGuard = vm->stackMapping;
+  vm->upperGuard = vm->stackMapping + vm->guardSize + stackBytes;
+  mprotect(vm->lowerGuard + vm->guardSize, stackBytes, PROT_READ | PROT_WRITE);
+  vm->stack = (Memory) (vm->upperGuard - vm->stackSize * sizeof(WORD));
+}
+
+void initVM(VM* vm, int codeSize, int stackSize) {
+  memset(vm, 0, sizeof(VM));
+  vm->codeBlock = createCodeBlock(codeSize);
+  vm->stackSize = stackSize;
+  vm->jitEnabled = jitSupported;
+  allocateStack(vm);
+  resetVM(vm);
+}
+
+void cleanVM(VM* vm) {
+  freeCodeBlock(vm->codeBlock);
+  freeVerification(&(vm->verification));
+  if (vm->stackMapping != NULL)
+    munmap(vm->stackMapping, vm->stackMappingSize);
+  vm->codeBlock = NULL;
+  vm->stackMapping = NULL;
+  vm->stack = NULL;
 }
 
-void initVM(void) {
-  codeBlock = createCodeBlock(codeSize);
-  stack = (Memory) malloc(stackSize * sizeof(WORD));
-  resetVM();
+static int isGuardAddress(VM* vm, char* address) {
+  return ((address >= vm->lowerGuard) && (address < vm->lowerGuard + vm->guardSize)) ||
+    ((address >= vm->upperGuard) && (address < vm->upperGuard + vm->guardSize));
 }
 
-void cleanVM(void) {
-  freeCodeBlock(codeBlock);
-  free(stack);
+static void handleSegmentationFault(int signo, siginfo_t* info, void* context) {
+  VM* vm = runningVM;
+
+  if ((vm != NULL) && isGuardAddress(vm, (char*) info->si_addr))
+    siglongjmp(vm->overflowJump, 1);
+
+  // Not ours: crash the way we would have without the handler
+  sigaction(SIGSEGV, &previousAction, NULL);
+  raise(SIGSEGV);
 }
 
-int loadExecutable(FILE* f) {
-  loadCode(codeBlock,f);
-  resetVM();
+// The handler is shared by every VM in the process, so it is installed once
+static void installOverflowHandler(void) {
+  struct sigaction action;
+
+  action.sa_sigaction = handleSegmentationFault;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigaction(SIGSEGV, &action, &previousAction);
+}
+
+// Each thread handles its faults on a stack of its own, so that the
+// handler doesn't depend on the state of the C stack
+static void installSignalStack(VM* vm, stack_t* oldSignalStack) {
+  stack_t ss;
+
+  vm->signalStack = (char*) malloc(SIGSTKSZ);
+  ss.ss_sp = vm->signalStack;
+  ss.ss_size = SIGSTKSZ;
+  ss.ss_flags = 0;
+  sigaltstack(&ss, oldSignalStack);
+}
+
+static void removeSignalStack(VM* vm, stack_t* oldSignalStack) {
+  sigaltstack(oldSignalStack, NULL);
+  free(vm->signalStack);
+  vm->signalStack = NULL;
+}
+
+// Returns 0 if the executable is larger than the code block
+int loadExecutable(VM* vm, FILE* f) {
+  if (!loadCode(vm->codeBlock,f))
+    return 0;
+  resetVM(vm);
+  verifyExecutable(vm);
   return 1;
 }
 
-int saveExecutable(FILE* f) {
-  saveCode(codeBlock,f);
+/*
+ * Verified code cannot under- or overflow the operand stack within a
+ * frame, so the only overflow left is by recursion, which the guard pages
+ * catch as long as no single frame can step over a guard region.
+ */
+int verifyExecutable(VM* vm) {
+  freeVerification(&(vm->verification));
+  vm->verified = verifyCode(vm->codeBlock, &(vm->verification)) &&
+    ((vm->verification.maxDepth + 1) * (int) sizeof(WORD) <= GUARD_SIZE);
+  return vm->verified;
+}
+
+void printVerificationReport(VM* vm) {
+  printVerification(&(vm->verification));
+  if (vm->verification.verified && !vm->verified)
+    printf("Frames are larger than the stack guard: running checked\n");
+}
+
+int saveExecutable(VM* vm, FILE* f) {
+  saveCode(vm->codeBlock,f);
   return 1;
 }
 
-int checkStack(void) {
-  return ((t >= 0) && (t <stackSize));
+int base(VM* vm, int p) {
+  int currentBase = vm->b;
+  while (p > 0) {
+    currentBase = vm->stack[currentBase + 3];
+    p --;
+  }
+  return currentBase;
 }
 
-int base(int p) {
-  int currentBase = b;
+// base() that stays inside the stack, -1 if a static link leads outside
+static int checkedBase(VM* vm, int p) {
+  int currentBase = vm->b;
   while (p > 0) {
-    currentBase = stack[currentBase + 3];
+    if ((currentBase + 3 < 0) || (currentBase + 3 >= vm->stackSize))
+      return -1;
+    currentBase = vm->stack[currentBase + 3];
     p --;
   }
   return currentBase;
 }
 
-void printMemory(void) {
+static int isStackAddress(VM* vm, int address) {
+  return (address >= 0) && (address < vm->stackSize);
+}
+
+// Used by the checked loop before executing code[pc]
+static int checkInstruction(VM* vm) {
+  Instruction* inst;
+  int address;
+
+  if ((vm->pc < 0) || (vm->pc >= vm->codeBlock->codeSize))
+    return PS_INVALID_CODE;
+  inst = vm->codeBlock->code + vm->pc;
+
+  if (vm->t + 1 < stackPops(inst))
+    return PS_INVALID_CODE;
+  if (vm->t + stackPushes(inst) >= vm->stackSize)
+    return PS_STACK_OVERFLOW;
+
+  switch (inst->op) {
+  case OP_LA:
+  case OP_LV:
+  case OP_CALL:
+    address = checkedBase(vm, inst->p);
+    if (address < 0)
+      return PS_INVALID_CODE;
+    if ((inst->op == OP_LV) && !isStackAddress(vm, address + inst->q))
+      return PS_INVALID_CODE;
+    break;
+  case OP_LI:
+    if (!isStackAddress(vm, vm->stack[vm->t]))
+      return PS_INVALID_CODE;
+    break;
+  case OP_ST:
+    if (!isStackAddress(vm, vm->stack[vm->t-1]))
+      return PS_INVALID_CODE;
+    break;
+  case OP_EP:
+  case OP_EF:
+    if (!isStackAddress(vm, vm->b) || !isStackAddress(vm, vm->b + 2))
+      return PS_INVALID_CODE;
+    break;
+  case OP_SL:
+  case OP_SR:
+    if (!IS_SHIFT_COUNT(inst->q))
+      return PS_INVALID_CODE;
+    break;
+  default:
+    break;
+  }
+  return PS_ACTIVE;
+}
+
+// RC and RI: like wscanw, every read consumes one line of input
+static int readInput(VM* vm, WINDOW* win, char* format, int* number) {
+  char line[100];
+
+  if (vm->output == NULL) {
+    echo();
+    wscanw(win, format, number);
+    noecho();
+    return 1;
+  }
+
+  if ((vm->input == NULL) || (fgets(line, sizeof(line), vm->input) == NULL))
+    return 0;
+  *number = 0;
+  return sscanf(line, format, number) == 1;
+}
+
+static void writeOutput(VM* vm, WINDOW* win, char* format, int value) {
+  if (vm->output != NULL)
+    fprintf(vm->output, format, value);
+  else wprintw(win, format, value);
+}
+
+void printMemory(VM* vm) {
   int i;
   printf("Start dumping...\n");
-  for (i = 0; i <= t; i++) 
-    printf("  %4d: %d\n",i,stack[i]);
+  for (i = 0; i <= vm->t; i++)
+    printf("  %4d: %d\n",i,vm->stack[i]);
   printf("Finish dumping!\n");
 }
 
-void printCodeBuffer(void) {
-  printCodeBlock(codeBlock);
+void printCodeBuffer(VM* vm) {
+  printCodeBlock(vm->codeBlock);
 }
 
-int run(void) {
-  Instruction* code = codeBlock->code;
-  int count = 0;
-  int number;
-  char s[100];
-
-  WINDOW* win = initscr();
-  nonl();
-  cbreak();
-  noecho();
-  scrollok(win,TRUE);
-  
-  ps = PS_ACTIVE;
-  while (ps == PS_ACTIVE) {
-    if (debugMode) {
-      sprintInstruction(s,&(code[pc]));
-      wprintw(win, "%6d-%-4d:  %s\n",count++,pc,s);
-    }
-
-    switch (code[pc].op) {
-    case OP_LA: 
-      t ++;
-      if (checkStack())
-	stack[t] = base(code[pc].p) + code[pc].q;
-      break;
-    case OP_LV: 
-      t ++;
-      if (checkStack())
-	stack[t] = stack[base(code[pc].p) + code[pc].q];
-      break;
-    case OP_LC: 
-      t ++;
-      if (checkStack())
-	stack[t] = code[pc].q;
-      break;
-    case OP_LI: 
-      stack[t] = stack[stack[t]];
-      break;
-    case OP_INT:
-      t += code[pc].q;
-      checkStack();
-      break;
-    case OP_DCT: 
-      t -= code[pc].q;
-      checkStack();
-      break;
-    case OP_J: 
-      pc = code[pc].q - 1;
-      break;
-    case OP_FJ: 
-      if (stack[t] == FALSE) 
-	pc = code[pc].q - 1;
-      t --;
-      checkStack();
-      break;
-    case OP_HL: 
-      ps = PS_NORMAL_EXIT;
-      break;
-    case OP_ST: 
-      stack[stack[t-1]] = stack[t];
-      t -= 2;
-      checkStack();
-      break;
-    case OP_CALL: 
-      stack[t+2] = b;                 // Dynamic Link
-      stack[t+3] = pc;                // Return Address
-      stack[t+4] = base(code[pc].p);  // Static Link
-      b = t + 1;                      // Base & Result
-      pc = code[pc].q - 1;              
-      break;
-    case OP_EP: 
-      t = b - 1;                      // Previous top
-      pc = stack[b+2];                // Saved return address
-      b = stack[b+1];                 // Saved base
-      break;
-    case OP_EF:
-      t = b;                          // return value is on the top of the stack
-      pc = stack[b+2];                // Saved return address
-      b = stack[b+1];                 // saved base
-      break;
-    case OP_RC: 
-      t ++;
-      echo();
-      wscanw(win,"%c",&number);
-      noecho();
-      stack[t] = number;
-      checkStack();
-      break;
-    case OP_RI:
-      t ++;
-      echo();
-      wscanw(win,"%d",&number);
-      noecho();
-      stack[t] = number;
-      checkStack();
-      break;
-    case OP_WRC: 
-      wprintw(win,"%c",stack[t]);
-      t --;
-      checkStack();
-      break;     
-    case OP_WRI: 
-      wprintw(win,"%d",stack[t]);
-      t --;
-      checkStack();
-      break;
-    case OP_WLN:
-      wprintw(win,"\n");
-      break;
-    case OP_AD:
-      t --;
-      if (checkStack()) 
-	stack[t] += stack[t+1];
-      break;
-    case OP_SB:
-      t --;
-      if (checkStack()) 
-	stack[t] -= stack[t+1];
-      break;
-    case OP_ML:
-      t --;
-      if (checkStack()) 
-	stack[t] *= stack[t+1];
-      break;
-
-    case OP_DV: 
-      t --;
-      if (checkStack()) {
-	if (stack[t+1] == 0)
-	  ps = PS_DIVIDE_BY_ZERO;
-	else stack[t] /= stack[t+1];
-      }
-      break;
-    case OP_NEG:
-      stack[t] = - stack[t];
-      break;
-    case OP_CV: 
-      stack[t+1] = stack[t];
-      t ++;
-      checkStack();
-      break;
-    case OP_EQ:
-      t --;
-      if (stack[t] == stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
-      break;
-    case OP_NE:
-      t --;
-      if (stack[t] != stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
-      break;
-    case OP_GT:
-      t --;
-      if (stack[t] > stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
-      break;
-    case OP_LT:
-      t --;
-      if (stack[t] < stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
-      break;
-    case OP_GE:
-      t --;
-      if (stack[t] >= stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
-      break;
-    case OP_LE:
-      t --;
-      if (stack[t] <= stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
-      break;
-    case OP_BP:
-      // Just for debugging
-      debugMode = 1;
-      break;
-    default: break;
-    }
-
-    if (debugMode) {
-      int command;
-      int level, offset;
-      int interactive = 1;
-      
-      do {
-	interactive = 0;
-
-	command = getch();
-	switch (command) {
-	case 'a':
-	case 'A':
-	  wprintw(win,"\nEnter memory location (level, offset):");
-	  wscanw(win,"%d %d", &level, &offset);
-	  wprintw(win,"Absolute address = %d\n", base(level) + offset);
-	  interactive = 1;
-	  break;
-	case 'm':
-	case 'M':
-	  wprintw(win,"\nEnter memory location (level, offset):");
-	  wscanw(win,"%d %d", &level, &offset);
-	  wprintw(win,"Value = %d\n", stack[base(level) + offset]);
-	  interactive = 1;
-	  break;
-	case 't':
-	case 'T':
-	  wprintw(win,"Top (%d) = %d\n", t, stack[t]);
-	  interactive = 1;
-	  break;
-	case 'c':
-	case 'C':
-	  debugMode = 0;
-	  break;
-	case 'h':
-	case 'H':
-	  ps = PS_NORMAL_EXIT;
-	  break;
-	default: break;
-	}
-      } while (interactive);
-    }
-    pc ++;
+// What stopped the machine, NULL if it halted normally
+char* getErrorMessage(VM* vm) {
+  switch (vm->ps) {
+  case PS_DIVIDE_BY_ZERO: return "Divide by zero";
+  case PS_STACK_OVERFLOW: return "Stack overflow";
+  case PS_IO_ERROR: return "IO error";
+  case PS_INVALID_CODE: return "Invalid code";
+  default: return NULL;
+  }
+}
+
+// Source line of the instruction that stopped the machine, 0 if unknown.
+// run() leaves pc one past that instruction.
+int getErrorLine(VM* vm) {
+  if ((vm->pc < 1) || (vm->pc > vm->codeBlock->codeSize))
+    return 0;
+  return lineOfCode(vm->codeBlock, vm->pc - 1);
+}
+
+#define RUN_LOOP runPlain
+#define VM_PROFILE 0
+#define VM_CHECKED 0
+#include "vmloop.h"
+#undef RUN_LOOP
+#undef VM_PROFILE
+#undef VM_CHECKED
+
+#define RUN_LOOP runChecked
+#define VM_PROFILE 0
+#define VM_CHECKED 1
+#include "vmloop.h"
+#undef RUN_LOOP
+#undef VM_PROFILE
+#undef VM_CHECKED
+
+// Profiling is not about speed, so it always runs checked
+#define RUN_LOOP runProfiled
+#define VM_PROFILE 1
+#define VM_CHECKED 1
+#include "vmloop.h"
+#undef RUN_LOOP
+#undef VM_PROFILE
+#undef VM_CHECKED
+
+int run(VM* vm) {
+  stack_t oldSignalStack;
+  WINDOW* win = NULL;
+
+  if (vm->stack == NULL)
+    return vm->ps = PS_STACK_OVERFLOW;
+
+  if (vm->output == NULL) {
+    win = initscr();
+    nonl();
+    cbreak();
+    noecho();
+    scrollok(win,TRUE);
+  } else vm->debugMode = 0;
+
+  if ((vm->profile == NULL) && vm->jitEnabled)
+    vm->jit = createJIT(vm->codeBlock, vm->stackSize, !vm->verified);
+
+  pthread_once(&handlerOnce, installOverflowHandler);
+  installSignalStack(vm, &oldSignalStack);
+  runningVM = vm;
+  if (sigsetjmp(vm->overflowJump, 1) == 0) {
+    if (vm->profile != NULL) {
+      startProfileTimer(vm->profile);
+      runProfiled(vm, win);
+      stopProfileTimer(vm->profile);
+    } else if (vm->verified)
+      runPlain(vm, win);
+    else runChecked(vm, win);
+  } else {
+    // Faulted in a guard region while executing code[pc]
+    vm->ps = PS_STACK_OVERFLOW;
+    vm->pc ++;
+    if (vm->profile != NULL)
+      stopProfileTimer(vm->profile);
+  }
+  runningVM = NULL;
+  removeSignalStack(vm, &oldSignalStack);
+
+  freeJIT(vm->jit);
+  vm->jit = NULL;
+
+  if (win != NULL) {
+    wprintw(win,"\nPress any key to exit...");getch();
+    endwin();
   }
-  wprintw(win,"\nPress any key to exit...");getch();
-  endwin();
-  return ps;
+  return vm->ps;
 }
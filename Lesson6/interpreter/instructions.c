@@ -15,14 +15,48 @@ CodeBlock* createCodeBlock(int maxSize) {
   codeBlock->code = (Instruction*) malloc(maxSize * sizeof(Instruction));
   codeBlock->codeSize = 0;
   codeBlock->maxSize = maxSize;
+  codeBlock->lines = NULL;
+  codeBlock->lineCount = 0;
+  codeBlock->maxLines = 0;
+  codeBlock->currentLine = 0;
   return codeBlock;
 }
 
 void freeCodeBlock(CodeBlock* codeBlock) {
+  free(codeBlock->lines);
   free(codeBlock->code);
   free(codeBlock);
 }
 
+static void addLineEntry(CodeBlock* codeBlock, CodeAddress address, int lineNo) {
+  if (codeBlock->lineCount >= codeBlock->maxLines) {
+    codeBlock->maxLines = (codeBlock->maxLines == 0) ? 64 : codeBlock->maxLines * 2;
+    codeBlock->lines = (LineEntry*) realloc(codeBlock->lines, codeBlock->maxLines * sizeof(LineEntry));
+  }
+  codeBlock->lines[codeBlock->lineCount].address = address;
+  codeBlock->lines[codeBlock->lineCount].lineNo = lineNo;
+  codeBlock->lineCount ++;
+}
+
+void setCurrentLine(CodeBlock* codeBlock, int lineNo) {
+  codeBlock->currentLine = lineNo;
+}
+
+// Returns the source line of the instruction at address, or 0 if unknown
+int lineOfCode(CodeBlock* codeBlock, CodeAddress address) {
+  int low = 0, high = codeBlock->lineCount - 1, mid;
+
+  if ((high < 0) || (address < codeBlock->lines[0].address))
+    return 0;
+  while (low < high) {
+    mid = (low + high + 1) / 2;
+    if (codeBlock->lines[mid].address <= address)
+      low = mid;
+    else high = mid - 1;
+  }
+  return codeBlock->lines[low].lineNo;
+}
+
 int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q) {
   Instruction* bottom = codeBlock->code + codeBlock->codeSize;
 
@@ -31,6 +65,12 @@ int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q) {
   bottom->op = op;
   bottom->p = p;
   bottom->q = q;
+
+  if ((codeBlock->currentLine > 0) &&
+      ((codeBlock->lineCount == 0) ||
+       (codeBlock->lines[codeBlock->lineCount - 1].lineNo != codeBlock->currentLine)))
+    addLineEntry(codeBlock, codeBlock->codeSize, codeBlock->currentLine);
+
   codeBlock->codeSize ++;
   return 1;
 }
@@ -65,6 +105,8 @@ int emitGT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GT, DC_VALUE, D
 int emitLT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LT, DC_VALUE, DC_VALUE); }
 int emitGE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GE, DC_VALUE, DC_VALUE); }
 int emitLE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LE, DC_VALUE, DC_VALUE); }
+int emitSL(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_SL, DC_VALUE, q); }
+int emitSR(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_SR, DC_VALUE, q); }
 
 int emitBP(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_BP, DC_VALUE, DC_VALUE); }
 
@@ -101,6 +143,8 @@ void printInstruction(Instruction* inst) {
   case OP_LT: printf("LT"); break;
   case OP_GE: printf("GE"); break;
   case OP_LE: printf("LE"); break;
+  case OP_SL: printf("SL %d", inst->q); break;
+  case OP_SR: printf("SR %d", inst->q); break;
 
   case OP_BP: printf("BP"); break;
   default: break;
@@ -139,6 +183,8 @@ void sprintInstruction(char* s, Instruction* inst) {
   case OP_LT: sprintf(s,"LT"); break;
   case OP_GE: sprintf(s,"GE"); break;
   case OP_LE: sprintf(s,"LE"); break;
+  case OP_SL: sprintf(s, "SL %d", inst->q); break;
+  case OP_SR: sprintf(s, "SR %d", inst->q); break;
 
   case OP_BP: sprintf(s,"BP"); break;
   default: break;
@@ -157,19 +203,69 @@ void printCodeBlock(CodeBlock* codeBlock) {
 }
 
 
-void loadCode(CodeBlock* codeBlock, FILE* f) {
+/*
+ * Returns 0 if the code does not fit in the code block. The line table at
+ * the end of the file, found from its last record, goes to the lines of
+ * the block and takes no code space. A stream we can't seek in is read as
+ * code to its end.
+ */
+int loadCode(CodeBlock* codeBlock, FILE* f) {
   Instruction* code = codeBlock->code;
-  int n;
+  Instruction record;
+  long size = -1;
+  int count = 0;
+  int n, i;
 
   codeBlock->codeSize = 0;
-  while (!feof(f)) {
-    n = fread(code, sizeof(Instruction), MAX_BLOCK, f);
+  codeBlock->lineCount = 0;
+  if (fseek(f, 0, SEEK_END) == 0)
+    size = ftell(f) / (long) sizeof(Instruction);
+  if ((size > 0) && (fseek(f, (size - 1) * (long) sizeof(Instruction), SEEK_SET) == 0) &&
+      (fread(&record, sizeof(Instruction), 1, f) == 1) &&
+      ((int) record.op == LINE_TABLE_MAGIC) && (record.p >= 0) && (record.p < size - 1)) {
+    count = record.p;
+    size -= count + 1;
+  }
+  if (size >= 0) {
+    if (size > codeBlock->maxSize) return 0;
+    rewind(f);
+  }
+
+  while (!feof(f) && (codeBlock->codeSize < codeBlock->maxSize) &&
+	 ((size < 0) || (codeBlock->codeSize < size))) {
+    n = codeBlock->maxSize - codeBlock->codeSize;
+    if ((size >= 0) && (n > size - codeBlock->codeSize)) n = size - codeBlock->codeSize;
+    if (n > MAX_BLOCK) n = MAX_BLOCK;
+    n = fread(code, sizeof(Instruction), n, f);
+    if (n == 0) break;
     code += n;
     codeBlock->codeSize += n;
   }
+  if ((size < 0) && (codeBlock->codeSize == codeBlock->maxSize) &&
+      (fread(&record, sizeof(Instruction), 1, f) == 1))
+    return 0;
+
+  for (i = 0; (i < count) && (fread(&record, sizeof(Instruction), 1, f) == 1); i ++)
+    addLineEntry(codeBlock, (CodeAddress) record.op, record.p);
+  return 1;
 }
 
 
 void saveCode(CodeBlock* codeBlock, FILE* f) {
+  Instruction record;
+  int i;
+
   fwrite(codeBlock->code, sizeof(Instruction), codeBlock->codeSize, f);
+  if (codeBlock->lineCount == 0) return;
+
+  for (i = 0; i < codeBlock->lineCount; i ++) {
+    record.op = (enum OpCode) codeBlock->lines[i].address;
+    record.p = codeBlock->lines[i].lineNo;
+    record.q = 0;
+    fwrite(&record, sizeof(Instruction), 1, f);
+  }
+  record.op = (enum OpCode) LINE_TABLE_MAGIC;
+  record.p = codeBlock->lineCount;
+  record.q = 0;
+  fwrite(&record, sizeof(Instruction), 1, f);
 }
@@ -49,7 +49,11 @@ enum OpCode {
   OP_GE,   // Greater or Equal t := t - 1;  if s[t] >= s[t+1] then s[t] := 1 else s[t] := 0;
   OP_LE,   // Less or Equal    t := t - 1;  if s[t] >= s[t+1] then s[t] := 1 else s[t] := 0;
 
-  OP_BP    // Break point. Just for debugging
+  OP_BP,   // Break point. Just for debugging
+
+  // Added later, after BP, so that older executables keep their opcodes
+  OP_SL,   // Shift Left       s[t] := s[t] * 2^q;
+  OP_SR    // Shift Right      s[t] := s[t] / 2^q;  rounded towards 0 as DV
 };
 
 struct Instruction_ {
@@ -61,10 +65,31 @@ struct Instruction_ {
 typedef struct Instruction_ Instruction;
 typedef int CodeAddress;
 
+/*
+ * Executables may end with a table mapping code addresses to source lines.
+ * It is stored in records of the size of an instruction, after the final HL
+ * of the program, so loaders that don't know about it still run the code:
+ *   { address, lineNo, 0 }           one per run of instructions on a line
+ *   { LINE_TABLE_MAGIC, count, 0 }
+ */
+#define LINE_TABLE_MAGIC 0x4B504C4E
+
+struct LineEntry_ {
+  CodeAddress address;     // first instruction of the run
+  int lineNo;
+};
+
+typedef struct LineEntry_ LineEntry;
+
 struct CodeBlock_ {
   Instruction* code;
   int codeSize;
   int maxSize;
+
+  LineEntry* lines;
+  int lineCount;
+  int maxLines;
+  int currentLine;         // source line recorded for newly emitted code
 };
 
 typedef struct CodeBlock_ CodeBlock;
@@ -72,6 +97,9 @@ typedef struct CodeBlock_ CodeBlock;
 CodeBlock* createCodeBlock(int maxSize);
 void freeCodeBlock(CodeBlock* codeBlock);
 
+void setCurrentLine(CodeBlock* codeBlock, int lineNo);
+int lineOfCode(CodeBlock* codeBlock, CodeAddress address);
+
 int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q);
 
 int emitLA(CodeBlock* codeBlock, WORD p, WORD q);
@@ -104,6 +132,8 @@ int emitGT(CodeBlock* codeBlock);
 int emitLT(CodeBlock* codeBlock);
 int emitGE(CodeBlock* codeBlock);
 int emitLE(CodeBlock* codeBlock);
+int emitSL(CodeBlock* codeBlock, WORD q);
+int emitSR(CodeBlock* codeBlock, WORD q);
 
 int emitBP(CodeBlock* codeBlock);
 
@@ -111,7 +141,7 @@ void sprintInstruction(char *buffer,Instruction* instruction);
 void printInstruction(Instruction* instruction);
 void printCodeBlock(CodeBlock* codeBlock);
 
-void loadCode(CodeBlock* codeBlock, FILE* f);
+int loadCode(CodeBlock* codeBlock, FILE* f);
 void saveCode(CodeBlock* codeBlock, FILE* f);
 
 #endif
@@ -0,0 +1,549 @@
+/*
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#define JIT_BLACKLISTED -1
+
+/*
+ * A trace is the straight-line path the interpreter took through one
+ * iteration of a hot loop, from the loop header back to the backward J.
+ * Every FJ on the path becomes a guard: when the condition goes the other
+ * way at run time the native code leaves through a side exit that stores t
+ * and returns the pc the interpreter has to continue at.
+ *
+ * The checked interpreter runs code the verifier did not accept; its
+ * traces also check every address they read or write through, and leave
+ * through a side exit at the instruction when one is out of the stack, so
+ * that the interpreter reports it.
+ *
+ * A trace has a second entry just after the guard of its first FJ, the
+ * loop condition, so that a run of the loop is traced from its first trip
+ * on and not only from the first backward J.
+ *
+ * Native code register usage (x86-64, System V):
+ *   rdi  stack base        rsi  int* t (written back on exit)
+ *   rcx  t                 r9d  b
+ *   eax, edx, r10d  scratch
+ */
+
+struct Trace_ {
+  CodeAddress header;
+  CodeAddress entryPc;   // the FJ the second entry follows, or -1
+  int entry;             // offset of the second entry in code
+  unsigned char* code;
+  int codeSize;
+  int minDelta;          // lowest stack slot touched, relative to t at entry
+  int maxDelta;          // highest stack slot touched, relative to t at entry
+};
+
+typedef CodeAddress (*TraceFunction)(WORD* stack, int* t, int b);
+
+struct NativeBuffer_ {
+  unsigned char* bytes;
+  int size;
+  int maxSize;
+};
+
+typedef struct NativeBuffer_ NativeBuffer;
+
+struct SideExit_ {
+  int patch;             // offset of the rel32 to patch
+  CodeAddress pc;        // where the interpreter resumes
+};
+
+typedef struct SideExit_ SideExit;
+
+const int jitSupported = JIT_SUPPORTED;
+
+/******************* Native code buffer ******************************/
+
+static void emitByte(NativeBuffer* buf, unsigned char byte) {
+  if (buf->size >= buf->maxSize) {
+    buf->maxSize = (buf->maxSize == 0) ? 1024 : buf->maxSize * 2;
+    buf->bytes = (unsigned char*) realloc(buf->bytes, buf->maxSize);
+  }
+  buf->bytes[buf->size ++] = byte;
+}
+
+static void emitBytes(NativeBuffer* buf, int n, ...) {
+  va_list args;
+  int i;
+
+  va_start(args, n);
+  for (i = 0; i < n; i ++)
+    emitByte(buf, (unsigned char) va_arg(args, int));
+  va_end(args);
+}
+
+static void emitWord(NativeBuffer* buf, WORD w) {
+  unsigned int u = (unsigned int) w;
+  emitByte(buf, u & 0xFF);
+  emitByte(buf, (u >> 8) & 0xFF);
+  emitByte(buf, (u >> 16) & 0xFF);
+  emitByte(buf, (u >> 24) & 0xFF);
+}
+
+static void patchWord(NativeBuffer* buf, int offset, WORD w) {
+  unsigned int u = (unsigned int) w;
+  buf->bytes[offset] = u & 0xFF;
+  buf->bytes[offset + 1] = (u >> 8) & 0xFF;
+  buf->bytes[offset + 2] = (u >> 16) & 0xFF;
+  buf->bytes[offset + 3] = (u >> 24) & 0xFF;
+}
+
+/******************* Instruction templates ******************************/
+
+#define EMIT_LOAD_TOP(buf)      emitBytes(buf, 3, 0x8B, 0x04, 0x8F)          // mov eax, [rdi+rcx*4]
+#define EMIT_LOAD_BELOW(buf)    emitBytes(buf, 4, 0x8B, 0x44, 0x8F, 0xFC)    // mov eax, [rdi+rcx*4-4]
+#define EMIT_STORE_TOP(buf)     emitBytes(buf, 3, 0x89, 0x04, 0x8F)          // mov [rdi+rcx*4], eax
+#define EMIT_INC_T(buf)         emitBytes(buf, 3, 0x48, 0xFF, 0xC1)          // inc rcx
+#define EMIT_DEC_T(buf)         emitBytes(buf, 3, 0x48, 0xFF, 0xC9)          // dec rcx
+
+static void emitGuard(NativeBuffer* buf, unsigned char jcc, CodeAddress pc,
+		      SideExit* exits, int* exitCount) {
+  emitBytes(buf, 2, 0x0F, jcc);                          // jcc rel32
+  exits[*exitCount].patch = buf->size;
+  exits[*exitCount].pc = pc;
+  (*exitCount) ++;
+  emitWord(buf, 0);
+}
+
+// Leaves at pc unless 0 <= eax < limit
+static void emitAddressGuard(NativeBuffer* buf, int limit, CodeAddress pc,
+			     SideExit* exits, int* exitCount) {
+  emitByte(buf, 0x3D); emitWord(buf, limit);             // cmp eax, limit
+  emitGuard(buf, 0x83, pc, exits, exitCount);            // jae
+}
+
+// eax := base(p), checking the static links followed if limit > 0
+static void emitBase(NativeBuffer* buf, int p, int limit, CodeAddress pc,
+		     SideExit* exits, int* exitCount) {
+  emitBytes(buf, 3, 0x44, 0x89, 0xC8);                   // mov eax, r9d
+  while (p > 0) {
+    if (limit > 0)
+      emitAddressGuard(buf, limit - 3, pc, exits, exitCount);
+    emitBytes(buf, 3, 0x48, 0x63, 0xC0);                 // movsxd rax, eax
+    emitBytes(buf, 4, 0x8B, 0x44, 0x87, 0x0C);           // mov eax, [rdi+rax*4+12]
+    p --;
+  }
+}
+
+static void emitCompare(NativeBuffer* buf, unsigned char setcc) {
+  EMIT_LOAD_TOP(buf);
+  EMIT_DEC_T(buf);
+  emitBytes(buf, 3, 0x39, 0x04, 0x8F);                   // cmp [rdi+rcx*4], eax
+  emitBytes(buf, 3, 0x0F, setcc, 0xC0);                  // setcc al
+  emitBytes(buf, 3, 0x0F, 0xB6, 0xC0);                   // movzx eax, al
+  EMIT_STORE_TOP(buf);
+}
+
+/******************* Trace recording ******************************/
+
+static int isTraceable(enum OpCode op) {
+  switch (op) {
+  case OP_LA: case OP_LV: case OP_LC: case OP_LI:
+  case OP_INT: case OP_DCT: case OP_J: case OP_FJ: case OP_ST:
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV: case OP_NEG: case OP_CV:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+  case OP_SL: case OP_SR:
+    return 1;
+  default:
+    // Calls, I/O, halt and breakpoints leave the trace to the interpreter
+    return 0;
+  }
+}
+
+static int stackEffect(Instruction* inst) {
+  switch (inst->op) {
+  case OP_LA: case OP_LV: case OP_LC: case OP_CV:
+    return 1;
+  case OP_INT:
+    return inst->q;
+  case OP_DCT:
+    return - inst->q;
+  case OP_FJ:
+    return -1;
+  case OP_ST:
+    return -2;
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+static void abortRecording(JIT* jit) {
+  jit->hotCounts[jit->recordHeader] = JIT_BLACKLISTED;
+  jit->recording = 0;
+}
+
+static Trace* compileTrace(JIT* jit);
+
+void jitRecord(JIT* jit, CodeAddress pc, WORD top) {
+  Instruction* inst = jit->code->code + pc;
+
+  if (jit->recordCount > 0 && pc == jit->recordHeader) {
+    // Back at the header: the iteration is complete
+    Trace* trace = compileTrace(jit);
+
+    jit->traces[jit->recordHeader] = trace;
+    if (trace == NULL)
+      jit->hotCounts[jit->recordHeader] = JIT_BLACKLISTED;
+    else if (trace->entryPc >= 0)
+      jit->entries[trace->entryPc] = trace;
+    jit->recording = 0;
+    return;
+  }
+
+  if (pc == jit->recordEnd + 1) {
+    // The loop ended on the trip being recorded. Once, try again on the
+    // second trip of its next run: a loop that ran JIT_HOT_LOOP trips in
+    // runs of a divisor of it gets hot on the last trip of a run.
+    if (jit->hotCounts[jit->recordHeader] > JIT_HOT_LOOP)
+      abortRecording(jit);
+    else {
+      jit->hotCounts[jit->recordHeader] = 2 * JIT_HOT_LOOP - 1;
+      jit->recording = 0;
+    }
+    return;
+  }
+
+  if ((pc < jit->recordHeader) || (pc > jit->recordEnd) || (jit->recordCount >= JIT_MAX_TRACE) ||
+      !isTraceable(inst->op) ||
+      ((inst->op == OP_J) && (inst->q <= pc) && (inst->q != jit->recordHeader))) {
+    // Left the loop, entered an inner loop or met something we can't compile
+    abortRecording(jit);
+    return;
+  }
+
+  jit->records[jit->recordCount].pc = pc;
+  jit->records[jit->recordCount].taken = (inst->op == OP_FJ) && (top == FALSE);
+  jit->recordCount ++;
+}
+
+/******************* Trace compilation ******************************/
+
+#if JIT_SUPPORTED
+
+static Trace* compileTrace(JIT* jit) {
+  NativeBuffer buf = { NULL, 0, 0 };
+  SideExit* exits;
+  int exitCount = 0;
+  int limit = jit->checked ? jit->stackSize : 0;
+  CodeAddress pc;
+  CodeAddress entryPc = -1;
+  int loopStart, entryStart = 0;
+  int delta = 0, minDelta = 0, maxDelta = 0;
+  Trace* trace;
+  Instruction* inst;
+  int i;
+
+  // The trace must jump back to its header with the stack as it found it
+  inst = jit->code->code + jit->records[jit->recordCount - 1].pc;
+  if ((inst->op != OP_J) || (inst->q != jit->recordHeader))
+    return NULL;
+
+  for (i = 0; i < jit->recordCount; i ++) {
+    inst = jit->code->code + jit->records[i].pc;
+    delta += stackEffect(inst);
+    if (delta < minDelta) minDelta = delta;
+    if (delta > maxDelta) maxDelta = delta;
+    // Entered after the first FJ only if t is where it was at the header
+    if ((inst->op == OP_FJ) && (entryPc == -1))
+      entryPc = ((delta == 0) && !jit->records[i].taken) ? jit->records[i].pc : -2;
+    // An FJ or DV leaves at one guard, an access at one per static link and one more
+    exitCount += 2 + (((inst->op == OP_LA) || (inst->op == OP_LV)) ? inst->p : 0);
+  }
+  if (delta != 0)
+    return NULL;
+  exits = (SideExit*) malloc(exitCount * sizeof(SideExit));
+  exitCount = 0;
+
+  emitBytes(&buf, 3, 0x48, 0x63, 0x0E);                  // movsxd rcx, [rsi]
+  emitBytes(&buf, 3, 0x41, 0x89, 0xD1);                  // mov r9d, edx
+  loopStart = buf.size;
+
+  for (i = 0; i < jit->recordCount; i ++) {
+    pc = jit->records[i].pc;
+    inst = jit->code->code + pc;
+
+    switch (inst->op) {
+    case OP_LA:
+      emitBase(&buf, inst->p, limit, pc, exits, &exitCount);
+      emitByte(&buf, 0x05); emitWord(&buf, inst->q);     // add eax, q
+      EMIT_INC_T(&buf);
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_LV:
+      emitBase(&buf, inst->p, limit, pc, exits, &exitCount);
+      if (limit > 0) {
+	emitByte(&buf, 0x05); emitWord(&buf, inst->q);   // add eax, q
+	emitAddressGuard(&buf, limit, pc, exits, &exitCount);
+	emitBytes(&buf, 3, 0x48, 0x63, 0xC0);            // movsxd rax, eax
+	emitBytes(&buf, 3, 0x8B, 0x04, 0x87);            // mov eax, [rdi+rax*4]
+      } else {
+	emitBytes(&buf, 3, 0x48, 0x63, 0xC0);            // movsxd rax, eax
+	emitBytes(&buf, 3, 0x8B, 0x84, 0x87);            // mov eax, [rdi+rax*4+q*4]
+	emitWord(&buf, inst->q * (int) sizeof(WORD));
+      }
+      EMIT_INC_T(&buf);
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_LC:
+      EMIT_INC_T(&buf);
+      emitBytes(&buf, 3, 0xC7, 0x04, 0x8F);              // mov dword [rdi+rcx*4], q
+      emitWord(&buf, inst->q);
+      break;
+    case OP_LI:
+      if (limit > 0) {
+	EMIT_LOAD_TOP(&buf);
+	emitAddressGuard(&buf, limit, pc, exits, &exitCount);
+	emitBytes(&buf, 3, 0x48, 0x63, 0xC0);            // movsxd rax, eax
+      } else emitBytes(&buf, 4, 0x48, 0x63, 0x04, 0x8F); // movsxd rax, [rdi+rcx*4]
+      emitBytes(&buf, 3, 0x8B, 0x04, 0x87);              // mov eax, [rdi+rax*4]
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_INT:
+      emitBytes(&buf, 3, 0x48, 0x81, 0xC1);              // add rcx, q
+      emitWord(&buf, inst->q);
+      break;
+    case OP_DCT:
+      emitBytes(&buf, 3, 0x48, 0x81, 0xE9);              // sub rcx, q
+      emitWord(&buf, inst->q);
+      break;
+    case OP_J:
+      // Forward jumps are already followed by the recording
+      if (i == jit->recordCount - 1) {
+	emitByte(&buf, 0xE9);                            // jmp loopStart
+	emitWord(&buf, loopStart - (buf.size + 4));
+      }
+      break;
+    case OP_FJ:
+      EMIT_LOAD_TOP(&buf);
+      EMIT_DEC_T(&buf);
+      emitBytes(&buf, 2, 0x85, 0xC0);                    // test eax, eax
+      if (jit->records[i].taken)
+	emitGuard(&buf, 0x85, jit->records[i].pc + 1, exits, &exitCount);   // jnz
+      else
+	emitGuard(&buf, 0x84, inst->q, exits, &exitCount);             // jz
+      if (pc == entryPc)
+	entryStart = buf.size;
+      break;
+    case OP_ST:
+      if (limit > 0) {
+	EMIT_LOAD_BELOW(&buf);
+	emitAddressGuard(&buf, limit, pc, exits, &exitCount);
+	emitBytes(&buf, 3, 0x48, 0x63, 0xC0);            // movsxd rax, eax
+      } else emitBytes(&buf, 5, 0x48, 0x63, 0x44, 0x8F, 0xFC);  // movsxd rax, [rdi+rcx*4-4]
+      emitBytes(&buf, 3, 0x8B, 0x14, 0x8F);              // mov edx, [rdi+rcx*4]
+      emitBytes(&buf, 3, 0x89, 0x14, 0x87);              // mov [rdi+rax*4], edx
+      emitBytes(&buf, 4, 0x48, 0x83, 0xE9, 0x02);        // sub rcx, 2
+      break;
+    case OP_AD:
+      EMIT_LOAD_TOP(&buf);
+      EMIT_DEC_T(&buf);
+      emitBytes(&buf, 3, 0x01, 0x04, 0x8F);              // add [rdi+rcx*4], eax
+      break;
+    case OP_SB:
+      EMIT_LOAD_TOP(&buf);
+      EMIT_DEC_T(&buf);
+      emitBytes(&buf, 3, 0x29, 0x04, 0x8F);              // sub [rdi+rcx*4], eax
+      break;
+    case OP_ML:
+      EMIT_LOAD_BELOW(&buf);
+      emitBytes(&buf, 4, 0x0F, 0xAF, 0x04, 0x8F);        // imul eax, [rdi+rcx*4]
+      EMIT_DEC_T(&buf);
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_DV:
+      emitBytes(&buf, 4, 0x44, 0x8B, 0x14, 0x8F);        // mov r10d, [rdi+rcx*4]
+      emitBytes(&buf, 3, 0x45, 0x85, 0xD2);              // test r10d, r10d
+      // Division by zero is reported by the interpreter
+      emitGuard(&buf, 0x84, jit->records[i].pc, exits, &exitCount);         // jz
+      EMIT_LOAD_BELOW(&buf);
+      emitByte(&buf, 0x99);                              // cdq
+      emitBytes(&buf, 3, 0x41, 0xF7, 0xFA);              // idiv r10d
+      EMIT_DEC_T(&buf);
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_NEG:
+      emitBytes(&buf, 3, 0xF7, 0x1C, 0x8F);              // neg dword [rdi+rcx*4]
+      break;
+    case OP_SL:
+      emitBytes(&buf, 4, 0xC1, 0x24, 0x8F, inst->q);     // shl dword [rdi+rcx*4], q
+      break;
+    case OP_SR:
+      EMIT_LOAD_TOP(&buf);
+      emitBytes(&buf, 2, 0x89, 0xC2);                    // mov edx, eax
+      emitBytes(&buf, 3, 0xC1, 0xFA, 0x1F);              // sar edx, 31
+      emitBytes(&buf, 3, 0xC1, 0xEA, 32 - inst->q);      // shr edx, 32 - q
+      emitBytes(&buf, 2, 0x01, 0xD0);                    // add eax, edx
+      emitBytes(&buf, 3, 0xC1, 0xF8, inst->q);           // sar eax, q
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_CV:
+      EMIT_LOAD_TOP(&buf);
+      EMIT_INC_T(&buf);
+      EMIT_STORE_TOP(&buf);
+      break;
+    case OP_EQ: emitCompare(&buf, 0x94); break;          // sete
+    case OP_NE: emitCompare(&buf, 0x95); break;          // setne
+    case OP_GT: emitCompare(&buf, 0x9F); break;          // setg
+    case OP_LT: emitCompare(&buf, 0x9C); break;          // setl
+    case OP_GE: emitCompare(&buf, 0x9D); break;          // setge
+    case OP_LE: emitCompare(&buf, 0x9E); break;          // setle
+    default:
+      free(buf.bytes);
+      free(exits);
+      return NULL;
+    }
+  }
+
+  // Side exits: write t back and tell the interpreter where to go on
+  for (i = 0; i < exitCount; i ++) {
+    patchWord(&buf, exits[i].patch, buf.size - (exits[i].patch + 4));
+    emitBytes(&buf, 2, 0x89, 0x0E);                      // mov [rsi], ecx
+    emitByte(&buf, 0xB8); emitWord(&buf, exits[i].pc);   // mov eax, pc
+    emitByte(&buf, 0xC3);                                // ret
+  }
+  free(exits);
+
+  trace = (Trace*) malloc(sizeof(Trace));
+  trace->header = jit->recordHeader;
+  trace->entryPc = (entryPc >= 0) ? entryPc : -1;
+  if (trace->entryPc >= 0) {
+    trace->entry = buf.size;
+    emitBytes(&buf, 3, 0x48, 0x63, 0x0E);                // movsxd rcx, [rsi]
+    emitBytes(&buf, 3, 0x41, 0x89, 0xD1);                // mov r9d, edx
+    emitByte(&buf, 0xE9);                                // jmp entryStart
+    emitWord(&buf, entryStart - (buf.size + 4));
+  }
+  trace->minDelta = minDelta;
+  trace->maxDelta = maxDelta;
+  trace->codeSize = buf.size;
+  trace->code = mmap(NULL, buf.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (trace->code == MAP_FAILED) {
+    free(trace);
+    free(buf.bytes);
+    return NULL;
+  }
+  memcpy(trace->code, buf.bytes, buf.size);
+  free(buf.bytes);
+  if (mprotect(trace->code, buf.size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(trace->code, buf.size);
+    free(trace);
+    return NULL;
+  }
+  return trace;
+}
+
+CodeAddress jitExecute(Trace* trace, WORD* stack, int stackSize, int* t, int b) {
+  TraceFunction run;
+
+  if ((*t + trace->minDelta < 0) || (*t + trace->maxDelta >= stackSize))
+    return trace->header;   // not enough room: let the interpreter do it
+
+  run = (TraceFunction) (void*) trace->code;
+  return run(stack, t, b);
+}
+
+CodeAddress jitEnter(Trace* trace, WORD* stack, int stackSize, int* t, int b) {
+  TraceFunction run;
+
+  if ((*t + trace->minDelta < 0) || (*t + trace->maxDelta >= stackSize))
+    return trace->entryPc + 1;
+
+  run = (TraceFunction) (void*) (trace->code + trace->entry);
+  return run(stack, t, b);
+}
+
+static void freeTrace(Trace* trace) {
+  munmap(trace->code, trace->codeSize);
+  free(trace);
+}
+
+#else
+
+static Trace* compileTrace(JIT* jit) {
+  return NULL;
+}
+
+CodeAddress jitExecute(Trace* trace, WORD* stack, int stackSize, int* t, int b) {
+  return trace->header;
+}
+
+CodeAddress jitEnter(Trace* trace, WORD* stack, int stackSize, int* t, int b) {
+  return trace->entryPc + 1;
+}
+
+static void freeTrace(Trace* trace) {
+  free(trace);
+}
+
+#endif
+
+/******************* Hot loop detection ******************************/
+
+JIT* createJIT(CodeBlock* codeBlock, int stackSize, int checked) {
+  JIT* jit = (JIT*) malloc(sizeof(JIT));
+
+  jit->code = codeBlock;
+  jit->stackSize = stackSize;
+  jit->checked = checked;
+  jit->recording = 0;
+  jit->recordCount = 0;
+  jit->hotCounts = (int*) calloc(codeBlock->codeSize + 1, sizeof(int));
+  jit->traces = (Trace**) calloc(codeBlock->codeSize + 1, sizeof(Trace*));
+  jit->entries = (Trace**) calloc(codeBlock->codeSize + 1, sizeof(Trace*));
+  return jit;
+}
+
+void freeJIT(JIT* jit) {
+  int i;
+
+  if (jit == NULL) return;
+  for (i = 0; i <= jit->code->codeSize; i ++)
+    if (jit->traces[i] != NULL)
+      freeTrace(jit->traces[i]);
+  free(jit->traces);
+  free(jit->entries);
+  free(jit->hotCounts);
+  free(jit);
+}
+
+Trace* jitBackwardJump(JIT* jit, CodeAddress header, CodeAddress jumpAddress) {
+  // Unverified code may jump anywhere: the checked interpreter reports it
+  if ((header < 0) || (header > jit->code->codeSize))
+    return NULL;
+
+  if (jit->traces[header] != NULL)
+    return jit->traces[header];
+
+  if ((jit->hotCounts[header] == JIT_BLACKLISTED) || jit->recording)
+    return NULL;
+
+  if (++ jit->hotCounts[header] >= JIT_HOT_LOOP) {
+    jit->recording = 1;
+    jit->recordCount = 0;
+    jit->recordHeader = header;
+    jit->recordEnd = jumpAddress;
+  }
+  return NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "instructions.h"
+
+#define JIT_HOT_LOOP 50       // backward jumps to a loop header before it is traced
+#define JIT_MAX_TRACE 256     // longest trace (in instructions) we try to record
+
+struct Trace_;
+typedef struct Trace_ Trace;
+
+struct TraceRecord_ {
+  CodeAddress pc;
+  int taken;             // FJ only: did the recorded iteration jump?
+};
+
+typedef struct TraceRecord_ TraceRecord;
+
+// Hot loop counters, compiled traces and the recording in progress of one VM
+struct JIT_ {
+  int recording;         // checked by the interpreter before every instruction
+  CodeBlock* code;
+  int stackSize;
+  int checked;           // traces check their addresses, for code not verified
+  int* hotCounts;
+  Trace** traces;
+  Trace** entries;       // by the pc of the FJ after which a trace is entered
+
+  TraceRecord records[JIT_MAX_TRACE];
+  int recordCount;
+  CodeAddress recordHeader;
+  CodeAddress recordEnd;
+};
+
+typedef struct JIT_ JIT;
+
+extern const int jitSupported;   // 0 where we can't generate native code
+
+JIT* createJIT(CodeBlock* codeBlock, int stackSize, int checked);
+void freeJIT(JIT* jit);
+
+// Called by the interpreter on every backward J. Returns the compiled trace
+// of the loop if there is one, otherwise counts the iteration and starts
+// recording when the loop becomes hot.
+Trace* jitBackwardJump(JIT* jit, CodeAddress header, CodeAddress jumpAddress);
+
+// Called by the interpreter before executing each instruction while recording
+void jitRecord(JIT* jit, CodeAddress pc, WORD top);
+
+// Runs a trace until one of its guards fails. Returns the pc at which the
+// interpreter should resume; t is updated in place.
+CodeAddress jitExecute(Trace* trace, WORD* stack, int stackSize, int* t, int b);
+
+// Same, entering the trace just after the FJ at trace->entryPc, which the
+// interpreter has just executed without jumping
+CodeAddress jitEnter(Trace* trace, WORD* stack, int stackSize, int* t, int b);
+
+#endif
@@ -0,0 +1,346 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * kplrun-bench: the reference numbers for the VM and the code generator.
+ * Every P.kpl in the directory is compiled with kplc and run headless a
+ * number of times; the median run time is reported with the number of
+ * instructions the program executes, counted once by a profiled run.
+ * When there is a P.expected, the output must match it, and P.in is the
+ * input if there is one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "vm.h"
+
+#define SOURCE_FILE_EXT ".kpl"
+#define EXPECTED_FILE_EXT ".expected"
+#define INPUT_FILE_EXT ".in"
+
+#define BENCH_STACK_SIZE 65536
+#define BENCH_CODE_SIZE 16384
+#define MAX_RUNS 100
+#define MAX_KPLC_FLAGS 8
+
+char* kplcPath = "kplc";
+char* kplcFlags[MAX_KPLC_FLAGS];
+int kplcFlagCount = 0;
+int runCount = 5;
+int stackSize;
+int codeSize;
+int jitEnabled;
+
+void printUsage(void) {
+  printf("Usage: kplrun-bench directory [-kplc=path] [-kplc-flag=flag]... [-runs=N] [-s=stack_size] [-c=code_size] [-nojit]\n");
+  printf("   directory: kpl programs, each with an optional .expected output and .in input\n");
+  printf("   -kplc=path: the compiler (default: kplc)\n");
+  printf("   -kplc-flag=flag: compile with flag, such as -O2 (up to %d)\n", MAX_KPLC_FLAGS);
+  printf("   -runs=N: runs of each program, the median is reported (default: 5)\n");
+  printf("   -s=stack_size: set the stack size (default: %d)\n", BENCH_STACK_SIZE);
+  printf("   -c=code_size: set the code size (default: %d)\n", BENCH_CODE_SIZE);
+  printf("   -nojit: interpret hot loops instead of compiling them to native code\n");
+}
+
+int analyseParam(char* param) {
+  if (strncmp(param, "-kplc=", 6) == 0) {
+    kplcPath = param + 6;
+    return 1;
+  }
+  if (strncmp(param, "-kplc-flag=", 11) == 0) {
+    if (kplcFlagCount >= MAX_KPLC_FLAGS) return 0;
+    kplcFlags[kplcFlagCount ++] = param + 11;
+    return 1;
+  }
+  if (strncmp(param, "-runs=", 6) == 0) {
+    runCount = atoi(param + 6);
+    return (runCount > 0) && (runCount <= MAX_RUNS);
+  }
+  if (strncmp(param, "-s=", 3) == 0) {
+    stackSize = atoi(param+3);
+    return 1;
+  }
+  if (strncmp(param, "-c=", 3) == 0) {
+    codeSize = atoi(param+3);
+    return 1;
+  }
+  if (strcmp(param, "-nojit") == 0) {
+    jitEnabled = 0;
+    return 1;
+  }
+  return 0;
+}
+
+static double now(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static char* makeFileName(char* directory, char* name, char* ext) {
+  char* fileName = (char*) malloc(strlen(directory) + 1 + strlen(name) + strlen(ext) + 1);
+  sprintf(fileName, "%s/%s%s", directory, name, ext);
+  return fileName;
+}
+
+// The whole file in a malloc'ed buffer, NULL if it can't be read
+static char* readFile(char* fileName, size_t* size) {
+  FILE* f = fopen(fileName, "rb");
+  char* content;
+
+  if (f == NULL) return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  content = (char*) malloc(*size + 1);
+  if (fread(content, 1, *size, f) != *size) {
+    free(content);
+    content = NULL;
+  }
+  fclose(f);
+  return content;
+}
+
+// Runs kplc source executable flags, with what it prints going to ours
+static int compileProgram(char* source, char* executable) {
+  char* args[MAX_KPLC_FLAGS + 4];
+  pid_t pid;
+  int status;
+  int i;
+
+  args[0] = kplcPath;
+  args[1] = source;
+  args[2] = executable;
+  for (i = 0; i < kplcFlagCount; i++)
+    args[3 + i] = kplcFlags[i];
+  args[3 + kplcFlagCount] = NULL;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) return 0;
+  if (pid == 0) {
+    execvp(kplcPath, args);
+    _exit(127);
+  }
+  if (waitpid(pid, &status, 0) < 0) return 0;
+  return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+/*
+ * Loads and runs the executable once. Returns the run time in seconds,
+ * or a negative number if it can't be loaded. The output is returned in
+ * a malloc'ed buffer, and with a profile the instructions are counted.
+ */
+static double runProgram(char* executable, char* input, char** output, size_t* outputSize,
+			 unsigned long long* instructions) {
+  VM vm;
+  FILE* f;
+  double start, time;
+  char* message;
+  int i;
+
+  f = fopen(executable, "rb");
+  if (f == NULL) return -1;
+  initVM(&vm, codeSize, stackSize);
+  vm.jitEnabled = jitEnabled;
+  if (!loadExecutable(&vm, f)) {
+    fclose(f);
+    cleanVM(&vm);
+    return -1;
+  }
+  fclose(f);
+
+  vm.input = (input != NULL) ? fopen(input, "r") : NULL;
+  vm.output = open_memstream(output, outputSize);
+  if (instructions != NULL)
+    vm.profile = createProfile(vm.codeBlock);
+
+  start = now();
+  run(&vm);
+  time = now() - start;
+
+  message = getErrorMessage(&vm);
+  if (message != NULL)
+    fprintf(vm.output, "Runtime error: %s!\n", message);
+
+  if (instructions != NULL) {
+    *instructions = 0;
+    for (i = 0; i < vm.codeBlock->codeSize; i++)
+      *instructions += vm.profile->pcCounts[i];
+    freeProfile(vm.profile);
+  }
+  fclose(vm.output);
+  if (vm.input != NULL) fclose(vm.input);
+  cleanVM(&vm);
+  return time;
+}
+
+static int compareTimes(const void* a, const void* b) {
+  double x = *((double*) a);
+  double y = *((double*) b);
+  return (x > y) - (x < y);
+}
+
+static int compareNames(const void* a, const void* b) {
+  return strcmp(*((char**) a), *((char**) b));
+}
+
+// Returns 1 if the program passed: it compiled, ran, and printed what it should
+static int benchProgram(char* directory, char* name, char* workDirectory) {
+  char* source = makeFileName(directory, name, SOURCE_FILE_EXT);
+  char* expectedFile = makeFileName(directory, name, EXPECTED_FILE_EXT);
+  char* input = makeFileName(directory, name, INPUT_FILE_EXT);
+  char* executable = makeFileName(workDirectory, name, "");
+  char* symbols = makeFileName(workDirectory, name, SYMBOL_FILE_EXT);
+  double times[MAX_RUNS];
+  unsigned long long instructions = 0;
+  char* expected;
+  size_t expectedSize;
+  char* output = NULL;
+  size_t outputSize = 0;
+  double median;
+  int passed = 0;
+  int i;
+
+  if (access(input, R_OK) != 0) {
+    free(input);
+    input = NULL;
+  }
+  expected = readFile(expectedFile, &expectedSize);
+
+  if (!compileProgram(source, executable)) {
+    printf("  %-12s does not compile\n", name);
+    goto done;
+  }
+
+  // The profiled run counts, and checks the output
+  if (runProgram(executable, input, &output, &outputSize, &instructions) < 0) {
+    printf("  %-12s can\'t be loaded\n", name);
+    goto done;
+  }
+  if ((expected != NULL) &&
+      ((outputSize != expectedSize) || (memcmp(output, expected, outputSize) != 0))) {
+    printf("  %-12s prints a wrong output\n", name);
+    goto done;
+  }
+
+  for (i = 0; i < runCount; i++) {
+    free(output);
+    output = NULL;
+    times[i] = runProgram(executable, input, &output, &outputSize, NULL);
+  }
+  qsort(times, runCount, sizeof(double), compareTimes);
+  if (runCount % 2 == 1)
+    median = times[runCount / 2];
+  else median = (times[runCount / 2 - 1] + times[runCount / 2]) / 2;
+
+  printf("  %-12s %12.3f %16llu %14.1f\n", name, median * 1000, instructions,
+	 (median > 0) ? instructions / median / 1e6 : 0.0);
+  passed = 1;
+
+ done:
+  unlink(executable);
+  unlink(symbols);
+  free(output);
+  free(expected);
+  free(source);
+  free(expectedFile);
+  free(input);
+  free(executable);
+  free(symbols);
+  return passed;
+}
+
+// The names of the *.kpl files in the directory, sorted, without extension
+static char** findPrograms(char* directory, int* count) {
+  DIR* dir;
+  struct dirent* entry;
+  char** names = NULL;
+  int size = 0;
+  int nameLength;
+  int extLength = strlen(SOURCE_FILE_EXT);
+
+  dir = opendir(directory);
+  if (dir == NULL) return NULL;
+
+  *count = 0;
+  while ((entry = readdir(dir)) != NULL) {
+    nameLength = strlen(entry->d_name);
+    if ((nameLength <= extLength) ||
+	(strcmp(entry->d_name + nameLength - extLength, SOURCE_FILE_EXT) != 0))
+      continue;
+
+    if (*count == size) {
+      size = (size == 0) ? 16 : 2 * size;
+      names = (char**) realloc(names, size * sizeof(char*));
+    }
+    names[*count] = strndup(entry->d_name, nameLength - extLength);
+    (*count) ++;
+  }
+  closedir(dir);
+
+  qsort(names, *count, sizeof(char*), compareNames);
+  return names;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  char workDirectory[] = "/tmp/kplrun-bench-XXXXXX";
+  char** names;
+  int count = 0;
+  int failed = 0;
+  int i;
+
+  stackSize = BENCH_STACK_SIZE;
+  codeSize = BENCH_CODE_SIZE;
+  jitEnabled = jitSupported;
+
+  if (argc <= 1) {
+    printf("kplrun-bench: no input directory.\n");
+    printUsage();
+    return -1;
+  }
+
+  for (i = 2; i < argc; i++)
+    if (analyseParam(argv[i]) == 0) {
+      printUsage();
+      return -1;
+    }
+
+  names = findPrograms(argv[1], &count);
+  if (names == NULL) {
+    printf("kplrun-bench: Can\'t read directory %s!\n", argv[1]);
+    return -1;
+  }
+  if (mkdtemp(workDirectory) == NULL) {
+    printf("kplrun-bench: Can\'t create a temporary directory!\n");
+    return -1;
+  }
+
+  printf("%d runs per program, %s\n", runCount, jitEnabled ? "jit" : "no jit");
+  printf("  %-12s %12s %16s %14s\n", "program", "median (ms)", "instructions", "Minstr/s");
+  for (i = 0; i < count; i++) {
+    if (!benchProgram(argv[1], names[i], workDirectory))
+      failed ++;
+    free(names[i]);
+  }
+  free(names);
+  rmdir(workDirectory);
+
+  if (failed > 0) {
+    printf("kplrun-bench: %d program(s) failed.\n", failed);
+    return 1;
+  }
+  return 0;
+}
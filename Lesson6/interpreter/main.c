@@ -9,22 +9,39 @@
 #include <string.h>
 
 #include "vm.h"
-#define DEFAULT_STACK_SIZE 2048
-#define DEFAULT_CODE_SIZE 1024
-
-extern int debugMode;
-extern int stackSize;
-extern int codeSize;
 
+int debugMode;
+int stackSize;
+int codeSize;
+int jitEnabled;
+int profileMode;
 int dumpCode;
+int verifyOnly;
+char* profileFile;
+char* foldedFile;
 
 
 void printUsage(void) {
-  printf("Usage: kplrun input [-s=stack_size] [-c=code_size] [-debug] [-dump]\n");
+  printf("Usage: kplrun input [-s=stack_size] [-c=code_size] [-debug] [-dump] [-nojit] [-verify] [-profile=output] [-folded=output]\n");
   printf("   input: input kpl program\n");
   printf("   -s=stack_size: set the stack size\n");
   printf("   -c=code_size: set the code size\n");
   printf("   -debug: enable code dump\n");
+  printf("   -nojit: interpret hot loops instead of compiling them to native code\n");
+  printf("   -verify: report what the bytecode verifier found instead of running\n");
+  printf("   -profile=output: count executed instructions and write a report to output\n");
+  printf("   -folded=output: write per call path instruction counts in folded-stack format\n");
+}
+
+void printRuntimeError(VM* vm) {
+  char* message = getErrorMessage(vm);
+  int lineNo = getErrorLine(vm);
+
+  if (message == NULL)
+    return;
+  if (lineNo > 0)
+    printf("Runtime error: %s at line %d!\n", message, lineNo);
+  else printf("Runtime error: %s!\n", message);
 }
 
 int analyseParam(char* param) {
@@ -44,6 +61,24 @@ int analyseParam(char* param) {
     dumpCode = 1;
     return 1;
   }
+  if (strncmp(param, "-profile=", 9) == 0) {
+    profileMode = 1;
+    profileFile = param + 9;
+    return 1;
+  }
+  if (strncmp(param, "-folded=", 8) == 0) {
+    profileMode = 1;
+    foldedFile = param + 8;
+    return 1;
+  }
+  if (strcmp(param, "-verify") == 0) {
+    verifyOnly = 1;
+    return 1;
+  }
+  if (strcmp(param, "-nojit") == 0) {
+    jitEnabled = 0;
+    return 1;
+  }
   return 0;
 }
 
@@ -52,11 +87,18 @@ int analyseParam(char* param) {
 int main(int argc, char *argv[]) {
   int i;
   FILE* f;
+  char* symFileName;
+  VM vm;
 
   debugMode = 0;
+  jitEnabled = jitSupported;
   stackSize = DEFAULT_STACK_SIZE;
   codeSize = DEFAULT_CODE_SIZE;
   dumpCode = 0;
+  verifyOnly = 0;
+  profileMode = 0;
+  profileFile = NULL;
+  foldedFile = NULL;
 
   if (argc <= 1) {
     printf("kplrun: no input file.\n");
@@ -77,33 +119,48 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  initVM();
-  if (loadExecutable(f) == 0) {
-    printf("kplrun: Wrong executable format!\n");
+  initVM(&vm, codeSize, stackSize);
+  vm.debugMode = debugMode;
+  vm.jitEnabled = jitEnabled;
+  if (loadExecutable(&vm, f) == 0) {
+    printf("kplrun: The executable is larger than the code size %d (see -c)!\n", codeSize);
     fclose(f);
-    cleanVM();
+    cleanVM(&vm);
     return -1;
   }
   fclose(f);
 
+  if (profileMode) {
+    vm.profile = createProfile(vm.codeBlock);
+    symFileName = (char*) malloc(strlen(argv[1]) + strlen(SYMBOL_FILE_EXT) + 1);
+    strcpy(symFileName, argv[1]);
+    strcat(symFileName, SYMBOL_FILE_EXT);
+    loadSymbols(vm.profile, symFileName);
+    free(symFileName);
+  }
+
   if (dumpCode) {
-    printCodeBuffer();
+    printCodeBuffer(&vm);
     return 0;
   }
 
-  switch (run()) {
-  case PS_DIVIDE_BY_ZERO:
-    printf("Runtime error: Divide by zero!\n");
-    break;
-  case PS_STACK_OVERFLOW:
-    printf("Runtime error: Stack overflow!\n");
-    break;
-  case PS_IO_ERROR:
-    printf("Runtime error: IO error!\n");
-    break;
-  default:
-    break;
+  if (verifyOnly) {
+    printVerificationReport(&vm);
+    cleanVM(&vm);
+    return 0;
   }
-  cleanVM();
+
+  run(&vm);
+  printRuntimeError(&vm);
+
+  if (profileMode) {
+    if ((profileFile != NULL) && (writeProfile(vm.profile, profileFile) == 0))
+      printf("kplrun: Can\'t write profile file!\n");
+    if ((foldedFile != NULL) && (writeFoldedStacks(vm.profile, foldedFile) == 0))
+      printf("kplrun: Can\'t write folded stack file!\n");
+    freeProfile(vm.profile);
+  }
+
+  cleanVM(&vm);
   return 0;
 }
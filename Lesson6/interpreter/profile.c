@@ -0,0 +1,342 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+
+#define NUM_OF_OPCODES (OP_SR + 1)
+#define MAX_SYMBOL_LEN 100
+
+struct Symbol_ {
+  CodeAddress address;
+  char name[MAX_SYMBOL_LEN];
+  struct Symbol_ *next;
+};
+
+typedef struct Symbol_ Symbol;
+
+static CallNode* makeCallNode(CodeAddress address, CallNode* parent) {
+  CallNode* node = (CallNode*) malloc(sizeof(CallNode));
+  node->address = address;
+  node->selfCount = 0;
+  node->calls = 0;
+  node->parent = parent;
+  node->children = NULL;
+  node->next = NULL;
+  return node;
+}
+
+static void freeCallNode(CallNode* node) {
+  CallNode* child;
+
+  while (node->children != NULL) {
+    child = node->children;
+    node->children = child->next;
+    freeCallNode(child);
+  }
+  free(node);
+}
+
+Profile* createProfile(CodeBlock* codeBlock) {
+  Profile* profile = (Profile*) malloc(sizeof(Profile));
+
+  profile->code = codeBlock;
+  profile->pcCounts = (unsigned long long*) calloc(codeBlock->codeSize + 1, sizeof(unsigned long long));
+  profile->rootCall = makeCallNode(0, NULL);
+  profile->rootCall->calls = 1;
+  profile->currentCall = profile->rootCall;
+  profile->symbols = NULL;
+  profile->wallTime = 0;
+  return profile;
+}
+
+void freeProfile(Profile* profile) {
+  Symbol* symbol;
+
+  if (profile == NULL) return;
+  free(profile->pcCounts);
+  freeCallNode(profile->rootCall);
+  while (profile->symbols != NULL) {
+    symbol = profile->symbols;
+    profile->symbols = symbol->next;
+    free(symbol);
+  }
+  free(profile);
+}
+
+/******************* Call graph ******************************/
+
+void profileCall(Profile* profile, CodeAddress address) {
+  CallNode* node = profile->currentCall->children;
+
+  while ((node != NULL) && (node->address != address))
+    node = node->next;
+
+  if (node == NULL) {
+    node = makeCallNode(address, profile->currentCall);
+    node->next = profile->currentCall->children;
+    profile->currentCall->children = node;
+  }
+  node->calls ++;
+  profile->currentCall = node;
+}
+
+void profileReturn(Profile* profile) {
+  if (profile->currentCall->parent != NULL)
+    profile->currentCall = profile->currentCall->parent;
+}
+
+// Reads the "address name" lines kplc writes next to the executable
+int loadSymbols(Profile* profile, char* fileName) {
+  FILE* f;
+  Symbol* symbol;
+  CodeAddress address;
+  char name[MAX_SYMBOL_LEN];
+
+  f = fopen(fileName, "r");
+  if (f == NULL) return 0;
+
+  while (fscanf(f, "%d %99s", &address, name) == 2) {
+    symbol = (Symbol*) malloc(sizeof(Symbol));
+    symbol->address = address;
+    strcpy(symbol->name, name);
+    symbol->next = profile->symbols;
+    profile->symbols = symbol;
+  }
+  fclose(f);
+  return 1;
+}
+
+static void symbolName(Profile* profile, char* buffer, CodeAddress address) {
+  Symbol* symbol;
+
+  for (symbol = profile->symbols; symbol != NULL; symbol = symbol->next)
+    if (symbol->address == address) {
+      strcpy(buffer, symbol->name);
+      return;
+    }
+  sprintf(buffer, "@%d", address);
+}
+
+void startProfileTimer(Profile* profile) {
+  clock_gettime(CLOCK_MONOTONIC, &profile->startTime);
+}
+
+void stopProfileTimer(Profile* profile) {
+  struct timespec stopTime;
+
+  clock_gettime(CLOCK_MONOTONIC, &stopTime);
+  profile->wallTime = (stopTime.tv_sec - profile->startTime.tv_sec) +
+    (stopTime.tv_nsec - profile->startTime.tv_nsec) / 1e9;
+}
+
+// qsort has no context argument, so the sort keys are passed on the side
+static __thread unsigned long long* sortKeys;
+
+static int compareCounts(const void* a, const void* b) {
+  unsigned long long ca = sortKeys[*(const int*) a];
+  unsigned long long cb = sortKeys[*(const int*) b];
+
+  if (ca != cb) return (ca < cb) ? 1 : -1;
+  return *(const int*) a - *(const int*) b;
+}
+
+static void opCodeName(char* buffer, enum OpCode op) {
+  Instruction inst;
+  char* space;
+
+  inst.op = op;
+  inst.p = 0;
+  inst.q = 0;
+  buffer[0] = '\0';
+  sprintInstruction(buffer, &inst);
+  space = strchr(buffer, ' ');
+  if (space != NULL) *space = '\0';
+}
+
+static double percent(unsigned long long count, unsigned long long total) {
+  return (total == 0) ? 0.0 : 100.0 * count / total;
+}
+
+static void writeLineProfile(Profile* profile, FILE* f, unsigned long long total) {
+  unsigned long long* lineCounts;
+  int* order;
+  int maxLine = 0;
+  int n = 0;
+  int i;
+
+  for (i = 0; i < profile->code->lineCount; i ++)
+    if (profile->code->lines[i].lineNo > maxLine)
+      maxLine = profile->code->lines[i].lineNo;
+
+  lineCounts = (unsigned long long*) calloc(maxLine + 1, sizeof(unsigned long long));
+  order = (int*) malloc((maxLine + 1) * sizeof(int));
+  for (i = 0; i < profile->code->codeSize; i ++)
+    lineCounts[lineOfCode(profile->code, i)] += profile->pcCounts[i];
+
+  for (i = 1; i <= maxLine; i ++)
+    if (lineCounts[i] > 0) order[n ++] = i;
+  sortKeys = lineCounts;
+  qsort(order, n, sizeof(int), compareCounts);
+
+  fprintf(f, "\nBy source line:\n");
+  fprintf(f, "  %6s %14s %8s\n", "line", "count", "%");
+  for (i = 0; i < n; i ++)
+    fprintf(f, "  %6d %14llu %8.2f\n", order[i], lineCounts[order[i]], percent(lineCounts[order[i]], total));
+
+  free(lineCounts);
+  free(order);
+}
+
+/*
+ * Sums the call tree into per-procedure figures. A recursive procedure
+ * only counts its outermost activation towards the inclusive total, so
+ * the time isn't counted once per level.
+ */
+static unsigned long long sumCallTree(CallNode* node, int* active,
+				      unsigned long long* inclusive, unsigned long long* exclusive,
+				      unsigned long long* calls) {
+  unsigned long long total = node->selfCount;
+  CallNode* child;
+
+  active[node->address] ++;
+  for (child = node->children; child != NULL; child = child->next)
+    total += sumCallTree(child, active, inclusive, exclusive, calls);
+  active[node->address] --;
+
+  exclusive[node->address] += node->selfCount;
+  calls[node->address] += node->calls;
+  if (active[node->address] == 0)
+    inclusive[node->address] += total;
+  return total;
+}
+
+static void writeProcedureProfile(Profile* profile, FILE* f, unsigned long long total, int* order) {
+  int codeSize = profile->code->codeSize;
+  unsigned long long* inclusive;
+  unsigned long long* exclusive;
+  unsigned long long* calls;
+  int* active;
+  char name[MAX_SYMBOL_LEN];
+  int n = 0;
+  int i;
+
+  inclusive = (unsigned long long*) calloc(codeSize + 1, sizeof(unsigned long long));
+  exclusive = (unsigned long long*) calloc(codeSize + 1, sizeof(unsigned long long));
+  calls = (unsigned long long*) calloc(codeSize + 1, sizeof(unsigned long long));
+  active = (int*) calloc(codeSize + 1, sizeof(int));
+
+  sumCallTree(profile->rootCall, active, inclusive, exclusive, calls);
+
+  for (i = 0; i < codeSize; i ++)
+    if (calls[i] > 0) order[n ++] = i;
+  sortKeys = inclusive;
+  qsort(order, n, sizeof(int), compareCounts);
+
+  fprintf(f, "\nBy procedure:\n");
+  fprintf(f, "  %-20s %10s %14s %8s %14s %8s\n", "procedure", "calls", "inclusive", "%", "exclusive", "%");
+  for (i = 0; i < n; i ++) {
+    symbolName(profile, name, order[i]);
+    fprintf(f, "  %-20s %10llu %14llu %8.2f %14llu %8.2f\n", name, calls[order[i]],
+	    inclusive[order[i]], percent(inclusive[order[i]], total),
+	    exclusive[order[i]], percent(exclusive[order[i]], total));
+  }
+
+  free(inclusive);
+  free(exclusive);
+  free(calls);
+  free(active);
+}
+
+int writeProfile(Profile* profile, char* fileName) {
+  FILE* f;
+  unsigned long long opCounts[NUM_OF_OPCODES];
+  unsigned long long total = 0;
+  int* order;
+  int codeSize = profile->code->codeSize;
+  char s[100];
+  int i;
+
+  f = fopen(fileName, "w");
+  if (f == NULL) return 0;
+
+  memset(opCounts, 0, sizeof(opCounts));
+  for (i = 0; i < codeSize; i ++) {
+    opCounts[profile->code->code[i].op] += profile->pcCounts[i];
+    total += profile->pcCounts[i];
+  }
+
+  fprintf(f, "KPL execution profile\n\n");
+  fprintf(f, "Instructions executed: %llu\n", total);
+  fprintf(f, "Wall time:             %.6f s\n", profile->wallTime);
+  fprintf(f, "Instructions/second:   %.0f\n", (profile->wallTime > 0) ? total / profile->wallTime : 0.0);
+
+  order = (int*) malloc((codeSize > NUM_OF_OPCODES ? codeSize : NUM_OF_OPCODES) * sizeof(int));
+
+  fprintf(f, "\nBy opcode:\n");
+  fprintf(f, "  %-6s %14s %8s\n", "op", "count", "%");
+  for (i = 0; i < NUM_OF_OPCODES; i ++) order[i] = i;
+  sortKeys = opCounts;
+  qsort(order, NUM_OF_OPCODES, sizeof(int), compareCounts);
+  for (i = 0; i < NUM_OF_OPCODES && opCounts[order[i]] > 0; i ++) {
+    opCodeName(s, order[i]);
+    fprintf(f, "  %-6s %14llu %8.2f\n", s, opCounts[order[i]], percent(opCounts[order[i]], total));
+  }
+
+  if (profile->code->lineCount > 0)
+    writeLineProfile(profile, f, total);
+
+  fprintf(f, "\nBy instruction:\n");
+  fprintf(f, "  %6s  %-14s %6s %14s %8s\n", "pc", "instruction", "line", "count", "%");
+  for (i = 0; i < codeSize; i ++) order[i] = i;
+  sortKeys = profile->pcCounts;
+  qsort(order, codeSize, sizeof(int), compareCounts);
+  for (i = 0; i < codeSize && profile->pcCounts[order[i]] > 0; i ++) {
+    sprintInstruction(s, profile->code->code + order[i]);
+    fprintf(f, "  %6d  %-14s %6d %14llu %8.2f\n", order[i], s, lineOfCode(profile->code, order[i]),
+	    profile->pcCounts[order[i]], percent(profile->pcCounts[order[i]], total));
+  }
+
+  writeProcedureProfile(profile, f, total, order);
+
+  free(order);
+  fclose(f);
+  return 1;
+}
+
+static void writeFoldedNode(Profile* profile, FILE* f, CallNode* node, char* path, int length) {
+  char name[MAX_SYMBOL_LEN];
+  CallNode* child;
+  int n;
+
+  symbolName(profile, name, node->address);
+  n = strlen(name);
+  path = (char*) realloc(path, length + n + 2);
+  if (length > 0) path[length ++] = ';';
+  strcpy(path + length, name);
+  length += n;
+
+  if (node->selfCount > 0)
+    fprintf(f, "%s %llu\n", path, node->selfCount);
+  for (child = node->children; child != NULL; child = child->next)
+    writeFoldedNode(profile, f, child, strdup(path), length);
+  free(path);
+}
+
+// One "main;caller;callee count" line per call path, as flamegraph tools expect
+int writeFoldedStacks(Profile* profile, char* fileName) {
+  FILE* f;
+
+  f = fopen(fileName, "w");
+  if (f == NULL) return 0;
+  writeFoldedNode(profile, f, profile->rootCall, NULL, 0);
+  fclose(f);
+  return 1;
+}
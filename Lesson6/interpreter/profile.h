@@ -0,0 +1,57 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <time.h>
+
+#include "instructions.h"
+
+#define SYMBOL_FILE_EXT ".sym"
+
+// One node per distinct call path; the root is the main program
+struct CallNode_ {
+  CodeAddress address;
+  unsigned long long selfCount;   // instructions executed in this activation path
+  unsigned long long calls;
+  struct CallNode_ *parent;
+  struct CallNode_ *children;
+  struct CallNode_ *next;
+};
+
+typedef struct CallNode_ CallNode;
+
+struct Symbol_;
+
+// Everything counted while one VM runs profiled
+struct Profile_ {
+  CodeBlock* code;
+  unsigned long long* pcCounts;   // executions of each instruction
+  CallNode* rootCall;
+  CallNode* currentCall;
+  struct Symbol_* symbols;
+  struct timespec startTime;
+  double wallTime;
+};
+
+typedef struct Profile_ Profile;
+
+Profile* createProfile(CodeBlock* codeBlock);
+void freeProfile(Profile* profile);
+
+int loadSymbols(Profile* profile, char* fileName);
+
+void profileCall(Profile* profile, CodeAddress address);
+void profileReturn(Profile* profile);
+
+void startProfileTimer(Profile* profile);
+void stopProfileTimer(Profile* profile);
+
+int writeProfile(Profile* profile, char* fileName);
+int writeFoldedStacks(Profile* profile, char* fileName);
+
+#endif
@@ -0,0 +1,291 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * kplrun-batch: runs a directory of compiled KPL programs as a regression
+ * suite. Every program P with a P.expected next to it is run headless on
+ * its own VM, reading P.in if there is one, and passes when what it prints
+ * (followed by its runtime error, if any) equals P.expected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vm.h"
+
+#define EXPECTED_FILE_EXT ".expected"
+#define INPUT_FILE_EXT ".in"
+
+#define RESULT_PASSED      0
+#define RESULT_FAILED      1   // ran, but printed something else
+#define RESULT_LOAD_ERROR  2   // the program or its expected output can't be read
+
+struct Test_ {
+  char* program;        // path without extension
+  int result;
+};
+
+typedef struct Test_ Test;
+
+struct Suite_ {
+  Test* tests;
+  int testCount;
+  int nextTest;
+  pthread_mutex_t lock;
+};
+
+typedef struct Suite_ Suite;
+
+int stackSize;
+int codeSize;
+int jitEnabled;
+int workerCount;
+
+void printUsage(void) {
+  printf("Usage: kplrun-batch directory [-j=workers] [-s=stack_size] [-c=code_size] [-nojit]\n");
+  printf("   directory: compiled programs, each with a .expected output and an optional .in input\n");
+  printf("   -j=workers: number of programs to run at once (default: one per processor)\n");
+  printf("   -s=stack_size: set the stack size\n");
+  printf("   -c=code_size: set the code size\n");
+  printf("   -nojit: interpret hot loops instead of compiling them to native code\n");
+}
+
+int analyseParam(char* param) {
+  if (strncmp(param, "-j=", 3) == 0) {
+    workerCount = atoi(param+3);
+    return workerCount > 0;
+  }
+  if (strncmp(param, "-s=", 3) == 0) {
+    stackSize = atoi(param+3);
+    return 1;
+  }
+  if (strncmp(param, "-c=", 3) == 0) {
+    codeSize = atoi(param+3);
+    return 1;
+  }
+  if (strcmp(param, "-nojit") == 0) {
+    jitEnabled = 0;
+    return 1;
+  }
+  return 0;
+}
+
+static char* makeFileName(char* program, char* ext) {
+  char* fileName = (char*) malloc(strlen(program) + strlen(ext) + 1);
+  strcpy(fileName, program);
+  strcat(fileName, ext);
+  return fileName;
+}
+
+// The whole file in a malloc'ed buffer, NULL if it can't be read
+static char* readFile(char* fileName, size_t* size) {
+  FILE* f = fopen(fileName, "rb");
+  char* content;
+
+  if (f == NULL) return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  content = (char*) malloc(*size + 1);
+  if (fread(content, 1, *size, f) != *size) {
+    free(content);
+    content = NULL;
+  }
+  fclose(f);
+  return content;
+}
+
+static int runTest(Test* test) {
+  VM vm;
+  FILE* f;
+  char* fileName;
+  char* expected;
+  size_t expectedSize;
+  char* output = NULL;
+  size_t outputSize = 0;
+  char* message;
+  int lineNo;
+  int result;
+
+  fileName = makeFileName(test->program, EXPECTED_FILE_EXT);
+  expected = readFile(fileName, &expectedSize);
+  free(fileName);
+  f = fopen(test->program, "rb");
+  if ((expected == NULL) || (f == NULL)) {
+    if (f != NULL) fclose(f);
+    free(expected);
+    return RESULT_LOAD_ERROR;
+  }
+
+  initVM(&vm, codeSize, stackSize);
+  vm.jitEnabled = jitEnabled;
+  if (!loadExecutable(&vm, f)) {
+    fclose(f);
+    cleanVM(&vm);
+    free(expected);
+    return RESULT_LOAD_ERROR;
+  }
+  fclose(f);
+
+  fileName = makeFileName(test->program, INPUT_FILE_EXT);
+  vm.input = fopen(fileName, "r");
+  free(fileName);
+  vm.output = open_memstream(&output, &outputSize);
+
+  run(&vm);
+
+  // Same report as kplrun, so that expected failures can be tested too
+  message = getErrorMessage(&vm);
+  lineNo = getErrorLine(&vm);
+  if ((message != NULL) && (lineNo > 0))
+    fprintf(vm.output, "Runtime error: %s at line %d!\n", message, lineNo);
+  else if (message != NULL)
+    fprintf(vm.output, "Runtime error: %s!\n", message);
+
+  fclose(vm.output);
+  if (vm.input != NULL) fclose(vm.input);
+  cleanVM(&vm);
+
+  if ((outputSize == expectedSize) && (memcmp(output, expected, outputSize) == 0))
+    result = RESULT_PASSED;
+  else result = RESULT_FAILED;
+  free(output);
+  free(expected);
+  return result;
+}
+
+static void* runWorker(void* arg) {
+  Suite* suite = (Suite*) arg;
+  int test;
+
+  while (1) {
+    pthread_mutex_lock(&suite->lock);
+    test = suite->nextTest ++;
+    pthread_mutex_unlock(&suite->lock);
+    if (test >= suite->testCount) break;
+    suite->tests[test].result = runTest(suite->tests + test);
+  }
+  return NULL;
+}
+
+static int compareTests(const void* a, const void* b) {
+  return strcmp(((Test*) a)->program, ((Test*) b)->program);
+}
+
+// One test per *.expected file in the directory, sorted by name
+static int findTests(Suite* suite, char* directory) {
+  DIR* dir;
+  struct dirent* entry;
+  int size = 0;
+  int nameLength;
+  int extLength = strlen(EXPECTED_FILE_EXT);
+  char* program;
+
+  dir = opendir(directory);
+  if (dir == NULL) return 0;
+
+  while ((entry = readdir(dir)) != NULL) {
+    nameLength = strlen(entry->d_name);
+    if ((nameLength <= extLength) ||
+	(strcmp(entry->d_name + nameLength - extLength, EXPECTED_FILE_EXT) != 0))
+      continue;
+
+    program = (char*) malloc(strlen(directory) + 1 + nameLength - extLength + 1);
+    sprintf(program, "%s/%.*s", directory, nameLength - extLength, entry->d_name);
+
+    if (suite->testCount == size) {
+      size = (size == 0) ? 64 : 2 * size;
+      suite->tests = (Test*) realloc(suite->tests, size * sizeof(Test));
+    }
+    suite->tests[suite->testCount].program = program;
+    suite->tests[suite->testCount].result = RESULT_LOAD_ERROR;
+    suite->testCount ++;
+  }
+  closedir(dir);
+
+  qsort(suite->tests, suite->testCount, sizeof(Test), compareTests);
+  return 1;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  Suite suite;
+  pthread_t* workers;
+  struct timespec startTime, endTime;
+  double seconds;
+  int passed = 0, failed = 0, loadErrors = 0;
+  int i;
+
+  stackSize = DEFAULT_STACK_SIZE;
+  codeSize = DEFAULT_CODE_SIZE;
+  jitEnabled = jitSupported;
+  workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (argc <= 1) {
+    printf("kplrun-batch: no input directory.\n");
+    printUsage();
+    return -1;
+  }
+
+  for ( i = 2; i < argc; i++)
+    if (analyseParam(argv[i]) == 0) {
+      printUsage();
+      return -1;
+    }
+
+  suite.tests = NULL;
+  suite.testCount = 0;
+  suite.nextTest = 0;
+  if (!findTests(&suite, argv[1])) {
+    printf("kplrun-batch: Can\'t read directory %s!\n", argv[1]);
+    return -1;
+  }
+
+  if (workerCount > suite.testCount) workerCount = suite.testCount;
+  if (workerCount < 1) workerCount = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  pthread_mutex_init(&suite.lock, NULL);
+  workers = (pthread_t*) malloc(workerCount * sizeof(pthread_t));
+  for (i = 0; i < workerCount; i++)
+    pthread_create(&workers[i], NULL, runWorker, &suite);
+  for (i = 0; i < workerCount; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  pthread_mutex_destroy(&suite.lock);
+  clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+  for (i = 0; i < suite.testCount; i++) {
+    switch (suite.tests[i].result) {
+    case RESULT_PASSED:
+      passed ++;
+      break;
+    case RESULT_FAILED:
+      printf("FAIL %s\n", suite.tests[i].program);
+      failed ++;
+      break;
+    default:
+      printf("FAIL %s (can\'t read the program or its expected output)\n", suite.tests[i].program);
+      loadErrors ++;
+      break;
+    }
+    free(suite.tests[i].program);
+  }
+  free(suite.tests);
+
+  seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+  printf("%d passed, %d failed", passed, failed + loadErrors);
+  printf(" (%d programs in %.3f s on %d threads, %.1f programs/s)\n",
+	 suite.testCount, seconds, workerCount, (seconds > 0) ? suite.testCount / seconds : 0.0);
+
+  return (failed + loadErrors > 0) ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verifier.h"
+
+#define UNKNOWN_DEPTH -1
+
+/*
+ * The verifier interprets the code abstractly, one procedure at a time.
+ * The abstract state at a pc is the stack depth relative to the frame,
+ * t - (b-1): 0 on entry to a procedure (and to the main program, where
+ * b = 0 and t = -1). A CALL leaves the caller's depth unchanged if the
+ * callee exits with EP and adds one if it exits with EF.
+ */
+
+// Operand stack words an instruction reads before executing
+int stackPops(Instruction* inst) {
+  switch (inst->op) {
+  case OP_LI: case OP_FJ: case OP_WRC: case OP_WRI: case OP_NEG: case OP_CV:
+  case OP_SL: case OP_SR:
+    return 1;
+  case OP_ST:
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+    return 2;
+  case OP_DCT:
+    return inst->q;
+  default:
+    return 0;
+  }
+}
+
+// Stack words above t an instruction writes to
+int stackPushes(Instruction* inst) {
+  switch (inst->op) {
+  case OP_LA: case OP_LV: case OP_LC: case OP_RC: case OP_RI: case OP_CV:
+    return 1;
+  case OP_INT:
+    return inst->q;
+  case OP_CALL:
+    return 4;               // result, dynamic link, return address, static link
+  default:
+    return 0;
+  }
+}
+
+static int stackEffect(Instruction* inst) {
+  switch (inst->op) {
+  case OP_LA: case OP_LV: case OP_LC: case OP_RC: case OP_RI: case OP_CV:
+    return 1;
+  case OP_INT:
+    return inst->q;
+  case OP_DCT:
+    return - inst->q;
+  case OP_FJ: case OP_WRC: case OP_WRI:
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+    return -1;
+  case OP_ST:
+    return -2;
+  default:
+    return 0;
+  }
+}
+
+static int fail(Verification* verification, CodeAddress pc, char* message) {
+  verification->verified = 0;
+  verification->failedAt = pc;
+  strcpy(verification->message, message);
+  return 0;
+}
+
+static int isProcedureEnd(enum OpCode op) {
+  return (op == OP_EP) || (op == OP_EF) || (op == OP_HL);
+}
+
+// Finds how the procedure starting at entry returns, ignoring stack depths
+static int findReturnKind(CodeBlock* codeBlock, CodeAddress entry, char* visited,
+			  CodeAddress* worklist, Verification* verification, int* returnKind) {
+  Instruction* inst;
+  int seenEP = 0, seenEF = 0;
+  int n = 0;
+  CodeAddress pc;
+
+  memset(visited, 0, codeBlock->codeSize);
+  worklist[n ++] = entry;
+  visited[entry] = 1;
+
+  while (n > 0) {
+    pc = worklist[-- n];
+    inst = codeBlock->code + pc;
+
+    if (inst->op == OP_EP) seenEP = 1;
+    if (inst->op == OP_EF) seenEF = 1;
+    if (isProcedureEnd(inst->op))
+      continue;
+
+    if ((inst->op == OP_J) || (inst->op == OP_FJ))
+      if (!visited[inst->q]) {
+	visited[inst->q] = 1;
+	worklist[n ++] = inst->q;
+      }
+
+    if (inst->op != OP_J) {
+      if (pc + 1 >= codeBlock->codeSize)
+	return fail(verification, pc, "Control falls off the end of the code");
+      if (!visited[pc + 1]) {
+	visited[pc + 1] = 1;
+	worklist[n ++] = pc + 1;
+      }
+    }
+  }
+
+  if (seenEP && seenEF)
+    return fail(verification, entry, "Procedure exits with both EP and EF");
+  *returnKind = seenEF ? RETURNS_VALUE : RETURNS_NOTHING;
+  return 1;
+}
+
+static ProcedureInfo* findProcedure(Verification* verification, CodeAddress entry) {
+  int i;
+
+  for (i = 0; i < verification->procedureCount; i ++)
+    if (verification->procedures[i].entry == entry)
+      return verification->procedures + i;
+  return NULL;
+}
+
+static int mergeDepth(int* depth, CodeAddress* worklist, int* n, CodeAddress pc, int d,
+		      Verification* verification) {
+  if (depth[pc] == UNKNOWN_DEPTH) {
+    depth[pc] = d;
+    worklist[(*n) ++] = pc;
+    return 1;
+  }
+  if (depth[pc] != d)
+    return fail(verification, pc, "Inconsistent stack depth");
+  return 1;
+}
+
+// Computes the stack depth at every pc of one procedure
+static int checkDepths(CodeBlock* codeBlock, ProcedureInfo* proc, int* depth,
+		       CodeAddress* worklist, Verification* verification) {
+  Instruction* inst;
+  ProcedureInfo* callee;
+  CodeAddress pc;
+  int n = 0;
+  int d, next;
+  int i;
+
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    depth[i] = UNKNOWN_DEPTH;
+  depth[proc->entry] = 0;
+  worklist[n ++] = proc->entry;
+  proc->maxFrame = 0;
+  proc->maxDepth = 0;
+
+  while (n > 0) {
+    pc = worklist[-- n];
+    inst = codeBlock->code + pc;
+    d = depth[pc];
+
+    if (d < stackPops(inst))
+      return fail(verification, pc, "Stack underflow");
+    if (d + stackPushes(inst) > proc->maxDepth)
+      proc->maxDepth = d + stackPushes(inst);
+    if ((inst->op == OP_INT) && (inst->q < 0))
+      return fail(verification, pc, "Negative INT");
+
+    next = d + stackEffect(inst);
+    if (inst->op == OP_INT && next > proc->maxFrame)
+      proc->maxFrame = next;
+
+    switch (inst->op) {
+    case OP_EP:
+    case OP_EF:
+    case OP_HL:
+      break;
+    case OP_J:
+      if (!mergeDepth(depth, worklist, &n, inst->q, next, verification)) return 0;
+      break;
+    case OP_FJ:
+      if (!mergeDepth(depth, worklist, &n, inst->q, next, verification)) return 0;
+      if (!mergeDepth(depth, worklist, &n, pc + 1, next, verification)) return 0;
+      break;
+    case OP_CALL:
+      callee = findProcedure(verification, inst->q);
+      next = d + callee->returnKind;
+      if (!mergeDepth(depth, worklist, &n, pc + 1, next, verification)) return 0;
+      break;
+    default:
+      if (!mergeDepth(depth, worklist, &n, pc + 1, next, verification)) return 0;
+      break;
+    }
+  }
+  return 1;
+}
+
+static void addProcedure(Verification* verification, CodeAddress entry) {
+  ProcedureInfo* proc;
+
+  if (findProcedure(verification, entry) != NULL)
+    return;
+  proc = verification->procedures + verification->procedureCount ++;
+  proc->entry = entry;
+  proc->returnKind = RETURNS_NOTHING;
+  proc->maxFrame = 0;
+  proc->maxDepth = 0;
+}
+
+int verifyCode(CodeBlock* codeBlock, Verification* verification) {
+  Instruction* inst;
+  char* visited;
+  int* depth;
+  CodeAddress* worklist;
+  int ok = 1;
+  int i;
+
+  verification->verified = 1;
+  verification->failedAt = 0;
+  verification->message[0] = '\0';
+  verification->procedures = (ProcedureInfo*) malloc((codeBlock->codeSize + 1) * sizeof(ProcedureInfo));
+  verification->procedureCount = 0;
+  verification->maxDepth = 0;
+
+  if (codeBlock->codeSize == 0)
+    return fail(verification, 0, "Empty code");
+
+  // Every jump and call must land inside the code
+  addProcedure(verification, 0);
+  for (i = 0; i < codeBlock->codeSize; i ++) {
+    inst = codeBlock->code + i;
+    if ((inst->op < OP_LA) || (inst->op > OP_SR))
+      return fail(verification, i, "Unknown opcode");
+    if ((inst->op == OP_J) || (inst->op == OP_FJ) || (inst->op == OP_CALL))
+      if ((inst->q < 0) || (inst->q >= codeBlock->codeSize))
+	return fail(verification, i, "Jump target out of range");
+    if ((inst->op == OP_CALL) || (inst->op == OP_LA) || (inst->op == OP_LV))
+      if (inst->p < 0)
+	return fail(verification, i, "Negative nesting level");
+    if ((inst->op == OP_SL) || (inst->op == OP_SR))
+      if (!IS_SHIFT_COUNT(inst->q))
+	return fail(verification, i, "Shift count out of range");
+    if (inst->op == OP_CALL)
+      addProcedure(verification, inst->q);
+  }
+
+  visited = (char*) malloc(codeBlock->codeSize);
+  depth = (int*) malloc(codeBlock->codeSize * sizeof(int));
+  worklist = (CodeAddress*) malloc(codeBlock->codeSize * sizeof(CodeAddress));
+
+  for (i = 0; ok && i < verification->procedureCount; i ++)
+    ok = findReturnKind(codeBlock, verification->procedures[i].entry, visited, worklist,
+			verification, &(verification->procedures[i].returnKind));
+
+  for (i = 0; ok && i < verification->procedureCount; i ++) {
+    ok = checkDepths(codeBlock, verification->procedures + i, depth, worklist, verification);
+    if (verification->procedures[i].maxDepth > verification->maxDepth)
+      verification->maxDepth = verification->procedures[i].maxDepth;
+  }
+
+  free(visited);
+  free(depth);
+  free(worklist);
+  return ok;
+}
+
+void freeVerification(Verification* verification) {
+  free(verification->procedures);
+  verification->procedures = NULL;
+  verification->procedureCount = 0;
+}
+
+void printVerification(Verification* verification) {
+  ProcedureInfo* proc;
+  int i;
+
+  if (!verification->verified) {
+    printf("Not verified: %s at %d\n", verification->message, verification->failedAt);
+    return;
+  }
+
+  printf("Verified: maximum stack depth per frame %d\n", verification->maxDepth);
+  printf("  %6s %8s %10s %10s\n", "entry", "returns", "max frame", "max depth");
+  for (i = 0; i < verification->procedureCount; i ++) {
+    proc = verification->procedures + i;
+    printf("  %6d %8s %10d %10d\n", proc->entry,
+	   (proc->returnKind == RETURNS_VALUE) ? "value" : "-", proc->maxFrame, proc->maxDepth);
+  }
+}
@@ -0,0 +1,47 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __VERIFIER_H__
+#define __VERIFIER_H__
+
+#include "instructions.h"
+
+#define RETURNS_NOTHING 0   // exits with EP (or never returns)
+#define RETURNS_VALUE 1     // exits with EF
+
+// The counts SL and SR may shift by
+#define IS_SHIFT_COUNT(q) (((q) >= 1) && ((q) <= 30))
+
+// What the verifier learnt about one procedure (or the main program)
+struct ProcedureInfo_ {
+  CodeAddress entry;
+  int returnKind;
+  int maxFrame;             // largest t - (b-1) right after an INT
+  int maxDepth;             // largest t - (b-1) anywhere, including CALL's link words
+};
+
+typedef struct ProcedureInfo_ ProcedureInfo;
+
+struct Verification_ {
+  int verified;
+  CodeAddress failedAt;     // meaningful when verified is 0
+  char message[100];
+
+  ProcedureInfo* procedures;
+  int procedureCount;
+  int maxDepth;             // over all procedures
+};
+
+typedef struct Verification_ Verification;
+
+int stackPops(Instruction* inst);
+int stackPushes(Instruction* inst);
+
+int verifyCode(CodeBlock* codeBlock, Verification* verification);
+void freeVerification(Verification* verification);
+void printVerification(Verification* verification);
+
+#endif
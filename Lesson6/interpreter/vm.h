@@ -7,7 +7,13 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdio.h>
+#include <setjmp.h>
+
 #include "instructions.h"
+#include "verifier.h"
+#include "jit.h"
+#include "profile.h"
 
 #define PS_ACTIVE         0
 #define PS_INACTIVE       1
@@ -15,19 +21,72 @@
 #define PS_IO_ERROR       3
 #define PS_DIVIDE_BY_ZERO 4
 #define PS_STACK_OVERFLOW 5
+#define PS_INVALID_CODE   6
+
+#define DEFAULT_STACK_SIZE 2048
+#define DEFAULT_CODE_SIZE 1024
+
+#define GUARD_SIZE (64 * 1024)  // bytes of PROT_NONE memory on each side of the stack
 
 typedef WORD* Memory;
 
-void printMemory(void);
-void printCodeBuffer(void);
+/*
+ * One KPL machine. All interpreter state lives here, so any number of VMs
+ * can run at the same time, each on its own thread. The caller owns the
+ * struct: initVM() fills it in and cleanVM() releases what it points to.
+ */
+struct VM_ {
+  CodeBlock* codeBlock;
+  Memory stack;
+  int stackSize;
+  int t;
+  int b;
+  int pc;
+  int ps;
+
+  int debugMode;
+  int jitEnabled;
+  Profile* profile;         // when not NULL, run() counts into it
+
+  // When output is not NULL the VM runs headless: RC and RI read one line
+  // each from input and the write instructions print to output. Otherwise
+  // it talks to the terminal through curses, which only one VM may do.
+  FILE* input;
+  FILE* output;
+
+  // Set when the loaded code passed the verifier and runs unchecked
+  int verified;
+  Verification verification;
+
+  JIT* jit;
+
+  // The stack mapping and its guard regions
+  char* stackMapping;
+  size_t stackMappingSize;
+  char* lowerGuard;
+  char* upperGuard;
+  size_t guardSize;
+  char* signalStack;
+  sigjmp_buf overflowJump;
+};
+
+typedef struct VM_ VM;
+
+void printMemory(VM* vm);
+void printCodeBuffer(VM* vm);
+
+void resetVM(VM* vm);
+void initVM(VM* vm, int codeSize, int stackSize);
+void cleanVM(VM* vm);
 
-void resetVM(void);
-void initVM(void);
-void cleanVM(void);
+int loadExecutable(VM* vm, FILE* f);
+int saveExecutable(VM* vm, FILE* f);
 
-int loadExecutable(FILE* f);
-int saveExecutable(FILE* f);
+int verifyExecutable(VM* vm);
+void printVerificationReport(VM* vm);
 
-int run(void);
+int run(VM* vm);
+char* getErrorMessage(VM* vm);
+int getErrorLine(VM* vm);
 
 #endif
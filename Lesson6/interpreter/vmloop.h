@@ -0,0 +1,283 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+/*
+ * The dispatch loop of the interpreter. VM.c includes this file once for
+ * every variant of the loop it needs: RUN_LOOP names the function and
+ * VM_PROFILE compiles instruction counting and the shadow call stack in
+ * (and the JIT out), so the plain loop pays nothing for profiling.
+ * VM_CHECKED makes every instruction check its stack and code accesses
+ * first; the unchecked loop only runs code the verifier has accepted.
+ * The traces the checked loop runs check their addresses in the same way.
+ */
+
+static int RUN_LOOP(VM* vm, WINDOW* win) {
+  Instruction* code = vm->codeBlock->code;
+  Memory stack = vm->stack;
+#if VM_PROFILE
+  Profile* profile = vm->profile;
+#else
+  JIT* jit = vm->jit;
+#endif
+  int count = 0;
+  int number;
+  char s[100];
+
+  vm->ps = PS_ACTIVE;
+  while (vm->ps == PS_ACTIVE) {
+    if (vm->debugMode) {
+      sprintInstruction(s,&(code[vm->pc]));
+      if (vm->codeBlock->lineCount > 0)
+	wprintw(win, "%6d-%-4d:  %-14s (line %d)\n",count++,vm->pc,s,lineOfCode(vm->codeBlock,vm->pc));
+      else wprintw(win, "%6d-%-4d:  %s\n",count++,vm->pc,s);
+    }
+
+#if VM_CHECKED
+    if ((vm->ps = checkInstruction(vm)) != PS_ACTIVE) {
+      vm->pc ++;
+      break;
+    }
+#endif
+
+#if VM_PROFILE
+    profile->pcCounts[vm->pc] ++;
+    profile->currentCall->selfCount ++;
+#else
+    if ((jit != NULL) && jit->recording) {
+      if (vm->debugMode) jit->recording = 0;
+      else jitRecord(jit, vm->pc, stack[vm->t]);
+    }
+#endif
+
+    switch (code[vm->pc].op) {
+    case OP_LA: 
+      vm->t ++;
+      stack[vm->t] = base(vm, code[vm->pc].p) + code[vm->pc].q;
+      break;
+    case OP_LV: 
+      vm->t ++;
+      stack[vm->t] = stack[base(vm, code[vm->pc].p) + code[vm->pc].q];
+      break;
+    case OP_LC: 
+      vm->t ++;
+      stack[vm->t] = code[vm->pc].q;
+      break;
+    case OP_LI: 
+      stack[vm->t] = stack[stack[vm->t]];
+      break;
+    case OP_INT:
+      vm->t += code[vm->pc].q;
+      break;
+    case OP_DCT: 
+      vm->t -= code[vm->pc].q;
+      break;
+    case OP_J: 
+#if !VM_PROFILE
+      if ((jit != NULL) && (code[vm->pc].q <= vm->pc) && !vm->debugMode) {
+	// Backward jump: a loop iteration ends here
+	Trace* trace = jitBackwardJump(jit, code[vm->pc].q, vm->pc);
+	if (trace != NULL) {
+	  vm->pc = jitExecute(trace, stack, vm->stackSize, &vm->t, vm->b) - 1;
+	  break;
+	}
+      }
+#endif
+      vm->pc = code[vm->pc].q - 1;
+      break;
+    case OP_FJ: 
+      if (stack[vm->t] == FALSE) 
+	vm->pc = code[vm->pc].q - 1;
+#if !VM_PROFILE
+      else if ((jit != NULL) && (jit->entries[vm->pc] != NULL) && !jit->recording && !vm->debugMode) {
+	// A loop with a compiled trace starts a trip: run it from here
+	vm->t --;
+	vm->pc = jitEnter(jit->entries[vm->pc], stack, vm->stackSize, &vm->t, vm->b) - 1;
+	break;
+      }
+#endif
+      vm->t --;
+      break;
+    case OP_HL: 
+      vm->ps = PS_NORMAL_EXIT;
+      break;
+    case OP_ST: 
+      stack[stack[vm->t-1]] = stack[vm->t];
+      vm->t -= 2;
+      break;
+    case OP_CALL: 
+#if VM_PROFILE
+      profileCall(profile, code[vm->pc].q);
+#endif
+      stack[vm->t+2] = vm->b;                     // Dynamic Link
+      stack[vm->t+3] = vm->pc;                    // Return Address
+      stack[vm->t+4] = base(vm, code[vm->pc].p);  // Static Link
+      vm->b = vm->t + 1;                          // Base & Result
+      vm->pc = code[vm->pc].q - 1;              
+      break;
+    case OP_EP: 
+#if VM_PROFILE
+      profileReturn(profile);
+#endif
+      vm->t = vm->b - 1;                      // Previous top
+      vm->pc = stack[vm->b+2];                // Saved return address
+      vm->b = stack[vm->b+1];                 // Saved base
+      break;
+    case OP_EF:
+#if VM_PROFILE
+      profileReturn(profile);
+#endif
+      vm->t = vm->b;                          // return value is on the top of the stack
+      vm->pc = stack[vm->b+2];                // Saved return address
+      vm->b = stack[vm->b+1];                 // saved base
+      break;
+    case OP_RC: 
+      vm->t ++;
+      if (readInput(vm, win, "%c", &number))
+	stack[vm->t] = number;
+      else vm->ps = PS_IO_ERROR;
+      break;
+    case OP_RI:
+      vm->t ++;
+      if (readInput(vm, win, "%d", &number))
+	stack[vm->t] = number;
+      else vm->ps = PS_IO_ERROR;
+      break;
+    case OP_WRC: 
+      writeOutput(vm, win, "%c", stack[vm->t]);
+      vm->t --;
+      break;     
+    case OP_WRI: 
+      writeOutput(vm, win, "%d", stack[vm->t]);
+      vm->t --;
+      break;
+    case OP_WLN:
+      writeOutput(vm, win, "\n", 0);
+      break;
+    case OP_AD:
+      vm->t --;
+      stack[vm->t] += stack[vm->t+1];
+      break;
+    case OP_SB:
+      vm->t --;
+      stack[vm->t] -= stack[vm->t+1];
+      break;
+    case OP_ML:
+      vm->t --;
+      stack[vm->t] *= stack[vm->t+1];
+      break;
+
+    case OP_DV: 
+      vm->t --;
+      if (stack[vm->t+1] == 0)
+	vm->ps = PS_DIVIDE_BY_ZERO;
+      else stack[vm->t] /= stack[vm->t+1];
+      break;
+    case OP_NEG:
+      stack[vm->t] = - stack[vm->t];
+      break;
+    case OP_CV: 
+      stack[vm->t+1] = stack[vm->t];
+      vm->t ++;
+      break;
+    case OP_EQ:
+      vm->t --;
+      if (stack[vm->t] == stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      break;
+    case OP_NE:
+      vm->t --;
+      if (stack[vm->t] != stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      break;
+    case OP_GT:
+      vm->t --;
+      if (stack[vm->t] > stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      break;
+    case OP_LT:
+      vm->t --;
+      if (stack[vm->t] < stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      break;
+    case OP_GE:
+      vm->t --;
+      if (stack[vm->t] >= stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      break;
+    case OP_LE:
+      vm->t --;
+      if (stack[vm->t] <= stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      break;
+    case OP_SL:
+      stack[vm->t] = (WORD) ((unsigned) stack[vm->t] << code[vm->pc].q);
+      break;
+    case OP_SR:
+      // A negative value is biased to round towards 0, as DV does
+      number = stack[vm->t];
+      if (number < 0)
+	number += (1 << code[vm->pc].q) - 1;
+      stack[vm->t] = number >> code[vm->pc].q;
+      break;
+    case OP_BP:
+      // Just for debugging, which needs the terminal
+      if (vm->output == NULL)
+	vm->debugMode = 1;
+      break;
+    default: break;
+    }
+
+    if (vm->debugMode) {
+      int command;
+      int level, offset;
+      int interactive = 1;
+      
+      do {
+	interactive = 0;
+
+	command = getch();
+	switch (command) {
+	case 'a':
+	case 'A':
+	  wprintw(win,"\nEnter memory location (level, offset):");
+	  wscanw(win,"%d %d", &level, &offset);
+	  wprintw(win,"Absolute address = %d\n", base(vm, level) + offset);
+	  interactive = 1;
+	  break;
+	case 'm':
+	case 'M':
+	  wprintw(win,"\nEnter memory location (level, offset):");
+	  wscanw(win,"%d %d", &level, &offset);
+	  wprintw(win,"Value = %d\n", stack[base(vm, level) + offset]);
+	  interactive = 1;
+	  break;
+	case 't':
+	case 'T':
+	  wprintw(win,"Top (%d) = %d\n", vm->t, stack[vm->t]);
+	  interactive = 1;
+	  break;
+	case 'c':
+	case 'C':
+	  vm->debugMode = 0;
+	  break;
+	case 'h':
+	case 'H':
+	  vm->ps = PS_NORMAL_EXIT;
+	  break;
+	default: break;
+	}
+      } while (interactive);
+    }
+    vm->pc ++;
+  }
+  return vm->ps;
+}